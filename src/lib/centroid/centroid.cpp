@@ -8,8 +8,11 @@
 
 #define PI 3.141592653589793238
 
-std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
-    const Grid::Grid &grid) {
+// Find the local maxima on the data of a dense grid, stored with either double
+// or single precision.
+template <typename V>
+std::vector<Centroid::LocalMax> find_local_maxima_data(const Grid::Grid &grid,
+                                                       const V *data) {
     std::vector<Centroid::LocalMax> points;
     // FIXME: This is performed in O(n^2), but using the divide and conquer
     // strategy we might achieve O(n * log(n)) or lower.
@@ -34,11 +37,11 @@ std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
             // ----------------------------------------------
             // |              | bottom_value |              |
             // ----------------------------------------------
-            double value = grid.data[index];
-            double right_value = grid.data[index + 1];
-            double left_value = grid.data[index - 1];
-            double top_value = grid.data[index - grid.n];
-            double bottom_value = grid.data[index + grid.n];
+            double value = data[index];
+            double right_value = data[index + 1];
+            double left_value = data[index - 1];
+            double top_value = data[index - grid.n];
+            double bottom_value = data[index + grid.n];
 
             if ((value != 0) && (value > left_value) && (value > right_value) &&
                 (value > top_value) && (value > bottom_value)) {
@@ -50,8 +53,62 @@ std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
     return points;
 }
 
-std::optional<Centroid::Peak> Centroid::build_peak(
-    const RawData::RawData &raw_data, const LocalMax &local_max) {
+std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
+    const Grid::Grid &grid) {
+    if (grid.single_precision) {
+        return find_local_maxima_data(grid, grid.float_data.data());
+    }
+    return find_local_maxima_data(grid, grid.data.data());
+}
+
+std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
+    const Grid::SparseGrid &grid) {
+    const size_t tile_size = Grid::SparseGrid::tile_size;
+    std::vector<Centroid::LocalMax> points;
+    // Same as above, but skipping the unallocated tiles, where all values are
+    // zero. The points are visited in the same order as in the dense grid.
+    for (size_t j = 1; j < grid.m - 1; ++j) {
+        size_t tj = j / tile_size;
+        for (size_t ti = 0; ti < grid.num_tiles_mz; ++ti) {
+            const auto &tile = grid.tiles[ti + tj * grid.num_tiles_mz];
+            if (tile.empty()) {
+                continue;
+            }
+            size_t i_begin = ti * tile_size;
+            if (i_begin < 1) {
+                i_begin = 1;
+            }
+            size_t i_end = (ti + 1) * tile_size;
+            if (i_end > grid.n - 1) {
+                i_end = grid.n - 1;
+            }
+            const double *row = &tile[j % tile_size * tile_size];
+            for (size_t i = i_begin; i < i_end; ++i) {
+                double value = row[i % tile_size];
+                if (value == 0) {
+                    continue;
+                }
+                double right_value = Grid::value_at(grid, i + 1, j);
+                double left_value = Grid::value_at(grid, i - 1, j);
+                double top_value = Grid::value_at(grid, i, j - 1);
+                double bottom_value = Grid::value_at(grid, i, j + 1);
+                if ((value > left_value) && (value > right_value) &&
+                    (value > top_value) && (value > bottom_value)) {
+                    points.push_back({grid.bins_mz[i], grid.bins_rt[j], value});
+                }
+            }
+        }
+    }
+    return points;
+}
+
+// Builds a Peak object for the given local_max from any of the raw data
+// layouts that provide theoretical_fwhm and raw_points. If an index is given,
+// it is used to find the raw points of the ROI.
+template <typename T>
+std::optional<Centroid::Peak> build_peak_scans(
+    const T &raw_data, const RawData::RoiIndex *index,
+    const Centroid::LocalMax &local_max) {
     Centroid::Peak peak = {};
     peak.id = 0;
     peak.local_max_mz = local_max.mz;
@@ -69,8 +126,12 @@ std::optional<Centroid::Peak> Centroid::build_peak(
 
     // Extract the raw data points for the ROI.
     auto raw_points =
-        RawData::raw_points(raw_data, peak.roi_min_mz, peak.roi_max_mz,
-                            peak.roi_min_rt, peak.roi_max_rt);
+        index != nullptr
+            ? RawData::raw_points(raw_data, *index, peak.roi_min_mz,
+                                  peak.roi_max_mz, peak.roi_min_rt,
+                                  peak.roi_max_rt)
+            : RawData::raw_points(raw_data, peak.roi_min_mz, peak.roi_max_mz,
+                                  peak.roi_min_rt, peak.roi_max_rt);
     if (raw_points.num_points == 0 || raw_points.num_scans < 3) {
         return std::nullopt;
     }
@@ -254,9 +315,10 @@ std::optional<Centroid::Peak> Centroid::build_peak(
     return peak;
 }
 
-std::vector<Centroid::Peak> Centroid::find_peaks_serial(
-    const RawData::RawData &raw_data, const Grid::Grid &grid,
-    size_t max_peaks) {
+template <typename T, typename G>
+std::vector<Centroid::Peak> find_peaks_serial_scans(const T &raw_data,
+                                                    const G &grid,
+                                                    size_t max_peaks) {
     // Finding local maxima.
     auto local_max = Centroid::find_local_maxima(grid);
 
@@ -267,12 +329,15 @@ std::vector<Centroid::Peak> Centroid::find_peaks_serial(
     };
     std::sort(local_max.begin(), local_max.end(), sort_local_max);
 
+    // The index speeds up the extraction of the raw points for each peak.
+    auto index = RawData::build_roi_index(raw_data);
+
     std::vector<Centroid::Peak> peaks;
     for (const auto &max : local_max) {
         if (peaks.size() == max_peaks) {
             break;
         }
-        auto peak = build_peak(raw_data, max);
+        auto peak = build_peak_scans(raw_data, &index, max);
         if (peak) {
             peaks.push_back(peak.value());
         }
@@ -286,12 +351,12 @@ std::vector<Centroid::Peak> Centroid::find_peaks_serial(
     return peaks;
 }
 
-std::vector<Centroid::Peak> Centroid::find_peaks_parallel(
-    const RawData::RawData &raw_data, const Grid::Grid &grid, size_t max_peaks,
-    size_t max_threads) {
-    // Finding local maxima.
-    auto local_max = Centroid::find_local_maxima(grid);
-
+// Build the peaks for the given local maxima in parallel, returning up to
+// max_peaks of them sorted by height.
+template <typename T>
+std::vector<Centroid::Peak> build_peaks_parallel(
+    const T &raw_data, const std::vector<Centroid::LocalMax> &local_max,
+    size_t max_peaks, size_t max_threads) {
     // The number of groups/threads is set to the maximum possible concurrency.
     uint64_t num_threads = std::thread::hardware_concurrency();
     if (num_threads > max_threads) {
@@ -306,13 +371,18 @@ std::vector<Centroid::Peak> Centroid::find_peaks_parallel(
         groups[k].push_back(i);
     }
 
+    // The index speeds up the extraction of the raw points for each peak and
+    // is shared by all threads.
+    auto index = RawData::build_roi_index(raw_data);
+
     std::vector<std::thread> threads(num_threads);
     std::vector<std::vector<Centroid::Peak>> peaks_array(num_threads);
     for (size_t i = 0; i < groups.size(); ++i) {
         threads[i] = std::thread(
-            [&groups, &local_max, &peaks_array, &raw_data, &grid, i]() {
+            [&groups, &local_max, &peaks_array, &raw_data, &index, i]() {
                 for (const auto &k : groups[i]) {
-                    auto peak = build_peak(raw_data, local_max[k]);
+                    auto peak =
+                        build_peak_scans(raw_data, &index, local_max[k]);
                     if (peak) {
                         peaks_array[i].push_back(peak.value());
                     }
@@ -351,6 +421,149 @@ std::vector<Centroid::Peak> Centroid::find_peaks_parallel(
     return peaks;
 }
 
+template <typename T, typename G>
+std::vector<Centroid::Peak> find_peaks_parallel_scans(const T &raw_data,
+                                                      const G &grid,
+                                                      size_t max_peaks,
+                                                      size_t max_threads) {
+    // Finding local maxima.
+    auto local_max = Centroid::find_local_maxima(grid);
+    return build_peaks_parallel(raw_data, local_max, max_peaks, max_threads);
+}
+
+template <typename T>
+std::vector<Centroid::LocalMax> find_local_maxima_streaming(
+    const T &raw_data, const Grid::ResampleParams &params, uint64_t band_rows,
+    size_t max_threads) {
+    auto kernel = Grid::resample_kernel(raw_data, params);
+    uint64_t m = kernel.grid.m;
+    if (band_rows == 0) {
+        band_rows = 1;
+    }
+
+    // The first and last rows of the grid can't contain local maxima, so the
+    // bands only cover the rows in between.
+    uint64_t num_bands = 0;
+    if (m > 2) {
+        num_bands = (m - 2 + band_rows - 1) / band_rows;
+    }
+
+    // The bands are distributed among the threads, and each thread only keeps
+    // the grid of the band it is currently processing.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads > num_bands) {
+        num_threads = num_bands;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    std::vector<std::vector<Centroid::LocalMax>> band_local_max(num_bands);
+    auto process_bands = [&](size_t thread_index) {
+        for (size_t b = thread_index; b < num_bands; b += num_threads) {
+            uint64_t row_begin = 1 + b * band_rows;
+            uint64_t row_end = row_begin + band_rows;
+            if (row_end > m - 1) {
+                row_end = m - 1;
+            }
+            // The band is resampled with the neighbouring row at each side,
+            // which find_local_maxima skips as they are on the border.
+            auto band = Grid::resample_rows(raw_data, kernel, row_begin - 1,
+                                            row_end + 1);
+            band_local_max[b] = Centroid::find_local_maxima(band);
+        }
+    };
+    if (num_threads == 1) {
+        process_bands(0);
+    } else {
+        std::vector<std::thread> threads(num_threads);
+        for (size_t t = 0; t < num_threads; ++t) {
+            threads[t] = std::thread(process_bands, t);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Join the local maxima of all bands in order.
+    std::vector<Centroid::LocalMax> local_max;
+    for (const auto &points : band_local_max) {
+        local_max.insert(local_max.end(), points.begin(), points.end());
+    }
+    return local_max;
+}
+
+template <typename T>
+std::vector<Centroid::Peak> find_peaks_streaming_scans(
+    const T &raw_data, const Grid::ResampleParams &params, uint64_t band_rows,
+    size_t max_peaks, size_t max_threads) {
+    auto local_max =
+        find_local_maxima_streaming(raw_data, params, band_rows, max_threads);
+    return build_peaks_parallel(raw_data, local_max, max_peaks, max_threads);
+}
+
+template <typename T>
+std::optional<Centroid::Peak> Centroid::build_peak(const T &raw_data,
+                                                   const LocalMax &local_max) {
+    return build_peak_scans(raw_data, nullptr, local_max);
+}
+
+template <typename T, typename G>
+std::vector<Centroid::Peak> Centroid::find_peaks_serial(const T &raw_data,
+                                                        const G &grid,
+                                                        size_t max_peaks) {
+    return find_peaks_serial_scans(raw_data, grid, max_peaks);
+}
+
+template <typename T, typename G>
+std::vector<Centroid::Peak> Centroid::find_peaks_parallel(const T &raw_data,
+                                                          const G &grid,
+                                                          size_t max_peaks,
+                                                          size_t max_threads) {
+    return find_peaks_parallel_scans(raw_data, grid, max_peaks, max_threads);
+}
+
+template <typename T>
+std::vector<Centroid::LocalMax> Centroid::find_local_maxima(
+    const T &raw_data, const Grid::ResampleParams &params, uint64_t band_rows,
+    size_t max_threads) {
+    return find_local_maxima_streaming(raw_data, params, band_rows,
+                                       max_threads);
+}
+
+template <typename T>
+std::vector<Centroid::Peak> Centroid::find_peaks_streaming(
+    const T &raw_data, const Grid::ResampleParams &params, uint64_t band_rows,
+    size_t max_peaks, size_t max_threads) {
+    return find_peaks_streaming_scans(raw_data, params, band_rows, max_peaks,
+                                      max_threads);
+}
+
+// Explicit instantiations of the peak detection functions for each raw data
+// layout.
+#define INSTANTIATE_PEAK_FUNCTIONS(T)                                          \
+    template std::optional<Centroid::Peak> Centroid::build_peak(               \
+        const T &, const LocalMax &);                                          \
+    template std::vector<Centroid::Peak> Centroid::find_peaks_serial(          \
+        const T &, const Grid::Grid &, size_t);                                \
+    template std::vector<Centroid::Peak> Centroid::find_peaks_serial(          \
+        const T &, const Grid::SparseGrid &, size_t);                          \
+    template std::vector<Centroid::Peak> Centroid::find_peaks_parallel(        \
+        const T &, const Grid::Grid &, size_t, size_t);                        \
+    template std::vector<Centroid::Peak> Centroid::find_peaks_parallel(        \
+        const T &, const Grid::SparseGrid &, size_t, size_t);                  \
+    template std::vector<Centroid::LocalMax> Centroid::find_local_maxima(      \
+        const T &, const Grid::ResampleParams &, uint64_t, size_t);            \
+    template std::vector<Centroid::Peak> Centroid::find_peaks_streaming(       \
+        const T &, const Grid::ResampleParams &, uint64_t, size_t, size_t);
+INSTANTIATE_PEAK_FUNCTIONS(RawData::RawData)
+INSTANTIATE_PEAK_FUNCTIONS(RawData::FlatRawData)
+INSTANTIATE_PEAK_FUNCTIONS(RawData::CompactRawData)
+INSTANTIATE_PEAK_FUNCTIONS(RawData::CompressedRawData)
+#undef INSTANTIATE_PEAK_FUNCTIONS
+
 double Centroid::peak_overlap(const Centroid::Peak &peak_a,
                               const Centroid::Peak &peak_b) {
     double peak_a_mz = peak_a.fitted_mz;
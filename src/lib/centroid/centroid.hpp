@@ -68,19 +68,45 @@ struct Peak {
 // given indexes i and j the point at data[i][j] is greater than the neighbors
 // in all 4 cardinal directions.
 std::vector<LocalMax> find_local_maxima(const Grid::Grid &grid);
+std::vector<LocalMax> find_local_maxima(const Grid::SparseGrid &grid);
+
+// Same as find_local_maxima on the grid returned by Grid::resample with the
+// given parameters, but the grid is resampled in bands of band_rows rows,
+// which are freed as soon as their local maxima are found. The memory needed
+// is then proportional to n * band_rows instead of the full grid. Up to
+// max_threads bands are processed in parallel. Since the local maxima depend
+// on the neighbouring rows, each band is resampled with an extra row at each
+// side. The result is the same as with the full grid.
+//
+// The peak detection functions take any of the raw data layouts as the
+// template parameter T, and are explicitly instantiated for each of them in
+// centroid.cpp.
+template <typename T>
+std::vector<LocalMax> find_local_maxima(const T &raw_data,
+                                        const Grid::ResampleParams &params,
+                                        uint64_t band_rows, size_t max_threads);
 
 // Builds a Peak object for the given local_max.
-std::optional<Peak> build_peak(const RawData::RawData &raw_data,
-                               const LocalMax &local_max);
-
-// Find the peaks in serial.
-std::vector<Peak> find_peaks_serial(const RawData::RawData &raw_data,
-                                    const Grid::Grid &grid, size_t max_peaks);
-
-// Find the peaks in parallel.
-std::vector<Peak> find_peaks_parallel(const RawData::RawData &raw_data,
-                                      const Grid::Grid &grid, size_t max_peaks,
-                                      size_t max_threads);
+template <typename T>
+std::optional<Peak> build_peak(const T &raw_data, const LocalMax &local_max);
+
+// Find the peaks in serial on a Grid or a SparseGrid.
+template <typename T, typename G>
+std::vector<Peak> find_peaks_serial(const T &raw_data, const G &grid,
+                                    size_t max_peaks);
+
+// Find the peaks in parallel on a Grid or a SparseGrid.
+template <typename T, typename G>
+std::vector<Peak> find_peaks_parallel(const T &raw_data, const G &grid,
+                                      size_t max_peaks, size_t max_threads);
+
+// Same as find_peaks_parallel, but the local maxima are found with the banded
+// find_local_maxima from the raw data, without resampling the full grid.
+template <typename T>
+std::vector<Peak> find_peaks_streaming(const T &raw_data,
+                                       const Grid::ResampleParams &params,
+                                       uint64_t band_rows, size_t max_peaks,
+                                       size_t max_threads);
 
 // Calculate the overlaping area between two peaks.
 double peak_overlap(const Peak &peak_a, const Peak &peak_b);
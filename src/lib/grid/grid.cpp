@@ -1,10 +1,15 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <thread>
 
 #include "grid/grid.hpp"
 #include "utils/serialization.hpp"
 #include "utils/search.hpp"
 
+// Number of rows of each chunk of the grid that is splatted at once.
+#define RESAMPLE_CHUNK_ROWS 64
+
 uint64_t Grid::x_index(const Grid &grid, double mz) {
     switch (grid.instrument_type) {
         case Instrument::ORBITRAP: {
@@ -75,10 +80,48 @@ double Grid::rt_at(const Grid &grid, uint64_t j) {
     return grid.min_rt + delta_rt * j;
 }
 
-Grid::Grid Grid::resample(const RawData::RawData &raw_data,
-                          const ResampleParams &params) {
-    // Initialize the Grid.
-    Grid grid;
+// Calculate the normalized weights of a 1D Gaussian kernel of the given half
+// width for each of the bins. The weight of the tap t for the bin i is stored
+// at weights[t * bins.size() + i], which corresponds to the bin
+// i + t - kernel_hw, so that the weights of each tap are contiguous. The
+// weights of the taps outside the bins are zero. The sigma of the kernel can
+// be different for each bin.
+std::vector<double> smoothing_weights(const std::vector<double> &bins,
+                                      const std::vector<double> &sigmas,
+                                      size_t kernel_hw) {
+    size_t num_bins = bins.size();
+    size_t kernel_size = 2 * kernel_hw + 1;
+    auto weights = std::vector<double>(kernel_size * num_bins);
+    for (size_t i = 0; i < num_bins; ++i) {
+        double sum_weights = 0;
+        for (size_t tap = 0; tap < kernel_size; ++tap) {
+            if (i + tap < kernel_hw || i + tap - kernel_hw >= num_bins) {
+                continue;
+            }
+            double a = (bins[i] - bins[i + tap - kernel_hw]) / sigmas[i];
+            double weight = std::exp(-0.5 * (a * a));
+            weights[tap * num_bins + i] = weight;
+            sum_weights += weight;
+        }
+        for (size_t tap = 0; tap < kernel_size; ++tap) {
+            weights[tap * num_bins + i] /= sum_weights;
+        }
+    }
+    return weights;
+}
+
+// Same as above, with the same sigma for all bins.
+std::vector<double> smoothing_weights(const std::vector<double> &bins,
+                                      double sigma, size_t kernel_hw) {
+    return smoothing_weights(bins, std::vector<double>(bins.size(), sigma),
+                             kernel_hw);
+}
+
+// Initialize the dimensions, bins and parameters of the grid for the given raw
+// data, without allocating the data.
+template <typename T>
+Grid::Grid empty_grid(const T &raw_data, const Grid::ResampleParams &params) {
+    Grid::Grid grid;
     grid.k = params.num_samples_mz;
     grid.t = params.num_samples_rt;
     grid.reference_mz = raw_data.reference_mz;
@@ -89,13 +132,13 @@ Grid::Grid Grid::resample(const RawData::RawData &raw_data,
     grid.max_mz = raw_data.max_mz;
     grid.min_rt = raw_data.min_rt;
     grid.max_rt = raw_data.max_rt;
+    grid.single_precision = params.single_precision;
 
     // Calculate the necessary dimensions for the Grid.
     uint64_t n = x_index(grid, raw_data.max_mz) + 1;
     uint64_t m = y_index(grid, raw_data.max_rt) + 1;
     grid.n = n;
     grid.m = m;
-    grid.data = std::vector<double>(n * m);
     grid.bins_mz = std::vector<double>(n);
     grid.bins_rt = std::vector<double>(m);
 
@@ -108,15 +151,24 @@ Grid::Grid Grid::resample(const RawData::RawData &raw_data,
     for (size_t j = 0; j < m; ++j) {
         grid.bins_rt[j] = rt_at(grid, j);
     }
+    return grid;
+}
+
+template <typename T>
+Grid::ResampleKernel create_resample_kernel(
+    const T &raw_data, const Grid::ResampleParams &params) {
+    Grid::ResampleKernel kernel;
+    kernel.grid = empty_grid(raw_data, params);
+    const auto &grid = kernel.grid;
 
     // Pre-calculate the smoothing sigma values for all bins of the grid.
-    double sigma_rt = RawData::fwhm_to_sigma(raw_data.fwhm_rt) *
+    kernel.sigma_rt = RawData::fwhm_to_sigma(raw_data.fwhm_rt) *
                       params.smoothing_coef_rt / std::sqrt(2);
-    auto sigma_mz_vec = std::vector<double>(n);
-    for (size_t i = 0; i < n; ++i) {
-        sigma_mz_vec[i] = RawData::fwhm_to_sigma(RawData::theoretical_fwhm(
-                              raw_data, grid.bins_mz[i])) *
-                          params.smoothing_coef_mz / std::sqrt(2);
+    kernel.sigma_mz = std::vector<double>(grid.n);
+    for (size_t i = 0; i < grid.n; ++i) {
+        kernel.sigma_mz[i] = RawData::fwhm_to_sigma(RawData::theoretical_fwhm(
+                                 raw_data, grid.bins_mz[i])) *
+                             params.smoothing_coef_mz / std::sqrt(2);
     }
 
     // Pre-calculate the kernel half widths for rt and mz.
@@ -128,145 +180,680 @@ Grid::Grid Grid::resample(const RawData::RawData &raw_data,
     double delta_rt = grid.fwhm_rt / params.num_samples_rt;
     double delta_mz = grid.fwhm_mz / params.num_samples_mz;
     double sigma_mz_ref = RawData::fwhm_to_sigma(grid.fwhm_mz);
-    uint64_t rt_kernel_hw = 3 * sigma_rt / delta_rt;
-    uint64_t mz_kernel_hw = 3 * sigma_mz_ref / delta_mz;
+    kernel.rt_kernel_hw = 3 * kernel.sigma_rt / delta_rt;
+    kernel.mz_kernel_hw = 3 * sigma_mz_ref / delta_mz;
 
-    // Gaussian splatting.
-    {
-        auto weights = std::vector<double>(n * m);
-        for (size_t s = 0; s < raw_data.scans.size(); ++s) {
-            const auto &scan = raw_data.scans[s];
-            double current_rt = scan.retention_time;
-
-            // Find the bin for the current retention time.
-            size_t index_rt = y_index(grid, current_rt);
-
-            // Find the min/max indexes for the rt kernel.
-            size_t j_min = 0;
-            if (index_rt >= rt_kernel_hw) {
-                j_min = index_rt - rt_kernel_hw;
-            }
-            size_t j_max = grid.m - 1;
-            if ((index_rt + rt_kernel_hw) < grid.m) {
-                j_max = index_rt + rt_kernel_hw;
-            }
+    // The smoothing weights only depend on the bin, so they are calculated and
+    // normalized once for each row/column.
+    kernel.rt_weights =
+        smoothing_weights(grid.bins_rt, kernel.sigma_rt, kernel.rt_kernel_hw);
+    kernel.mz_weights =
+        smoothing_weights(grid.bins_mz, kernel.sigma_mz, kernel.mz_kernel_hw);
+    return kernel;
+}
 
-            for (size_t k = 0; k < scan.num_points; ++k) {
-                double current_intensity = scan.intensity[k];
-                double current_mz = scan.mz[k];
+// Calculate the Gaussian kernel of the points of any of the raw data layouts on
+// the rows [row_begin, row_end) of the grid. For each point and each of these
+// rows within reach of its kernel, the weights of the bins [i_min, i_max] of
+// the row are calculated and passed to
+// accumulate(j, i_min, i_max, weights, intensity), where weights[i - i_min] is
+// the weight of the bin i. The points are always visited in the same order.
+template <typename T, typename Accumulate>
+void splat_points(const T &raw_data, const Grid::ResampleKernel &kernel,
+                  size_t row_begin, size_t row_end,
+                  const Accumulate &accumulate) {
+    const auto &grid = kernel.grid;
+    double sigma_rt = kernel.sigma_rt;
+    uint64_t rt_kernel_hw = kernel.rt_kernel_hw;
+    uint64_t mz_kernel_hw = kernel.mz_kernel_hw;
+    auto weights = std::vector<double>(2 * mz_kernel_hw + 1);
+    for (size_t s = 0; s < RawData::num_scans(raw_data); ++s) {
+        double current_rt = raw_data.retention_times[s];
 
-                // Find the bin for the current mz.
-                size_t index_mz = x_index(grid, current_mz);
+        // Find the bin for the current retention time.
+        size_t index_rt = y_index(grid, current_rt);
 
-                double sigma_mz = sigma_mz_vec[index_mz];
+        // Find the min/max indexes for the rt kernel within the rows.
+        size_t j_min = row_begin;
+        if (index_rt >= rt_kernel_hw && index_rt - rt_kernel_hw > j_min) {
+            j_min = index_rt - rt_kernel_hw;
+        }
+        size_t j_max = row_end - 1;
+        if ((index_rt + rt_kernel_hw) < j_max) {
+            j_max = index_rt + rt_kernel_hw;
+        }
+        if (j_min > j_max) {
+            continue;
+        }
 
-                // Find the min/max indexes for the mz kernel.
-                size_t i_min = 0;
-                if (index_mz >= mz_kernel_hw) {
-                    i_min = index_mz - mz_kernel_hw;
-                }
-                size_t i_max = grid.n - 1;
-                if ((index_mz + mz_kernel_hw) < grid.n) {
-                    i_max = index_mz + mz_kernel_hw;
-                }
+        auto scan = RawData::scan_points(raw_data, s);
+        for (size_t k = 0; k < scan.num_points; ++k) {
+            double current_intensity = scan.intensity[k];
+            double current_mz = scan.mz[k];
 
-                for (size_t j = j_min; j <= j_max; ++j) {
-                    for (size_t i = i_min; i <= i_max; ++i) {
-                        double x = grid.bins_mz[i];
-                        double y = grid.bins_rt[j];
+            // Find the bin for the current mz.
+            size_t index_mz = x_index(grid, current_mz);
 
-                        // Calculate the Gaussian weight for this point.
-                        double a = (x - current_mz) / sigma_mz;
-                        double b = (y - current_rt) / sigma_rt;
-                        double weight = std::exp(-0.5 * (a * a + b * b));
+            double sigma_mz = kernel.sigma_mz[index_mz];
 
-                        grid.data[i + j * n] += weight * current_intensity;
-                        weights[i + j * n] += weight;
-                    }
+            // Find the min/max indexes for the mz kernel.
+            size_t i_min = 0;
+            if (index_mz >= mz_kernel_hw) {
+                i_min = index_mz - mz_kernel_hw;
+            }
+            size_t i_max = grid.n - 1;
+            if ((index_mz + mz_kernel_hw) < grid.n) {
+                i_max = index_mz + mz_kernel_hw;
+            }
+
+            for (size_t j = j_min; j <= j_max; ++j) {
+                for (size_t i = i_min; i <= i_max; ++i) {
+                    double x = grid.bins_mz[i];
+                    double y = grid.bins_rt[j];
+
+                    // Calculate the Gaussian weight for this point.
+                    double a = (x - current_mz) / sigma_mz;
+                    double b = (y - current_rt) / sigma_rt;
+                    weights[i - i_min] = std::exp(-0.5 * (a * a + b * b));
                 }
+                accumulate(j, i_min, i_max, weights.data(), current_intensity);
             }
         }
-        for (size_t i = 0; i < (n * m); ++i) {
-            double weight = weights[i];
+    }
+}
+
+// Gaussian splatting of the points of any of the raw data layouts on the rows
+// [row_begin, row_end) of the grid, which are stored contiguously on output.
+//
+// The points are splatted on chunks of RESAMPLE_CHUNK_ROWS rows, which are
+// accumulated and normalized in double precision before being stored. Each
+// chunk visits the scans whose kernel reaches any of its rows, in the same
+// order, so the result doesn't depend on how the rows are split.
+template <typename T, typename V>
+void splat_rows(const T &raw_data, const Grid::ResampleKernel &kernel,
+                size_t row_begin, size_t row_end, V *output) {
+    uint64_t n = kernel.grid.n;
+    size_t chunk_rows = RESAMPLE_CHUNK_ROWS;
+    if (chunk_rows > row_end - row_begin) {
+        chunk_rows = row_end - row_begin;
+    }
+    auto chunk_data = std::vector<double>(chunk_rows * n);
+    auto chunk_weights = std::vector<double>(chunk_rows * n);
+    for (size_t chunk_begin = row_begin; chunk_begin < row_end;
+         chunk_begin += chunk_rows) {
+        size_t chunk_end = chunk_begin + chunk_rows;
+        if (chunk_end > row_end) {
+            chunk_end = row_end;
+        }
+        std::fill(chunk_data.begin(), chunk_data.end(), 0.0);
+        std::fill(chunk_weights.begin(), chunk_weights.end(), 0.0);
+        splat_points(raw_data, kernel, chunk_begin, chunk_end,
+                     [&](size_t j, size_t i_min, size_t i_max,
+                         const double *weights, double intensity) {
+                         size_t row_offset = (j - chunk_begin) * n;
+                         for (size_t i = i_min; i <= i_max; ++i) {
+                             double weight = weights[i - i_min];
+                             chunk_data[i + row_offset] += weight * intensity;
+                             chunk_weights[i + row_offset] += weight;
+                         }
+                     });
+        V *chunk_output = &output[(chunk_begin - row_begin) * n];
+        for (size_t i = 0; i < (chunk_end - chunk_begin) * n; ++i) {
+            double weight = chunk_weights[i];
             if (weight == 0) {
                 weight = 1;
             }
-            grid.data[i] = grid.data[i] / weight;
+            chunk_output[i] = chunk_data[i] / weight;
+        }
+    }
+}
+
+// Gaussian smoothing.
+//
+// The Gaussian 2D filter is separable. We obtain the same result with faster
+// performance by applying two 1D kernel convolutions instead. This is
+// specially noticeable on the full image.
+//
+// Using the precalculated weights, with zero weights for the taps outside the
+// grid, both convolutions are performed as a sum of scaled rows, which
+// accesses the data contiguously and can be vectorized by the compiler. Each
+// row is accumulated on a double precision buffer before being stored.
+
+// Retention time smoothing of the row j of the grid, restricted to num_cols
+// columns, accumulated on output. row_at(k) returns the same columns of the
+// row k, or nullptr if all of them are zero.
+template <typename RowAccessor>
+void smooth_row_rt(const Grid::ResampleKernel &kernel, size_t j,
+                   size_t num_cols, const RowAccessor &row_at,
+                   double *output) {
+    uint64_t m = kernel.grid.m;
+    size_t kernel_size = 2 * kernel.rt_kernel_hw + 1;
+    for (size_t tap = 0; tap < kernel_size; ++tap) {
+        double weight = kernel.rt_weights[tap * m + j];
+        if (weight == 0) {
+            continue;
+        }
+        size_t k = j + tap - kernel.rt_kernel_hw;
+        const auto *row = row_at(k);
+        if (row == nullptr) {
+            continue;
+        }
+        for (size_t i = 0; i < num_cols; ++i) {
+            output[i] += weight * row[i];
+        }
+    }
+}
+
+// mz smoothing of the columns [col_begin, col_end) of one row of the grid,
+// accumulated on output. The input stores the bins of the row starting at
+// input_begin, and must contain all the bins of the grid within mz_kernel_hw
+// of the given columns.
+//
+// Since sigma_mz is not constant, the weights are different for each column.
+template <typename V>
+void smooth_row_mz(const Grid::ResampleKernel &kernel, const V *input,
+                   size_t input_begin, size_t col_begin, size_t col_end,
+                   double *output) {
+    uint64_t n = kernel.grid.n;
+    uint64_t mz_kernel_hw = kernel.mz_kernel_hw;
+    size_t kernel_size = 2 * mz_kernel_hw + 1;
+    for (size_t tap = 0; tap < kernel_size; ++tap) {
+        // Only the columns with the tap inside the grid.
+        size_t min_i = col_begin;
+        if (tap < mz_kernel_hw && mz_kernel_hw - tap > min_i) {
+            min_i = mz_kernel_hw - tap;
+        }
+        size_t max_i = col_end;
+        if (tap > mz_kernel_hw) {
+            size_t limit =
+                tap - mz_kernel_hw < n ? n - (tap - mz_kernel_hw) : 0;
+            if (limit < max_i) {
+                max_i = limit;
+            }
+        }
+        const double *tap_weights = &kernel.mz_weights[tap * n];
+        for (size_t i = min_i; i < max_i; ++i) {
+            output[i - col_begin] +=
+                tap_weights[i] * input[i + tap - mz_kernel_hw - input_begin];
+        }
+    }
+}
+
+// Retention time smoothing of the rows [row_begin, row_end) of the grid into
+// output. The input stores contiguously the rows starting at input_begin, and
+// must contain all the rows of the grid within rt_kernel_hw of the given rows.
+template <typename V>
+void smooth_rows_rt(const Grid::ResampleKernel &kernel, const V *input,
+                    size_t input_begin, size_t row_begin, size_t row_end,
+                    V *output) {
+    uint64_t n = kernel.grid.n;
+    auto row_sum = std::vector<double>(n);
+    auto row_at = [&](size_t k) { return &input[(k - input_begin) * n]; };
+    for (size_t j = row_begin; j < row_end; ++j) {
+        std::fill(row_sum.begin(), row_sum.end(), 0.0);
+        smooth_row_rt(kernel, j, n, row_at, row_sum.data());
+        std::copy(row_sum.begin(), row_sum.end(), &output[(j - row_begin) * n]);
+    }
+}
+
+// mz smoothing of num_rows contiguous rows of the grid into output.
+template <typename V>
+void smooth_rows_mz(const Grid::ResampleKernel &kernel, const V *input,
+                    size_t num_rows, V *output) {
+    uint64_t n = kernel.grid.n;
+    auto row_sum = std::vector<double>(n);
+    for (size_t j = 0; j < num_rows; ++j) {
+        std::fill(row_sum.begin(), row_sum.end(), 0.0);
+        smooth_row_mz(kernel, &input[j * n], 0, 0, n, row_sum.data());
+        std::copy(row_sum.begin(), row_sum.end(), &output[j * n]);
+    }
+}
+
+// Resample the scans of any of the raw data layouts into the data of the grid
+// described by the kernel, stored as doubles or floats, using up to
+// max_threads threads.
+template <typename T, typename V>
+void resample_data(const T &raw_data, const Grid::ResampleKernel &kernel,
+                   size_t max_threads, std::vector<V> &data) {
+    uint64_t n = kernel.grid.n;
+    uint64_t m = kernel.grid.m;
+
+    // The rows of the grid are split in bands of consecutive rows, and each
+    // band is processed on its own thread. Each of the following steps writes
+    // only to the rows of its band, so no synchronization is needed besides
+    // waiting for all bands to finish before the next step.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads > m) {
+        num_threads = m;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    auto for_each_band = [num_threads, m](const auto &process_rows) {
+        if (num_threads == 1) {
+            process_rows(0, m);
+            return;
+        }
+        std::vector<std::thread> threads(num_threads);
+        for (size_t t = 0; t < num_threads; ++t) {
+            size_t band_begin = m * t / num_threads;
+            size_t band_end = m * (t + 1) / num_threads;
+            threads[t] = std::thread(process_rows, band_begin, band_end);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+
+    data = std::vector<V>(n * m);
+    for_each_band([&](size_t band_begin, size_t band_end) {
+        splat_rows(raw_data, kernel, band_begin, band_end,
+                   &data[band_begin * n]);
+    });
+    {
+        auto smoothed_data = std::vector<V>(n * m);
+        for_each_band([&](size_t band_begin, size_t band_end) {
+            smooth_rows_rt(kernel, data.data(), 0, band_begin, band_end,
+                           &smoothed_data[band_begin * n]);
+        });
+        data = std::move(smoothed_data);
+    }
+    {
+        auto smoothed_data = std::vector<V>(n * m);
+        for_each_band([&](size_t band_begin, size_t band_end) {
+            smooth_rows_mz(kernel, &data[band_begin * n], band_end - band_begin,
+                           &smoothed_data[band_begin * n]);
+        });
+        data = std::move(smoothed_data);
+    }
+}
+
+// Resample the rows [row_begin, row_end) of the grid described by the kernel
+// into data. Only the rows within reach of the rt kernel are splatted.
+template <typename T, typename V>
+void resample_rows_data(const T &raw_data, const Grid::ResampleKernel &kernel,
+                        size_t row_begin, size_t row_end,
+                        std::vector<V> &data) {
+    uint64_t n = kernel.grid.n;
+    size_t halo_begin = 0;
+    if (row_begin >= kernel.rt_kernel_hw) {
+        halo_begin = row_begin - kernel.rt_kernel_hw;
+    }
+    size_t halo_end = row_end + kernel.rt_kernel_hw;
+    if (halo_end > kernel.grid.m) {
+        halo_end = kernel.grid.m;
+    }
+    auto splatted_data = std::vector<V>((halo_end - halo_begin) * n);
+    splat_rows(raw_data, kernel, halo_begin, halo_end, splatted_data.data());
+    auto smoothed_data = std::vector<V>((row_end - row_begin) * n);
+    smooth_rows_rt(kernel, splatted_data.data(), halo_begin, row_begin,
+                   row_end, smoothed_data.data());
+    splatted_data = std::vector<V>();
+    data = std::vector<V>((row_end - row_begin) * n);
+    smooth_rows_mz(kernel, smoothed_data.data(), row_end - row_begin,
+                   data.data());
+}
+
+template <typename T>
+Grid::Grid resample_rows_scans(const T &raw_data,
+                               const Grid::ResampleKernel &kernel,
+                               uint64_t row_begin, uint64_t row_end) {
+    const auto &grid = kernel.grid;
+    if (row_end > grid.m) {
+        row_end = grid.m;
+    }
+    if (row_begin > row_end) {
+        row_begin = row_end;
+    }
+    Grid::Grid band;
+    band.n = grid.n;
+    band.m = row_end - row_begin;
+    band.k = grid.k;
+    band.t = grid.t;
+    band.single_precision = grid.single_precision;
+    band.bins_mz = grid.bins_mz;
+    band.bins_rt = std::vector<double>(grid.bins_rt.begin() + row_begin,
+                                       grid.bins_rt.begin() + row_end);
+    band.instrument_type = grid.instrument_type;
+    band.reference_mz = grid.reference_mz;
+    band.fwhm_mz = grid.fwhm_mz;
+    band.fwhm_rt = grid.fwhm_rt;
+    band.min_mz = grid.min_mz;
+    band.max_mz = grid.max_mz;
+    band.min_rt = grid.min_rt;
+    band.max_rt = grid.max_rt;
+    if (band.m == 0) {
+        return band;
+    }
+    band.min_rt = band.bins_rt.front();
+    band.max_rt = band.bins_rt.back();
+    if (band.single_precision) {
+        resample_rows_data(raw_data, kernel, row_begin, row_end,
+                           band.float_data);
+    } else {
+        resample_rows_data(raw_data, kernel, row_begin, row_end, band.data);
+    }
+    return band;
+}
+
+// Resample the scans of any of the raw data layouts into a smoothed grid, using
+// up to max_threads threads.
+template <typename T>
+Grid::Grid resample_scans(const T &raw_data, const Grid::ResampleParams &params,
+                          size_t max_threads) {
+    auto kernel = create_resample_kernel(raw_data, params);
+    Grid::Grid grid = kernel.grid;
+    if (grid.single_precision) {
+        resample_data(raw_data, kernel, max_threads, grid.float_data);
+    } else {
+        resample_data(raw_data, kernel, max_threads, grid.data);
+    }
+    return grid;
+}
+
+template <typename T>
+Grid::Grid Grid::resample(const T &raw_data, const ResampleParams &params) {
+    return resample_scans(raw_data, params, 1);
+}
+
+template <typename T>
+Grid::Grid Grid::resample_parallel(const T &raw_data,
+                                   const ResampleParams &params,
+                                   size_t max_threads) {
+    return resample_scans(raw_data, params, max_threads);
+}
+
+template <typename T>
+Grid::ResampleKernel Grid::resample_kernel(const T &raw_data,
+                                           const ResampleParams &params) {
+    return create_resample_kernel(raw_data, params);
+}
+
+template <typename T>
+Grid::Grid Grid::resample_rows(const T &raw_data, const ResampleKernel &kernel,
+                               uint64_t row_begin, uint64_t row_end) {
+    return resample_rows_scans(raw_data, kernel, row_begin, row_end);
+}
+
+// Initialize a sparse grid with the same dimensions and parameters as the given
+// one, with all tiles unallocated.
+Grid::SparseGrid empty_sparse_grid(const Grid::Grid &grid) {
+    const uint64_t tile_size = Grid::SparseGrid::tile_size;
+    Grid::SparseGrid sparse_grid;
+    sparse_grid.n = grid.n;
+    sparse_grid.m = grid.m;
+    sparse_grid.k = grid.k;
+    sparse_grid.t = grid.t;
+    sparse_grid.num_tiles_mz = (grid.n + tile_size - 1) / tile_size;
+    sparse_grid.num_tiles_rt = (grid.m + tile_size - 1) / tile_size;
+    sparse_grid.tiles = std::vector<std::vector<double>>(
+        sparse_grid.num_tiles_mz * sparse_grid.num_tiles_rt);
+    sparse_grid.bins_mz = grid.bins_mz;
+    sparse_grid.bins_rt = grid.bins_rt;
+    sparse_grid.instrument_type = grid.instrument_type;
+    sparse_grid.reference_mz = grid.reference_mz;
+    sparse_grid.fwhm_mz = grid.fwhm_mz;
+    sparse_grid.fwhm_rt = grid.fwhm_rt;
+    sparse_grid.min_mz = grid.min_mz;
+    sparse_grid.max_mz = grid.max_mz;
+    sparse_grid.min_rt = grid.min_rt;
+    sparse_grid.max_rt = grid.max_rt;
+    return sparse_grid;
+}
+
+// Find the range of tiles [first, last] that contain the bins within
+// kernel_hw of the bins of the given tile, with num_tiles tiles in this
+// dimension.
+void tile_neighbours(size_t tile, size_t kernel_hw, size_t num_tiles,
+                     size_t &first, size_t &last) {
+    const size_t tile_size = Grid::SparseGrid::tile_size;
+    size_t begin = tile * tile_size;
+    first = begin >= kernel_hw ? (begin - kernel_hw) / tile_size : 0;
+    last = (begin + tile_size - 1 + kernel_hw) / tile_size;
+    if (last >= num_tiles) {
+        last = num_tiles - 1;
+    }
+}
+
+// Resample the scans of any of the raw data layouts into a sparse grid. The
+// steps are the same as in resample_scans, but restricted to the allocated
+// tiles. Since the skipped bins are zero, and the values of each bin are
+// accumulated in the same order, the result is identical to the dense grid.
+template <typename T>
+Grid::SparseGrid resample_scans_sparse(const T &raw_data,
+                                       const Grid::ResampleParams &params) {
+    const size_t tile_size = Grid::SparseGrid::tile_size;
+    auto kernel = create_resample_kernel(raw_data, params);
+    const Grid::Grid &grid = kernel.grid;
+    Grid::SparseGrid sparse_grid = empty_sparse_grid(grid);
+    size_t num_tiles_mz = sparse_grid.num_tiles_mz;
+    size_t num_tiles_rt = sparse_grid.num_tiles_rt;
+    size_t num_tiles = sparse_grid.tiles.size();
+
+    // Gaussian splatting.
+    {
+        auto weights = std::vector<std::vector<double>>(num_tiles);
+        // The kernel row is split in the segments that belong to each tile,
+        // allocating the tiles as they are touched.
+        auto accumulate = [&](size_t j, size_t i_min, size_t i_max,
+                              const double *kernel_weights, double intensity) {
+            size_t i = i_min;
+            while (i <= i_max) {
+                size_t tile = i / tile_size + j / tile_size * num_tiles_mz;
+                size_t segment_end = (i / tile_size + 1) * tile_size;
+                if (segment_end > i_max + 1) {
+                    segment_end = i_max + 1;
+                }
+                if (sparse_grid.tiles[tile].empty()) {
+                    sparse_grid.tiles[tile] =
+                        std::vector<double>(tile_size * tile_size);
+                    weights[tile] = std::vector<double>(tile_size * tile_size);
+                }
+                size_t row_offset = j % tile_size * tile_size;
+                double *tile_data = &sparse_grid.tiles[tile][row_offset];
+                double *tile_weights = &weights[tile][row_offset];
+                for (; i < segment_end; ++i) {
+                    double weight = kernel_weights[i - i_min];
+                    tile_data[i % tile_size] += weight * intensity;
+                    tile_weights[i % tile_size] += weight;
+                }
+            }
+        };
+        splat_points(raw_data, kernel, 0, grid.m, accumulate);
+        for (size_t tile = 0; tile < num_tiles; ++tile) {
+            auto &tile_data = sparse_grid.tiles[tile];
+            for (size_t i = 0; i < tile_data.size(); ++i) {
+                double weight = weights[tile][i];
+                if (weight == 0) {
+                    weight = 1;
+                }
+                tile_data[i] = tile_data[i] / weight;
+            }
+            // Release the weights as soon as possible to reduce the peak
+            // memory usage.
+            weights[tile] = std::vector<double>();
         }
     }
 
     // Gaussian smoothing.
     //
-    // The Gaussian 2D filter is separable. We obtain the same result with
-    // faster performance by applying two 1D kernel convolutions instead. This
-    // is specially noticeable on the full image.
+    // The same row convolutions as in resample_scans, applied to the rows of
+    // each tile. A tile of the result is only allocated if any of the tiles
+    // within reach of the kernel are allocated, otherwise all its values are
+    // zero.
     {
-        auto smoothed_data = std::vector<double>(grid.n * grid.m);
+        auto smoothed_tiles = std::vector<std::vector<double>>(num_tiles);
 
         // Retention time smoothing.
-        for (size_t j = 0; j < grid.m; ++j) {
-            double current_rt = grid.bins_rt[j];
-            size_t min_k = 0;
-            if (j >= rt_kernel_hw) {
-                min_k = j - rt_kernel_hw;
+        for (size_t tj = 0; tj < num_tiles_rt; ++tj) {
+            size_t first_tj = 0;
+            size_t last_tj = 0;
+            tile_neighbours(tj, kernel.rt_kernel_hw, num_tiles_rt, first_tj,
+                            last_tj);
+            size_t row_end = (tj + 1) * tile_size;
+            if (row_end > grid.m) {
+                row_end = grid.m;
             }
-            size_t max_k = grid.m - 1;
-            if ((j + rt_kernel_hw) < grid.m) {
-                max_k = j + rt_kernel_hw;
-            }
-            for (size_t i = 0; i < grid.n; ++i) {
-                double sum_weights = 0;
-                double sum_weighted_values = 0;
-                for (size_t k = min_k; k <= max_k; ++k) {
-                    double a = (current_rt - grid.bins_rt[k]) / sigma_rt;
-                    double weight = std::exp(-0.5 * (a * a));
-                    sum_weights += weight;
-                    sum_weighted_values += weight * grid.data[i + k * grid.n];
+            for (size_t ti = 0; ti < num_tiles_mz; ++ti) {
+                bool occupied = false;
+                for (size_t k = first_tj; k <= last_tj && !occupied; ++k) {
+                    occupied =
+                        !sparse_grid.tiles[ti + k * num_tiles_mz].empty();
+                }
+                if (!occupied) {
+                    continue;
+                }
+                auto &smoothed_tile = smoothed_tiles[ti + tj * num_tiles_mz];
+                smoothed_tile = std::vector<double>(tile_size * tile_size);
+                // The row k of the tile column, if its tile is allocated.
+                auto row_at = [&](size_t k) -> const double * {
+                    const auto &tile =
+                        sparse_grid.tiles[ti + k / tile_size * num_tiles_mz];
+                    if (tile.empty()) {
+                        return nullptr;
+                    }
+                    return &tile[k % tile_size * tile_size];
+                };
+                for (size_t j = tj * tile_size; j < row_end; ++j) {
+                    smooth_row_rt(kernel, j, tile_size, row_at,
+                                  &smoothed_tile[j % tile_size * tile_size]);
                 }
-                smoothed_data[i + j * grid.n] =
-                    sum_weighted_values / sum_weights;
             }
         }
-        grid.data = smoothed_data;
+        sparse_grid.tiles = std::move(smoothed_tiles);
     }
     {
-        auto smoothed_data = std::vector<double>(grid.n * grid.m);
+        auto smoothed_tiles = std::vector<std::vector<double>>(num_tiles);
 
         // mz smoothing.
         //
-        // Since sigma_mz is not constant, we need to calculate the kernel half
-        // width for each potential mz value.
-        for (size_t i = 0; i < grid.n; ++i) {
-            double sigma_mz = sigma_mz_vec[i];
-            double current_mz = grid.bins_mz[i];
-
-            size_t min_k = 0;
-            if (i >= mz_kernel_hw) {
-                min_k = i - mz_kernel_hw;
+        // Each row of a tile is copied into a buffer together with the
+        // kernel_hw bins at each side within the grid, so that the convolution
+        // is performed on contiguous data as in the dense grid.
+        size_t kernel_hw = kernel.mz_kernel_hw;
+        auto buffer = std::vector<double>(tile_size + 2 * kernel_hw);
+        for (size_t tj = 0; tj < num_tiles_rt; ++tj) {
+            size_t row_end = (tj + 1) * tile_size;
+            if (row_end > grid.m) {
+                row_end = grid.m;
             }
-            size_t max_k = grid.n - 1;
-            if ((i + mz_kernel_hw) < grid.n) {
-                max_k = i + mz_kernel_hw;
-            }
-            for (size_t j = 0; j < grid.m; ++j) {
-                double sum_weights = 0;
-                double sum_weighted_values = 0;
-                for (size_t k = min_k; k <= max_k; ++k) {
-                    double a = (current_mz - grid.bins_mz[k]) / sigma_mz;
-                    double weight = std::exp(-0.5 * (a * a));
-                    sum_weights += weight;
-                    sum_weighted_values += weight * grid.data[k + j * grid.n];
+            for (size_t ti = 0; ti < num_tiles_mz; ++ti) {
+                size_t first_ti = 0;
+                size_t last_ti = 0;
+                tile_neighbours(ti, kernel_hw, num_tiles_mz, first_ti, last_ti);
+                bool occupied = false;
+                for (size_t k = first_ti; k <= last_ti && !occupied; ++k) {
+                    occupied =
+                        !sparse_grid.tiles[k + tj * num_tiles_mz].empty();
+                }
+                if (!occupied) {
+                    continue;
+                }
+                auto &smoothed_tile = smoothed_tiles[ti + tj * num_tiles_mz];
+                smoothed_tile = std::vector<double>(tile_size * tile_size);
+                size_t col_begin = ti * tile_size;
+                size_t col_end = col_begin + tile_size;
+                if (col_end > grid.n) {
+                    col_end = grid.n;
+                }
+                size_t buffer_begin =
+                    col_begin > kernel_hw ? col_begin - kernel_hw : 0;
+                size_t buffer_end = col_end + kernel_hw;
+                if (buffer_end > grid.n) {
+                    buffer_end = grid.n;
+                }
+                for (size_t j = tj * tile_size; j < row_end; ++j) {
+                    for (size_t i = buffer_begin; i < buffer_end; ++i) {
+                        buffer[i - buffer_begin] = value_at(sparse_grid, i, j);
+                    }
+                    smooth_row_mz(kernel, buffer.data(), buffer_begin,
+                                  col_begin, col_end,
+                                  &smoothed_tile[j % tile_size * tile_size]);
                 }
-                smoothed_data[i + j * grid.n] =
-                    sum_weighted_values / sum_weights;
             }
         }
-        grid.data = smoothed_data;
+        sparse_grid.tiles = std::move(smoothed_tiles);
+    }
+    return sparse_grid;
+}
+
+template <typename T>
+Grid::SparseGrid Grid::resample_sparse(const T &raw_data,
+                                       const ResampleParams &params) {
+    return resample_scans_sparse(raw_data, params);
+}
+
+// Explicit instantiations of the resampling functions for each raw data layout.
+#define INSTANTIATE_RESAMPLE_FUNCTIONS(T)                                      \
+    template Grid::Grid Grid::resample(const T &, const ResampleParams &);     \
+    template Grid::Grid Grid::resample_parallel(                               \
+        const T &, const ResampleParams &, size_t);                            \
+    template Grid::ResampleKernel Grid::resample_kernel(                       \
+        const T &, const ResampleParams &);                                    \
+    template Grid::Grid Grid::resample_rows(const T &, const ResampleKernel &, \
+                                            uint64_t, uint64_t);               \
+    template Grid::SparseGrid Grid::resample_sparse(const T &,                 \
+                                                    const ResampleParams &);
+INSTANTIATE_RESAMPLE_FUNCTIONS(RawData::RawData)
+INSTANTIATE_RESAMPLE_FUNCTIONS(RawData::FlatRawData)
+INSTANTIATE_RESAMPLE_FUNCTIONS(RawData::CompactRawData)
+INSTANTIATE_RESAMPLE_FUNCTIONS(RawData::CompressedRawData)
+#undef INSTANTIATE_RESAMPLE_FUNCTIONS
+
+Grid::SparseGrid Grid::to_sparse(const Grid &grid) {
+    const size_t tile_size = SparseGrid::tile_size;
+    SparseGrid sparse_grid = empty_sparse_grid(grid);
+    for (size_t j = 0; j < grid.m; ++j) {
+        for (size_t i = 0; i < grid.n; ++i) {
+            double value = value_at(grid, i, j);
+            if (value == 0) {
+                continue;
+            }
+            size_t tile_index =
+                i / tile_size + j / tile_size * sparse_grid.num_tiles_mz;
+            auto &tile = sparse_grid.tiles[tile_index];
+            if (tile.empty()) {
+                tile = std::vector<double>(tile_size * tile_size);
+            }
+            tile[i % tile_size + j % tile_size * tile_size] = value;
+        }
+    }
+    return sparse_grid;
+}
+
+Grid::Grid Grid::to_dense(const SparseGrid &sparse_grid) {
+    Grid grid;
+    grid.n = sparse_grid.n;
+    grid.m = sparse_grid.m;
+    grid.k = sparse_grid.k;
+    grid.t = sparse_grid.t;
+    grid.single_precision = false;
+    grid.data = std::vector<double>(grid.n * grid.m);
+    grid.bins_mz = sparse_grid.bins_mz;
+    grid.bins_rt = sparse_grid.bins_rt;
+    grid.instrument_type = sparse_grid.instrument_type;
+    grid.reference_mz = sparse_grid.reference_mz;
+    grid.fwhm_mz = sparse_grid.fwhm_mz;
+    grid.fwhm_rt = sparse_grid.fwhm_rt;
+    grid.min_mz = sparse_grid.min_mz;
+    grid.max_mz = sparse_grid.max_mz;
+    grid.min_rt = sparse_grid.min_rt;
+    grid.max_rt = sparse_grid.max_rt;
+    for (size_t j = 0; j < grid.m; ++j) {
+        for (size_t i = 0; i < grid.n; ++i) {
+            grid.data[i + j * grid.n] = value_at(sparse_grid, i, j);
+        }
     }
     return grid;
 }
 
-Grid::Grid Grid::subset(Grid grid, double min_mz, double max_mz, double min_rt, double max_rt) {
+// Extract a dense subset from either a dense or a sparse grid.
+template <typename G>
+Grid::Grid subset_grid(const G &grid, double min_mz, double max_mz,
+                       double min_rt, double max_rt) {
     // Find min/max bin in mz and rt.
     size_t min_mz_idx = Search::lower_bound(grid.bins_mz, min_mz);
     size_t max_mz_idx = Search::lower_bound(grid.bins_mz, max_mz);
@@ -274,7 +861,7 @@ Grid::Grid Grid::subset(Grid grid, double min_mz, double max_mz, double min_rt,
     size_t max_rt_idx = Search::lower_bound(grid.bins_rt, max_rt);
 
     // Initialize new grid.
-    Grid new_grid;
+    Grid::Grid new_grid;
     new_grid.n = max_mz_idx - min_mz_idx;
     new_grid.m = max_rt_idx - min_rt_idx;
     new_grid.k = grid.k;
@@ -285,10 +872,11 @@ Grid::Grid Grid::subset(Grid grid, double min_mz, double max_mz, double min_rt,
     new_grid.fwhm_rt = grid.fwhm_rt;
     new_grid.min_mz = grid.bins_mz[min_mz_idx];
     new_grid.max_mz = grid.bins_mz[max_mz_idx];
-    new_grid.min_rt = grid.bins_mz[min_rt_idx];
-    new_grid.max_rt = grid.bins_mz[max_rt_idx];
+    new_grid.min_rt = grid.bins_rt[min_rt_idx];
+    new_grid.max_rt = grid.bins_rt[max_rt_idx];
 
     // Initialize new grid memory.
+    new_grid.single_precision = false;
     new_grid.data = std::vector<double>(new_grid.n * new_grid.m);
 
     // Initialize bins.
@@ -309,9 +897,20 @@ Grid::Grid Grid::subset(Grid grid, double min_mz, double max_mz, double min_rt,
         for (size_t i = 0; i < new_grid.n; i++) {
             size_t mz_idx = min_mz_idx + i;
             size_t rt_idx = min_rt_idx + j;
-            new_grid.data[i + j * new_grid.n] = grid.data[mz_idx + rt_idx * grid.n];
+            new_grid.data[i + j * new_grid.n] =
+                Grid::value_at(grid, mz_idx, rt_idx);
         }
     }
 
     return new_grid;
 }
+
+Grid::Grid Grid::subset(const Grid &grid, double min_mz, double max_mz,
+                        double min_rt, double max_rt) {
+    return subset_grid(grid, min_mz, max_mz, min_rt, max_rt);
+}
+
+Grid::Grid Grid::subset(const SparseGrid &grid, double min_mz, double max_mz,
+                        double min_rt, double max_rt) {
+    return subset_grid(grid, min_mz, max_mz, min_rt, max_rt);
+}
@@ -20,14 +20,14 @@ struct Grid {
     uint64_t t;
 
     // The Grid data is stored as an array, and the mz and rt corresponding to
-    // each bin is memoized for quick indexing when searching.
-    // TODO(alex): Not sure that these should be doubles anymore, it uses
-    // a significant amount of memory and is storing smoothed data, which
-    // already alters the precision of the initial measurements. The issue is
-    // that the resampling procedure involves the summation of many numbers on
-    // several grid points, which might significantly alter results. More
-    // testing is needed.
+    // each bin is memoized for quick indexing when searching. If
+    // single_precision is set, the data is stored as floats in float_data to
+    // halve the memory usage, and data is empty. Otherwise only data is used.
+    // The resampling always accumulates in double precision, so that only the
+    // stored values are rounded.
+    bool single_precision;
     std::vector<double> data;
+    std::vector<float> float_data;
     std::vector<double> bins_mz;
     std::vector<double> bins_rt;
 
@@ -53,13 +53,127 @@ struct Grid {
 // Since multiple passes of a Gaussian smoothing is equivalent to a single pass
 // with `sigma = sqrt(2) * sigma_pass`, we adjust the sigmas for each pass
 // accordingly.
+//
+// The resampling functions take any of the raw data layouts as the template
+// parameter T, and are explicitly instantiated for each of them in grid.cpp.
 struct ResampleParams {
     uint64_t num_samples_mz;
     uint64_t num_samples_rt;
     double smoothing_coef_mz;
     double smoothing_coef_rt;
+    // Store the resampled grid in single precision.
+    bool single_precision = false;
 };
-Grid resample(const RawData::RawData &raw_data, const ResampleParams &params);
+template <typename T>
+Grid resample(const T &raw_data, const ResampleParams &params);
+
+// Same as resample, but the grid is split in bands of retention time rows that
+// are splatted and smoothed in parallel on up to max_threads threads. The
+// result is the same as with resample.
+template <typename T>
+Grid resample_parallel(const T &raw_data, const ResampleParams &params,
+                       size_t max_threads);
+
+// A grid where the data is split in square tiles of tile_size x tile_size
+// bins, which are only allocated once a non zero value is stored on them. Since
+// most of an LC-MS map is empty, the memory needed is proportional to the area
+// occupied by the signal instead of the full mz/rt range. The parameters have
+// the same meaning as in Grid.
+struct SparseGrid {
+    static constexpr uint64_t tile_size = 64;
+
+    uint64_t n;
+    uint64_t m;
+    uint64_t k;
+    uint64_t t;
+
+    // The tile with indexes ti/tj is stored at tiles[ti + tj * num_tiles_mz]
+    // as tile_size * tile_size values in row major order, and contains the
+    // bins [ti * tile_size, (ti + 1) * tile_size) in mz and
+    // [tj * tile_size, (tj + 1) * tile_size) in rt. The bins of the last tiles
+    // that are outside the grid are always zero. Tiles that were never
+    // allocated are empty, and all their values are zero.
+    uint64_t num_tiles_mz;
+    uint64_t num_tiles_rt;
+    std::vector<std::vector<double>> tiles;
+    std::vector<double> bins_mz;
+    std::vector<double> bins_rt;
+
+    Instrument::Type instrument_type;
+    double reference_mz;
+    double fwhm_mz;
+    double fwhm_rt;
+
+    double min_mz;
+    double max_mz;
+    double min_rt;
+    double max_rt;
+};
+
+// Get the value of the bin i/j of the given sparse grid.
+inline double value_at(const SparseGrid &grid, uint64_t i, uint64_t j) {
+    const uint64_t tile_size = SparseGrid::tile_size;
+    const auto &tile =
+        grid.tiles[i / tile_size + j / tile_size * grid.num_tiles_mz];
+    if (tile.empty()) {
+        return 0.0;
+    }
+    return tile[i % tile_size + j % tile_size * tile_size];
+}
+
+// Same as resample, but the result is stored in a SparseGrid. The values are
+// the same as those of the dense grid, but neither the result nor the
+// intermediate buffers allocate the empty areas of the map. Sparse grids are
+// always stored in double precision, so params.single_precision is ignored.
+template <typename T>
+SparseGrid resample_sparse(const T &raw_data, const ResampleParams &params);
+
+// Convert between the dense and sparse representations of a grid. Only the
+// tiles with non zero values are allocated on the sparse grid. The dense grid
+// is returned in double precision.
+SparseGrid to_sparse(const Grid &grid);
+Grid to_dense(const SparseGrid &grid);
+
+// The dimensions of the grid and the Gaussian kernels used by resample, which
+// only depend on the raw data parameters and the ResampleParams. They can be
+// calculated once to resample the grid in bands of rows with resample_rows.
+struct ResampleKernel {
+    // The grid returned by resample, without the data.
+    Grid grid;
+    // Sigma of the kernel in rt and for each mz bin.
+    double sigma_rt;
+    std::vector<double> sigma_mz;
+    // Half width of the kernel in number of bins.
+    uint64_t rt_kernel_hw;
+    uint64_t mz_kernel_hw;
+    // Normalized weights of the 1D smoothing kernels. The weight of the tap t
+    // for the row/column i is stored at weights[t * m + i] and
+    // weights[t * n + i] respectively, and corresponds to the row/column
+    // i + t - kernel_hw.
+    std::vector<double> rt_weights;
+    std::vector<double> mz_weights;
+};
+template <typename T>
+ResampleKernel resample_kernel(const T &raw_data, const ResampleParams &params);
+
+// Resample the rows [row_begin, row_end) of the grid described by the given
+// kernel. Only the rows within reach of the kernel are splatted, so the memory
+// needed is proportional to the number of rows instead of the full grid. The
+// values are identical to the same rows of the grid returned by resample. The
+// returned grid only contains the given rows, with m, bins_rt, min_rt and
+// max_rt set accordingly.
+template <typename T>
+Grid resample_rows(const T &raw_data, const ResampleKernel &kernel,
+                   uint64_t row_begin, uint64_t row_end);
+
+// Get the value of the bin i/j of the given grid, independently of its
+// precision.
+inline double value_at(const Grid &grid, uint64_t i, uint64_t j) {
+    if (grid.single_precision) {
+        return grid.float_data[i + j * grid.n];
+    }
+    return grid.data[i + j * grid.n];
+}
 
 // Calculate the index i/j for the given mz/rt on the grid. This calculation is
 // performed in linear time.
@@ -72,7 +186,11 @@ double mz_at(const Grid &grid, uint64_t i);
 double rt_at(const Grid &grid, uint64_t j);
 
 // Extract a subset from the grid based on the given constrained dimensions.
-Grid subset(Grid grid, double min_mz, double max_mz, double min_rt, double max_rt);
+// The subset is returned as a dense grid in double precision.
+Grid subset(const Grid &grid, double min_mz, double max_mz, double min_rt,
+            double max_rt);
+Grid subset(const SparseGrid &grid, double min_mz, double max_mz, double min_rt,
+            double max_rt);
 
 }  // namespace Grid
 
@@ -15,6 +15,7 @@ bool Grid::Serialize::read_grid(std::istream &stream, Grid *grid) {
     Serialization::read_double(stream, &grid->max_mz);
     Serialization::read_double(stream, &grid->min_rt);
     Serialization::read_double(stream, &grid->max_rt);
+    grid->single_precision = false;
     grid->data = std::vector<double>(grid->n * grid->m);
     grid->bins_mz = std::vector<double>(grid->n);
     grid->bins_rt = std::vector<double>(grid->m);
@@ -43,8 +44,87 @@ bool Grid::Serialize::write_grid(std::ostream &stream, const Grid &grid) {
     Serialization::write_double(stream, grid.max_mz);
     Serialization::write_double(stream, grid.min_rt);
     Serialization::write_double(stream, grid.max_rt);
-    for (size_t i = 0; i < (grid.n * grid.m); ++i) {
-        Serialization::write_double(stream, grid.data[i]);
+    for (size_t j = 0; j < grid.m; ++j) {
+        for (size_t i = 0; i < grid.n; ++i) {
+            Serialization::write_double(stream, value_at(grid, i, j));
+        }
+    }
+    for (size_t i = 0; i < grid.n; ++i) {
+        Serialization::write_double(stream, grid.bins_mz[i]);
+    }
+    for (size_t i = 0; i < grid.m; ++i) {
+        Serialization::write_double(stream, grid.bins_rt[i]);
+    }
+    return stream.good();
+}
+
+bool Grid::Serialize::read_sparse_grid(std::istream &stream, SparseGrid *grid) {
+    const uint64_t tile_size = SparseGrid::tile_size;
+    Serialization::read_uint64(stream, &grid->n);
+    Serialization::read_uint64(stream, &grid->m);
+    Serialization::read_uint64(stream, &grid->k);
+    Serialization::read_uint64(stream, &grid->t);
+    uint8_t instrument_type = 0;
+    Serialization::read_uint8(stream, &instrument_type);
+    grid->instrument_type = static_cast<Instrument::Type>(instrument_type);
+    Serialization::read_double(stream, &grid->reference_mz);
+    Serialization::read_double(stream, &grid->fwhm_mz);
+    Serialization::read_double(stream, &grid->fwhm_rt);
+    Serialization::read_double(stream, &grid->min_mz);
+    Serialization::read_double(stream, &grid->max_mz);
+    Serialization::read_double(stream, &grid->min_rt);
+    Serialization::read_double(stream, &grid->max_rt);
+    if (!stream.good()) {
+        return false;
+    }
+    grid->num_tiles_mz = (grid->n + tile_size - 1) / tile_size;
+    grid->num_tiles_rt = (grid->m + tile_size - 1) / tile_size;
+    grid->tiles = std::vector<std::vector<double>>(grid->num_tiles_mz *
+                                                   grid->num_tiles_rt);
+    for (auto &tile : grid->tiles) {
+        bool allocated = false;
+        Serialization::read_bool(stream, &allocated);
+        if (!stream.good()) {
+            return false;
+        }
+        if (!allocated) {
+            continue;
+        }
+        tile = std::vector<double>(tile_size * tile_size);
+        for (size_t i = 0; i < tile.size(); ++i) {
+            Serialization::read_double(stream, &tile[i]);
+        }
+    }
+    grid->bins_mz = std::vector<double>(grid->n);
+    grid->bins_rt = std::vector<double>(grid->m);
+    for (size_t i = 0; i < grid->n; ++i) {
+        Serialization::read_double(stream, &grid->bins_mz[i]);
+    }
+    for (size_t i = 0; i < grid->m; ++i) {
+        Serialization::read_double(stream, &grid->bins_rt[i]);
+    }
+    return stream.good();
+}
+
+bool Grid::Serialize::write_sparse_grid(std::ostream &stream,
+                                        const SparseGrid &grid) {
+    Serialization::write_uint64(stream, grid.n);
+    Serialization::write_uint64(stream, grid.m);
+    Serialization::write_uint64(stream, grid.k);
+    Serialization::write_uint64(stream, grid.t);
+    Serialization::write_uint8(stream, grid.instrument_type);
+    Serialization::write_double(stream, grid.reference_mz);
+    Serialization::write_double(stream, grid.fwhm_mz);
+    Serialization::write_double(stream, grid.fwhm_rt);
+    Serialization::write_double(stream, grid.min_mz);
+    Serialization::write_double(stream, grid.max_mz);
+    Serialization::write_double(stream, grid.min_rt);
+    Serialization::write_double(stream, grid.max_rt);
+    for (const auto &tile : grid.tiles) {
+        Serialization::write_bool(stream, !tile.empty());
+        for (size_t i = 0; i < tile.size(); ++i) {
+            Serialization::write_double(stream, tile[i]);
+        }
     }
     for (size_t i = 0; i < grid.n; ++i) {
         Serialization::write_double(stream, grid.bins_mz[i]);
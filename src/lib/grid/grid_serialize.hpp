@@ -10,9 +10,19 @@
 namespace Grid::Serialize {
 
 // Grid::Grid
+//
+// The values are always stored in double precision, so single precision grids
+// are read back as double precision grids.
 bool read_grid(std::istream &stream, Grid *grid);
 bool write_grid(std::ostream &stream, const Grid &grid);
 
+// Grid::SparseGrid
+//
+// Only the allocated tiles are stored, each preceded by a flag that indicates
+// if the tile is allocated.
+bool read_sparse_grid(std::istream &stream, SparseGrid *grid);
+bool write_sparse_grid(std::ostream &stream, const SparseGrid &grid);
+
 }  // namespace Grid::Serialize
 
 #endif /* GRID_GRIDSERIALIZE_HPP */
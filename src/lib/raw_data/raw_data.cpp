@@ -1,7 +1,22 @@
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
 #include "raw_data/raw_data.hpp"
+#include "utils/scan_codec.hpp"
 #include "utils/search.hpp"
 
-double RawData::theoretical_fwhm(const RawData &raw_data, double mz) {
+// Number of decompressed scans kept in the cache of each thread for the
+// CompressedRawData.
+#define SCAN_CACHE_SIZE 16
+
+// Average number of points per scan on each tile of the RoiIndex. Smaller
+// tiles reduce the points visited by each query but increase the memory
+// usage of the index.
+#define ROI_INDEX_POINTS_PER_TILE 16
+
+double RawData::theoretical_fwhm(const Metadata &raw_data, double mz) {
     double e = 0;
     switch (raw_data.instrument_type) {
         case Instrument::ORBITRAP: {
@@ -29,27 +44,74 @@ double RawData::fwhm_to_sigma(double fwhm) {
     return fwhm / (2 * std::sqrt(2 * std::log(2)));
 }
 
-Xic::Xic RawData::xic(const RawData &raw_data, double min_mz, double max_mz,
-                      double min_rt, double max_rt, Xic::Method method) {
+// Find the first point of the scan between begin and end with an mz greater
+// or equal than the given one.
+template <typename T>
+size_t first_point_from(const T &scan, size_t begin, size_t end, double mz) {
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (scan.mz[middle] < mz) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+// Find the first point of the scan between begin and end with an mz greater
+// than the given one.
+template <typename T>
+size_t first_point_after(const T &scan, size_t begin, size_t end, double mz) {
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (scan.mz[middle] <= mz) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+// Calculate the sum of the intensities of the scan j from the point min_i up
+// to max_mz using the cumulative intensities.
+template <typename T>
+double sum_intensity(const RawData::IntensitySums &sums, const T &scan,
+                     size_t j, size_t min_i, double max_mz) {
+    size_t max_i = first_point_after(scan, min_i, scan.num_points, max_mz);
+    if (max_i <= min_i) {
+        return 0;
+    }
+    const double *cumulative = &sums.cumulative[sums.offsets[j]];
+    return cumulative[max_i] - cumulative[min_i];
+}
+
+// Calculate the extracted ion chromatogram on any of the raw data layouts. If
+// the cumulative intensities are given, they are used for the Xic::SUM.
+template <typename T>
+Xic::Xic calculate_xic(const T &raw_data, const RawData::IntensitySums *sums,
+                       double min_mz, double max_mz, double min_rt,
+                       double max_rt, Xic::Method method) {
     Xic::Xic result = {};
     result.min_mz = min_mz;
     result.max_mz = max_mz;
     result.min_rt = min_rt;
     result.max_rt = max_rt;
     result.method = method;
-    const auto &scans = raw_data.scans;
-    if (scans.size() == 0) {
+    size_t num_scans = RawData::num_scans(raw_data);
+    if (num_scans == 0) {
         return result;
     }
 
     // Find scan indices.
     size_t min_j = Search::lower_bound(raw_data.retention_times, min_rt);
-    size_t max_j = scans.size();
-    if (scans[min_j].retention_time < min_rt) {
+    size_t max_j = num_scans;
+    if (raw_data.retention_times[min_j] < min_rt) {
         ++min_j;
     }
     for (size_t j = min_j; j < max_j; ++j) {
-        const auto &scan = scans[j];
+        auto scan = RawData::scan_points(raw_data, j);
         if (scan.num_points == 0) {
             continue;
         }
@@ -57,15 +119,7 @@ Xic::Xic RawData::xic(const RawData &raw_data, double min_mz, double max_mz,
             break;
         }
 
-        double internal_min_mz = min_mz;
-        double internal_max_mz = max_mz;
-        if (internal_min_mz < scan.mz[0]) {
-            internal_min_mz = scan.mz[0];
-        }
-        if (internal_max_mz > scan.mz[scan.num_points - 1]) {
-            internal_max_mz = scan.mz[scan.num_points - 1];
-        }
-        size_t min_i = Search::lower_bound(scan.mz, min_mz);
+        size_t min_i = Search::lower_bound(scan.mz, scan.num_points, min_mz);
         size_t max_i = scan.num_points;
         if (scan.mz[min_i] < min_mz) {
             ++min_i;
@@ -74,6 +128,11 @@ Xic::Xic RawData::xic(const RawData &raw_data, double min_mz, double max_mz,
         double aggregated_intensity = 0;
         switch (method) {
             case Xic::SUM: {
+                if (sums != nullptr) {
+                    aggregated_intensity =
+                        sum_intensity(*sums, scan, j, min_i, max_mz);
+                    break;
+                }
                 // Sum all points in the scan.
                 for (size_t i = min_i; i < max_i; ++i) {
                     if (scan.mz[i] > max_mz) {
@@ -105,23 +164,265 @@ Xic::Xic RawData::xic(const RawData &raw_data, double min_mz, double max_mz,
     return result;
 }
 
-RawData::RawPoints RawData::raw_points(const RawData &raw_data, double min_mz,
-                                       double max_mz, double min_rt,
-                                       double max_rt) {
-    RawPoints raw_points = {};
-    const auto &scans = raw_data.scans;
-    if (scans.size() == 0) {
+template <typename T>
+Xic::Xic RawData::xic(const T &raw_data, double min_mz, double max_mz,
+                      double min_rt, double max_rt, Xic::Method method) {
+    return calculate_xic(raw_data, nullptr, min_mz, max_mz, min_rt, max_rt,
+                         method);
+}
+
+// Calculate the batched Xic on any of the raw data layouts. If the cumulative
+// intensities are given, they are used for the Xic::SUM.
+template <typename T>
+Xic::XicBatch calculate_xic_batch(const T &raw_data,
+                                  const RawData::IntensitySums *sums,
+                                  const std::vector<Xic::Target> &targets,
+                                  Xic::Method method, size_t max_threads) {
+    Xic::XicBatch result = {};
+    result.method = method;
+    if (method != Xic::SUM && method != Xic::MAX) {
+        result.method = Xic::UNKNOWN;
+        return result;
+    }
+    size_t num_scans = RawData::num_scans(raw_data);
+    size_t num_targets = targets.size();
+
+    // As in xic, the empty scans are not part of the traces, so we count the
+    // non empty scans before each scan to find the position of each scan on
+    // the traces.
+    std::vector<size_t> non_empty_before(num_scans + 1, 0);
+    for (size_t j = 0; j < num_scans; ++j) {
+        bool empty = RawData::scan_points(raw_data, j).num_points == 0;
+        non_empty_before[j + 1] = non_empty_before[j] + (empty ? 0 : 1);
+    }
+
+    // Find the scans of each target and the size of the traces, so that the
+    // output can be allocated once and filled independently by each thread.
+    const auto &retention_times = raw_data.retention_times;
+    std::vector<size_t> first_scan(num_targets);
+    std::vector<size_t> last_scan(num_targets);
+    result.offsets.resize(num_targets + 1, 0);
+    for (size_t k = 0; k < num_targets; ++k) {
+        first_scan[k] =
+            std::lower_bound(retention_times.begin(), retention_times.end(),
+                             targets[k].min_rt) -
+            retention_times.begin();
+        last_scan[k] =
+            std::upper_bound(retention_times.begin(), retention_times.end(),
+                             targets[k].max_rt) -
+            retention_times.begin();
+        if (last_scan[k] < first_scan[k]) {
+            last_scan[k] = first_scan[k];
+        }
+        result.offsets[k + 1] = result.offsets[k] +
+                                non_empty_before[last_scan[k]] -
+                                non_empty_before[first_scan[k]];
+    }
+    result.retention_time.resize(result.offsets[num_targets]);
+    result.intensity.resize(result.offsets[num_targets]);
+
+    // Sort the targets by their first scan, to add them to the active list as
+    // the scans are visited.
+    std::vector<size_t> sorted_targets(num_targets);
+    for (size_t k = 0; k < num_targets; ++k) {
+        sorted_targets[k] = k;
+    }
+    std::sort(sorted_targets.begin(), sorted_targets.end(),
+              [&first_scan](size_t a, size_t b) {
+                  return first_scan[a] < first_scan[b];
+              });
+
+    // Visit the scans between shard_begin and shard_end, keeping the active
+    // targets sorted by min_mz so that the points of the scan are searched
+    // from left to right.
+    auto sweep_scans = [&](size_t shard_begin, size_t shard_end) {
+        std::vector<size_t> active;
+        size_t next_target = 0;
+        for (size_t j = shard_begin; j < shard_end; ++j) {
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [&last_scan, j](size_t k) {
+                                            return last_scan[k] <= j;
+                                        }),
+                         active.end());
+            for (; next_target < num_targets &&
+                   first_scan[sorted_targets[next_target]] <= j;
+                 ++next_target) {
+                size_t k = sorted_targets[next_target];
+                if (last_scan[k] <= j) {
+                    continue;
+                }
+                auto position = std::upper_bound(
+                    active.begin(), active.end(), k,
+                    [&targets](size_t a, size_t b) {
+                        return targets[a].min_mz < targets[b].min_mz;
+                    });
+                active.insert(position, k);
+            }
+            if (active.empty()) {
+                continue;
+            }
+            auto scan = RawData::scan_points(raw_data, j);
+            if (scan.num_points == 0) {
+                continue;
+            }
+
+            size_t min_i = 0;
+            for (const auto &k : active) {
+                const auto &target = targets[k];
+                min_i = first_point_from(scan, min_i, scan.num_points,
+                                         target.min_mz);
+                double aggregated_intensity = 0;
+                if (method == Xic::SUM && sums != nullptr) {
+                    aggregated_intensity = sum_intensity(*sums, scan, j, min_i,
+                                                         target.max_mz);
+                } else {
+                    for (size_t i = min_i; i < scan.num_points; ++i) {
+                        if (scan.mz[i] > target.max_mz) {
+                            break;
+                        }
+                        if (method == Xic::SUM) {
+                            aggregated_intensity += scan.intensity[i];
+                        } else if (scan.intensity[i] > aggregated_intensity) {
+                            aggregated_intensity = scan.intensity[i];
+                        }
+                    }
+                }
+                size_t index = result.offsets[k] + non_empty_before[j] -
+                               non_empty_before[first_scan[k]];
+                result.retention_time[index] = scan.retention_time;
+                result.intensity[index] = aggregated_intensity;
+            }
+        }
+    };
+
+    // The number of threads is set to the maximum possible concurrency, but
+    // there are no more shards than scans.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads > num_scans) {
+        num_threads = num_scans;
+    }
+    if (num_threads <= 1) {
+        sweep_scans(0, num_scans);
+        return result;
+    }
+    std::vector<std::thread> threads(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        size_t shard_begin = num_scans * i / num_threads;
+        size_t shard_end = num_scans * (i + 1) / num_threads;
+        threads[i] = std::thread(sweep_scans, shard_begin, shard_end);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+template <typename T>
+Xic::XicBatch RawData::xic_batch(const T &raw_data,
+                                 const std::vector<Xic::Target> &targets,
+                                 Xic::Method method, size_t max_threads) {
+    return calculate_xic_batch(raw_data, nullptr, targets, method,
+                               max_threads);
+}
+
+// Build the cumulative intensities on any of the raw data layouts.
+template <typename T>
+RawData::IntensitySums create_intensity_sums(const T &raw_data) {
+    RawData::IntensitySums sums = {};
+    size_t num_scans = RawData::num_scans(raw_data);
+    size_t num_points = 0;
+    for (size_t j = 0; j < num_scans; ++j) {
+        num_points += RawData::scan_points(raw_data, j).num_points;
+    }
+    sums.offsets.reserve(num_scans);
+    sums.cumulative.reserve(num_points + num_scans);
+    for (size_t j = 0; j < num_scans; ++j) {
+        auto scan = RawData::scan_points(raw_data, j);
+        sums.offsets.push_back(sums.cumulative.size());
+        double cumulative = 0;
+        sums.cumulative.push_back(cumulative);
+        for (size_t i = 0; i < scan.num_points; ++i) {
+            cumulative += scan.intensity[i];
+            sums.cumulative.push_back(cumulative);
+        }
+    }
+    return sums;
+}
+
+// Calculate the total intensity of a region on any of the raw data layouts.
+template <typename T>
+double calculate_total_intensity(const T &raw_data,
+                                 const RawData::IntensitySums &sums,
+                                 double min_mz, double max_mz, double min_rt,
+                                 double max_rt) {
+    const auto &retention_times = raw_data.retention_times;
+    size_t min_j = std::lower_bound(retention_times.begin(),
+                                    retention_times.end(), min_rt) -
+                   retention_times.begin();
+    double total_intensity = 0;
+    for (size_t j = min_j; j < retention_times.size(); ++j) {
+        if (retention_times[j] > max_rt) {
+            break;
+        }
+        auto scan = RawData::scan_points(raw_data, j);
+        size_t min_i = first_point_from(scan, 0, scan.num_points, min_mz);
+        total_intensity += sum_intensity(sums, scan, j, min_i, max_mz);
+    }
+    return total_intensity;
+}
+
+template <typename T>
+RawData::IntensitySums RawData::build_intensity_sums(const T &raw_data) {
+    return create_intensity_sums(raw_data);
+}
+
+template <typename T>
+double RawData::total_intensity(const T &raw_data, const IntensitySums &sums,
+                                double min_mz, double max_mz, double min_rt,
+                                double max_rt) {
+    return calculate_total_intensity(raw_data, sums, min_mz, max_mz, min_rt,
+                                     max_rt);
+}
+
+template <typename T>
+Xic::Xic RawData::xic(const T &raw_data, const IntensitySums &sums,
+                      double min_mz, double max_mz, double min_rt,
+                      double max_rt, Xic::Method method) {
+    return calculate_xic(raw_data, &sums, min_mz, max_mz, min_rt, max_rt,
+                         method);
+}
+
+template <typename T>
+Xic::XicBatch RawData::xic_batch(const T &raw_data, const IntensitySums &sums,
+                                 const std::vector<Xic::Target> &targets,
+                                 Xic::Method method, size_t max_threads) {
+    return calculate_xic_batch(raw_data, &sums, targets, method,
+                               max_threads);
+}
+
+// Find the raw data points within the given region on any of the raw data
+// layouts.
+template <typename T>
+RawData::RawPoints find_raw_points(const T &raw_data, double min_mz,
+                                   double max_mz, double min_rt,
+                                   double max_rt) {
+    RawData::RawPoints raw_points = {};
+    size_t num_scans = RawData::num_scans(raw_data);
+    if (num_scans == 0) {
         return raw_points;
     }
 
     size_t min_j = Search::lower_bound(raw_data.retention_times, min_rt);
-    size_t max_j = scans.size();
-    if (scans[min_j].retention_time < min_rt) {
+    size_t max_j = num_scans;
+    if (raw_data.retention_times[min_j] < min_rt) {
         ++min_j;
     }
 
     for (size_t j = min_j; j < max_j; ++j) {
-        const auto &scan = scans[j];
+        auto scan = RawData::scan_points(raw_data, j);
         if (scan.retention_time > max_rt) {
             break;
         }
@@ -129,7 +430,7 @@ RawData::RawPoints RawData::raw_points(const RawData &raw_data, double min_mz,
             continue;
         }
 
-        size_t min_i = Search::lower_bound(scan.mz, min_mz);
+        size_t min_i = Search::lower_bound(scan.mz, scan.num_points, min_mz);
         size_t max_i = scan.num_points;
         if (scan.mz[min_i] < min_mz) {
             ++min_i;
@@ -152,3 +453,486 @@ RawData::RawPoints RawData::raw_points(const RawData &raw_data, double min_mz,
 
     return raw_points;
 }
+
+template <typename T>
+RawData::RawPoints RawData::raw_points(const T &raw_data, double min_mz,
+                                       double max_mz, double min_rt,
+                                       double max_rt) {
+    return find_raw_points(raw_data, min_mz, max_mz, min_rt, max_rt);
+}
+
+// Find the tile of the RoiIndex that contains the given mz. The mz outside the
+// range of the index are assigned to the first or last tile.
+size_t roi_tile(const RawData::RoiIndex &index, double mz) {
+    double tile = (mz - index.min_mz) / index.tile_width;
+    if (!(tile > 0)) {
+        return 0;
+    }
+    if (tile >= index.num_tiles - 1) {
+        return index.num_tiles - 1;
+    }
+    return static_cast<size_t>(tile);
+}
+
+// Build the RoiIndex on any of the raw data layouts.
+template <typename T>
+RawData::RoiIndex create_roi_index(const T &raw_data) {
+    RawData::RoiIndex index = {};
+    size_t num_scans = RawData::num_scans(raw_data);
+
+    // Find the mz range and the number of points of the data.
+    double min_mz = std::numeric_limits<double>::infinity();
+    double max_mz = -std::numeric_limits<double>::infinity();
+    size_t num_points = 0;
+    size_t num_non_empty_scans = 0;
+    for (size_t j = 0; j < num_scans; ++j) {
+        auto scan = RawData::scan_points(raw_data, j);
+        if (scan.num_points == 0) {
+            continue;
+        }
+        min_mz = std::min(min_mz, scan.mz[0]);
+        max_mz = std::max(max_mz, scan.mz[scan.num_points - 1]);
+        num_points += scan.num_points;
+        ++num_non_empty_scans;
+    }
+
+    // The tiles are sized to have ROI_INDEX_POINTS_PER_TILE points per scan on
+    // average.
+    index.num_tiles = 1;
+    if (num_non_empty_scans != 0) {
+        index.num_tiles = std::max<size_t>(
+            1, num_points / (num_non_empty_scans * ROI_INDEX_POINTS_PER_TILE));
+    }
+    index.min_mz = num_points != 0 ? min_mz : 0;
+    index.tile_width = 1;
+    if (num_points != 0 && max_mz > min_mz) {
+        index.tile_width = (max_mz - min_mz) / index.num_tiles;
+    }
+
+    size_t stride = index.num_tiles + 1;
+    index.tile_offsets.resize(num_scans * stride);
+    for (size_t j = 0; j < num_scans; ++j) {
+        auto scan = RawData::scan_points(raw_data, j);
+        uint32_t *offsets = &index.tile_offsets[j * stride];
+        // Each tile starts at the first point with a tile greater or equal
+        // than its own, which requires the mz to be sorted.
+        size_t next_tile = 0;
+        for (size_t i = 0; i < scan.num_points; ++i) {
+            size_t tile = roi_tile(index, scan.mz[i]);
+            for (; next_tile <= tile; ++next_tile) {
+                offsets[next_tile] = i;
+            }
+        }
+        for (; next_tile < stride; ++next_tile) {
+            offsets[next_tile] = scan.num_points;
+        }
+    }
+    return index;
+}
+
+template <typename T>
+RawData::RoiIndex RawData::build_roi_index(const T &raw_data) {
+    return create_roi_index(raw_data);
+}
+
+// Find the raw points on any of the raw data layouts using the RoiIndex.
+template <typename T>
+RawData::RawPoints find_indexed_raw_points(const T &raw_data,
+                                           const RawData::RoiIndex &index,
+                                           double min_mz, double max_mz,
+                                           double min_rt, double max_rt) {
+    RawData::RawPoints raw_points = {};
+    size_t num_scans = RawData::num_scans(raw_data);
+    if (num_scans == 0 || min_mz > max_mz) {
+        return raw_points;
+    }
+
+    size_t min_j = Search::lower_bound(raw_data.retention_times, min_rt);
+    size_t max_j = num_scans;
+    if (raw_data.retention_times[min_j] < min_rt) {
+        ++min_j;
+    }
+    for (size_t j = min_j; j < num_scans; ++j) {
+        if (raw_data.retention_times[j] > max_rt) {
+            max_j = j;
+            break;
+        }
+    }
+
+    // The points on the query are on the tiles from min_tile to max_tile.
+    // Since the number of candidate points is known from the index, the
+    // output is allocated only once.
+    size_t stride = index.num_tiles + 1;
+    size_t min_tile = roi_tile(index, min_mz);
+    size_t max_tile = roi_tile(index, max_mz);
+    size_t num_candidates = 0;
+    for (size_t j = min_j; j < max_j; ++j) {
+        const uint32_t *offsets = &index.tile_offsets[j * stride];
+        num_candidates += offsets[max_tile + 1] - offsets[min_tile];
+    }
+    raw_points.rt.reserve(num_candidates);
+    raw_points.mz.reserve(num_candidates);
+    raw_points.intensity.reserve(num_candidates);
+
+    for (size_t j = min_j; j < max_j; ++j) {
+        const uint32_t *offsets = &index.tile_offsets[j * stride];
+        size_t min_i = offsets[min_tile];
+        size_t max_i = offsets[max_tile + 1];
+        // Skip the scans without points on the tiles, without accessing
+        // their data.
+        if (min_i == max_i) {
+            continue;
+        }
+        auto scan = RawData::scan_points(raw_data, j);
+        while (min_i < max_i && scan.mz[min_i] < min_mz) {
+            ++min_i;
+        }
+        bool scan_not_empty = false;
+        for (size_t i = min_i; i < max_i; ++i) {
+            if (scan.mz[i] > max_mz) {
+                break;
+            }
+            scan_not_empty = true;
+            raw_points.rt.push_back(scan.retention_time);
+            raw_points.mz.push_back(scan.mz[i]);
+            raw_points.intensity.push_back(scan.intensity[i]);
+            ++raw_points.num_points;
+        }
+        if (scan_not_empty) {
+            ++raw_points.num_scans;
+        }
+    }
+
+    return raw_points;
+}
+
+template <typename T>
+RawData::RawPoints RawData::raw_points(const T &raw_data, const RoiIndex &index,
+                                       double min_mz, double max_mz,
+                                       double min_rt, double max_rt) {
+    return find_indexed_raw_points(raw_data, index, min_mz, max_mz, min_rt,
+                                   max_rt);
+}
+
+// Explicit instantiations of the public functions for each raw data layout.
+#define INSTANTIATE_RAW_DATA_FUNCTIONS(T)                                      \
+    template Xic::Xic RawData::xic(const T &, double, double, double, double, \
+                                   Xic::Method);                               \
+    template Xic::XicBatch RawData::xic_batch(                                 \
+        const T &, const std::vector<Xic::Target> &, Xic::Method, size_t);     \
+    template RawData::IntensitySums RawData::build_intensity_sums(const T &);  \
+    template double RawData::total_intensity(                                  \
+        const T &, const IntensitySums &, double, double, double, double);     \
+    template Xic::Xic RawData::xic(const T &, const IntensitySums &, double,  \
+                                   double, double, double, Xic::Method);       \
+    template Xic::XicBatch RawData::xic_batch(                                 \
+        const T &, const IntensitySums &, const std::vector<Xic::Target> &,    \
+        Xic::Method, size_t);                                                  \
+    template RawData::RawPoints RawData::raw_points(const T &, double, double, \
+                                                    double, double);           \
+    template RawData::RoiIndex RawData::build_roi_index(const T &);            \
+    template RawData::RawPoints RawData::raw_points(                           \
+        const T &, const RoiIndex &, double, double, double, double);
+INSTANTIATE_RAW_DATA_FUNCTIONS(RawData)
+INSTANTIATE_RAW_DATA_FUNCTIONS(FlatRawData)
+INSTANTIATE_RAW_DATA_FUNCTIONS(CompactRawData)
+INSTANTIATE_RAW_DATA_FUNCTIONS(CompressedRawData)
+#undef INSTANTIATE_RAW_DATA_FUNCTIONS
+
+RawData::FlatRawData RawData::flatten(const RawData &raw_data) {
+    FlatRawData flat_data = {};
+    static_cast<Metadata &>(flat_data) = raw_data;
+
+    // Count the points and MSn scans first, so that each array is allocated
+    // only once.
+    size_t num_scans = raw_data.scans.size();
+    size_t num_points = 0;
+    size_t num_precursors = 0;
+    for (const auto &scan : raw_data.scans) {
+        num_points += scan.num_points;
+        if (scan.ms_level > 1) {
+            ++num_precursors;
+        }
+    }
+    flat_data.mz.reserve(num_points);
+    flat_data.intensity.reserve(num_points);
+    flat_data.offsets.reserve(num_scans + 1);
+    flat_data.retention_times.reserve(num_scans);
+    flat_data.headers.reserve(num_scans);
+    flat_data.precursors.reserve(num_precursors);
+
+    for (const auto &scan : raw_data.scans) {
+        flat_data.offsets.push_back(flat_data.mz.size());
+        flat_data.mz.insert(flat_data.mz.end(), scan.mz.begin(),
+                            scan.mz.begin() + scan.num_points);
+        flat_data.intensity.insert(flat_data.intensity.end(),
+                                   scan.intensity.begin(),
+                                   scan.intensity.begin() + scan.num_points);
+        flat_data.retention_times.push_back(scan.retention_time);
+        ScanHeader header = {};
+        header.scan_number = scan.scan_number;
+        header.ms_level = scan.ms_level;
+        header.polarity = scan.polarity;
+        header.precursor_index = ScanHeader::no_precursor;
+        header.max_intensity = scan.max_intensity;
+        header.total_intensity = scan.total_intensity;
+        if (scan.ms_level > 1) {
+            header.precursor_index = flat_data.precursors.size();
+            flat_data.precursors.push_back(scan.precursor_information);
+        }
+        flat_data.headers.push_back(header);
+    }
+    flat_data.offsets.push_back(flat_data.mz.size());
+    return flat_data;
+}
+
+RawData::CompactRawData RawData::compact(const RawData &raw_data,
+                                         bool single_precision_mz) {
+    CompactRawData compact_data = {};
+    static_cast<Metadata &>(compact_data) = raw_data;
+    compact_data.single_precision_mz = single_precision_mz;
+
+    // Count the points and MSn scans first, so that each array is allocated
+    // only once.
+    size_t num_scans = raw_data.scans.size();
+    size_t num_points = 0;
+    size_t num_precursors = 0;
+    for (const auto &scan : raw_data.scans) {
+        num_points += scan.num_points;
+        if (scan.ms_level > 1) {
+            ++num_precursors;
+        }
+    }
+    if (single_precision_mz) {
+        compact_data.mz_offsets.reserve(num_points);
+    } else {
+        compact_data.mz.reserve(num_points);
+    }
+    compact_data.intensity.reserve(num_points);
+    compact_data.offsets.reserve(num_scans + 1);
+    compact_data.retention_times.reserve(num_scans);
+    compact_data.mz_base.reserve(num_scans);
+    compact_data.headers.reserve(num_scans);
+    compact_data.precursors.reserve(num_precursors);
+
+    for (const auto &scan : raw_data.scans) {
+        compact_data.offsets.push_back(compact_data.intensity.size());
+        double mz_base = scan.num_points != 0 ? scan.mz[0] : 0;
+        for (size_t i = 0; i < scan.num_points; ++i) {
+            if (single_precision_mz) {
+                compact_data.mz_offsets.push_back(scan.mz[i] - mz_base);
+            } else {
+                compact_data.mz.push_back(scan.mz[i]);
+            }
+            compact_data.intensity.push_back(scan.intensity[i]);
+        }
+        compact_data.retention_times.push_back(scan.retention_time);
+        compact_data.mz_base.push_back(mz_base);
+        ScanHeader header = {};
+        header.scan_number = scan.scan_number;
+        header.ms_level = scan.ms_level;
+        header.polarity = scan.polarity;
+        header.precursor_index = ScanHeader::no_precursor;
+        header.max_intensity = scan.max_intensity;
+        header.total_intensity = scan.total_intensity;
+        if (scan.ms_level > 1) {
+            header.precursor_index = compact_data.precursors.size();
+            compact_data.precursors.push_back(scan.precursor_information);
+        }
+        compact_data.headers.push_back(header);
+    }
+    compact_data.offsets.push_back(compact_data.intensity.size());
+    return compact_data;
+}
+
+RawData::CompressedRawData RawData::compress(const RawData &raw_data) {
+    // The ids start at 1, since 0 is the id of data not created here.
+    static std::atomic<uint64_t> next_id(1);
+    CompressedRawData compressed_data = {};
+    static_cast<Metadata &>(compressed_data) = raw_data;
+    compressed_data.id = next_id++;
+
+    size_t num_scans = raw_data.scans.size();
+    compressed_data.mz_offsets.reserve(num_scans + 1);
+    compressed_data.intensity_offsets.reserve(num_scans + 1);
+    compressed_data.num_points.reserve(num_scans);
+    compressed_data.retention_times.reserve(num_scans);
+    compressed_data.headers.reserve(num_scans);
+    for (const auto &scan : raw_data.scans) {
+        compressed_data.mz_offsets.push_back(compressed_data.data.size());
+        ScanCodec::encode_mz(scan.mz.data(), scan.num_points,
+                             compressed_data.data);
+        compressed_data.intensity_offsets.push_back(
+            compressed_data.data.size());
+        ScanCodec::encode_intensity(scan.intensity.data(), scan.num_points,
+                                    compressed_data.data);
+        compressed_data.num_points.push_back(scan.num_points);
+        compressed_data.retention_times.push_back(scan.retention_time);
+        ScanHeader header = {};
+        header.scan_number = scan.scan_number;
+        header.ms_level = scan.ms_level;
+        header.polarity = scan.polarity;
+        header.precursor_index = ScanHeader::no_precursor;
+        header.max_intensity = scan.max_intensity;
+        header.total_intensity = scan.total_intensity;
+        if (scan.ms_level > 1) {
+            header.precursor_index = compressed_data.precursors.size();
+            compressed_data.precursors.push_back(scan.precursor_information);
+        }
+        compressed_data.headers.push_back(header);
+    }
+    compressed_data.mz_offsets.push_back(compressed_data.data.size());
+    compressed_data.intensity_offsets.push_back(compressed_data.data.size());
+    compressed_data.data.shrink_to_fit();
+    return compressed_data;
+}
+
+// A decompressed scan of a CompressedRawData, identified by the id of the
+// data and the scan index.
+struct CachedScan {
+    uint64_t id;
+    size_t index;
+    uint64_t last_used;
+    std::vector<double> mz;
+    std::vector<double> intensity;
+};
+
+RawData::ScanPoints RawData::scan_points(const CompressedRawData &raw_data,
+                                         size_t i) {
+    // Each thread has its own cache, so no locking is needed. When the scan
+    // is not found, the least recently used entry is replaced. Data with the
+    // id 0 was not created by compress and could be any data, so its scans
+    // are never found in the cache, but they are still decompressed into the
+    // least recently used entry to keep them valid for as long as the others.
+    static thread_local std::vector<CachedScan> cache(SCAN_CACHE_SIZE);
+    static thread_local uint64_t num_calls = 0;
+    ++num_calls;
+    CachedScan *entry = &cache[0];
+    for (auto &cached_scan : cache) {
+        if (raw_data.id != 0 && cached_scan.last_used != 0 &&
+            cached_scan.id == raw_data.id && cached_scan.index == i) {
+            entry = &cached_scan;
+            break;
+        }
+        if (cached_scan.last_used < entry->last_used) {
+            entry = &cached_scan;
+        }
+    }
+    bool cached = raw_data.id != 0 && entry->last_used != 0 &&
+                  entry->id == raw_data.id && entry->index == i;
+    entry->last_used = num_calls;
+    if (!cached) {
+        entry->id = raw_data.id;
+        entry->index = i;
+        const uint8_t *data = raw_data.data.data();
+        size_t num_points = raw_data.num_points[i];
+        uint64_t mz_begin = raw_data.mz_offsets[i];
+        uint64_t intensity_begin = raw_data.intensity_offsets[i];
+        uint64_t intensity_end = raw_data.mz_offsets[i + 1];
+        if (ScanCodec::decode_mz(data + mz_begin, intensity_begin - mz_begin,
+                                 num_points, entry->mz) != ScanCodec::OK ||
+            ScanCodec::decode_intensity(data + intensity_begin,
+                                        intensity_end - intensity_begin,
+                                        num_points,
+                                        entry->intensity) != ScanCodec::OK) {
+            entry->mz.clear();
+            entry->intensity.clear();
+        }
+    }
+    return {raw_data.retention_times[i], entry->mz.data(),
+            entry->intensity.data(), entry->mz.size()};
+}
+
+// Check if the spacing between the points i - 1 and i of a profile scan is
+// larger than twice the spacing of the neighbouring points.
+bool has_sampling_gap(const std::vector<double> &mz, size_t i) {
+    double reference = std::numeric_limits<double>::infinity();
+    if (i >= 2) {
+        reference = mz[i - 1] - mz[i - 2];
+    }
+    if (i + 1 < mz.size()) {
+        reference = std::min(reference, mz[i + 1] - mz[i]);
+    }
+    return mz[i] - mz[i - 1] > 2 * reference;
+}
+
+// Find the m/z of the apex of a peak by fitting a Gaussian to its maximum and
+// the two neighbouring points, that is, a parabola to the logarithm of their
+// intensities. The m/z are taken relative to the maximum to avoid losing
+// precision.
+double interpolate_apex(double mz_0, double mz_1, double mz_2,
+                        double intensity_0, double intensity_1,
+                        double intensity_2) {
+    if (intensity_0 <= 0 || intensity_1 <= 0 || intensity_2 <= 0) {
+        return mz_1;
+    }
+    double a = mz_0 - mz_1;
+    double c = mz_2 - mz_1;
+    double d_0 = std::log(intensity_0 / intensity_1);
+    double d_2 = std::log(intensity_2 / intensity_1);
+    double p = (d_0 * c - d_2 * a) / (a * c * (a - c));
+    if (!(p < 0)) {
+        return mz_1;
+    }
+    double q = (d_0 - p * a * a) / a;
+    return mz_1 + std::clamp(-q / (2 * p), a, c);
+}
+
+void RawData::centroid_scan(Scan &scan) {
+    auto &mz = scan.mz;
+    auto &intensity = scan.intensity;
+    size_t n = std::min(mz.size(), intensity.size());
+
+    // The gaps are found before the centroids start overwriting the points.
+    std::vector<bool> gaps(n, false);
+    for (size_t i = 1; i < n; ++i) {
+        gaps[i] = has_sampling_gap(mz, i);
+    }
+
+    // The centroids are stored in place, since there are never more centroids
+    // than points already visited.
+    size_t num_centroids = 0;
+    double max_intensity = 0;
+    double total_intensity = 0;
+    size_t begin = 0;
+    while (begin < n) {
+        // Climb to the maximum of the peak and descend until the intensity
+        // increases again. Flat regions are assigned to the previous peak.
+        size_t apex = begin;
+        while (apex + 1 < n && !gaps[apex + 1] &&
+               intensity[apex + 1] >= intensity[apex]) {
+            ++apex;
+        }
+        size_t end = apex + 1;
+        while (end < n && !gaps[end] &&
+               intensity[end] <= intensity[end - 1]) {
+            ++end;
+        }
+
+        double apex_mz = mz[apex];
+        if (apex > begin && apex + 1 < end) {
+            apex_mz = interpolate_apex(mz[apex - 1], mz[apex], mz[apex + 1],
+                                       intensity[apex - 1], intensity[apex],
+                                       intensity[apex + 1]);
+        }
+        double peak_intensity = 0;
+        for (size_t i = begin; i < end; ++i) {
+            peak_intensity += intensity[i];
+        }
+        mz[num_centroids] = apex_mz;
+        intensity[num_centroids] = peak_intensity;
+        ++num_centroids;
+        if (peak_intensity > max_intensity) {
+            max_intensity = peak_intensity;
+        }
+        total_intensity += peak_intensity;
+        begin = end;
+    }
+    mz.resize(num_centroids);
+    intensity.resize(num_centroids);
+    mz.shrink_to_fit();
+    intensity.shrink_to_fit();
+    scan.num_points = num_centroids;
+    scan.max_intensity = max_intensity;
+    scan.total_intensity = total_intensity;
+}
@@ -44,6 +44,24 @@ struct Xic {
     double min_rt;
     double max_rt;
 };
+
+// The region to extract for one of the targets of a batched Xic extraction.
+struct Target {
+    double min_mz;
+    double max_mz;
+    double min_rt;
+    double max_rt;
+};
+
+// The result of a batched Xic extraction. The traces of all targets are
+// stored in the same columnar arrays, with the trace of the target k going
+// from offsets[k] to offsets[k + 1].
+struct XicBatch {
+    Method method;
+    std::vector<uint64_t> offsets;
+    std::vector<double> retention_time;
+    std::vector<double> intensity;
+};
 }  // namespace Xic
 
 // In this namespace we have access to the data structures for working with raw
@@ -91,8 +109,8 @@ struct Scan {
     PrecursorInformation precursor_information;
 };
 
-// Main structure that hold information about a RawData file.
-struct RawData {
+// Parameters of the raw data that are shared by all of its layouts.
+struct Metadata {
     // The instrument type.
     Instrument::Type instrument_type;
     // Min/max mass to charge range (m/z).
@@ -111,7 +129,10 @@ struct RawData {
     double reference_mz;
     // Average full width half maximum of chromatographic peaks.
     double fwhm_rt;
+};
 
+// Main structure that hold information about a RawData file.
+struct RawData : Metadata {
     // Extracted scans.
     std::vector<Scan> scans;
     // This information is saved for quick search.
@@ -120,6 +141,178 @@ struct RawData {
     std::vector<double> retention_times;
 };
 
+// Compact metadata of a scan stored on a FlatRawData. The precursor
+// information is only kept for MSn scans, on a separate table.
+struct ScanHeader {
+    uint64_t scan_number;
+    uint8_t ms_level;
+    Polarity::Type polarity;
+    // Index of the precursor information on FlatRawData::precursors, or
+    // ScanHeader::no_precursor for MS1 scans.
+    uint32_t precursor_index;
+    double max_intensity;
+    double total_intensity;
+
+    static constexpr uint32_t no_precursor = UINT32_MAX;
+};
+
+// Contiguous layout of the scans of a RawData. The points of all scans are
+// stored one scan after the other on a single pair of mz/intensity arrays, and
+// the points of the i-th scan are in the range [offsets[i], offsets[i + 1]).
+// Building it takes a constant number of allocations, independently of the
+// number of scans.
+struct FlatRawData : Metadata {
+    // Points of all the scans.
+    std::vector<double> mz;
+    std::vector<double> intensity;
+    // Offsets of the first point of each scan, with an additional offset at
+    // the end for the total number of points.
+    std::vector<uint64_t> offsets;
+    // Retention time and metadata of each scan.
+    std::vector<double> retention_times;
+    std::vector<ScanHeader> headers;
+    // Precursor information for the MSn scans.
+    std::vector<PrecursorInformation> precursors;
+};
+
+// Read only view of the points of a single scan, independently of the layout
+// of the raw data.
+struct ScanPoints {
+    double retention_time;
+    const double *mz;
+    const double *intensity;
+    size_t num_points;
+};
+
+inline size_t num_scans(const RawData &raw_data) {
+    return raw_data.scans.size();
+}
+
+inline size_t num_scans(const FlatRawData &raw_data) {
+    return raw_data.headers.size();
+}
+
+inline ScanPoints scan_points(const RawData &raw_data, size_t i) {
+    const auto &scan = raw_data.scans[i];
+    return {scan.retention_time, scan.mz.data(), scan.intensity.data(),
+            scan.num_points};
+}
+
+inline ScanPoints scan_points(const FlatRawData &raw_data, size_t i) {
+    size_t offset = raw_data.offsets[i];
+    return {raw_data.retention_times[i], raw_data.mz.data() + offset,
+            raw_data.intensity.data() + offset,
+            raw_data.offsets[i + 1] - offset};
+}
+
+// Convert the given RawData into the contiguous FlatRawData layout.
+FlatRawData flatten(const RawData &raw_data);
+
+// Same as FlatRawData, but the points are stored in single precision. The
+// intensities are stored as floats. If single_precision_mz is set, the mz are
+// stored as float offsets from the first mz of each scan, which is kept in
+// double precision, so that the rounding error is relative to the mz range of
+// the scan instead of the mz itself. Otherwise the mz are stored as doubles.
+// The algorithms working on this layout still accumulate in double precision.
+struct CompactRawData : Metadata {
+    // Points of all the scans. Only one of mz or mz_offsets is used,
+    // depending on single_precision_mz.
+    bool single_precision_mz;
+    std::vector<double> mz;
+    std::vector<float> mz_offsets;
+    std::vector<float> intensity;
+    // Offsets of the first point of each scan, with an additional offset at
+    // the end for the total number of points.
+    std::vector<uint64_t> offsets;
+    // Retention time, base mz and metadata of each scan.
+    std::vector<double> retention_times;
+    std::vector<double> mz_base;
+    std::vector<ScanHeader> headers;
+    // Precursor information for the MSn scans.
+    std::vector<PrecursorInformation> precursors;
+};
+
+// The mz of a scan on a CompactRawData, which can be indexed as an array of
+// doubles independently of how they are stored.
+struct CompactMz {
+    const double *mz;
+    const float *mz_offsets;
+    double mz_base;
+
+    double operator[](size_t i) const {
+        return mz != nullptr ? mz[i] : mz_base + mz_offsets[i];
+    }
+};
+
+// Same as ScanPoints, for a scan on a CompactRawData.
+struct CompactScanPoints {
+    double retention_time;
+    CompactMz mz;
+    const float *intensity;
+    size_t num_points;
+};
+
+inline size_t num_scans(const CompactRawData &raw_data) {
+    return raw_data.headers.size();
+}
+
+inline CompactScanPoints scan_points(const CompactRawData &raw_data,
+                                     size_t i) {
+    size_t offset = raw_data.offsets[i];
+    CompactMz mz = {nullptr, nullptr, raw_data.mz_base[i]};
+    if (raw_data.single_precision_mz) {
+        mz.mz_offsets = raw_data.mz_offsets.data() + offset;
+    } else {
+        mz.mz = raw_data.mz.data() + offset;
+    }
+    return {raw_data.retention_times[i], mz,
+            raw_data.intensity.data() + offset,
+            raw_data.offsets[i + 1] - offset};
+}
+
+// Convert the given RawData into the CompactRawData layout, storing the mz in
+// single precision if single_precision_mz is set.
+CompactRawData compact(const RawData &raw_data, bool single_precision_mz);
+
+// Same as FlatRawData, but the points of each scan are losslessly compressed
+// with the ScanCodec functions to reduce the memory usage. The scans are
+// decompressed on demand by scan_points into a small cache on each thread,
+// so that the algorithms visiting the same scans repeatedly, for example when
+// building the peaks, only decompress them once. The data must not be
+// modified after calling compress, since the cached scans would be stale.
+struct CompressedRawData : Metadata {
+    // Unique identifier of this data in the decompression caches, assigned by
+    // compress. The scans of data with the id 0 are not cached.
+    uint64_t id;
+
+    // Compressed mz and intensity of all the scans.
+    std::vector<uint8_t> data;
+    // Offsets of the compressed mz and intensity of each scan in data, with
+    // an additional offset at the end for the total size.
+    std::vector<uint64_t> mz_offsets;
+    std::vector<uint64_t> intensity_offsets;
+    // Number of points, retention time and metadata of each scan.
+    std::vector<uint64_t> num_points;
+    std::vector<double> retention_times;
+    std::vector<ScanHeader> headers;
+    // Precursor information for the MSn scans.
+    std::vector<PrecursorInformation> precursors;
+};
+
+inline size_t num_scans(const CompressedRawData &raw_data) {
+    return raw_data.headers.size();
+}
+
+// Decompress the scan at the given index. The returned points are stored in
+// the decompression cache of the calling thread and remain valid until
+// another scan_points call on the same thread evicts them, which doesn't
+// happen for at least the next 15 calls. If the scan can't be decompressed,
+// an empty scan is returned.
+ScanPoints scan_points(const CompressedRawData &raw_data, size_t i);
+
+// Convert the given RawData into the CompressedRawData layout.
+CompressedRawData compress(const RawData &raw_data);
+
 // Raw data points in a struct of arrays format.
 struct RawPoints {
     uint64_t num_points;
@@ -129,20 +322,101 @@ struct RawPoints {
     std::vector<double> intensity;
 };
 
+// The following functions take any of the raw data layouts as the template
+// parameter T: RawData, FlatRawData, CompactRawData or CompressedRawData. They
+// are explicitly instantiated for each of them in raw_data.cpp.
+
 // Calculate the extracted ion chromatogram for ROI described by the
 // min/max_mz/rt on the given raw_data.
-Xic::Xic xic(const RawData &raw_data, double min_mz, double max_mz,
-             double min_rt, double max_rt, Xic::Method method);
+template <typename T>
+Xic::Xic xic(const T &raw_data, double min_mz, double max_mz, double min_rt,
+             double max_rt, Xic::Method method);
+
+// Calculate the Xic of all the given targets, giving the same traces as
+// calling xic for each of them. The targets are sorted by retention time and
+// mz, so that the scans are visited only once, keeping the list of targets
+// active on each scan. The scans are split in retention time shards that are
+// processed on up to max_threads threads.
+template <typename T>
+Xic::XicBatch xic_batch(const T &raw_data,
+                        const std::vector<Xic::Target> &targets,
+                        Xic::Method method, size_t max_threads);
+
+// Cumulative intensities of each scan, used to calculate the total intensity
+// of a region with two binary searches per scan instead of visiting all its
+// points. The num_points + 1 cumulative intensities of the scan j start at
+// offsets[j] with a zero, so that the sum of the points from i to k - 1 is
+// cumulative[offsets[j] + k] - cumulative[offsets[j] + i]. The sums can differ
+// from the ones calculated point by point in the last digits due to rounding.
+struct IntensitySums {
+    std::vector<uint64_t> offsets;
+    std::vector<double> cumulative;
+};
+
+// Build the IntensitySums of the given raw data.
+template <typename T>
+IntensitySums build_intensity_sums(const T &raw_data);
+
+// Calculate the total intensity of the points within the square region
+// defined by min/max_mz/rt, using the IntensitySums built for this raw_data.
+template <typename T>
+double total_intensity(const T &raw_data, const IntensitySums &sums,
+                       double min_mz, double max_mz, double min_rt,
+                       double max_rt);
+
+// Same as xic and xic_batch, using the IntensitySums built for this raw_data
+// for the Xic::SUM.
+template <typename T>
+Xic::Xic xic(const T &raw_data, const IntensitySums &sums, double min_mz,
+             double max_mz, double min_rt, double max_rt, Xic::Method method);
+template <typename T>
+Xic::XicBatch xic_batch(const T &raw_data, const IntensitySums &sums,
+                        const std::vector<Xic::Target> &targets,
+                        Xic::Method method, size_t max_threads);
 
 // Calculate the theoretical FWHM of the peak for the given mz.
-double theoretical_fwhm(const RawData &raw_data, double mz);
+double theoretical_fwhm(const Metadata &raw_data, double mz);
 
 // Transform the FWHM to sigma assuming a Gaussian distribution.
 double fwhm_to_sigma(double fwhm);
 
 // Find the raw data points within the square region defined by min/max_mz/rt.
-RawPoints raw_points(const RawData &raw_data, double min_mz, double max_mz,
+template <typename T>
+RawPoints raw_points(const T &raw_data, double min_mz, double max_mz,
                      double min_rt, double max_rt);
+
+// Index of the raw data points used to speed up repeated raw_points queries.
+// The mz range of the data is split into tiles of equal width and for each
+// scan we store the index of its first point on each tile. A query can then
+// jump directly to the points of the tiles covering its mz range and skip the
+// scans without points on them.
+struct RoiIndex {
+    // The mz tiles, covering the mz range of all points on the data.
+    double min_mz;
+    double tile_width;
+    uint64_t num_tiles;
+    // Index of the first point of each scan on each tile, with an additional
+    // entry at the end for the number of points on the scan. There are
+    // num_tiles + 1 entries per scan.
+    std::vector<uint32_t> tile_offsets;
+};
+
+// Build the RoiIndex for the given raw data. The number of tiles is chosen to
+// have a small number of points per tile on average.
+template <typename T>
+RoiIndex build_roi_index(const T &raw_data);
+
+// Same as raw_points, using the given index built for this raw_data.
+template <typename T>
+RawPoints raw_points(const T &raw_data, const RoiIndex &index, double min_mz,
+                     double max_mz, double min_rt, double max_rt);
+
+// Convert a profile mode scan into centroid mode. Each peak on the scan is
+// replaced by a single point with the total intensity of the peak, located at
+// the apex interpolated from the maximum and its two neighbours. Peaks are
+// delimited by local minima of the intensity and by gaps in the sampling of
+// the spectrum, such as the ones left by removing points with zero intensity.
+void centroid_scan(Scan &scan);
 }  // namespace RawData
 
 // In this namespace we have access to the data structures for working with
@@ -1,698 +1,1859 @@
 #include <zlib.h>
-#include <regex>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include "utils/base64.hpp"
 #include "utils/compression.hpp"
+#include "utils/memory_map.hpp"
+#include "utils/numpress.hpp"
 #include "xml_reader.hpp"
 
-RawData::Scan parse_mzxml_scan(std::istream &stream,
-                               std::optional<XmlReader::Tag> &tag,
-                               double min_mz, double max_mz, double min_rt,
-                               double max_rt, Polarity::Type polarity,
-                               size_t ms_level) {
-    RawData::Scan scan;
-    uint64_t precursor_id = 0;
+// Initialize an empty RawData object with the given instrument parameters.
+RawData::RawData init_raw_data(Instrument::Type instrument_type,
+                               double resolution_ms1, double resolution_msn,
+                               double reference_mz) {
+    RawData::RawData raw_data = {};
+    raw_data.instrument_type = instrument_type;
+    raw_data.min_mz = std::numeric_limits<double>::infinity();
+    raw_data.max_mz = -std::numeric_limits<double>::infinity();
+    raw_data.min_rt = std::numeric_limits<double>::infinity();
+    raw_data.max_rt = -std::numeric_limits<double>::infinity();
+    raw_data.resolution_ms1 = resolution_ms1;
+    raw_data.resolution_msn = resolution_msn;
+    raw_data.reference_mz = reference_mz;
+    raw_data.fwhm_rt = 0;  // TODO(alex): Should this be passed as well?
+    raw_data.scans = {};
+    raw_data.retention_times = {};
+    // TODO(alex): Can we automatically detect the instrument type and set
+    // resolution from the header?
+    return raw_data;
+}
+
+// Append the scan to the RawData if it's not empty and update the min/max
+// mz/rt bounds accordingly.
+void update_raw_data(RawData::RawData &raw_data, RawData::Scan &scan) {
+    if (scan.num_points == 0) {
+        return;
+    }
+    raw_data.scans.push_back(scan);
+    raw_data.retention_times.push_back(scan.retention_time);
+    if (scan.retention_time < raw_data.min_rt) {
+        raw_data.min_rt = scan.retention_time;
+    }
+    if (scan.retention_time > raw_data.max_rt) {
+        raw_data.max_rt = scan.retention_time;
+    }
+    if (scan.mz[0] < raw_data.min_mz) {
+        raw_data.min_mz = scan.mz[0];
+    }
+    if (scan.mz[scan.mz.size() - 1] > raw_data.max_mz) {
+        raw_data.max_mz = scan.mz[scan.mz.size() - 1];
+    }
+}
+
+// Check if a scan with the given MS level and polarity is selected by the
+// filter. An MS level of zero or an unknown polarity match any filter, so that
+// scans can be checked while their metadata is still being read.
+bool filter_matches(const XmlReader::ScanFilter &filter, size_t ms_level,
+                    Polarity::Type polarity) {
+    if (ms_level != 0 && ms_level != filter.ms_level) {
+        return false;
+    }
+    return polarity == Polarity::UNKNOWN || filter.polarity == Polarity::BOTH ||
+           polarity == filter.polarity;
+}
+
+// Check if a scan with the given MS level and polarity is selected by any of
+// the filters.
+bool any_filter_matches(const std::vector<XmlReader::ScanFilter> &filters,
+                        size_t ms_level, Polarity::Type polarity) {
+    for (const auto &filter : filters) {
+        if (filter_matches(filter, ms_level, polarity)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check if the points of a scan with the given MS level and polarity are
+// needed by any of the filters that select it. Otherwise the binary data of the
+// scan doesn't need to be decoded.
+bool any_filter_needs_points(const std::vector<XmlReader::ScanFilter> &filters,
+                             size_t ms_level, Polarity::Type polarity) {
+    for (const auto &filter : filters) {
+        if (!filter.headers_only &&
+            filter_matches(filter, ms_level, polarity)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Centroid the scan if it was acquired in profile mode and any of the filters
+// that select it requests it.
+void centroid_if_requested(const std::vector<XmlReader::ScanFilter> &filters,
+                           bool profile, RawData::Scan &scan) {
+    if (!profile || scan.num_points == 0) {
+        return;
+    }
+    for (const auto &filter : filters) {
+        if (filter.centroid &&
+            filter_matches(filter, scan.ms_level, scan.polarity)) {
+            RawData::centroid_scan(scan);
+            return;
+        }
+    }
+}
+
+// Check if a parsed scan has to be stored in any of the outputs. Scans without
+// points are only stored by the filters that keep the headers, as long as they
+// were not rejected while parsing, in which case they have no MS level.
+bool keep_scan(const std::vector<XmlReader::ScanFilter> &filters,
+               const RawData::Scan &scan) {
+    if (scan.num_points != 0) {
+        return true;
+    }
+    if (scan.ms_level == 0) {
+        return false;
+    }
+    for (const auto &filter : filters) {
+        if (filter.headers_only &&
+            filter_matches(filter, scan.ms_level, scan.polarity)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Append the metadata of the scan to the RawData, leaving out its points. The
+// min/max mz bounds are not affected.
+void update_raw_data_headers(RawData::RawData &raw_data,
+                             const RawData::Scan &scan) {
+    RawData::Scan header = {};
+    header.scan_number = scan.scan_number;
+    header.ms_level = scan.ms_level;
+    header.retention_time = scan.retention_time;
+    header.polarity = scan.polarity;
+    header.precursor_information = scan.precursor_information;
+    raw_data.scans.push_back(std::move(header));
+    raw_data.retention_times.push_back(scan.retention_time);
+    if (scan.retention_time < raw_data.min_rt) {
+        raw_data.min_rt = scan.retention_time;
+    }
+    if (scan.retention_time > raw_data.max_rt) {
+        raw_data.max_rt = scan.retention_time;
+    }
+}
+
+// Append the scan to each of the outputs whose filter it matches.
+void update_raw_data(std::vector<RawData::RawData> &raw_data,
+                     const std::vector<XmlReader::ScanFilter> &filters,
+                     RawData::Scan &scan) {
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (!filter_matches(filters[i], scan.ms_level, scan.polarity)) {
+            continue;
+        }
+        if (filters[i].headers_only) {
+            if (scan.ms_level != 0) {
+                update_raw_data_headers(raw_data[i], scan);
+            }
+        } else {
+            update_raw_data(raw_data[i], scan);
+        }
+    }
+}
+
+// Check for xml whitespace and digit characters, independently of the
+// current locale.
+bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Convert the given string to a number. The tokenizer returns strings that are
+// not null terminated, so they are copied to a small buffer first.
+double to_double(std::string_view str) {
+    char buffer[64];
+    size_t size = std::min(str.size(), sizeof(buffer) - 1);
+    std::memcpy(buffer, str.data(), size);
+    buffer[size] = '\0';
+    return std::strtod(buffer, nullptr);
+}
+
+int64_t to_int(std::string_view str) {
+    char buffer[32];
+    size_t size = std::min(str.size(), sizeof(buffer) - 1);
+    std::memcpy(buffer, str.data(), size);
+    buffer[size] = '\0';
+    return std::strtoll(buffer, nullptr, 10);
+}
+
+// Parse the retention time in xs:duration units. Here we are only accounting
+// for the data as stored in seconds, minutes and hours. It is unlikely that we
+// are going to need to parse the days, months and years. For more information
+// about the format see:
+//    https://www.ibm.com/support/knowledgecenter/en/ssw_ibm_i_72/rzasp/rzasp_xsduration.htm
+std::optional<double> parse_retention_time(std::string_view duration) {
+    size_t period_start = duration.find('P');
+    if (period_start == std::string_view::npos) {
+        return std::nullopt;
+    }
+    size_t time_start = duration.find('T', period_start);
+    if (time_start == std::string_view::npos) {
+        return std::nullopt;
+    }
+    double retention_time = 0;
+    bool seconds_found = false;
+    for (size_t i = time_start + 1; i < duration.size();) {
+        size_t j = i;
+        while (j < duration.size() &&
+               (is_digit(duration[j]) || duration[j] == '.')) {
+            ++j;
+        }
+        if (j == i || j == duration.size()) {
+            return std::nullopt;
+        }
+        double value = to_double(duration.substr(i, j - i));
+        if (duration[j] == 'H') {
+            retention_time += value * 60 * 60;
+        } else if (duration[j] == 'M') {
+            retention_time += value * 60;
+        } else if (duration[j] == 'S') {
+            retention_time += value;
+            seconds_found = true;
+        } else {
+            return std::nullopt;
+        }
+        i = j + 1;
+    }
+    // NOTE: The seconds are required.
+    if (!seconds_found) {
+        return std::nullopt;
+    }
+    return retention_time;
+}
+
+// Check if the tag starts with the given prefix, followed by the end of the tag
+// name.
+bool tag_name_matches(std::string_view tag, std::string_view prefix) {
+    if (tag.size() <= prefix.size() ||
+        tag.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    char c = tag[prefix.size()];
+    return is_whitespace(c) || c == '>' || c == '/';
+}
+
+bool XmlReader::TagView::has_attribute(std::string_view attribute_name) const {
+    for (size_t i = 0; i < num_attributes; ++i) {
+        if (attributes[i].first == attribute_name) {
+            return true;
+        }
+    }
+    for (const auto &[name, value] : overflow_attributes) {
+        if (name == attribute_name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string_view XmlReader::TagView::attribute(
+    std::string_view attribute_name) const {
+    for (size_t i = 0; i < num_attributes; ++i) {
+        if (attributes[i].first == attribute_name) {
+            return attributes[i].second;
+        }
+    }
+    for (const auto &[name, value] : overflow_attributes) {
+        if (name == attribute_name) {
+            return value;
+        }
+    }
+    return {};
+}
+
+std::optional<XmlReader::TagView> XmlReader::Tokenizer::read_tag() {
+    auto tag = std::optional<TagView>(TagView{});
+    size_t tag_begin = data.find('<', position);
+    size_t tag_end = tag_begin == std::string_view::npos
+                         ? std::string_view::npos
+                         : data.find('>', tag_begin);
+    if (tag_end == std::string_view::npos) {
+        position = data.size();
+        return std::nullopt;
+    }
+    position = tag_end + 1;
+
+    // Contents of the tag without the angle brackets.
+    auto buffer = data.substr(tag_begin + 1, tag_end - tag_begin - 1);
+    if (buffer.empty()) {
+        return std::nullopt;
+    }
+
+    // Check if this is a closing tag for a previous one.
+    if (buffer[0] == '/') {
+        tag->closed = true;
+        size_t end_name = 1;
+        while (end_name < buffer.size() && !is_whitespace(buffer[end_name])) {
+            ++end_name;
+        }
+        tag->name = buffer.substr(1, end_name - 1);
+        return tag;
+    }
+
+    // Read tag name.
+    size_t end_name = 0;
+    while (end_name < buffer.size() && !is_whitespace(buffer[end_name]) &&
+           buffer[end_name] != '/') {
+        ++end_name;
+    }
+    tag->name = buffer.substr(0, end_name);
+
+    // Check if this is a self-closing tag.
+    size_t end_attributes = buffer.size();
+    if (buffer[buffer.size() - 1] == '/') {
+        --end_attributes;
+        tag->closed = true;
+    }
+
+    // Read attributes.
+    for (size_t i = end_name; i < end_attributes;) {
+        if (is_whitespace(buffer[i])) {
+            ++i;
+            continue;
+        }
+        // Find attribute name.
+        size_t equals = buffer.find('=', i);
+        if (equals == std::string_view::npos || equals >= end_attributes) {
+            break;
+        }
+        size_t end_attribute_name = equals;
+        while (end_attribute_name > i &&
+               is_whitespace(buffer[end_attribute_name - 1])) {
+            --end_attribute_name;
+        }
+
+        // Find attribute value.
+        size_t quote = equals + 1;
+        while (quote < end_attributes && is_whitespace(buffer[quote])) {
+            ++quote;
+        }
+        if (quote == end_attributes ||
+            (buffer[quote] != '"' && buffer[quote] != '\'')) {
+            // Malformed xml.
+            return std::nullopt;
+        }
+        size_t end_quote = buffer.find(buffer[quote], quote + 1);
+        if (end_quote == std::string_view::npos ||
+            end_quote >= end_attributes) {
+            // Malformed xml.
+            return std::nullopt;
+        }
+        auto attribute =
+            std::make_pair(buffer.substr(i, end_attribute_name - i),
+                           buffer.substr(quote + 1, end_quote - quote - 1));
+        if (tag->num_attributes < TagView::max_attributes) {
+            tag->attributes[tag->num_attributes] = attribute;
+            ++tag->num_attributes;
+        } else {
+            tag->overflow_attributes.push_back(attribute);
+        }
+        i = end_quote + 1;
+    }
+
+    return tag;
+}
+
+std::optional<std::string_view> XmlReader::Tokenizer::read_data() {
+    size_t data_end = data.find('<', position);
+    if (data_end == std::string_view::npos) {
+        position = data.size();
+        return std::nullopt;
+    }
+    auto contents = data.substr(position, data_end - position);
+    position = data_end;
+
+    // Trim potential whitespace at the beginning of the data string.
+    size_t data_begin = 0;
+    while (data_begin < contents.size() &&
+           is_whitespace(contents[data_begin])) {
+        ++data_begin;
+    }
+    if (data_begin == contents.size()) {
+        return std::nullopt;
+    }
+    return contents.substr(data_begin);
+}
+
+// When a scan is rejected by the filters only its retention time is kept, so
+// that the readers can stop once they are past the requested range.
+RawData::Scan rejected_scan(const RawData::Scan &scan) {
+    RawData::Scan rejected = {};
+    rejected.retention_time = scan.retention_time;
+    return rejected;
+}
+
+// Decode the contents of an mzXML peaks tag that has just been read by the
+// tokenizer into the given scan, filtering the points outside the min/max mz
+// range. Returns false if the data could not be decoded.
+bool parse_mzxml_peaks(XmlReader::Tokenizer &tokenizer,
+                       const XmlReader::TagView &peaks_tag, size_t num_points,
+                       double min_mz, double max_mz, RawData::Scan &scan) {
+    // Extract the precision from the peaks tag.
+    if (!peaks_tag.has_attribute("precision")) {
+        return false;
+    }
+    int precision = to_int(peaks_tag.attribute("precision"));
+
+    // Extract the byteOrder from the peaks tag. This determines the endianness
+    // in which the data was stored. `network` == `big_endian`.
+    if (!peaks_tag.has_attribute("byteOrder")) {
+        return false;
+    }
+    auto little_endian = peaks_tag.attribute("byteOrder") != "network";
+
+    // Extract the contentType/pairOrder from the peaks tag and exit if it is
+    // not `m/z-int`. In older versions of ProteoWizard, the conversion was not
+    // validated and the tag was incorrect. Here we are supporting both
+    // versions for compatibility but we are not trying to be exhaustive.
+    if (!peaks_tag.has_attribute("contentType") &&
+        !peaks_tag.has_attribute("pairOrder")) {
+        return false;
+    }
+
+    // Find whether or not the data is compressed.
+    bool compressed = peaks_tag.attribute("compressionType") == "zlib";
+
+    // Extract the peaks from the data.
+    auto data = tokenizer.read_data();
+    if (!data) {
+        return false;
+    }
+
+    // Decode the base64-encoded data and decompress it if necessary. The
+    // scratch buffers are reused for all scans parsed by the same thread.
+    thread_local std::vector<uint8_t> decoded_data;
+    thread_local std::vector<uint8_t> decompressed_data;
+    thread_local std::vector<double> values;
+    Base64::decode_base64(data.value().data(), data.value().size(),
+                          decoded_data);
+    const std::vector<uint8_t> *raw_data = &decoded_data;
+    if (compressed) {
+        // Calculate amount of bytes in decompressed data.
+        size_t decompressed_len = num_points * 2 * (precision / 8);
+
+        // Decompress data.
+        int status =
+            Compression::inflate(decoded_data.data(), decoded_data.size(),
+                                 decompressed_data, decompressed_len);
+
+        // Check status after decompression.
+        if (status != Z_OK) {
+            return false;
+        }
+        raw_data = &decompressed_data;
+    }
+
+    // Interpret raw data as interleaved mz and intensity values. Peaks missing
+    // from the data are left out.
+    size_t num_values = 0;
+    if (precision == 32 || precision == 64) {
+        num_values = std::min(num_points * 2,
+                              raw_data->size() / (precision / 8) / 2 * 2);
+    }
+    values.resize(num_values);
+    if (precision == 32) {
+        Base64::interpret_floats(raw_data->data(), num_values, little_endian,
+                                 values.data());
+    } else if (precision == 64) {
+        Base64::interpret_doubles(raw_data->data(), num_values, little_endian,
+                                  values.data());
+    }
+
+    // The peaks that are kept are compacted at the front of the values, so
+    // that the scan vectors are allocated only once with their final size.
+    double intensity_sum = 0;
+    double max_intensity = 0;
+    size_t scan_size = 0;
+    for (size_t i = 0; i < num_values / 2; ++i) {
+        double mz = values[2 * i];
+        double intensity = values[2 * i + 1];
+
+        // We don't need to extract the peaks when we are not inside the mz
+        // bounds or contain no value.
+        if (mz < min_mz || mz > max_mz || intensity == 0) {
+            continue;
+        }
+
+        if (intensity > max_intensity) {
+            max_intensity = intensity;
+        }
+        intensity_sum += intensity;
+
+        values[2 * scan_size] = mz;
+        values[2 * scan_size + 1] = intensity;
+        ++scan_size;
+    }
+    scan.mz.resize(scan_size);
+    scan.intensity.resize(scan_size);
+    for (size_t i = 0; i < scan_size; ++i) {
+        scan.mz[i] = values[2 * i];
+        scan.intensity[i] = values[2 * i + 1];
+    }
+
+    scan.num_points = scan.mz.size();
+    scan.max_intensity = max_intensity;
+    scan.total_intensity = intensity_sum;
+    return true;
+}
+
+// Read the precursor information of an mzXML precursorMz tag that has just
+// been read by the tokenizer into the given scan. Returns false if the tag
+// contains no precursor m/z.
+bool parse_mzxml_precursor(XmlReader::Tokenizer &tokenizer,
+                           const XmlReader::TagView &precursor_tag,
+                           RawData::Scan &scan) {
+    if (precursor_tag.has_attribute("precursorIntensity")) {
+        scan.precursor_information.intensity =
+            to_double(precursor_tag.attribute("precursorIntensity"));
+    }
+
+    if (precursor_tag.has_attribute("windowWideness")) {
+        scan.precursor_information.window_wideness =
+            to_double(precursor_tag.attribute("windowWideness"));
+    }
+
+    if (precursor_tag.has_attribute("precursorCharge")) {
+        scan.precursor_information.charge =
+            to_int(precursor_tag.attribute("precursorCharge"));
+    }
+
+    auto activation_method = precursor_tag.attribute("activationMethod");
+    if (activation_method == "CID") {
+        scan.precursor_information.activation_method = ActivationMethod::CID;
+    } else if (activation_method == "HCD") {
+        scan.precursor_information.activation_method = ActivationMethod::HCD;
+    } else {
+        scan.precursor_information.activation_method =
+            ActivationMethod::UNKNOWN;
+    }
+
+    if (precursor_tag.has_attribute("precursorScanNum")) {
+        scan.precursor_information.scan_number =
+            to_int(precursor_tag.attribute("precursorScanNum"));
+    }
+
+    auto data = tokenizer.read_data();
+    if (!data) {
+        return false;
+    }
+    scan.precursor_information.mz = to_double(data.value());
+    return true;
+}
+
+// Check if an mzXML scan was acquired in profile mode. Scans without the
+// centroided attribute are assumed to be centroided already.
+bool is_profile_mzxml_scan(const XmlReader::TagView &tag) {
+    return tag.attribute("centroided") == "0";
+}
+
+// Read the attributes of an mzXML scan tag into the given scan, including the
+// number of m/z-intensity pairs it contains. Returns false if the scan is not
+// selected by the filters or the retention time range. past_max_rt is set if
+// the retention time of the scan is past max_rt.
+bool parse_mzxml_scan_tag(const XmlReader::TagView &tag, double min_rt,
+                          double max_rt,
+                          const std::vector<XmlReader::ScanFilter> &filters,
+                          RawData::Scan &scan, size_t &num_points,
+                          bool &past_max_rt) {
     scan.precursor_information.scan_number = 0;
-    auto scan_attributes = tag.value().attributes;
+    bool selected = true;
 
     // Find scan number.
-    if (scan_attributes.find("num") == scan_attributes.end()) {
-        return {};
+    if (!tag.has_attribute("num")) {
+        selected = false;
     }
-    scan.scan_number = std::stoi(scan_attributes["num"]);
+    scan.scan_number = to_int(tag.attribute("num"));
 
     // Find polarity.
-    if (scan_attributes.find("polarity") != scan_attributes.end()) {
-        if (scan_attributes["polarity"] == "+") {
+    if (tag.has_attribute("polarity")) {
+        auto scan_polarity = tag.attribute("polarity");
+        if (scan_polarity == "+") {
             scan.polarity = Polarity::POSITIVE;
-        } else if (scan_attributes["polarity"] == "-") {
+        } else if (scan_polarity == "-") {
             scan.polarity = Polarity::NEGATIVE;
         } else {
             scan.polarity = Polarity::BOTH;
         }
-        if (polarity != Polarity::BOTH && scan.polarity != polarity) {
-            return {};
-        }
     }
 
     // Find MS level.
-    if (scan_attributes.find("msLevel") == scan_attributes.end()) {
-        return {};
-    }
-    size_t scan_ms_level = std::stoi(scan_attributes["msLevel"]);
-    scan.ms_level = scan_ms_level;
-
-    // Fill up the rest of the scan information.
-    if (scan_ms_level == ms_level) {
-        // Find the number of m/z-intensity pairs in the scan.
-        if (scan_attributes.find("peaksCount") == scan_attributes.end()) {
-            return {};
-        }
-        size_t num_points = std::stoi(scan_attributes["peaksCount"]);
-
-        // Extract the retention time.
-        if (scan_attributes.find("retentionTime") == scan_attributes.end()) {
-            // NOTE(alex): On the spec, the retention time attribute is
-            // optional, however, we do require it.
-            return {};
-        }
-
-        // The time is in xs:duration units. Here we are only accounting
-        // for the data as stored in seconds, minutes and hours. It is
-        // unlikely that we are going to need to parse the days, months
-        // and years. For more information about the format see:
-        //    https://www.ibm.com/support/knowledgecenter/en/ssw_ibm_i_72/rzasp/rzasp_xsduration.htm
-        std::regex rt_regex(
-            R"(P.*T(?:([[:digit:]]+)H)?(?:([[:digit:]]+)M)?(?:([[:digit:]]+\.?[[:digit:]]*)S))");
-        std::smatch matches;
-        if (!std::regex_search(scan_attributes["retentionTime"], matches,
-                               rt_regex) ||
-            matches.size() != 4) {
-            return {};
-        }
-        double retention_time = std::stod(matches[3]);
-        if (matches[2] != "") {
-            retention_time += std::stod(matches[2]) * 60;
-        }
-        if (matches[1] != "") {
-            retention_time += std::stod(matches[1]) * 60 * 60;
-        }
-        scan.retention_time = retention_time;
-
-        // Check if we are on the desired region as defined by
-        if (retention_time < min_rt) {
-            return {};
-        }
-        // Assuming linearity of the retention time on the mzXML file.
-        // TODO: We should stop searching for the next scan, since we are out of
-        // bounds.
-        if (retention_time > max_rt) {
-            return {};
-        }
-
-        // Fetch the next tag. We are interested in the contents of this scan
-        // tag: precursorMz and peaks.
-        auto next_tag = XmlReader::read_tag(stream);
-        while (stream.good() && !stream.eof()) {
-            if (next_tag.value().name == "scan" && next_tag.value().closed) {
-                break;
-            }
-            // We are not interested in subscans here. Continue until we find
-            // the corresponding output.
-            // FIXME: This only works with ONE subscan! ms1->ms2, if we are in
-            // ms1 and our ms2 contain subscans, it will FAIL. We need to
-            // recursively check child scans.
-            if (next_tag.value().name == "scan" && !next_tag.value().closed) {
-                next_tag = XmlReader::read_tag(stream);
-                while (stream.good() && !stream.eof()) {
-                    if (next_tag.value().name == "scan" &&
-                        next_tag.value().closed) {
-                        break;
-                    }
-                    next_tag = XmlReader::read_tag(stream);
-                }
-            }
-            if (next_tag.value().name == "peaks") {
-                auto peak_attributes = next_tag.value().attributes;
+    scan.ms_level = to_int(tag.attribute("msLevel"));
+    if (scan.ms_level == 0 ||
+        !any_filter_matches(filters, scan.ms_level, scan.polarity)) {
+        selected = false;
+    }
 
-                // Extract the precision from the peaks tag.
-                if (peak_attributes.find("precision") ==
-                    peak_attributes.end()) {
-                    return {};
-                }
-                int precision = std::stoi(peak_attributes["precision"]);
-
-                // Extract the byteOrder from the peaks tag. This determines
-                // the endianness in which the data was stored. `network` ==
-                // `big_endian`.
-                if (peak_attributes.find("byteOrder") ==
-                    peak_attributes.end()) {
-                    return {};
-                }
-                auto byte_order = peak_attributes["byteOrder"];
-                auto little_endian = byte_order != "network";
-
-                // Extract the contentType/pairOrder from the peaks tag and
-                // exit if it is not `m/z-int`. In older versions of
-                // ProteoWizard, the conversion was not validated and the
-                // tag was incorrect. Here we are supporting both versions
-                // for compatibility but we are not trying to be exhaustive.
-                auto content_type_found = peak_attributes.find("contentType") !=
-                                          peak_attributes.end();
-                auto pair_order_found =
-                    peak_attributes.find("pairOrder") != peak_attributes.end();
-                if (!content_type_found && !pair_order_found) {
-                    return {};
-                }
-                std::string pair_order;
-                if (content_type_found) {
-                    pair_order = peak_attributes["contentType"];
-                } else {
-                    pair_order = peak_attributes["pairOrder"];
-                }
+    // Find the number of m/z-intensity pairs in the scan.
+    if (!tag.has_attribute("peaksCount")) {
+        selected = false;
+    }
+    num_points = to_int(tag.attribute("peaksCount"));
+
+    // Extract the retention time. NOTE(alex): On the spec, the retention time
+    // attribute is optional, however, we do require it.
+    past_max_rt = false;
+    auto retention_time = parse_retention_time(tag.attribute("retentionTime"));
+    if (retention_time) {
+        scan.retention_time = retention_time.value();
+        // Assuming linearity of the retention time on the mzXML file, we can
+        // stop reading once we are past max_rt.
+        past_max_rt = scan.retention_time > max_rt;
+        if (scan.retention_time < min_rt || past_max_rt) {
+            selected = false;
+        }
+    } else {
+        selected = false;
+    }
+    return selected;
+}
 
-                // Find whether or not the data is compressed.
-                bool compressed = peak_attributes["compressionType"] == "zlib";
+// Parse the mzXML scan whose opening tag has just been read by the tokenizer,
+// including any nested scans, which take this scan as their precursor. The
+// scans selected by the filters are appended to the given vector, parents
+// before their children. Returns false if this scan is past max_rt, in which
+// case the file doesn't need to be read any further.
+bool parse_mzxml_scan(XmlReader::Tokenizer &tokenizer,
+                      const XmlReader::TagView &tag, double min_mz,
+                      double max_mz, double min_rt, double max_rt,
+                      const std::vector<XmlReader::ScanFilter> &filters,
+                      uint64_t precursor_id,
+                      std::vector<RawData::Scan> &scans) {
+    RawData::Scan scan = {};
+    size_t num_points = 0;
+    bool past_max_rt = false;
+    bool selected = parse_mzxml_scan_tag(tag, min_rt, max_rt, filters, scan,
+                                         num_points, past_max_rt);
+
+    // Go through the contents of this scan tag. We are interested in the
+    // precursorMz, the peaks and any nested scans. The scans that are not
+    // selected still need to be traversed to find their children.
+    size_t position = scans.size();
+    auto next_tag = tokenizer.read_tag();
+    while (next_tag) {
+        if (next_tag.value().name == "scan" && next_tag.value().closed) {
+            break;
+        }
+        if (next_tag.value().name == "scan" && !next_tag.value().closed) {
+            parse_mzxml_scan(tokenizer, next_tag.value(), min_mz, max_mz,
+                             min_rt, max_rt, filters, scan.scan_number, scans);
+        }
+        if (selected && next_tag.value().name == "peaks" &&
+            !next_tag.value().closed &&
+            any_filter_needs_points(filters, scan.ms_level, scan.polarity)) {
+            selected = parse_mzxml_peaks(tokenizer, next_tag.value(),
+                                         num_points, min_mz, max_mz, scan);
+        }
+        if (selected && next_tag.value().name == "precursorMz" &&
+            !next_tag.value().closed) {
+            selected = parse_mzxml_precursor(tokenizer, next_tag.value(), scan);
+        }
+        next_tag = tokenizer.read_tag();
+    }
 
-                // Extract the peaks from the data.
-                auto data = XmlReader::read_data(stream);
-                if (!data) {
-                    return {};
-                }
+    if (precursor_id != 0) {
+        scan.precursor_information.scan_number = precursor_id;
+    }
+    if (selected) {
+        centroid_if_requested(filters, is_profile_mzxml_scan(tag), scan);
+    }
+    if (selected && keep_scan(filters, scan)) {
+        scans.insert(scans.begin() + position, std::move(scan));
+    }
+    return !past_max_rt;
+}
 
-                // Decode base64-encoded string to raw data.
-                std::vector<uint8_t> raw_data;
-                Base64::decode_base64(data.value(), raw_data);
+// Parse all the scans contained in a top level mzXML scan element, including
+// any nested scans. Scans that don't match the given filters are not
+// returned. Returns std::nullopt if the element is past max_rt, in which case
+// the file doesn't need to be read any further.
+std::optional<std::vector<RawData::Scan>> parse_mzxml_element(
+    std::string_view element, double min_mz, double max_mz, double min_rt,
+    double max_rt, const std::vector<XmlReader::ScanFilter> &filters) {
+    std::vector<RawData::Scan> scans;
+    XmlReader::Tokenizer tokenizer(element);
+    auto tag = tokenizer.read_tag();
+    if (!tag || tag.value().name != "scan" || tag.value().closed) {
+        return scans;
+    }
+    if (!parse_mzxml_scan(tokenizer, tag.value(), min_mz, max_mz, min_rt,
+                          max_rt, filters, 0, scans)) {
+        return std::nullopt;
+    }
+    return scans;
+}
 
-                if (compressed) {
-                    // Calculate amount of bytes in decompressed data.
-                    size_t decompressed_len = num_points * 2 * (precision / 8);
-                    std::vector<uint8_t> decompressed_data;
+std::optional<RawData::RawData> XmlReader::read_mzxml(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level) {
+    auto raw_data = init_raw_data(instrument_type, resolution_ms1,
+                                  resolution_msn, reference_mz);
+    XmlReader::ElementReader reader(stream, "scan");
+    while (auto element = reader.next()) {
+        auto scans =
+            parse_mzxml_element(element.value(), min_mz, max_mz, min_rt,
+                                max_rt, {{ms_level, polarity}});
+        if (!scans) {
+            break;
+        }
+        for (auto &scan : scans.value()) {
+            update_raw_data(raw_data, scan);
+        }
+    }
+    return raw_data;
+}
 
-                    // Decompress data.
-                    int status = Compression::inflate(
-                        raw_data, decompressed_data, decompressed_len);
+// Parse the contents of an mzML spectrum tag that has just been read by the
+// tokenizer. If the spectrum doesn't match the given filters, the returned scan
+// will contain no points, and parsing stops as soon as this is known, leaving
+// the tokenizer inside the spectrum. If the binary data can't be decoded,
+// std::nullopt is returned instead.
+std::optional<RawData::Scan> parse_mzml_spectrum(
+    XmlReader::Tokenizer &tokenizer, const XmlReader::TagView &spectrum_tag,
+    double min_mz, double max_mz, double min_rt, double max_rt,
+    const std::vector<XmlReader::ScanFilter> &filters) {
+    RawData::Scan scan = {};
+    // Parse the contents and metadata of this spectrum.
+    scan.precursor_information.scan_number = 0;
 
-                    // Check status after decompression.
-                    if (status != Z_OK) {
-                        return {};
-                    }
+    // NOTE: In the mzML spec, the native scan number is described on
+    // the "id" attribute, and can contain more information than
+    // required for just an integer identifer. Moreover, it looks like,
+    // at least for Orbitrap data, the scan numbers are non-zero
+    // consecutive integers. For the sake of time, I'm just assuming
+    // here that this assumption is the same for all formats, but should
+    // probably find a more robust way of doing this.
+    scan.scan_number = to_int(spectrum_tag.attribute("index")) + 1;
+    // The decoded arrays are reused for all spectra parsed by the same
+    // thread.
+    thread_local std::vector<bool> filter_points;
+    thread_local std::vector<double> mzs;
+    thread_local std::vector<double> intensities;
+    filter_points.clear();
+    mzs.clear();
+    intensities.clear();
+    bool profile = false;
+    while (auto tag = tokenizer.read_tag()) {
+        if (tag.value().name == "spectrum" && tag.value().closed) {
+            break;
+        }
 
-                    raw_data = decompressed_data;
-                }
+        if (tag.value().name == "cvParam") {
+            auto accession = tag.value().attribute("accession");
 
-                // Interpret raw data.
-                double intensity_sum = 0;
-                double max_intensity = 0;
+            // This scan is ms_level 1
+            if (accession == "MS:1000579") {
+                scan.ms_level = 1;
+            }
 
-                scan.mz.resize(num_points);
-                scan.intensity.resize(num_points);
-                size_t scan_size = 0;
+            // MS level a multi-level MSn experiment.
+            if (accession == "MS:1000511") {
+                size_t scan_ms_level = to_int(tag.value().attribute("value"));
+                scan.ms_level = scan_ms_level;
+            }
 
-                size_t offset = 0;
-                for (size_t i = 0; i < num_points; ++i) {
-                    double mz = 0;
-                    double intensity = 0;
-                    // Interpret mz and intensity values.
-                    if (precision == 32) {
-                        mz = Base64::interpret_float(raw_data, offset,
-                                                     little_endian);
-                        offset += 4;
-                        intensity = Base64::interpret_float(raw_data, offset,
-                                                            little_endian);
-                        offset += 4;
-                    } else if (precision == 64) {
-                        mz = Base64::interpret_double(raw_data, offset,
-                                                      little_endian);
-                        offset += 8;
-                        intensity = Base64::interpret_double(raw_data, offset,
-                                                             little_endian);
-                        offset += 8;
-                    }
+            // Profile spectrum.
+            if (accession == "MS:1000128") {
+                profile = true;
+            }
 
-                    // We don't need to extract the peaks when we are not
-                    // inside the mz bounds or contain no value.
-                    if (mz < min_mz || mz > max_mz || intensity == 0) {
-                        continue;
-                    }
+            // Polarity.
+            if (accession == "MS:1000130") {
+                scan.polarity = Polarity::POSITIVE;
+            }
+            if (accession == "MS:1000129") {
+                scan.polarity = Polarity::NEGATIVE;
+            }
 
-                    if (intensity > max_intensity) {
-                        max_intensity = intensity;
-                    }
-                    intensity_sum += intensity;
+            // Stop as soon as the MS level or polarity is not selected by
+            // any of the filters.
+            if (!any_filter_matches(filters, scan.ms_level, scan.polarity)) {
+                return rejected_scan(scan);
+            }
 
-                    scan.mz[scan_size] = mz;
-                    scan.intensity[scan_size] = intensity;
-                    ++scan_size;
+            // Retention time.
+            if (accession == "MS:1000016") {
+                scan.retention_time = to_double(tag.value().attribute("value"));
+                // Retention time is store in seconds. Make sure it is
+                // the right unit. If the unit accession was
+                // "UO:0000010" it would be in seconds, so no action is
+                // required.
+                if (tag.value().attribute("unitAccession") == "UO:0000031") {
+                    scan.retention_time *= 60.0;
                 }
-                // Resize to number of elements that are actually included.
-                scan.mz.resize(scan_size);
-                scan.intensity.resize(scan_size);
-
-                // Shrink capacity
-                scan.mz.shrink_to_fit();
-                scan.intensity.shrink_to_fit();
+                if (scan.retention_time < min_rt ||
+                    scan.retention_time > max_rt) {
+                    return rejected_scan(scan);
+                }
+            }
+        }
 
-                scan.num_points = scan.mz.size();
-                scan.max_intensity = max_intensity;
-                scan.total_intensity = intensity_sum;
+        if (tag.value().name == "precursor") {
+            // Find scan number.
+            auto spectrum_ref = tag.value().attribute("spectrumRef");
+            size_t scan_idx = spectrum_ref.find("scan=");
+            if (scan_idx != std::string_view::npos) {
+                scan.precursor_information.scan_number =
+                    to_int(spectrum_ref.substr(scan_idx + 5));
             }
-            if (next_tag.value().name == "precursorMz") {
-                auto precursor_attributes = next_tag.value().attributes;
-                if (precursor_attributes.find("precursorIntensity") !=
-                    precursor_attributes.end()) {
-                    scan.precursor_information.intensity =
-                        std::stod(precursor_attributes["precursorIntensity"]);
+
+            scan.precursor_information.charge = 0;
+            scan.precursor_information.mz = 0.0;
+            scan.precursor_information.window_wideness = 0.0;
+            scan.precursor_information.intensity = 0.0;
+            scan.precursor_information.activation_method =
+                ActivationMethod::UNKNOWN;
+            while (auto tag = tokenizer.read_tag()) {
+                if (tag.value().name == "precursor" && tag.value().closed) {
+                    break;
                 }
+                if (tag.value().name == "cvParam") {
+                    auto accession = tag.value().attribute("accession");
+                    auto value = tag.value().attribute("value");
+                    // Isolation window.
+                    if (accession == "MS:1000827") {
+                        scan.precursor_information.mz = to_double(value);
+                    }
+                    if (accession == "MS:1000828") {
+                        scan.precursor_information.window_wideness +=
+                            to_double(value);
+                    }
+                    if (accession == "MS:1000829") {
+                        scan.precursor_information.window_wideness +=
+                            to_double(value);
+                    }
+                    // Charge state.
+                    if (accession == "MS:1000041") {
+                        scan.precursor_information.charge = to_int(value);
+                    }
+                    if (accession == "MS:1000042") {
+                        scan.precursor_information.intensity =
+                            to_double(value);
+                    }
+                    // Activation method.
+                    if (accession == "MS:1000422") {
+                        scan.precursor_information.activation_method =
+                            ActivationMethod::HCD;
+                    }
+                }
+            }
+        }
 
-                if (precursor_attributes.find("windowWideness") !=
-                    precursor_attributes.end()) {
-                    scan.precursor_information.window_wideness =
-                        std::stod(precursor_attributes["windowWideness"]);
+        if (tag.value().name == "binaryDataArray") {
+            // precision can be: 64 or 32 (bits).
+            int precision = 0;
+            // Uncompressed: false, Zlib compression: true.
+            bool compressed = false;
+            // MS-Numpress compression, applied before zlib if both are used.
+            auto numpress = Numpress::NONE;
+            // mz: 0, intensity: 1
+            int type = -1;
+            std::optional<std::string_view> data;
+            while (auto tag = tokenizer.read_tag()) {
+                if (tag.value().name == "binaryDataArray" &&
+                    tag.value().closed) {
+                    break;
+                }
+                if (tag.value().name == "cvParam") {
+                    auto accession = tag.value().attribute("accession");
+                    // Precision.
+                    if (accession == "MS:1000523") {
+                        precision = 64;
+                    }
+                    if (accession == "MS:1000521") {
+                        precision = 32;
+                    }
+                    // Compression.
+                    if (accession == "MS:1000574") {
+                        compressed = true;
+                    }
+                    if (accession == "MS:1002312" ||
+                        accession == "MS:1002746") {
+                        numpress = Numpress::LINEAR;
+                    }
+                    if (accession == "MS:1002313" ||
+                        accession == "MS:1002747") {
+                        numpress = Numpress::PIC;
+                    }
+                    if (accession == "MS:1002314" ||
+                        accession == "MS:1002748") {
+                        numpress = Numpress::SLOF;
+                    }
+                    if (accession == "MS:1002746" ||
+                        accession == "MS:1002747" ||
+                        accession == "MS:1002748") {
+                        compressed = true;
+                    }
+                    // Type of vector.
+                    if (accession == "MS:1000514") {
+                        type = 0;
+                    }
+                    if (accession == "MS:1000515") {
+                        type = 1;
+                    }
                 }
+                if (tag.value().name == "binary" && !tag.value().closed) {
+                    data = tokenizer.read_data();
+                }
+            }
+            // Arrays other than mz and intensity are not needed, and neither
+            // are the arrays of scans that only keep their headers.
+            if (data && (type == 0 || type == 1) &&
+                any_filter_needs_points(filters, scan.ms_level,
+                                        scan.polarity)) {
+                // Decode the base64-encoded data and decompress it if
+                // necessary. The scratch buffers are reused for all spectra
+                // parsed by the same thread.
+                thread_local std::vector<uint8_t> decoded_data;
+                thread_local std::vector<uint8_t> decompressed_data;
+                Base64::decode_base64(data.value().data(), data.value().size(),
+                                      decoded_data);
+                const std::vector<uint8_t> *binary_data = &decoded_data;
+                if (compressed) {
+                    // Decompress data, set decompressed length to 0
+                    // (unknown).
+                    int status = Compression::inflate(
+                        decoded_data.data(), decoded_data.size(),
+                        decompressed_data, 0);
 
-                if (precursor_attributes.find("precursorCharge") !=
-                    precursor_attributes.end()) {
-                    scan.precursor_information.charge =
-                        std::stoi(precursor_attributes["precursorCharge"]);
+                    // Check status after decompression.
+                    if (status != Z_OK) {
+                        return std::nullopt;
+                    }
+                    binary_data = &decompressed_data;
                 }
 
-                if (precursor_attributes.find("activationMethod") !=
-                    precursor_attributes.end()) {
-                    if (precursor_attributes["activationMethod"] == "CID") {
-                        scan.precursor_information.activation_method =
-                            ActivationMethod::CID;
-                    } else if (precursor_attributes["activationMethod"] ==
-                               "HCD") {
-                        scan.precursor_information.activation_method =
-                            ActivationMethod::HCD;
-                    } else {
-                        scan.precursor_information.activation_method =
-                            ActivationMethod::UNKNOWN;
+                // The values are decoded directly into the mz or intensity
+                // array. Arrays compressed with MS-Numpress are decoded
+                // into doubles, independently of the declared precision.
+                auto &values = type == 0 ? mzs : intensities;
+                if (numpress != Numpress::NONE) {
+                    if (Numpress::decode(numpress, *binary_data, values) !=
+                        Numpress::OK) {
+                        return std::nullopt;
                     }
+                } else if (precision == 32) {
+                    values.resize(binary_data->size() / 4);
+                    Base64::interpret_floats(binary_data->data(),
+                                             values.size(), true,
+                                             values.data());
+                } else if (precision == 64) {
+                    values.resize(binary_data->size() / 8);
+                    Base64::interpret_doubles(binary_data->data(),
+                                              values.size(), true,
+                                              values.data());
                 } else {
-                    scan.precursor_information.activation_method =
-                        ActivationMethod::UNKNOWN;
+                    values.clear();
                 }
 
-                auto data = XmlReader::read_data(stream);
-                if (!data) {
-                    return {};
+                if (filter_points.empty()) {
+                    filter_points.assign(values.size(), false);
                 }
-                scan.precursor_information.mz = std::stod(data.value());
-
-                if (precursor_attributes.find("precursorScanNum") !=
-                    precursor_attributes.end()) {
-                    scan.precursor_information.scan_number =
-                        std::stoi(precursor_attributes["precursorScanNum"]);
+                size_t num_points =
+                    std::min(values.size(), filter_points.size());
+                for (size_t i = 0; i < num_points; ++i) {
+                    if (type == 0 &&
+                        (values[i] < min_mz || values[i] > max_mz)) {
+                        filter_points[i] = true;
+                    }
+                    if (type == 1 && values[i] == 0.0) {
+                        filter_points[i] = true;
+                    }
                 }
             }
-            next_tag = XmlReader::read_tag(stream);
         }
-        return scan;
     }
 
-    // If we are interested in a scan with a mz_level != 1, we need to find the
-    // precursor to which it belongs.
-    if (scan_ms_level == ms_level - 1) {
-        precursor_id = scan.scan_number;
-        auto next_tag = XmlReader::read_tag(stream);
-        while (stream.good() && next_tag) {
-            if (next_tag.value().name == "scan" && next_tag.value().closed) {
-                break;
-            }
-            if (next_tag.value().name == "scan" && !next_tag.value().closed) {
-                auto child_scan =
-                    parse_mzxml_scan(stream, next_tag, min_mz, max_mz, min_rt,
-                                     max_rt, polarity, ms_level);
-                child_scan.precursor_information.scan_number = precursor_id;
-                if (child_scan.precursor_information.scan_number !=
-                        precursor_id &&
-                    child_scan.precursor_information.scan_number == 0) {
-                    child_scan.precursor_information.scan_number = precursor_id;
-                }
-                return child_scan;
-            }
-            next_tag = XmlReader::read_tag(stream);
+    // Filter mzs not in range and intensity == 0 scans and calculate
+    // max_intensity and total_intensity.
+    size_t num_points =
+        std::min({filter_points.size(), mzs.size(), intensities.size()});
+    size_t scan_size = std::count(filter_points.begin(),
+                                  filter_points.begin() + num_points, false);
+    scan.mz.reserve(scan_size);
+    scan.intensity.reserve(scan_size);
+    double intensity_sum = 0;
+    double max_intensity = 0;
+    for (size_t i = 0; i < num_points; ++i) {
+        if (filter_points[i]) {
+            continue;
+        }
+        scan.mz.push_back(mzs[i]);
+        scan.intensity.push_back(intensities[i]);
+        if (intensities[i] > max_intensity) {
+            max_intensity = intensities[i];
         }
+        intensity_sum += intensities[i];
     }
+    scan.num_points = scan.mz.size();
+    scan.max_intensity = max_intensity;
+    scan.total_intensity = intensity_sum;
+
+    // TODO: Assert that mz.size() == intenstiy.size()
+    if (scan.ms_level == 0 ||
+        !any_filter_matches(filters, scan.ms_level, scan.polarity) ||
+        scan.retention_time < min_rt || scan.retention_time > max_rt) {
+        return rejected_scan(scan);
+    }
+    centroid_if_requested(filters, profile, scan);
+    return scan;
+}
 
-    return {};
+// Parse an mzML spectrum element. Returns std::nullopt if the file doesn't
+// need to be read any further, either because the binary data of the spectrum
+// could not be decoded or because the spectrum is past max_rt.
+std::optional<RawData::Scan> parse_mzml_element(
+    std::string_view element, double min_mz, double max_mz, double min_rt,
+    double max_rt, const std::vector<XmlReader::ScanFilter> &filters) {
+    XmlReader::Tokenizer tokenizer(element);
+    auto tag = tokenizer.read_tag();
+    if (!tag || tag.value().name != "spectrum" || tag.value().closed) {
+        return RawData::Scan{};
+    }
+    auto scan = parse_mzml_spectrum(tokenizer, tag.value(), min_mz, max_mz,
+                                    min_rt, max_rt, filters);
+    if (scan && scan.value().retention_time > max_rt) {
+        return std::nullopt;
+    }
+    return scan;
 }
 
-std::optional<RawData::RawData> XmlReader::read_mzxml(
+std::optional<RawData::RawData> XmlReader::read_mzml(
     std::istream &stream, double min_mz, double max_mz, double min_rt,
     double max_rt, Instrument::Type instrument_type, double resolution_ms1,
     double resolution_msn, double reference_mz, Polarity::Type polarity,
     size_t ms_level) {
-    RawData::RawData raw_data = {};
-    raw_data.instrument_type = instrument_type;
-    raw_data.min_mz = std::numeric_limits<double>::infinity();
-    raw_data.max_mz = -std::numeric_limits<double>::infinity();
-    raw_data.min_rt = std::numeric_limits<double>::infinity();
-    raw_data.max_rt = -std::numeric_limits<double>::infinity();
-    raw_data.resolution_ms1 = resolution_ms1;
-    raw_data.resolution_msn = resolution_msn;
-    raw_data.reference_mz = reference_mz;
-    raw_data.fwhm_rt = 0;  // TODO(alex): Should this be passed as well?
-    raw_data.scans = {};
-    raw_data.retention_times = {};
-    // TODO(alex): Can we automatically detect the instrument type and set
-    // resolution from the header?
-    while (stream.good() && !stream.eof()) {
-        auto tag = XmlReader::read_tag(stream);
-        if (!tag) {
+    auto raw_data = init_raw_data(instrument_type, resolution_ms1,
+                                  resolution_msn, reference_mz);
+    XmlReader::ElementReader reader(stream, "spectrum");
+    while (auto element = reader.next()) {
+        auto scan = parse_mzml_element(element.value(), min_mz, max_mz, min_rt,
+                                       max_rt, {{ms_level, polarity}});
+        if (!scan) {
+            return raw_data;
+        }
+        update_raw_data(raw_data, scan.value());
+    }
+
+    return raw_data;
+}
+
+XmlReader::ElementReader::ElementReader(std::istream &stream,
+                                        std::string const &name,
+                                        size_t chunk_size)
+    : stream(stream),
+      open_tag("<" + name),
+      close_tag("</" + name),
+      chunk_size(chunk_size),
+      buffer(),
+      view(),
+      position(0),
+      memory_backed(false) {
+    // If the stream is already in memory there is no need to copy it.
+    auto memory_buffer =
+        dynamic_cast<MemoryMap::MemoryStreambuf *>(stream.rdbuf());
+    if (memory_buffer) {
+        view = memory_buffer->unread();
+        memory_backed = true;
+    }
+}
+
+bool XmlReader::ElementReader::fill(size_t n) {
+    if (memory_backed || !stream.good()) {
+        return false;
+    }
+    buffer.erase(0, n);
+    size_t old_size = buffer.size();
+    buffer.resize(old_size + chunk_size);
+    stream.read(&buffer[old_size], chunk_size);
+    buffer.resize(old_size + stream.gcount());
+    view = buffer;
+    return stream.gcount() > 0;
+}
+
+std::optional<std::string_view> XmlReader::ElementReader::next() {
+    // Find the beginning of the next element.
+    size_t begin = 0;
+    while (true) {
+        begin = view.find(open_tag, position);
+        if (begin == std::string_view::npos) {
+            // Keep enough data to match a tag that was split between chunks.
+            size_t n = view.size() > open_tag.size()
+                           ? view.size() - open_tag.size()
+                           : 0;
+            n = std::max(n, position);
+            position = 0;
+            if (!fill(n)) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        // We need at least one more character to check if the name matches.
+        if (begin + open_tag.size() >= view.size()) {
+            position = 0;
+            if (!fill(begin)) {
+                return std::nullopt;
+            }
             continue;
         }
-        auto atts = tag.value().attributes;
+        if (tag_name_matches(view.substr(begin), open_tag)) {
+            break;
+        }
+        position = begin + 1;
+    }
 
-        if (tag.value().name == "msRun" && tag.value().closed) {
+    // Find the end of the element, taking into account nested elements with
+    // the same name. Instead of visiting every tag inside the element we only
+    // search for the opening and closing tags of this name, which skips the
+    // contents with a fast character search. This matters most for elements
+    // that are filtered out, since these are not tokenized at all.
+    size_t depth = 0;
+    size_t cursor = begin;
+    while (true) {
+        size_t tag_begin = view.find(close_tag, cursor);
+        // Nested elements can only start before the next closing tag.
+        size_t nested_begin = view.substr(0, tag_begin).find(open_tag, cursor);
+        tag_begin = std::min(tag_begin, nested_begin);
+        size_t tag_end = tag_begin == std::string_view::npos
+                             ? std::string_view::npos
+                             : view.find('>', tag_begin);
+        if (tag_end == std::string_view::npos) {
+            if (tag_begin == std::string_view::npos) {
+                // Keep enough data to match a tag that was split between
+                // chunks.
+                size_t n = view.size() > close_tag.size()
+                               ? view.size() - close_tag.size()
+                               : 0;
+                cursor = std::max(cursor, n);
+            } else {
+                cursor = tag_begin;
+            }
+            cursor -= begin;
+            if (!fill(begin)) {
+                // Unterminated element.
+                return std::nullopt;
+            }
+            begin = 0;
+            continue;
+        }
+        auto tag = view.substr(tag_begin, tag_end - tag_begin + 1);
+        cursor = tag_end + 1;
+        if (tag_name_matches(tag, close_tag)) {
+            --depth;
+        } else if (tag_name_matches(tag, open_tag) &&
+                   tag[tag.size() - 2] != '/') {
+            ++depth;
+        }
+        if (depth == 0) {
             break;
         }
-        if (tag.value().name == "scan" && !tag.value().closed) {
-            auto scan = parse_mzxml_scan(stream, tag, min_mz, max_mz, min_rt,
-                                         max_rt, polarity, ms_level);
-            if (scan.num_points != 0) {
-                raw_data.scans.push_back(scan);
-                raw_data.retention_times.push_back(scan.retention_time);
-                if (scan.retention_time < raw_data.min_rt) {
-                    raw_data.min_rt = scan.retention_time;
-                }
-                if (scan.retention_time > raw_data.max_rt) {
-                    raw_data.max_rt = scan.retention_time;
+    }
+    position = cursor;
+    return view.substr(begin, cursor - begin);
+}
+
+// Parse the elements extracted by the ElementReader on a pool of worker
+// threads while the reader keeps going through the stream. Each element is
+// decoded into zero or more scans by parse_element, which returns std::nullopt
+// if the element could not be decoded or if there is no need to read any
+// further. The scans are returned in the same order as the elements appear in
+// the stream, stopping at the first element for which std::nullopt was
+// returned.
+template <typename ParseElement>
+std::vector<RawData::Scan> parse_elements_parallel(
+    XmlReader::ElementReader &reader, ParseElement parse_element,
+    size_t max_threads) {
+    // The number of threads is set to the maximum possible concurrency.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    // Limit the number of elements waiting to be decoded, so that we don't
+    // keep the whole file in memory if the workers can't keep up.
+    const size_t max_queued = num_threads * 16;
+    const size_t no_failure = std::numeric_limits<size_t>::max();
+
+    std::mutex mutex;
+    std::condition_variable queue_not_empty;
+    std::condition_variable queue_not_full;
+    // Elements are copied into the queue unless they point to memory that
+    // stays valid while the reader advances.
+    struct QueuedElement {
+        size_t index;
+        std::string_view data;
+        std::string storage;
+    };
+    std::deque<QueuedElement> queue;
+    // The copies of the elements that have already been parsed are recycled,
+    // so that their memory is reused instead of being allocated and freed for
+    // every element.
+    std::vector<std::string> free_storage;
+    std::vector<std::optional<std::vector<RawData::Scan>>> results;
+    size_t first_failure = no_failure;
+    bool done = false;
+
+    std::vector<std::thread> threads(num_threads);
+    for (auto &thread : threads) {
+        thread = std::thread([&]() {
+            while (true) {
+                QueuedElement element;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    queue_not_empty.wait(
+                        lock, [&]() { return !queue.empty() || done; });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    element = std::move(queue.front());
+                    queue.pop_front();
+                    // Elements after the stopping point are discarded anyway.
+                    if (element.index > first_failure) {
+                        if (!reader.is_memory_backed()) {
+                            free_storage.push_back(std::move(element.storage));
+                        }
+                        lock.unlock();
+                        queue_not_full.notify_one();
+                        continue;
+                    }
                 }
-                if (scan.mz[0] < raw_data.min_mz) {
-                    raw_data.min_mz = scan.mz[0];
+                queue_not_full.notify_one();
+                auto scans = parse_element(reader.is_memory_backed()
+                                               ? element.data
+                                               : element.storage);
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!scans && element.index < first_failure) {
+                    first_failure = element.index;
                 }
-                if (scan.mz[scan.mz.size() - 1] > raw_data.max_mz) {
-                    raw_data.max_mz = scan.mz[scan.mz.size() - 1];
+                results[element.index] = std::move(scans);
+                if (!reader.is_memory_backed()) {
+                    free_storage.push_back(std::move(element.storage));
                 }
             }
+        });
+    }
+
+    // Hand over the elements to the workers in order.
+    for (size_t i = 0;; ++i) {
+        auto element = reader.next();
+        if (!element) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        queue_not_full.wait(lock,
+                            [&]() { return queue.size() < max_queued; });
+        if (first_failure != no_failure) {
+            break;
+        }
+        results.emplace_back();
+        if (reader.is_memory_backed()) {
+            queue.push_back({i, element.value(), {}});
+        } else {
+            std::string storage;
+            if (!free_storage.empty()) {
+                storage = std::move(free_storage.back());
+                free_storage.pop_back();
+            }
+            storage.assign(element.value());
+            queue.push_back({i, {}, std::move(storage)});
+        }
+        lock.unlock();
+        queue_not_empty.notify_one();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done = true;
+    }
+    queue_not_empty.notify_all();
+
+    // Wait for the threads to finish.
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Reassemble the scans in order.
+    std::vector<RawData::Scan> scans;
+    for (size_t i = 0; i < results.size() && i < first_failure; ++i) {
+        for (auto &scan : results[i].value()) {
+            scans.push_back(std::move(scan));
         }
     }
+    return scans;
+}
+
+std::optional<RawData::RawData> XmlReader::read_mzxml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads) {
+    auto raw_data = read_mzxml_parallel(
+        stream, min_mz, max_mz, min_rt, max_rt, instrument_type, resolution_ms1,
+        resolution_msn, reference_mz, {{ms_level, polarity}}, max_threads);
+    if (!raw_data) {
+        return std::nullopt;
+    }
+    return std::move(raw_data.value()[0]);
+}
+
+std::optional<std::vector<RawData::RawData>> XmlReader::read_mzxml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads) {
+    std::vector<RawData::RawData> raw_data(
+        filters.size(), init_raw_data(instrument_type, resolution_ms1,
+                                      resolution_msn, reference_mz));
+    auto parse_element = [&](std::string_view element)
+        -> std::optional<std::vector<RawData::Scan>> {
+        return parse_mzxml_element(element, min_mz, max_mz, min_rt, max_rt,
+                                   filters);
+    };
+    XmlReader::ElementReader reader(stream, "scan");
+    auto scans = parse_elements_parallel(reader, parse_element, max_threads);
+    for (auto &scan : scans) {
+        update_raw_data(raw_data, filters, scan);
+    }
     return raw_data;
 }
 
-std::optional<RawData::RawData> XmlReader::read_mzml(
+std::optional<RawData::RawData> XmlReader::read_mzml_parallel(
     std::istream &stream, double min_mz, double max_mz, double min_rt,
     double max_rt, Instrument::Type instrument_type, double resolution_ms1,
     double resolution_msn, double reference_mz, Polarity::Type polarity,
-    size_t ms_level) {
-    RawData::RawData raw_data = {};
-    raw_data.instrument_type = instrument_type;
-    raw_data.min_mz = std::numeric_limits<double>::infinity();
-    raw_data.max_mz = -std::numeric_limits<double>::infinity();
-    raw_data.min_rt = std::numeric_limits<double>::infinity();
-    raw_data.max_rt = -std::numeric_limits<double>::infinity();
-    raw_data.resolution_ms1 = resolution_ms1;
-    raw_data.resolution_msn = resolution_msn;
-    raw_data.reference_mz = reference_mz;
-    raw_data.fwhm_rt = 0;  // TODO(alex): Should this be passed as well?
-    raw_data.scans = {};
-    raw_data.retention_times = {};
-    // TODO(alex): Can we automatically detect the instrument type and set
-    // resolution from the header?
-    while (stream.good() && !stream.eof()) {
-        auto tag = XmlReader::read_tag(stream);
-        if (!tag) {
+    size_t ms_level, size_t max_threads) {
+    auto raw_data = read_mzml_parallel(
+        stream, min_mz, max_mz, min_rt, max_rt, instrument_type, resolution_ms1,
+        resolution_msn, reference_mz, {{ms_level, polarity}}, max_threads);
+    if (!raw_data) {
+        return std::nullopt;
+    }
+    return std::move(raw_data.value()[0]);
+}
+
+std::optional<std::vector<RawData::RawData>> XmlReader::read_mzml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads) {
+    std::vector<RawData::RawData> raw_data(
+        filters.size(), init_raw_data(instrument_type, resolution_ms1,
+                                      resolution_msn, reference_mz));
+    auto parse_element = [&](std::string_view element)
+        -> std::optional<std::vector<RawData::Scan>> {
+        auto scan = parse_mzml_element(element, min_mz, max_mz, min_rt, max_rt,
+                                       filters);
+        if (!scan) {
+            return std::nullopt;
+        }
+        if (!keep_scan(filters, scan.value())) {
+            return std::vector<RawData::Scan>{};
+        }
+        return std::vector<RawData::Scan>{std::move(scan.value())};
+    };
+    XmlReader::ElementReader reader(stream, "spectrum");
+    auto scans = parse_elements_parallel(reader, parse_element, max_threads);
+    for (auto &scan : scans) {
+        update_raw_data(raw_data, filters, scan);
+    }
+    return raw_data;
+}
+
+std::optional<XmlReader::MzmlIndex> XmlReader::read_mzml_index(
+    std::string_view data) {
+    // The <indexListOffset> is located at the end of the file, right after the
+    // <indexList>, so we only need to look at the last few bytes to find it.
+    const std::string_view offset_tag = "<indexListOffset>";
+    size_t tail_size = std::min(data.size(), static_cast<size_t>(4096));
+    auto tail = data.substr(data.size() - tail_size);
+    size_t tag_pos = tail.rfind(offset_tag);
+    if (tag_pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    std::string offset_str(tail.substr(tag_pos + offset_tag.size(), 32));
+    char *end_ptr = nullptr;
+    uint64_t index_list_offset =
+        std::strtoull(offset_str.c_str(), &end_ptr, 10);
+    if (end_ptr == offset_str.c_str() || index_list_offset >= data.size()) {
+        return std::nullopt;
+    }
+
+    // Read the spectrum offsets from the <indexList>. Other indexes, such as
+    // the chromatogram index, are ignored.
+    MzmlIndex index = {};
+    XmlReader::Tokenizer tokenizer(data.substr(index_list_offset));
+    bool spectrum_index = false;
+    while (auto tag = tokenizer.read_tag()) {
+        if (tag.value().name == "indexList" && tag.value().closed) {
+            break;
+        }
+        if (tag.value().name == "index") {
+            spectrum_index = !tag.value().closed &&
+                             tag.value().attribute("name") == "spectrum";
             continue;
         }
-        if (tag.value().name == "spectrumList" && tag.value().closed) {
+        if (!spectrum_index || tag.value().name != "offset" ||
+            tag.value().closed) {
+            continue;
+        }
+        auto offset_data = tokenizer.read_data();
+        if (!offset_data || offset_data.value().empty() ||
+            !is_digit(offset_data.value()[0])) {
+            return std::nullopt;
+        }
+        uint64_t offset = to_int(offset_data.value());
+        if (offset >= data.size()) {
+            return std::nullopt;
+        }
+        index.ids.emplace_back(tag.value().attribute("idRef"));
+        index.offsets.push_back(offset);
+    }
+    if (index.offsets.empty()) {
+        return std::nullopt;
+    }
+    return index;
+}
+
+// Read the retention time of the spectrum that starts at the given offset
+// without decoding any of its binary data.
+std::optional<double> read_mzml_retention_time(std::string_view data,
+                                               uint64_t offset) {
+    XmlReader::Tokenizer tokenizer(data.substr(offset));
+    while (auto tag = tokenizer.read_tag()) {
+        if (tag.value().name == "spectrum" && tag.value().closed) {
             break;
         }
-        RawData::Scan scan = {};
-        if (tag.value().name == "spectrum" && !tag.value().closed) {
-            // Parse the contents and metadata of this spectrum.
-            scan.precursor_information.scan_number = 0;
-            auto scan_attributes = tag.value().attributes;
-
-            // NOTE: In the mzML spec, the native scan number is described on
-            // the "id" attribute, and can contain more information than
-            // required for just an integer identifer. Moreover, it looks like,
-            // at least for Orbitrap data, the scan numbers are non-zero
-            // consecutive integers. For the sake of time, I'm just assuming
-            // here that this assumption is the same for all formats, but should
-            // probably find a more robust way of doing this.
-            scan.scan_number = std::stoi(scan_attributes["index"]) + 1;
-            std::vector<bool> filter_points;
-            std::vector<double> mzs;
-            std::vector<double> intensities;
-            while (stream.good() && !stream.eof()) {
-                auto tag = XmlReader::read_tag(stream);
-                if (!tag) {
-                    break;
-                }
-                if (tag.value().name == "spectrum" && tag.value().closed) {
-                    break;
-                }
+        if (tag.value().name == "cvParam" &&
+            tag.value().attribute("accession") == "MS:1000016") {
+            double retention_time = to_double(tag.value().attribute("value"));
+            if (tag.value().attribute("unitAccession") == "UO:0000031") {
+                retention_time *= 60.0;
+            }
+            return retention_time;
+        }
+    }
+    return std::nullopt;
+}
 
-                if (tag.value().name == "cvParam") {
-                    auto cv_attributes = tag.value().attributes;
-                    auto accession = cv_attributes["accession"];
+std::pair<size_t, size_t> XmlReader::find_mzml_spectra(std::string_view data,
+                                                       const MzmlIndex &index,
+                                                       double min_rt,
+                                                       double max_rt) {
+    // Binary search for the first spectrum where the retention time is not
+    // below the given threshold. Only the header of the visited spectra is
+    // parsed. Spectra with missing retention time are considered to be
+    // below the threshold.
+    auto bound = [&data, &index](double rt, bool inclusive) -> size_t {
+        size_t l = 0;
+        size_t r = index.offsets.size();
+        while (l < r) {
+            size_t mid = l + (r - l) / 2;
+            auto spectrum_rt =
+                read_mzml_retention_time(data, index.offsets[mid]);
+            bool below = !spectrum_rt || spectrum_rt.value() < rt ||
+                         (inclusive && spectrum_rt.value() == rt);
+            if (below) {
+                l = mid + 1;
+            } else {
+                r = mid;
+            }
+        }
+        return l;
+    };
+    size_t first = bound(min_rt, false);
+    size_t last = bound(max_rt, true);
+    if (last < first) {
+        last = first;
+    }
+    return {first, last};
+}
 
-                    // This scan is ms_level 1
-                    if (accession == "MS:1000579") {
-                        scan.ms_level = 1;
-                    }
+std::optional<RawData::RawData> XmlReader::read_mzml_indexed(
+    std::string_view data, const MzmlIndex &index, size_t first_spectrum,
+    size_t last_spectrum, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads) {
+    auto raw_data = read_mzml_indexed(
+        data, index, first_spectrum, last_spectrum, min_mz, max_mz, min_rt,
+        max_rt, instrument_type, resolution_ms1, resolution_msn, reference_mz,
+        {{ms_level, polarity}}, max_threads);
+    if (!raw_data) {
+        return std::nullopt;
+    }
+    return std::move(raw_data.value()[0]);
+}
 
-                    // MS level a multi-level MSn experiment.
-                    if (accession == "MS:1000511") {
-                        size_t scan_ms_level =
-                            std::stoi(cv_attributes["value"]);
-                        scan.ms_level = scan_ms_level;
-                    }
+std::optional<std::vector<RawData::RawData>> XmlReader::read_mzml_indexed(
+    std::string_view data, const MzmlIndex &index, size_t first_spectrum,
+    size_t last_spectrum, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads) {
+    std::vector<RawData::RawData> raw_data(
+        filters.size(), init_raw_data(instrument_type, resolution_ms1,
+                                      resolution_msn, reference_mz));
+    last_spectrum = std::min(last_spectrum, index.offsets.size());
+    if (first_spectrum >= last_spectrum) {
+        return raw_data;
+    }
 
-                    // Polarity.
-                    if (accession == "MS:1000130") {
-                        if (polarity != Polarity::BOTH &&
-                            Polarity::POSITIVE != polarity) {
-                            continue;
-                        }
-                        scan.polarity = Polarity::POSITIVE;
-                    }
-                    if (accession == "MS:1000129") {
-                        if (polarity != Polarity::BOTH &&
-                            Polarity::NEGATIVE != polarity) {
-                            continue;
-                        }
-                        scan.polarity = Polarity::NEGATIVE;
-                    }
+    // The number of threads is set to the maximum possible concurrency.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
 
-                    // Retention time.
-                    if (accession == "MS:1000016") {
-                        scan.retention_time = std::stod(cv_attributes["value"]);
-                        // Retention time is store in seconds. Make sure it is
-                        // the right unit. If the unit accession was
-                        // "UO:0000010" it would be in seconds, so no action is
-                        // required.
-                        if (cv_attributes["unitAccession"] == "UO:0000031") {
-                            scan.retention_time *= 60.0;
-                        }
-                        if (scan.retention_time < min_rt ||
-                            scan.retention_time > max_rt) {
-                            scan = {};
-                            break;
-                        }
-                    }
+    // Since we know where each spectrum begins, the workers can pick the next
+    // spectrum to decode directly from the index.
+    size_t num_spectra = last_spectrum - first_spectrum;
+    std::vector<std::optional<RawData::Scan>> scans(num_spectra);
+    std::atomic<size_t> next_spectrum(0);
+    std::atomic<bool> index_mismatch(false);
+    std::vector<std::thread> threads(num_threads);
+    for (auto &thread : threads) {
+        thread = std::thread([&]() {
+            for (size_t i = next_spectrum++; i < num_spectra;
+                 i = next_spectrum++) {
+                // Jump directly to the spectrum tag.
+                XmlReader::Tokenizer tokenizer(
+                    data.substr(index.offsets[first_spectrum + i]));
+                auto tag = tokenizer.read_tag();
+                if (!tag || tag.value().name != "spectrum" ||
+                    tag.value().closed) {
+                    index_mismatch = true;
+                    return;
                 }
+                scans[i] = parse_mzml_spectrum(tokenizer, tag.value(), min_mz,
+                                               max_mz, min_rt, max_rt, filters);
+            }
+        });
+    }
 
-                if (tag.value().name == "precursor") {
-                    auto precursor_attributes = tag.value().attributes;
-                    std::string spectrumRef =
-                        precursor_attributes["spectrumRef"];
-                    // Find scan number.
-                    size_t scanIdx = spectrumRef.find("scan=") + 5;
-                    scan.precursor_information.scan_number =
-                        std::stoull(spectrumRef.substr(scanIdx));
-
-                    scan.precursor_information.charge = 0;
-                    scan.precursor_information.mz = 0.0;
-                    scan.precursor_information.window_wideness = 0.0;
-                    scan.precursor_information.intensity = 0.0;
-                    scan.precursor_information.activation_method =
-                        ActivationMethod::UNKNOWN;
-                    while (stream.good() && !stream.eof()) {
-                        auto tag = XmlReader::read_tag(stream);
-                        if (!tag) {
-                            break;
-                        }
-                        if (tag.value().name == "precursor" &&
-                            tag.value().closed) {
-                            break;
-                        }
-                        if (tag.value().name == "cvParam") {
-                            auto cv_attributes = tag.value().attributes;
-                            auto accession = cv_attributes["accession"];
-                            // Isolation window.
-                            if (accession == "MS:1000827") {
-                                scan.precursor_information.mz =
-                                    std::stod(cv_attributes["value"]);
-                            }
-                            if (accession == "MS:1000828") {
-                                scan.precursor_information.window_wideness +=
-                                    std::stod(cv_attributes["value"]);
-                            }
-                            if (accession == "MS:1000829") {
-                                scan.precursor_information.window_wideness +=
-                                    std::stod(cv_attributes["value"]);
-                            }
-                            // Charge state.
-                            if (accession == "MS:1000041") {
-                                scan.precursor_information.charge =
-                                    std::stoi(cv_attributes["value"]);
-                            }
-                            if (accession == "MS:1000042") {
-                                scan.precursor_information.intensity =
-                                    std::stod(cv_attributes["value"]);
-                            }
-                            // Activation method.
-                            if (accession == "MS:1000422") {
-                                scan.precursor_information.activation_method =
-                                    ActivationMethod::HCD;
-                            }
-                        }
-                    }
-                }
+    // Wait for the threads to finish.
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
-                if (tag.value().name == "binaryDataArray") {
-                    // precision can be: 64 or 32 (bits).
-                    int precision = 0;
-                    // Uncompressed: false, Zlib compression: true.
-                    bool compressed = false;
-                    // mz: 0, intensity: 1
-                    int type = -1;
-                    std::optional<std::string> data;
-                    while (stream.good() && !stream.eof()) {
-                        auto tag = XmlReader::read_tag(stream);
-                        if (!tag) {
-                            break;
-                        }
-                        if (tag.value().name == "binaryDataArray" &&
-                            tag.value().closed) {
-                            break;
-                        }
-                        if (tag.value().name == "cvParam") {
-                            auto cv_attributes = tag.value().attributes;
-                            auto accession = cv_attributes["accession"];
-                            // Precision.
-                            if (accession == "MS:1000523") {
-                                precision = 64;
-                            }
-                            if (accession == "MS:1000521") {
-                                precision = 32;
-                            }
-                            // Compression.
-                            if (accession == "MS:1000574") {
-                                compressed = true;
-                            }
-                            // Type of vector.
-                            if (accession == "MS:1000514") {
-                                type = 0;
-                            }
-                            if (accession == "MS:1000515") {
-                                type = 1;
-                            }
-                        }
-                        if (tag.value().name == "binary" &&
-                            !tag.value().closed) {
-                            data = XmlReader::read_data(stream);
-                        }
-                    }
-                    if (data) {
-                        // decode data.
-                        std::vector<uint8_t> binary_data;
-                        Base64::decode_base64(data.value(), binary_data);
-                        if (compressed) {
-                            std::vector<uint8_t> decompressed_data;
-
-                            // Decompress data, set decompressed length to 0
-                            // (unknown).
-                            int status = Compression::inflate(
-                                binary_data, decompressed_data, 0);
-
-                            // Check status after decompression.
-                            if (status != Z_OK) {
-                                return raw_data;
-                            }
-
-                            binary_data = decompressed_data;
-                        }
+    if (index_mismatch) {
+        // The index doesn't match the contents of the file.
+        return std::nullopt;
+    }
+    for (auto &scan : scans) {
+        if (!scan) {
+            break;
+        }
+        update_raw_data(raw_data, filters, scan.value());
+    }
+    return raw_data;
+}
 
-                        size_t num_points =
-                            binary_data.size() / (precision / 8);
+std::optional<XmlReader::MzxmlIndex> XmlReader::read_mzxml_index(
+    std::string_view data) {
+    // The <indexOffset> is located at the end of the file, right after the
+    // scan <index>, so we only need to look at the last few bytes to find it.
+    const std::string_view offset_tag = "<indexOffset>";
+    size_t tail_size = std::min(data.size(), static_cast<size_t>(4096));
+    auto tail = data.substr(data.size() - tail_size);
+    size_t tag_pos = tail.rfind(offset_tag);
+    if (tag_pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    std::string offset_str(tail.substr(tag_pos + offset_tag.size(), 32));
+    char *end_ptr = nullptr;
+    uint64_t index_offset = std::strtoull(offset_str.c_str(), &end_ptr, 10);
+    if (end_ptr == offset_str.c_str() || index_offset >= data.size()) {
+        return std::nullopt;
+    }
+
+    // Read the scan offsets. The scans have to be listed in the same order as
+    // they appear in the file, so that the nesting of the scans can be
+    // reconstructed.
+    MzxmlIndex index = {};
+    XmlReader::Tokenizer tokenizer(data.substr(index_offset));
+    bool scan_index = false;
+    while (auto tag = tokenizer.read_tag()) {
+        if (tag.value().name == "index") {
+            if (tag.value().closed && scan_index) {
+                break;
+            }
+            scan_index = !tag.value().closed &&
+                         tag.value().attribute("name") == "scan";
+            continue;
+        }
+        if (!scan_index || tag.value().name != "offset" ||
+            tag.value().closed) {
+            continue;
+        }
+        auto offset_data = tokenizer.read_data();
+        if (!offset_data || offset_data.value().empty() ||
+            !is_digit(offset_data.value()[0])) {
+            return std::nullopt;
+        }
+        uint64_t offset = to_int(offset_data.value());
+        if (offset >= data.size() ||
+            (!index.offsets.empty() && offset <= index.offsets.back())) {
+            return std::nullopt;
+        }
+        index.offsets.push_back(offset);
+    }
+    if (index.offsets.empty()) {
+        return std::nullopt;
+    }
+    return index;
+}
 
-                        if (type == 0) {  // mz
-                            mzs = std::vector<double>(num_points);
-                        }
-                        if (type == 1) {  // intensity
-                            intensities = std::vector<double>(num_points);
-                        }
-                        if (filter_points.empty()) {
-                            filter_points =
-                                std::vector<bool>(num_points, false);
-                        }
+// Read the opening tag of the mzXML scan that starts at the given offset.
+std::optional<XmlReader::TagView> read_mzxml_scan_tag(std::string_view data,
+                                                      uint64_t offset) {
+    XmlReader::Tokenizer tokenizer(data.substr(offset));
+    auto tag = tokenizer.read_tag();
+    if (!tag || tag.value().name != "scan" || tag.value().closed) {
+        return std::nullopt;
+    }
+    return tag;
+}
 
-                        // offset for interpretation.
-                        size_t offset = 0;
-                        for (size_t i = 0; i < num_points; ++i) {
-                            double value = 0;
-                            if (precision == 32) {
-                                value = Base64::interpret_float(binary_data,
-                                                                offset, true);
-                                offset += 4;
-                            } else if (precision == 64) {
-                                value = Base64::interpret_double(binary_data,
-                                                                 offset, true);
-                                offset += 8;
-                            }
-                            if (type == 0) {  // mz
-                                mzs[i] = value;
-                                if (value < min_mz || value > max_mz) {
-                                    filter_points[i] = true;
-                                }
-                            }
-                            if (type == 1) {  // intensity
-                                intensities[i] = value;
-                                if (value == 0.0) {
-                                    filter_points[i] = true;
-                                }
-                            }
-                        }
-                    }
-                }
+std::pair<size_t, size_t> XmlReader::find_mzxml_scans(std::string_view data,
+                                                      const MzxmlIndex &index,
+                                                      double min_rt,
+                                                      double max_rt) {
+    // Binary search for the first scan where the retention time is not below
+    // the given threshold. Only the opening tag of the visited scans is
+    // parsed. Scans with missing retention time are considered to be below
+    // the threshold.
+    auto bound = [&data, &index](double rt, bool inclusive) -> size_t {
+        size_t l = 0;
+        size_t r = index.offsets.size();
+        while (l < r) {
+            size_t mid = l + (r - l) / 2;
+            std::optional<double> scan_rt;
+            auto tag = read_mzxml_scan_tag(data, index.offsets[mid]);
+            if (tag) {
+                scan_rt =
+                    parse_retention_time(tag.value().attribute("retentionTime"));
             }
+            bool below = !scan_rt || scan_rt.value() < rt ||
+                         (inclusive && scan_rt.value() == rt);
+            if (below) {
+                l = mid + 1;
+            } else {
+                r = mid;
+            }
+        }
+        return l;
+    };
+    size_t first = bound(min_rt, false);
+    size_t last = bound(max_rt, true);
+    if (last < first) {
+        last = first;
+    }
+    return {first, last};
+}
 
-            // Filter mzs not in range and intensity == 0 scans and calculate
-            // max_intensity and total_intensity.
-            double intensity_sum = 0;
-            double max_intensity = 0;
-            for (size_t i = 0; i < filter_points.size(); ++i) {
-                if (filter_points[i]) {
-                    continue;
+// The position of an mzXML scan in the nesting of the scans, used to find the
+// precursors of nested scans after the scans have been decoded independently.
+struct MzxmlScanNesting {
+    // The scan contains nested scans, which follow it in the file.
+    bool has_children = false;
+    // Number of enclosing scans that end right after this scan.
+    size_t closed_parents = 0;
+};
+
+// Parse the mzXML scan whose opening tag has just been read by the tokenizer.
+// Nested scans are not parsed, since they have their own entry in the index,
+// but the nesting of the scan is recorded. The returned scan contains no points
+// and has no MS level if it is not selected.
+RawData::Scan parse_mzxml_indexed_scan(
+    XmlReader::Tokenizer &tokenizer, const XmlReader::TagView &tag,
+    double min_mz, double max_mz, double min_rt, double max_rt,
+    const std::vector<XmlReader::ScanFilter> &filters,
+    MzxmlScanNesting &nesting) {
+    RawData::Scan scan = {};
+    size_t num_points = 0;
+    bool past_max_rt = false;
+    bool selected = parse_mzxml_scan_tag(tag, min_rt, max_rt, filters, scan,
+                                         num_points, past_max_rt);
+    while (auto next_tag = tokenizer.read_tag()) {
+        if (next_tag.value().name == "scan") {
+            if (!next_tag.value().closed) {
+                nesting.has_children = true;
+                break;
+            }
+            // Count the enclosing scans that are closed before the next scan
+            // starts or the run ends.
+            while (auto parent_tag = tokenizer.read_tag()) {
+                if (parent_tag.value().name == "msRun" ||
+                    (parent_tag.value().name == "scan" &&
+                     !parent_tag.value().closed)) {
+                    break;
                 }
-                scan.mz.push_back(mzs[i]);
-                scan.intensity.push_back(intensities[i]);
-                if (intensities[i] > max_intensity) {
-                    max_intensity = intensities[i];
+                if (parent_tag.value().name == "scan") {
+                    ++nesting.closed_parents;
                 }
-                intensity_sum += intensities[i];
             }
-            scan.num_points = scan.mz.size();
-            scan.max_intensity = max_intensity;
-            scan.total_intensity = intensity_sum;
+            break;
+        }
+        if (selected && next_tag.value().name == "peaks" &&
+            !next_tag.value().closed &&
+            any_filter_needs_points(filters, scan.ms_level, scan.polarity)) {
+            selected = parse_mzxml_peaks(tokenizer, next_tag.value(),
+                                         num_points, min_mz, max_mz, scan);
+        }
+        if (selected && next_tag.value().name == "precursorMz" &&
+            !next_tag.value().closed) {
+            selected = parse_mzxml_precursor(tokenizer, next_tag.value(), scan);
+        }
+    }
+    if (selected) {
+        centroid_if_requested(filters, is_profile_mzxml_scan(tag), scan);
+    } else {
+        scan.mz.clear();
+        scan.intensity.clear();
+        scan.num_points = 0;
+        scan.ms_level = 0;
+    }
+    return scan;
+}
 
-            // TODO: Assert that mz.size() == intenstiy.size()
-            if (scan.ms_level == 0 || scan.ms_level != ms_level) {
-                scan = {};
-            }
+std::optional<RawData::RawData> XmlReader::read_mzxml_indexed(
+    std::string_view data, const MzxmlIndex &index, size_t first_scan,
+    size_t last_scan, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads) {
+    auto raw_data = read_mzxml_indexed(
+        data, index, first_scan, last_scan, min_mz, max_mz, min_rt, max_rt,
+        instrument_type, resolution_ms1, resolution_msn, reference_mz,
+        {{ms_level, polarity}}, max_threads);
+    if (!raw_data) {
+        return std::nullopt;
+    }
+    return std::move(raw_data.value()[0]);
+}
+
+std::optional<std::vector<RawData::RawData>> XmlReader::read_mzxml_indexed(
+    std::string_view data, const MzxmlIndex &index, size_t first_scan,
+    size_t last_scan, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads) {
+    std::vector<RawData::RawData> raw_data(
+        filters.size(), init_raw_data(instrument_type, resolution_ms1,
+                                      resolution_msn, reference_mz));
+    last_scan = std::min(last_scan, index.offsets.size());
+    if (first_scan >= last_scan) {
+        return raw_data;
+    }
+
+    // The precursor of a nested scan is the scan that encloses it, which may
+    // be before the first scan in the range. Scans are read from the closest
+    // MS1 scan, which is not nested, so that the nesting can be reconstructed.
+    // The additional scans are outside of the retention time range, so their
+    // peaks are not decoded.
+    while (first_scan > 0) {
+        auto tag = read_mzxml_scan_tag(data, index.offsets[first_scan]);
+        if (!tag) {
+            return std::nullopt;
+        }
+        if (to_int(tag.value().attribute("msLevel")) == 1) {
+            break;
         }
+        --first_scan;
+    }
 
-        // Update RawData.
-        if (scan.num_points != 0) {
-            if (scan.retention_time < min_rt) {
-                continue;
-            }
-            if (scan.retention_time > max_rt) {
-                break;
-            }
-            raw_data.scans.push_back(scan);
-            raw_data.retention_times.push_back(scan.retention_time);
-            if (scan.retention_time < raw_data.min_rt) {
-                raw_data.min_rt = scan.retention_time;
-            }
-            if (scan.retention_time > raw_data.max_rt) {
-                raw_data.max_rt = scan.retention_time;
-            }
-            if (scan.mz[0] < raw_data.min_mz) {
-                raw_data.min_mz = scan.mz[0];
+    // The number of threads is set to the maximum possible concurrency.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    // Since we know where each scan begins, the workers can pick the next scan
+    // to decode directly from the index.
+    size_t num_scans = last_scan - first_scan;
+    std::vector<RawData::Scan> scans(num_scans);
+    std::vector<MzxmlScanNesting> nesting(num_scans);
+    std::atomic<size_t> next_scan(0);
+    std::atomic<bool> index_mismatch(false);
+    std::vector<std::thread> threads(num_threads);
+    for (auto &thread : threads) {
+        thread = std::thread([&]() {
+            for (size_t i = next_scan++; i < num_scans; i = next_scan++) {
+                // Jump directly to the scan tag.
+                XmlReader::Tokenizer tokenizer(
+                    data.substr(index.offsets[first_scan + i]));
+                auto tag = tokenizer.read_tag();
+                if (!tag || tag.value().name != "scan" ||
+                    tag.value().closed) {
+                    index_mismatch = true;
+                    return;
+                }
+                scans[i] = parse_mzxml_indexed_scan(
+                    tokenizer, tag.value(), min_mz, max_mz, min_rt, max_rt,
+                    filters, nesting[i]);
             }
-            if (scan.mz[scan.mz.size() - 1] > raw_data.max_mz) {
-                raw_data.max_mz = scan.mz[scan.mz.size() - 1];
+        });
+    }
+
+    // Wait for the threads to finish.
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (index_mismatch) {
+        // The index doesn't match the contents of the file.
+        return std::nullopt;
+    }
+
+    // Resolve the precursors of the nested scans following the order of the
+    // file, keeping track of the scans that enclose the current one.
+    std::vector<uint64_t> parents;
+    for (size_t i = 0; i < num_scans; ++i) {
+        auto &scan = scans[i];
+        if (!parents.empty() && parents.back() != 0) {
+            scan.precursor_information.scan_number = parents.back();
+        }
+        if (nesting[i].has_children) {
+            parents.push_back(scan.scan_number);
+        } else {
+            for (size_t j = 0;
+                 j < nesting[i].closed_parents && !parents.empty(); ++j) {
+                parents.pop_back();
             }
         }
+        if (keep_scan(filters, scan)) {
+            update_raw_data(raw_data, filters, scan);
+        }
     }
-
     return raw_data;
 }
 
@@ -833,63 +1994,207 @@ IdentData::IdentData XmlReader::read_mzidentml(std::istream &stream,
                                                bool max_rank_only,
                                                double min_mz, double max_mz,
                                                double min_rt, double max_rt) {
+    // The tokenizer requires a contiguous buffer, so unless the stream is
+    // already in memory we read its contents first.
+    auto memory_buffer =
+        dynamic_cast<MemoryMap::MemoryStreambuf *>(stream.rdbuf());
+    if (memory_buffer) {
+        return read_mzidentml(memory_buffer->unread(), ignore_decoy,
+                              require_threshold, max_rank_only, min_mz, max_mz,
+                              min_rt, max_rt);
+    }
+    std::string data(std::istreambuf_iterator<char>(stream), {});
+    return read_mzidentml(std::string_view(data), ignore_decoy,
+                          require_threshold, max_rank_only, min_mz, max_mz,
+                          min_rt, max_rt);
+}
+
+// Parse the SpectrumIdentificationResults contained in the given part of a
+// SpectrumIdentificationList, stopping at the end of the list. The matches are
+// returned in the same order as in the file.
+std::vector<IdentData::SpectrumMatch> parse_mzidentml_results(
+    std::string_view data, bool require_threshold, bool max_rank_only,
+    double min_mz, double max_mz, double min_rt, double max_rt) {
+    std::vector<IdentData::SpectrumMatch> matches;
+    XmlReader::Tokenizer tokenizer(data);
+    while (auto tag = tokenizer.read_tag()) {
+        if (tag.value().name == "SpectrumIdentificationList" &&
+            tag.value().closed) {
+            break;
+        }
+        // Find the next SpectrumIdentificationResult.
+        if (tag.value().name != "SpectrumIdentificationResult") {
+            continue;
+        }
+
+        // Record all SpectrumIdentificationItems for this result.
+        std::vector<IdentData::SpectrumMatch> spectrum_matches;
+        double retention_time = 0.0;
+        while (auto tag = tokenizer.read_tag()) {
+            if (tag.value().name == "SpectrumIdentificationResult" &&
+                tag.value().closed) {
+                break;
+            }
+
+            if (tag.value().name == "cvParam") {
+                // Retention time or scan start time.
+                auto accession = tag.value().attribute("accession");
+                if (accession == "MS:1000894" || accession == "MS:1000016") {
+                    retention_time = to_double(tag.value().attribute("value"));
+                    // If the retention time is in minutes, we convert it back
+                    // to seconds.
+                    if (tag.value().attribute("unitAccession") ==
+                        "UO:0000031") {
+                        retention_time *= 60.0;
+                    }
+                }
+            }
+
+            // Identification item.
+            if (tag.value().name == "SpectrumIdentificationItem" &&
+                !tag.value().closed) {
+                const auto &item_tag = tag.value();
+                IdentData::SpectrumMatch spectrum_match = {};
+                spectrum_match.id = item_tag.attribute("id");
+                spectrum_match.pass_threshold =
+                    item_tag.attribute("passThreshold") == "true";
+                if (require_threshold && !spectrum_match.pass_threshold) {
+                    continue;
+                }
+                spectrum_match.match_id = item_tag.attribute("peptide_ref");
+                spectrum_match.charge_state =
+                    to_int(item_tag.attribute("chargeState"));
+                spectrum_match.experimental_mz =
+                    to_double(item_tag.attribute("experimentalMassToCharge"));
+                spectrum_match.retention_time = 0;
+                spectrum_match.rank = to_int(item_tag.attribute("rank"));
+                // Might be optional according to the mzIdentML v1.2.0 spec.
+                if (item_tag.has_attribute("calculatedMassToCharge")) {
+                    spectrum_match.theoretical_mz =
+                        to_double(item_tag.attribute("calculatedMassToCharge"));
+                } else {
+                    spectrum_match.theoretical_mz = 0.0;
+                }
+
+                spectrum_matches.push_back(spectrum_match);
+            }
+        }
+
+        if (max_rank_only) {
+            if (spectrum_matches.empty()) {
+                continue;
+            }
+            IdentData::SpectrumMatch selected_spectrum = {};
+            // Update retention time on the provisional spectrum_matches list
+            // and find the maximum rank spectrum. The rank is in descending
+            // order of importance, thus rank 1 is the maximum, and bigger
+            // numbers are worse.
+            for (size_t i = 0; i < spectrum_matches.size(); ++i) {
+                auto &spectrum_match = spectrum_matches[i];
+                spectrum_match.retention_time = retention_time;
+                if (i == 0 || spectrum_match.rank < selected_spectrum.rank) {
+                    selected_spectrum = spectrum_match;
+                }
+            }
+            if (selected_spectrum.experimental_mz >= min_mz &&
+                selected_spectrum.experimental_mz <= max_mz &&
+                selected_spectrum.retention_time >= min_rt &&
+                selected_spectrum.retention_time <= max_rt) {
+                matches.push_back(selected_spectrum);
+            }
+        } else {
+            // Update retention time on the provisional spectrum_matches list
+            // and push each element to the list of PSM.
+            for (auto &spectrum_match : spectrum_matches) {
+                spectrum_match.retention_time = retention_time;
+                if (spectrum_match.experimental_mz >= min_mz &&
+                    spectrum_match.experimental_mz <= max_mz &&
+                    spectrum_match.retention_time >= min_rt &&
+                    spectrum_match.retention_time <= max_rt) {
+                    matches.push_back(spectrum_match);
+                }
+            }
+        }
+    }
+    return matches;
+}
+
+// Find the beginning of the first SpectrumIdentificationResult tag at or after
+// the given position, or the end of the data if there is none.
+size_t find_mzidentml_result(std::string_view data, size_t position) {
+    const std::string_view result_tag = "<SpectrumIdentificationResult";
+    while ((position = data.find(result_tag, position)) !=
+           std::string_view::npos) {
+        size_t end = position + result_tag.size();
+        if (end < data.size() &&
+            (std::isspace(data[end]) || data[end] == '>' || data[end] == '/')) {
+            return position;
+        }
+        position = end;
+    }
+    return data.size();
+}
+
+IdentData::IdentData XmlReader::read_mzidentml(std::string_view data,
+                                               bool ignore_decoy,
+                                               bool require_threshold,
+                                               bool max_rank_only,
+                                               double min_mz, double max_mz,
+                                               double min_rt, double max_rt) {
+    return read_mzidentml_parallel(data, ignore_decoy, require_threshold,
+                                   max_rank_only, min_mz, max_mz, min_rt,
+                                   max_rt, 1);
+}
+
+IdentData::IdentData XmlReader::read_mzidentml_parallel(
+    std::string_view data, bool ignore_decoy, bool require_threshold,
+    bool max_rank_only, double min_mz, double max_mz, double min_rt,
+    double max_rt, size_t max_threads) {
     IdentData::IdentData ident_data = {};
+    XmlReader::Tokenizer tokenizer(data);
 
     // Find the DBSequences, Peptides and PeptideEvidence in the
     // SequenceCollection tag.
-    while (stream.good() && !stream.eof()) {
-        auto tag = XmlReader::read_tag(stream);
-        if (!tag) {
-            continue;
-        }
+    while (auto tag = tokenizer.read_tag()) {
         if (tag.value().name == "SequenceCollection" && tag.value().closed) {
             break;
         }
         if (tag.value().name == "DBSequence") {
-            auto attributes = tag.value().attributes;
-            if (attributes.empty()) {
+            if (tag.value().num_attributes == 0) {
                 continue;
             }
             IdentData::DBSequence db_sequence = {};
-            db_sequence.id = attributes["id"];
-            db_sequence.accession = attributes["accession"];
-            db_sequence.db_reference = attributes["searchDatabase_ref"];
+            db_sequence.id = tag.value().attribute("id");
+            db_sequence.accession = tag.value().attribute("accession");
+            db_sequence.db_reference =
+                tag.value().attribute("searchDatabase_ref");
             if (!tag.value().closed) {
                 // Check if the DBSequence contains the protein description as a
                 // cvParam tag.
-                while (stream.good() && !stream.eof()) {
-                    auto tag = XmlReader::read_tag(stream);
-                    if (!tag) {
-                        continue;
-                    }
+                while (auto tag = tokenizer.read_tag()) {
                     if (tag.value().name == "DBSequence" &&
                         tag.value().closed) {
                         break;
                     }
-                    auto attributes = tag.value().attributes;
                     if (tag.value().name == "cvParam" &&
-                        attributes["accession"] == "MS:1001088") {
-                        db_sequence.description = attributes["value"];
+                        tag.value().attribute("accession") == "MS:1001088") {
+                        db_sequence.description =
+                            tag.value().attribute("value");
                     }
                 }
             }
             ident_data.db_sequences.push_back(db_sequence);
         } else if (tag.value().name == "Peptide") {
             IdentData::Peptide peptide = {};
-            auto attributes = tag.value().attributes;
-            peptide.id = attributes["id"];
+            peptide.id = tag.value().attribute("id");
             // Find peptide sequence and modifications.
-            while (stream.good() && !stream.eof()) {
-                auto tag = XmlReader::read_tag(stream);
-                if (!tag) {
-                    continue;
-                }
+            while (auto tag = tokenizer.read_tag()) {
                 if (tag.value().name == "Peptide" && tag.value().closed) {
                     break;
                 }
                 if (tag.value().name == "PeptideSequence" &&
                     !tag.value().closed) {
-                    auto data = XmlReader::read_data(stream);
+                    auto data = tokenizer.read_data();
                     if (!data) {
                         return {};
                         break;
@@ -899,83 +2204,87 @@ IdentData::IdentData XmlReader::read_mzidentml(std::istream &stream,
                 // Search peptide modifications.
                 if (tag.value().name == "Modification" && !tag.value().closed) {
                     // Save modification info.
-                    auto attributes = tag.value().attributes;
+                    const auto &modification_tag = tag.value();
                     auto modification = IdentData::PeptideModification{};
-                    if (attributes.find("monoisotopicMassDelta") !=
-                        attributes.end()) {
+                    auto mass_delta =
+                        modification_tag.attribute("monoisotopicMassDelta");
+                    if (!mass_delta.empty()) {
                         modification.monoisotopic_mass_delta =
-                            std::stod(attributes["monoisotopicMassDelta"]);
+                            to_double(mass_delta);
                     }
-                    if (attributes.find("avgMassDelta") != attributes.end()) {
+                    auto average_mass_delta =
+                        modification_tag.attribute("avgMassDelta");
+                    if (!average_mass_delta.empty()) {
                         modification.average_mass_delta =
-                            std::stod(attributes["avgMassDelta"]);
+                            to_double(average_mass_delta);
                     }
-                    if (attributes.find("residues") != attributes.end()) {
-                        modification.residues = attributes["residues"];
+                    if (modification_tag.has_attribute("residues")) {
+                        modification.residues =
+                            modification_tag.attribute("residues");
                     }
-                    if (attributes.find("location") != attributes.end()) {
+                    if (modification_tag.has_attribute("location")) {
                         modification.location =
-                            std::stoi(attributes["location"]);
+                            to_int(modification_tag.attribute("location"));
                     } else {
                         modification.location = -1;
                     }
                     // Find identification information for this modification.
-                    while (stream.good() && !stream.eof()) {
-                        auto tag = XmlReader::read_tag(stream);
-                        if (!tag) {
-                            continue;
-                        }
+                    while (auto tag = tokenizer.read_tag()) {
                         if (tag.value().name == "Modification" &&
                             tag.value().closed) {
                             peptide.modifications.push_back(modification);
                             break;
                         }
                         if (tag.value().name == "cvParam") {
-                            auto attributes = tag.value().attributes;
-                            modification.id.push_back(attributes["accession"] +
-                                                      "|" + attributes["name"]);
+                            std::string id(tag.value().attribute("accession"));
+                            id += "|";
+                            id += tag.value().attribute("name");
+                            modification.id.push_back(id);
                         }
                     }
                     peptide.modifications.push_back(modification);
                 } else if (tag.value().name == "SubstitutionModification") {
                     // Save modification info.
-                    auto attributes = tag.value().attributes;
+                    const auto &modification_tag = tag.value();
                     auto modification = IdentData::PeptideModification{};
-                    if (attributes.find("monoisotopicMassDelta") !=
-                        attributes.end()) {
+                    auto mass_delta =
+                        modification_tag.attribute("monoisotopicMassDelta");
+                    if (!mass_delta.empty()) {
                         modification.monoisotopic_mass_delta =
-                            std::stod(attributes["monoisotopicMassDelta"]);
+                            to_double(mass_delta);
                     }
-                    if (attributes.find("avgMassDelta") != attributes.end()) {
+                    auto average_mass_delta =
+                        modification_tag.attribute("avgMassDelta");
+                    if (!average_mass_delta.empty()) {
                         modification.average_mass_delta =
-                            std::stod(attributes["avgMassDelta"]);
+                            to_double(average_mass_delta);
                     }
-                    if (attributes.find("residues") != attributes.end()) {
-                        modification.residues = attributes["residues"];
+                    if (modification_tag.has_attribute("residues")) {
+                        modification.residues =
+                            modification_tag.attribute("residues");
                     }
-                    if (attributes.find("location") != attributes.end()) {
+                    if (modification_tag.has_attribute("location")) {
                         modification.location =
-                            std::stoi(attributes["location"]);
+                            to_int(modification_tag.attribute("location"));
                     } else {
                         modification.location = -1;
                     }
-                    modification.id.push_back(
-                        "SUBSTITUTION|" + attributes["originalResidue"] + "->" +
-                        attributes["replacementResidue"]);
+                    std::string id = "SUBSTITUTION|";
+                    id += modification_tag.attribute("originalResidue");
+                    id += "->";
+                    id += modification_tag.attribute("replacementResidue");
+                    modification.id.push_back(id);
                     peptide.modifications.push_back(modification);
                 }
             }
             ident_data.peptides.push_back(peptide);
         } else if (tag.value().name == "PeptideEvidence") {
             IdentData::PeptideEvidence peptide_evidence;
-            auto attributes = tag.value().attributes;
-            peptide_evidence.id = attributes["id"];
-            peptide_evidence.db_sequence_id = attributes["dBSequence_ref"];
-            peptide_evidence.peptide_id = attributes["peptide_ref"];
-            peptide_evidence.decoy = false;
-            if (attributes.find("isDecoy") != attributes.end()) {
-                peptide_evidence.decoy = attributes["isDecoy"] == "true";
-            }
+            peptide_evidence.id = tag.value().attribute("id");
+            peptide_evidence.db_sequence_id =
+                tag.value().attribute("dBSequence_ref");
+            peptide_evidence.peptide_id = tag.value().attribute("peptide_ref");
+            peptide_evidence.decoy = tag.value().attribute("isDecoy") == "true";
             if (ignore_decoy && peptide_evidence.decoy) {
                 continue;
             }
@@ -983,113 +2292,59 @@ IdentData::IdentData XmlReader::read_mzidentml(std::istream &stream,
         }
     }
 
-    // Find the PSMs for this data (SpectrumIdentificationResult).
-    while (stream.good() && !stream.eof()) {
-        auto tag = XmlReader::read_tag(stream);
-        if (!tag) {
-            continue;
-        }
-        if (tag.value().name == "SpectrumIdentificationList" &&
-            tag.value().closed) {
-            break;
-        }
-        // Find the next SpectrumIdentificationResult.
-        if (tag.value().name != "SpectrumIdentificationResult") {
-            continue;
-        }
-
-        // Record all SpectrumIdentificationItems for this result.
-        std::vector<IdentData::SpectrumMatch> spectrum_matches;
-        double retention_time = 0.0;
-        while (stream.good() && !stream.eof()) {
-            tag = XmlReader::read_tag(stream);
-            if (!tag) {
-                continue;
-            }
-            if (tag.value().name == "SpectrumIdentificationResult" &&
-                tag.value().closed) {
-                break;
-            }
-            auto attributes = tag.value().attributes;
+    // The SpectrumIdentificationResults are independent of each other, so the
+    // SpectrumIdentificationList is split into chunks of similar size at the
+    // beginning of a result, which are parsed in parallel.
+    auto results = data.substr(tokenizer.offset());
+    size_t list_end = results.find("</SpectrumIdentificationList");
+    if (list_end != std::string_view::npos) {
+        results = results.substr(0, list_end);
+    }
 
-            if (tag.value().name == "cvParam") {
-                // Retention time or scan start time.
-                if (attributes["accession"] == "MS:1000894" ||
-                    attributes["accession"] == "MS:1000016") {
-                    retention_time = std::stod(attributes["value"]);
-                    // If the retention time is in minutes, we convert it back
-                    // to seconds.
-                    if (attributes["unitAccession"] == "UO:0000031") {
-                        retention_time *= 60.0;
-                    }
-                }
-            }
+    // The number of threads is set to the maximum possible concurrency.
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads > max_threads) {
+        num_threads = max_threads;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
 
-            // Identification item.
-            if (tag.value().name == "SpectrumIdentificationItem" &&
-                !tag.value().closed) {
-                IdentData::SpectrumMatch spectrum_match = {};
-                spectrum_match.id = attributes["id"];
-                spectrum_match.pass_threshold =
-                    attributes["passThreshold"] == "true";
-                if (require_threshold && !spectrum_match.pass_threshold) {
-                    continue;
-                }
-                spectrum_match.match_id = attributes["peptide_ref"];
-                spectrum_match.charge_state =
-                    std::stoi(attributes["chargeState"]);
-                spectrum_match.experimental_mz =
-                    std::stod(attributes["experimentalMassToCharge"]);
-                spectrum_match.retention_time = 0;
-                spectrum_match.rank = std::stoi(attributes["rank"]);
-                // Might be optional according to the mzIdentML v1.2.0 spec.
-                if (attributes.find("calculatedMassToCharge") !=
-                    attributes.end()) {
-                    spectrum_match.theoretical_mz =
-                        std::stod(attributes["calculatedMassToCharge"]);
-                } else {
-                    spectrum_match.theoretical_mz = 0.0;
-                }
+    std::vector<size_t> chunk_bounds(num_threads + 1, 0);
+    for (size_t i = 1; i < num_threads; ++i) {
+        chunk_bounds[i] = find_mzidentml_result(
+            results, std::max(chunk_bounds[i - 1],
+                              results.size() / num_threads * i));
+    }
+    chunk_bounds[num_threads] = results.size();
+
+    std::vector<std::vector<IdentData::SpectrumMatch>> chunk_matches(
+        num_threads);
+    std::vector<std::thread> threads(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads[i] = std::thread([&, i]() {
+            chunk_matches[i] = parse_mzidentml_results(
+                results.substr(chunk_bounds[i],
+                               chunk_bounds[i + 1] - chunk_bounds[i]),
+                require_threshold, max_rank_only, min_mz, max_mz, min_rt,
+                max_rt);
+        });
+    }
 
-                spectrum_matches.push_back(spectrum_match);
-            }
-        }
+    // Wait for the threads to finish.
+    for (auto &thread : threads) {
+        thread.join();
+    }
 
-        if (max_rank_only) {
-            if (spectrum_matches.empty()) {
-                continue;
-            }
-            IdentData::SpectrumMatch selected_spectrum = {};
-            // Update retention time on the provisional spectrum_matches list
-            // and find the maximum rank spectrum. The rank is in descending
-            // order of importance, thus rank 1 is the maximum, and bigger
-            // numbers are worse.
-            for (size_t i = 0; i < spectrum_matches.size(); ++i) {
-                auto &spectrum_match = spectrum_matches[i];
-                spectrum_match.retention_time = retention_time;
-                if (i == 0 || spectrum_match.rank < selected_spectrum.rank) {
-                    selected_spectrum = spectrum_match;
-                }
-            }
-            if (selected_spectrum.experimental_mz >= min_mz &&
-                selected_spectrum.experimental_mz <= max_mz &&
-                selected_spectrum.retention_time >= min_rt &&
-                selected_spectrum.retention_time <= max_rt) {
-                ident_data.spectrum_matches.push_back(selected_spectrum);
-            }
-        } else {
-            // Update retention time on the provisional spectrum_matches list
-            // and push each element to the list of PSM.
-            for (auto &spectrum_match : spectrum_matches) {
-                spectrum_match.retention_time = retention_time;
-                if (spectrum_match.experimental_mz >= min_mz &&
-                    spectrum_match.experimental_mz <= max_mz &&
-                    spectrum_match.retention_time >= min_rt &&
-                    spectrum_match.retention_time <= max_rt) {
-                    ident_data.spectrum_matches.push_back(spectrum_match);
-                }
-            }
-        }
+    // Join the matches in the same order as in the file.
+    size_t num_matches = 0;
+    for (const auto &matches : chunk_matches) {
+        num_matches += matches.size();
+    }
+    ident_data.spectrum_matches.reserve(num_matches);
+    for (auto &matches : chunk_matches) {
+        std::move(matches.begin(), matches.end(),
+                  std::back_inserter(ident_data.spectrum_matches));
     }
     return ident_data;
 }
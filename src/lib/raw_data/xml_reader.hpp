@@ -1,8 +1,13 @@
 #ifndef RAWDATA_XMLREADER_HPP
 #define RAWDATA_XMLREADER_HPP
 
+#include <array>
 #include <map>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include "raw_data/raw_data.hpp"
 
@@ -25,6 +30,105 @@ std::optional<Tag> read_tag(std::istream &stream);
 // necessary.
 std::optional<std::string> read_data(std::istream &stream);
 
+// A view of an Xml tag. The name and attributes point to the buffer from
+// which the tag was read, so no memory is allocated for them, but the view is
+// only valid while the buffer exists.
+struct TagView {
+    // Maximum number of attributes stored inline for a single tag. Any
+    // attributes beyond this number are stored in overflow_attributes, which
+    // only allocates memory for tags with unusually many attributes.
+    static constexpr size_t max_attributes = 24;
+
+    std::string_view name;
+    std::array<std::pair<std::string_view, std::string_view>, max_attributes>
+        attributes;
+    size_t num_attributes;
+    std::vector<std::pair<std::string_view, std::string_view>>
+        overflow_attributes;
+    bool closed;
+
+    // Check if the tag contains the given attribute.
+    bool has_attribute(std::string_view attribute_name) const;
+
+    // Returns the value of the given attribute or an empty string if the
+    // attribute is not present.
+    std::string_view attribute(std::string_view attribute_name) const;
+};
+
+// Tokenizer reads tags and data from a contiguous buffer, such as a
+// MemoryMap::MappedFile or an element returned by the ElementReader, without
+// copying them.
+class Tokenizer {
+   public:
+    Tokenizer(std::string_view data) : data(data), position(0) {}
+
+    // Reads the contents of the next tag in the buffer.
+    std::optional<TagView> read_tag();
+
+    // Read data until the next tag is found and trim whitespace at the
+    // beginning if necessary.
+    std::optional<std::string_view> read_data();
+
+    // Returns the current position of the tokenizer in the buffer.
+    size_t offset() const { return position; }
+
+   private:
+    std::string_view data;
+    size_t position;
+};
+
+// ElementReader extracts complete xml elements with the given tag name from a
+// stream, including any nested elements with the same name. The stream is read
+// in large chunks instead of tag by tag, so that each element can be parsed
+// independently afterwards, for example on a different thread. If the stream
+// reads from a MemoryMap::MemoryStreambuf, the elements point directly to its
+// memory instead.
+class ElementReader {
+   public:
+    ElementReader(std::istream &stream, std::string const &name,
+                  size_t chunk_size = 1 << 22);
+
+    // Returns the next element in the stream, from the beginning of its
+    // opening tag to the end of its closing tag, or std::nullopt if there are
+    // no more elements. Unless the reader is memory backed, the element is
+    // only valid until next is called again.
+    std::optional<std::string_view> next();
+
+    // Check if the elements point to the memory of the stream.
+    bool is_memory_backed() const { return memory_backed; }
+
+   private:
+    std::istream &stream;
+    std::string open_tag;
+    std::string close_tag;
+    size_t chunk_size;
+    // Data read from the stream that has not been returned yet, starting at
+    // the given position.
+    std::string buffer;
+    std::string_view view;
+    size_t position;
+    bool memory_backed;
+
+    // Discard the first n bytes of the buffer and append the next chunk of
+    // the stream. Returns false if no more data could be read.
+    bool fill(size_t n);
+};
+
+// The MS level and polarity of the scans that go into one of the outputs of
+// the multi-output readers. Scans without polarity information are accepted
+// by any filter. If headers_only is set, the binary data of the scans is not
+// decoded and they are stored without points, keeping only their metadata and
+// precursor information. If centroid is set, the scans acquired in profile mode
+// are centroided with RawData::centroid_scan while they are being read. Since
+// each scan is decoded only once, a scan selected by several filters is
+// centroided if any of them requests it.
+struct ScanFilter {
+    size_t ms_level;
+    Polarity::Type polarity;
+    bool headers_only = false;
+    bool centroid = false;
+};
+
 // Read an entire mzxml file into the RawData::RawData data structure filtering
 // based on min/max mz/rt and polarity.
 std::optional<RawData::RawData> read_mzxml(
@@ -33,6 +137,23 @@ std::optional<RawData::RawData> read_mzxml(
     double resolution_msn, double reference_mz, Polarity::Type polarity,
     size_t ms_level);
 
+// Same as read_mzxml, but the scans are decoded on up to max_threads worker
+// threads while the stream is being read.
+std::optional<RawData::RawData> read_mzxml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads);
+
+// Same as read_mzxml_parallel, but fills one RawData::RawData for each of the
+// given filters, in the same order, in a single pass over the stream. A scan
+// is stored in every output whose filter it matches.
+std::optional<std::vector<RawData::RawData>> read_mzxml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads);
+
 // Read an entire mzML file into the RawData::RawData data structure filtering
 // based on min/max mz/rt and polarity.
 std::optional<RawData::RawData> read_mzml(
@@ -41,10 +162,116 @@ std::optional<RawData::RawData> read_mzml(
     double resolution_msn, double reference_mz, Polarity::Type polarity,
     size_t ms_level);
 
+// Same as read_mzml, but the spectra are decoded on up to max_threads worker
+// threads while the stream is being read.
+std::optional<RawData::RawData> read_mzml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads);
+
+// Same as read_mzml_parallel, but fills one RawData::RawData for each of the
+// given filters, in the same order, in a single pass over the stream.
+std::optional<std::vector<RawData::RawData>> read_mzml_parallel(
+    std::istream &stream, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads);
+
+// The byte offsets of the spectra on an indexed mzML file, as stored in the
+// <indexList> at the end of the file, with their corresponding native ids.
+struct MzmlIndex {
+    std::vector<std::string> ids;
+    std::vector<uint64_t> offsets;
+};
+
+// Read the spectrum index from the given mzML file contents, usually a
+// MemoryMap::MappedFile. Returns std::nullopt if the file is not indexed.
+std::optional<MzmlIndex> read_mzml_index(std::string_view data);
+
+// Find the range of spectra [first, last) on the index whose retention time is
+// within min/max_rt. Only the headers of O(log(n)) spectra are parsed, assuming
+// that spectra are sorted by retention time.
+std::pair<size_t, size_t> find_mzml_spectra(std::string_view data,
+                                            const MzmlIndex &index,
+                                            double min_rt, double max_rt);
+
+// Read the spectra in the range [first_spectrum, last_spectrum) of the index
+// into the RawData::RawData data structure filtering based on min/max mz/rt and
+// polarity. The file is accessed directly at the offsets given by the index,
+// skipping the rest of the spectra. The spectra are decoded on up to
+// max_threads threads.
+std::optional<RawData::RawData> read_mzml_indexed(
+    std::string_view data, const MzmlIndex &index, size_t first_spectrum,
+    size_t last_spectrum, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads);
+
+// Same as read_mzml_indexed, but fills one RawData::RawData for each of the
+// given filters, in the same order, decoding each spectrum only once.
+std::optional<std::vector<RawData::RawData>> read_mzml_indexed(
+    std::string_view data, const MzmlIndex &index, size_t first_spectrum,
+    size_t last_spectrum, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads);
+
+// The byte offsets of the scans on an indexed mzXML file, as stored in the
+// scan <index> at the end of the file, in the same order as they appear in the
+// file.
+struct MzxmlIndex {
+    std::vector<uint64_t> offsets;
+};
+
+// Read the scan index from the given mzXML file contents, usually a
+// MemoryMap::MappedFile. Returns std::nullopt if the file is not indexed or
+// the index is not in file order.
+std::optional<MzxmlIndex> read_mzxml_index(std::string_view data);
+
+// Find the range of scans [first, last) on the index whose retention time is
+// within min/max_rt. Only the opening tag of O(log(n)) scans is parsed,
+// assuming that scans are sorted by retention time.
+std::pair<size_t, size_t> find_mzxml_scans(std::string_view data,
+                                           const MzxmlIndex &index,
+                                           double min_rt, double max_rt);
+
+// Read the scans in the range [first_scan, last_scan) of the index into the
+// RawData::RawData data structure filtering based on min/max mz/rt and
+// polarity. The scans are decoded independently on up to max_threads threads,
+// and the precursors of nested scans are resolved afterwards. Returns
+// std::nullopt if the index doesn't match the file.
+std::optional<RawData::RawData> read_mzxml_indexed(
+    std::string_view data, const MzxmlIndex &index, size_t first_scan,
+    size_t last_scan, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz, Polarity::Type polarity,
+    size_t ms_level, size_t max_threads);
+
+// Same as read_mzxml_indexed, but fills one RawData::RawData for each of the
+// given filters, in the same order, decoding each scan only once.
+std::optional<std::vector<RawData::RawData>> read_mzxml_indexed(
+    std::string_view data, const MzxmlIndex &index, size_t first_scan,
+    size_t last_scan, double min_mz, double max_mz, double min_rt,
+    double max_rt, Instrument::Type instrument_type, double resolution_ms1,
+    double resolution_msn, double reference_mz,
+    const std::vector<ScanFilter> &filters, size_t max_threads);
+
 // Read an entire mzIdentML file into a IdentData::IdentData data structure.
 IdentData::IdentData read_mzidentml(std::istream &stream, bool ignore_decoy,
     bool require_threshold, bool max_rank_only, double min_mz, double max_mz, 
     double min_rt, double max_rt);
+IdentData::IdentData read_mzidentml(std::string_view data, bool ignore_decoy,
+                                    bool require_threshold, bool max_rank_only,
+                                    double min_mz, double max_mz,
+                                    double min_rt, double max_rt);
+
+// Same as read_mzidentml, but the SpectrumIdentificationResults are parsed in
+// chunks on up to max_threads threads. The results are identical.
+IdentData::IdentData read_mzidentml_parallel(
+    std::string_view data, bool ignore_decoy, bool require_threshold,
+    bool max_rank_only, double min_mz, double max_mz, double min_rt,
+    double max_rt, size_t max_threads);
 }  // namespace XmlReader
 
 #endif /* RAWDATA_XMLREADER_HPP */
@@ -1,35 +1,35 @@
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <vector>
 
 #include "utils/base64.hpp"
 
-void Base64::decode_base64(const std::string &input, std::vector<uint8_t> &output) {
-    size_t in_len = input.size();
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86_SIMD
+#include <immintrin.h>
+#endif
 
-    size_t out_len = in_len / 4 * 3;
-    if (input[in_len - 1] == '=') {
-        --out_len;
-    }
-    if (input[in_len - 2] == '=') {
-        --out_len;
-    }
-
-    output.resize(out_len);
-
-    for (size_t i = 0, j = 0; i < in_len; i += 4, j += 3) {
+// Decode the base64 data starting at input character i and output byte j
+// one group of 4 characters at a time.
+void decode_base64_scalar(const char *input, size_t in_len, uint8_t *output,
+                          size_t out_len, size_t i, size_t j) {
+    for (; i < in_len; i += 4, j += 3) {
         uint8_t a = input[i] == '='
                         ? 0
-                        : translation_table[static_cast<int>(input[i])];
-        uint8_t b = input[i + 1] == '='
-                        ? 0
-                        : translation_table[static_cast<int>(input[i + 1])];
-        uint8_t c = input[i + 2] == '='
-                        ? 0
-                        : translation_table[static_cast<int>(input[i + 2])];
-        uint8_t d = input[i + 3] == '='
-                        ? 0
-                        : translation_table[static_cast<int>(input[i + 3])];
+                        : Base64::translation_table[static_cast<int>(input[i])];
+        uint8_t b =
+            input[i + 1] == '='
+                ? 0
+                : Base64::translation_table[static_cast<int>(input[i + 1])];
+        uint8_t c =
+            input[i + 2] == '='
+                ? 0
+                : Base64::translation_table[static_cast<int>(input[i + 2])];
+        uint8_t d =
+            input[i + 3] == '='
+                ? 0
+                : Base64::translation_table[static_cast<int>(input[i + 3])];
 
         if (j < out_len) {
             output[j] = (a << 2) + (b >> 4);
@@ -43,6 +43,158 @@ void Base64::decode_base64(const std::string &input, std::vector<uint8_t> &outpu
     }
 }
 
+#ifdef BASE64_X86_SIMD
+// The vectorized decoders translate the characters to their 6-bit values using
+// nibble lookup tables and pack four 6-bit values into three bytes with
+// multiply-add instructions. A block of characters is only decoded if all of
+// them are valid base64 characters, otherwise the number of characters
+// decoded so far is returned and the rest is left to the scalar decoder. The
+// last characters of the input, which may contain padding, are always left to
+// the scalar decoder as well, which also guarantees that the full width stores
+// stay within the output buffer.
+
+// Decode blocks of 16 characters into 12 bytes using SSSE3.
+__attribute__((target("ssse3"))) size_t decode_base64_ssse3(
+    const char *input, size_t in_len, uint8_t *output) {
+    const __m128i lut_lo =
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi =
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll =
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i merge_ab_bc = _mm_set1_epi32(0x01400140);
+    const __m128i merge_abcd = _mm_set1_epi32(0x00011000);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                       -1, -1, -1, -1);
+    size_t i = 0;
+    size_t j = 0;
+    for (; i + 16 + 8 <= in_len; i += 16, j += 12) {
+        __m128i str = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(input + i));
+        __m128i hi_nibbles =
+            _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        __m128i invalid =
+            _mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+        if (_mm_movemask_epi8(invalid) != 0) {
+            break;
+        }
+        __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+        __m128i roll =
+            _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+        str = _mm_add_epi8(str, roll);
+        str = _mm_maddubs_epi16(str, merge_ab_bc);
+        str = _mm_madd_epi16(str, merge_abcd);
+        str = _mm_shuffle_epi8(str, pack);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + j), str);
+    }
+    return i;
+}
+
+// Decode blocks of 32 characters into 24 bytes using AVX2.
+__attribute__((target("avx2"))) size_t decode_base64_avx2(const char *input,
+                                                          size_t in_len,
+                                                          uint8_t *output) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+        0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+        -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i merge_ab_bc = _mm256_set1_epi32(0x01400140);
+    const __m256i merge_abcd = _mm256_set1_epi32(0x00011000);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+        4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+    size_t j = 0;
+    for (; i + 32 + 16 <= in_len; i += 32, j += 24) {
+        __m256i str = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(input + i));
+        __m256i hi_nibbles =
+            _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        __m256i roll =
+            _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        str = _mm256_maddubs_epi16(str, merge_ab_bc);
+        str = _mm256_madd_epi16(str, merge_abcd);
+        str = _mm256_shuffle_epi8(str, pack);
+        str = _mm256_permutevar8x32_epi32(str, permute);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + j), str);
+    }
+    return i;
+}
+
+// Vector instruction sets available on this CPU.
+enum SimdLevel { SCALAR, SSSE3, AVX2 };
+
+SimdLevel detect_simd_level() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return SSSE3;
+    }
+    return SCALAR;
+}
+#endif
+
+void Base64::decode_base64(const std::string &input,
+                           std::vector<uint8_t> &output) {
+    decode_base64(input.data(), input.size(), output);
+}
+
+void Base64::decode_base64(const char *input, size_t in_len,
+                           std::vector<uint8_t> &output) {
+    if (in_len < 4) {
+        output.clear();
+        return;
+    }
+
+    size_t out_len = in_len / 4 * 3;
+    if (input[in_len - 1] == '=') {
+        --out_len;
+    }
+    if (input[in_len - 2] == '=') {
+        --out_len;
+    }
+
+    output.resize(out_len);
+
+    size_t i = 0;
+#ifdef BASE64_X86_SIMD
+    static const SimdLevel simd_level = detect_simd_level();
+    if (simd_level == AVX2) {
+        i = decode_base64_avx2(input, in_len, output.data());
+    }
+    if (simd_level >= SSSE3) {
+        i += decode_base64_ssse3(input + i, in_len - i,
+                                 output.data() + i / 4 * 3);
+    }
+#endif
+    decode_base64_scalar(input, in_len, output.data(), out_len, i, i / 4 * 3);
+}
+
 // Interpreting functions.
 
 // Read four bytes from the stream from the start index, order bytes
@@ -118,3 +270,65 @@ double Base64::interpret_double(std::vector<uint8_t> &data, size_t offset,
     std::memcpy(&ret, &bytes, sizeof(bytes));
     return ret;
 }
+
+// Reverse the byte order of a 32 or 64 bit value.
+uint32_t bswap32(uint32_t value) {
+#ifdef _MSC_VER
+    return _byteswap_ulong(value);
+#else
+    return __builtin_bswap32(value);
+#endif
+}
+
+uint64_t bswap64(uint64_t value) {
+#ifdef _MSC_VER
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// Returns true if the byte order of the data differs from the machine's. The
+// machine's byte order is read from the first byte of a known integer, which
+// compilers fold into a constant.
+bool needs_byte_swap(bool little_endian) {
+    uint16_t one = 1;
+    uint8_t first_byte;
+    std::memcpy(&first_byte, &one, sizeof(first_byte));
+    return little_endian != (first_byte == 1);
+}
+
+void Base64::interpret_floats(const uint8_t *data, size_t num_values,
+                              bool little_endian, double *output) {
+    // The swap is hoisted out of the loops so that they can be vectorized.
+    if (needs_byte_swap(little_endian)) {
+        for (size_t i = 0; i < num_values; ++i) {
+            uint32_t bytes;
+            std::memcpy(&bytes, data + i * sizeof(bytes), sizeof(bytes));
+            bytes = bswap32(bytes);
+            float value;
+            std::memcpy(&value, &bytes, sizeof(value));
+            output[i] = value;
+        }
+    } else {
+        for (size_t i = 0; i < num_values; ++i) {
+            float value;
+            std::memcpy(&value, data + i * sizeof(value), sizeof(value));
+            output[i] = value;
+        }
+    }
+}
+
+void Base64::interpret_doubles(const uint8_t *data, size_t num_values,
+                               bool little_endian, double *output) {
+    if (needs_byte_swap(little_endian)) {
+        for (size_t i = 0; i < num_values; ++i) {
+            uint64_t bytes;
+            std::memcpy(&bytes, data + i * sizeof(bytes), sizeof(bytes));
+            bytes = bswap64(bytes);
+            std::memcpy(&output[i], &bytes, sizeof(bytes));
+        }
+    } else {
+        std::memcpy(output, data, num_values * sizeof(double));
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef UTILS_BASE64_HPP
 #define UTILS_BASE64_HPP
 
+#include <cstdint>
+#include <string>
 #include <vector>
 
 // This namespace contains functions to decode base64-encoded data into raw
@@ -26,8 +28,12 @@ static constexpr unsigned char translation_table[] = {
 
 // Decode input string containing base64-encoded data into bytes, result is
 // returned in the output vector. This function allocates the appropriate amount
-// of memory for the output vector.
+// of memory for the output vector. The input must not contain whitespace. On
+// x86 CPUs supporting SSSE3 or AVX2, the bulk of the input is decoded using
+// vector instructions.
 void decode_base64(std::string const &input, std::vector<uint8_t> &output);
+void decode_base64(const char *input, size_t in_len,
+                   std::vector<uint8_t> &output);
 
 // Interpreting raw data into floating-point values.
 uint32_t interpret_uint32(std::vector<uint8_t> &data, size_t offset,
@@ -39,6 +45,15 @@ float interpret_float(std::vector<uint8_t> &data, size_t offset,
 double interpret_double(std::vector<uint8_t> &data, size_t offset,
                         bool little_endian);
 
+// Interpret num_values consecutive floating-point values of 32 or 64 bits
+// stored in raw memory, writing them as doubles into the output array. The
+// byte order is converted in bulk when it doesn't match the machine's. The
+// caller must ensure that data and output hold num_values elements.
+void interpret_floats(const uint8_t *data, size_t num_values,
+                      bool little_endian, double *output);
+void interpret_doubles(const uint8_t *data, size_t num_values,
+                       bool little_endian, double *output);
+
 }  // namespace Base64
 
 #endif /* UTILS_BASE64_HPP */
@@ -1,4 +1,5 @@
 #include <zlib.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -16,76 +17,69 @@
 int Compression::inflate(std::vector<uint8_t> &in_data,
                          std::vector<uint8_t> &out_data,
                          size_t decompressed_len) {
+    return inflate(in_data.data(), in_data.size(), out_data, decompressed_len);
+}
+
+// Decompress raw memory from in_data into the out_data vector. If the length
+// of the data after decompression is unknown, decompressed_len should be 0 and
+// the output grows as needed, starting from a guess based on the input length,
+// since the output vector is zero-filled when it grows.
+int Compression::inflate(const uint8_t *in_data, size_t in_len,
+                         std::vector<uint8_t> &out_data,
+                         size_t decompressed_len) {
     int ret;
     z_stream strm;
-    out_data.resize(decompressed_len);
 
     // Allocate inflate state.
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
     strm.avail_in = 0;
-    strm.next_in = Z_NULL;
+    strm.next_in = const_cast<uint8_t *>(in_data);
     ret = inflateInit(&strm);
     if (ret != Z_OK) {
         return ret;
     }
 
-    unsigned char *in = reinterpret_cast<unsigned char *>(&in_data[0]);
+    if (decompressed_len != 0) {
+        out_data.resize(decompressed_len);
+    } else {
+        out_data.resize(std::min<size_t>(CHUNK, std::max<size_t>(4 * in_len,
+                                                                 4096)));
+    }
     size_t bytes_decompressed = 0;
-    // Decompress until deflate stream ends or end of file.
+    // Decompress until deflate stream ends, the data is exhausted or the
+    // output reached the expected length.
     do {
         // Read the amount of CHUNK or until the end of the data.
-        if (strm.total_in + CHUNK > in_data.size()) {
-            strm.avail_in = in_data.size() - strm.total_in;
-        } else {
-            strm.avail_in = CHUNK;
+        if (strm.avail_in == 0) {
+            strm.avail_in = std::min<size_t>(CHUNK, in_len - strm.total_in);
         }
-        if (strm.avail_in == 0) {  // End of data.
-            break;
-        }
-        // Use the total bytes read as an offset for the input data.
-        strm.next_in = in + strm.total_in;
-
-        // Run inflate() on input until output buffer not full.
-        do {
-            if (decompressed_len == 0) {
-                // Decompressed length unknown, alocate a new chunk.
-                strm.avail_out = CHUNK;
-                out_data.resize(out_data.size() + CHUNK);
-            } else {
-                // Calculate amount of free bytes in output buffer.
-                if (bytes_decompressed + CHUNK > decompressed_len) {
-                    strm.avail_out = decompressed_len - bytes_decompressed;
-                } else {
-                    strm.avail_out = CHUNK;
-                }
+        if (bytes_decompressed == out_data.size()) {
+            if (decompressed_len != 0) {
+                break;
             }
+            out_data.resize(2 * out_data.size());
+        }
+        strm.next_out = &out_data[bytes_decompressed];
+        strm.avail_out = out_data.size() - bytes_decompressed;
 
-            // Use next section of output buffer as output buffer.
-            strm.next_out = reinterpret_cast<unsigned char *>(
-                &out_data[bytes_decompressed]);
-
-            ret = inflate(&strm, Z_NO_FLUSH);
-            assert(ret != Z_STREAM_ERROR);
-
-            bytes_decompressed = strm.total_out;
-
-            switch (ret) {
-                case Z_NEED_DICT:
-                    ret = Z_DATA_ERROR;
-                    (void)inflateEnd(&strm);
-                    return ret;
-                case Z_DATA_ERROR:
-                    (void)inflateEnd(&strm);
-                    return ret;
-                case Z_MEM_ERROR:
-                    (void)inflateEnd(&strm);
-                    return ret;
-            }
-        } while (strm.avail_in != 0 && strm.avail_out != 0);
-
-        // Done when inflate() says it's done.
+        ret = inflate(&strm, Z_NO_FLUSH);
+        assert(ret != Z_STREAM_ERROR);
+        bytes_decompressed = strm.total_out;
+        switch (ret) {
+            case Z_NEED_DICT:
+                ret = Z_DATA_ERROR;
+                [[fallthrough]];
+            case Z_DATA_ERROR:
+            case Z_MEM_ERROR:
+                (void)inflateEnd(&strm);
+                return ret;
+        }
+        // No progress can be made if the data ended before the stream.
+        if (ret == Z_BUF_ERROR && strm.avail_in == 0) {
+            break;
+        }
     } while (ret != Z_STREAM_END);
 
     // Output vector might be bigger than needed if the size was unknown, resize
@@ -321,3 +315,186 @@ void Compression::InflateStream::open(std::string const &filename) {
         setstate(std::ios::badbit);
     }
 }
+
+// Initialize the read-ahead parameters, the buffers are allocated by the
+// background thread as needed.
+Compression::ReadAheadInflateStreambuf::ReadAheadInflateStreambuf(
+    size_t _buffer_size, size_t _max_buffers)
+    : buffer_size(_buffer_size), max_buffers(_max_buffers) {
+    if (max_buffers == 0) {
+        max_buffers = 1;
+    }
+    setg(nullptr, nullptr, nullptr);
+}
+
+// Destructor stops the background thread and closes the input file.
+Compression::ReadAheadInflateStreambuf::~ReadAheadInflateStreambuf() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    buffer_consumed.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (in_file) {
+        fclose(in_file);
+    }
+}
+
+// Open file and start decompressing it on the background thread.
+int Compression::ReadAheadInflateStreambuf::open(std::string const &filename) {
+    if (in_file) {
+        return ERROR;
+    }
+    in_file = fopen(filename.c_str(), "rb");
+    if (in_file == NULL) {
+        return ERROR;
+    }
+    thread = std::thread(&ReadAheadInflateStreambuf::inflate_file, this);
+    return OK;
+}
+
+int Compression::ReadAheadInflateStreambuf::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return inflate_status;
+}
+
+// Swap the current buffer with the next decompressed buffer when the current
+// one has been read, waiting for the background thread if necessary.
+int Compression::ReadAheadInflateStreambuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    if (!in_file) {
+        return EOF;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    buffer_ready.wait(lock, [&] { return !ready.empty() || finished; });
+    if (ready.empty()) {
+        return EOF;
+    }
+    if (current.capacity() != 0) {
+        unused.push_back(std::move(current));
+    }
+    current = std::move(ready.front());
+    ready.pop_front();
+    lock.unlock();
+    buffer_consumed.notify_one();
+
+    setg(current.data(), current.data(), current.data() + current.size());
+    return traits_type::to_int_type(*gptr());
+}
+
+// Decompress the file into buffers of buffer_size bytes, staying at most
+// max_buffers ahead of the reader. The window bits of 15 + 32 let Zlib detect
+// if the data has a gzip or a zlib header. Files with several concatenated
+// gzip members, as produced by some parallel compression tools, are
+// decompressed as a single stream. As with gzip, zero bytes padding the file
+// after a complete member are ignored.
+void Compression::ReadAheadInflateStreambuf::inflate_file() {
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    if (inflateInit2(&strm, 15 + 32) != Z_OK) {
+        std::lock_guard<std::mutex> lock(mutex);
+        inflate_status = ERROR;
+        finished = true;
+        buffer_ready.notify_all();
+        return;
+    }
+
+    std::vector<unsigned char> in(buffer_size);
+    // A stream is complete when the last member has been fully decompressed,
+    // otherwise the file was truncated.
+    bool stream_complete = false;
+    bool done = false;
+    int result = OK;
+    while (!done) {
+        // Wait until there is room to decompress another buffer.
+        std::vector<char> out;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            buffer_consumed.wait(
+                lock, [&] { return stopped || ready.size() < max_buffers; });
+            if (stopped) {
+                break;
+            }
+            if (!unused.empty()) {
+                out = std::move(unused.back());
+                unused.pop_back();
+            }
+        }
+        out.resize(buffer_size);
+        strm.next_out = reinterpret_cast<unsigned char *>(out.data());
+        strm.avail_out = buffer_size;
+
+        // Read and inflate data until the output buffer is full.
+        while (strm.avail_out != 0) {
+            if (strm.avail_in == 0) {
+                strm.avail_in = fread(in.data(), 1, in.size(), in_file);
+                strm.next_in = in.data();
+                if (ferror(in_file)) {
+                    result = ERROR;
+                    done = true;
+                    break;
+                }
+                if (strm.avail_in == 0) {
+                    if (!stream_complete) {
+                        result = ERROR;
+                    }
+                    done = true;
+                    break;
+                }
+            }
+            if (stream_complete) {
+                while (strm.avail_in != 0 && *strm.next_in == 0) {
+                    ++strm.next_in;
+                    --strm.avail_in;
+                }
+                if (strm.avail_in == 0) {
+                    continue;
+                }
+            }
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                stream_complete = true;
+                (void)inflateReset(&strm);
+            } else if (ret == Z_OK) {
+                stream_complete = false;
+            } else if (ret != Z_BUF_ERROR) {
+                result = ERROR;
+                done = true;
+                break;
+            }
+        }
+        out.resize(buffer_size - strm.avail_out);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!out.empty()) {
+            ready.push_back(std::move(out));
+        }
+        if (done) {
+            inflate_status = result;
+            finished = true;
+        }
+        buffer_ready.notify_all();
+    }
+    (void)inflateEnd(&strm);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    buffer_ready.notify_all();
+}
+
+// Open streambuf and check for success.
+void Compression::ReadAheadInflateStream::open(std::string const &filename) {
+    int state = ReadAheadInflateStreambuf::open(filename);
+    if (state == ERROR) {
+        setstate(std::ios::badbit);
+    }
+}
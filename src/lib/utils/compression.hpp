@@ -2,8 +2,13 @@
 #define UTILS_COMPRESSION_HPP
 
 #include <zlib.h>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
 #include <streambuf>
+#include <string>
+#include <thread>
 #include <vector>
 
 // This namespace contains necessary functions to (de)compress raw data.
@@ -14,6 +19,10 @@ enum state { OK, ERROR };
 // Decompress raw data.
 int inflate(std::vector<uint8_t> &in_data, std::vector<uint8_t> &out_data,
             size_t decompressed_len);
+// Decompress in_len bytes of raw memory. The capacity of out_data is reused,
+// so a scratch vector can be passed in repeatedly without reallocating.
+int inflate(const uint8_t *in_data, size_t in_len,
+            std::vector<uint8_t> &out_data, size_t decompressed_len);
 
 // Streambuf class allows a stream to write compressed data to a file by use of
 // an intermediate buffer.
@@ -100,6 +109,78 @@ class InflateStream : private InflateStreambuf, public std::istream {
     void open(std::string const &filename);
 };
 
+// Streambuf class allows a stream to read a zlib or gzip compressed file,
+// such as an .mzML.gz file. The file is decompressed ahead of the reader on a
+// background thread into a small number of large buffers, so that
+// decompression overlaps with the processing of the data.
+class ReadAheadInflateStreambuf : public std::streambuf {
+    // Size of each of the buffers and the maximum number of buffers that can
+    // be decompressed ahead of the reader.
+    size_t buffer_size;
+    size_t max_buffers;
+
+    // File to read compressed data from.
+    FILE *in_file = nullptr;
+
+    // The buffer being read, the buffers decompressed ahead and the buffers
+    // that have already been read and can be reused.
+    std::vector<char> current;
+    std::deque<std::vector<char>> ready;
+    std::vector<std::vector<char>> unused;
+
+    // Background thread and its synchronization state.
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable buffer_ready;
+    std::condition_variable buffer_consumed;
+    bool finished = false;
+    bool stopped = false;
+    int inflate_status = OK;
+
+   public:
+    // Constructor sets buffer size and the number of read-ahead buffers.
+    ReadAheadInflateStreambuf(size_t _buffer_size = 1 << 22,
+                              size_t _max_buffers = 4);
+    // Destructor stops the background thread and closes the file.
+    virtual ~ReadAheadInflateStreambuf();
+
+    // Open file and start decompressing it on the background thread.
+    int open(std::string const &filename);
+
+    // Returns ERROR if the file could not be decompressed, for example if it
+    // is truncated or corrupt. The reader sees the end of the stream at the
+    // point where the error occurred. Zero padding after the compressed data
+    // is not an error.
+    int status();
+
+   private:
+    virtual int underflow();  // Get the next buffer when the current is empty.
+    void inflate_file();      // Decompress the file on the background thread.
+};
+
+// ReadAheadInflateStream uses the ReadAheadInflateStreambuf to decompress the
+// data read from a file.
+class ReadAheadInflateStream : private ReadAheadInflateStreambuf,
+                               public std::istream {
+   public:
+    ReadAheadInflateStream(size_t buffer_size = 1 << 22,
+                           size_t max_buffers = 4)
+        : ReadAheadInflateStreambuf(buffer_size, max_buffers),
+          std::istream(this) {}
+    ReadAheadInflateStream(std::string const &filename,
+                           size_t buffer_size = 1 << 22,
+                           size_t max_buffers = 4)
+        : ReadAheadInflateStreambuf(buffer_size, max_buffers),
+          std::istream(this) {
+        open(filename);
+    }
+
+    // Open streambuf and check for success.
+    void open(std::string const &filename);
+
+    using ReadAheadInflateStreambuf::status;
+};
+
 }  // namespace Compression
 
 #endif /* UTILS_COMPRESSION_HPP */
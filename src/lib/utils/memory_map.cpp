@@ -0,0 +1,126 @@
+#ifdef _WIN32
+// Keep windows.h from defining the ERROR, min and max macros, which clash with
+// the MemoryMap::ERROR enumerator and std::min/std::max.
+#ifndef NOGDI
+#define NOGDI
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/memory_map.hpp"
+
+#ifdef _WIN32
+MemoryMap::MappedFile::~MappedFile() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+    }
+}
+
+int MemoryMap::MappedFile::open(std::string const &filename) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return ERROR;
+    }
+    file_handle = file;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        return ERROR;
+    }
+    size = static_cast<size_t>(file_size.QuadPart);
+    if (size == 0) {
+        // Empty files can't be mapped, but are valid.
+        return OK;
+    }
+    mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_handle == NULL) {
+        return ERROR;
+    }
+    data = static_cast<const char *>(
+        MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (data == NULL) {
+        return ERROR;
+    }
+    return OK;
+}
+#else
+MemoryMap::MappedFile::~MappedFile() {
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+}
+
+int MemoryMap::MappedFile::open(std::string const &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return ERROR;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return ERROR;
+    }
+    size = static_cast<size_t>(file_stat.st_size);
+    if (size == 0) {
+        // Empty files can't be mapped, but are valid.
+        close(fd);
+        return OK;
+    }
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping remains valid after closing the file descriptor.
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        size = 0;
+        return ERROR;
+    }
+    data = static_cast<const char *>(ptr);
+    return OK;
+}
+#endif
+
+// Initialize the get area to the given buffer. The buffer is never written to.
+MemoryMap::MemoryStreambuf::MemoryStreambuf(std::string_view buffer) {
+    char *begin = const_cast<char *>(buffer.data());
+    setg(begin, begin, begin + buffer.size());
+}
+
+// Move the read position relative to the beginning, end or current position.
+std::streambuf::pos_type MemoryMap::MemoryStreambuf::seekoff(
+    off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    char *target = nullptr;
+    if (dir == std::ios_base::beg) {
+        target = eback() + off;
+    } else if (dir == std::ios_base::cur) {
+        target = gptr() + off;
+    } else {
+        target = egptr() + off;
+    }
+    if (target < eback() || target > egptr()) {
+        return pos_type(off_type(-1));
+    }
+    setg(eback(), target, egptr());
+    return pos_type(target - eback());
+}
+
+// Move the read position to an absolute position from the beginning.
+std::streambuf::pos_type MemoryMap::MemoryStreambuf::seekpos(
+    pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
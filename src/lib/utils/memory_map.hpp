@@ -0,0 +1,68 @@
+#ifndef UTILS_MEMORYMAP_HPP
+#define UTILS_MEMORYMAP_HPP
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+// This namespace contains the necessary classes to access the contents of a
+// file directly from memory without reading it through a buffered stream.
+namespace MemoryMap {
+
+enum state { OK, ERROR };
+
+// A read-only memory mapping of an entire file. The mapping is released when
+// the object is destroyed, so any view obtained from it must not outlive it.
+class MappedFile {
+    // Start and size of the mapped region.
+    const char *data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    // Handles for the opened file and the mapping object.
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    // Destructor unmaps the file from memory.
+    ~MappedFile();
+
+    // Open the file and map its contents into memory.
+    int open(std::string const &filename);
+
+    // Access the mapped region.
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// Streambuf class allows a stream to read from an existing region of memory,
+// for example a MappedFile, without copying it.
+class MemoryStreambuf : public std::streambuf {
+   public:
+    MemoryStreambuf(std::string_view buffer);
+
+    // Access the part of the buffer that has not been read yet.
+    std::string_view unread() const {
+        return std::string_view(gptr(), egptr() - gptr());
+    }
+
+   private:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                             std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+};
+
+// MemoryStream uses the MemoryStreambuf to read the data from memory.
+class MemoryStream : private MemoryStreambuf, public std::istream {
+   public:
+    MemoryStream(std::string_view buffer)
+        : MemoryStreambuf(buffer), std::istream(this) {}
+};
+
+}  // namespace MemoryMap
+
+#endif /* UTILS_MEMORYMAP_HPP */
@@ -0,0 +1,168 @@
+#include <cmath>
+#include <cstring>
+
+#include "numpress.hpp"
+
+// Decode the 8 byte big endian double used as fixed point by the linear and
+// slof algorithms.
+double decode_fixed_point(const std::vector<uint8_t> &data) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        bits = (bits << 8) | data[i];
+    }
+    double fixed_point;
+    std::memcpy(&fixed_point, &bits, sizeof(fixed_point));
+    return fixed_point;
+}
+
+// Read the next half byte from the data, starting with the most significant
+// half of each byte.
+uint8_t read_half_byte(const std::vector<uint8_t> &data, size_t &position,
+                       bool &half) {
+    uint8_t half_byte = 0;
+    if (!half) {
+        half_byte = data[position] >> 4;
+    } else {
+        half_byte = data[position] & 0xf;
+        ++position;
+    }
+    half = !half;
+    return half_byte;
+}
+
+// Decode a 32 bit integer stored as a variable number of half bytes. The first
+// half byte is the number of leading half bytes that are zero (0-8) or, if
+// greater than 8, the number of leading half bytes that are 0xf plus 8. The
+// remaining half bytes follow, least significant first. Returns false if the
+// data ends before the integer is complete.
+bool decode_int(const std::vector<uint8_t> &data, size_t &position, bool &half,
+                uint32_t &value) {
+    uint8_t head = read_half_byte(data, position, half);
+    value = 0;
+    size_t n = head;
+    if (head > 8) {
+        n = head - 8;
+        for (size_t i = 0; i < n; ++i) {
+            value |= 0xf0000000u >> (4 * i);
+        }
+    }
+    if (n >= 8) {
+        return true;
+    }
+    // Check that the remaining half bytes are available.
+    size_t half_bytes_left = (data.size() - position) * 2 - (half ? 1 : 0);
+    if (half_bytes_left < 8 - n) {
+        return false;
+    }
+    for (size_t i = n; i < 8; ++i) {
+        uint32_t half_byte = read_half_byte(data, position, half);
+        value |= half_byte << ((i - n) * 4);
+    }
+    return true;
+}
+
+// Check if we are at the last half byte of the data and it is zero, in which
+// case it is padding added to complete the last byte.
+bool is_padding(const std::vector<uint8_t> &data, size_t position, bool half) {
+    return position == data.size() - 1 && half && (data[position] & 0xf) == 0;
+}
+
+int Numpress::decode_linear(const std::vector<uint8_t> &data,
+                            std::vector<double> &output) {
+    output.clear();
+    // The data starts with the fixed point followed by the first two values
+    // as 4 byte little endian integers.
+    if (data.size() < 8) {
+        return ERROR;
+    }
+    double fixed_point = decode_fixed_point(data);
+    if (data.size() == 8) {
+        return OK;
+    }
+    if (data.size() < 12 || (data.size() > 12 && data.size() < 16)) {
+        return ERROR;
+    }
+    int64_t ints[3] = {0, 0, 0};
+    for (size_t i = 0; i < 4; ++i) {
+        ints[1] |= static_cast<int64_t>(data[8 + i]) << (i * 8);
+    }
+    output.reserve(2 + (data.size() - 12) * 2);
+    output.push_back(ints[1] / fixed_point);
+    if (data.size() == 12) {
+        return OK;
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        ints[2] |= static_cast<int64_t>(data[12 + i]) << (i * 8);
+    }
+    output.push_back(ints[2] / fixed_point);
+
+    // The rest of the values are stored as the difference to a linear
+    // extrapolation of the previous two.
+    size_t position = 16;
+    bool half = false;
+    while (position < data.size()) {
+        if (is_padding(data, position, half)) {
+            break;
+        }
+        uint32_t diff = 0;
+        if (!decode_int(data, position, half, diff)) {
+            return ERROR;
+        }
+        ints[0] = ints[1];
+        ints[1] = ints[2];
+        int64_t extrapolation = ints[1] + (ints[1] - ints[0]);
+        ints[2] = extrapolation + static_cast<int32_t>(diff);
+        output.push_back(ints[2] / fixed_point);
+    }
+    return OK;
+}
+
+int Numpress::decode_pic(const std::vector<uint8_t> &data,
+                         std::vector<double> &output) {
+    output.clear();
+    output.reserve(data.size() * 2);
+    size_t position = 0;
+    bool half = false;
+    while (position < data.size()) {
+        if (is_padding(data, position, half)) {
+            break;
+        }
+        uint32_t value = 0;
+        if (!decode_int(data, position, half, value)) {
+            return ERROR;
+        }
+        output.push_back(value);
+    }
+    return OK;
+}
+
+int Numpress::decode_slof(const std::vector<uint8_t> &data,
+                          std::vector<double> &output) {
+    output.clear();
+    // The data starts with the fixed point followed by the values as 2 byte
+    // little endian integers.
+    if (data.size() < 8 || data.size() % 2 != 0) {
+        return ERROR;
+    }
+    double fixed_point = decode_fixed_point(data);
+    output.resize((data.size() - 8) / 2);
+    for (size_t i = 0; i < output.size(); ++i) {
+        uint16_t value = data[8 + 2 * i] | (data[8 + 2 * i + 1] << 8);
+        output[i] = std::exp(value / fixed_point) - 1;
+    }
+    return OK;
+}
+
+int Numpress::decode(Type type, const std::vector<uint8_t> &data,
+                     std::vector<double> &output) {
+    switch (type) {
+        case LINEAR:
+            return decode_linear(data, output);
+        case PIC:
+            return decode_pic(data, output);
+        case SLOF:
+            return decode_slof(data, output);
+        default:
+            return ERROR;
+    }
+}
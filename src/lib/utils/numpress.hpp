@@ -0,0 +1,45 @@
+#ifndef UTILS_NUMPRESS_HPP
+#define UTILS_NUMPRESS_HPP
+
+#include <cstdint>
+#include <vector>
+
+// This namespace contains functions to decode binary data arrays compressed
+// with the MS-Numpress algorithms, as described in:
+//
+//     Teleman J. et al. Numerical compression schemes for proteomics mass
+//     spectrometry data. Mol Cell Proteomics. 2014;13(6):1537-1542.
+//
+// The encoded data is usually base64-encoded and can be further compressed
+// with zlib, so it has to be decoded and decompressed before calling these
+// functions.
+namespace Numpress {
+
+enum state { OK, ERROR };
+
+// The MS-Numpress algorithm used to compress a binary data array.
+enum Type : uint8_t { NONE = 0, LINEAR = 1, PIC = 2, SLOF = 3 };
+
+// Decode data compressed with linear prediction, used for m/z values. The
+// result is returned in the output vector. Returns ERROR if the data is
+// corrupt.
+int decode_linear(const std::vector<uint8_t> &data,
+                  std::vector<double> &output);
+
+// Decode data compressed as positive integers, used for ion counts. The
+// result is returned in the output vector. Returns ERROR if the data is
+// corrupt.
+int decode_pic(const std::vector<uint8_t> &data, std::vector<double> &output);
+
+// Decode data compressed as short logged floats, used for intensities. The
+// result is returned in the output vector. Returns ERROR if the data is
+// corrupt.
+int decode_slof(const std::vector<uint8_t> &data, std::vector<double> &output);
+
+// Decode data compressed with the given algorithm.
+int decode(Type type, const std::vector<uint8_t> &data,
+           std::vector<double> &output);
+
+}  // namespace Numpress
+
+#endif /* UTILS_NUMPRESS_HPP */
@@ -0,0 +1,139 @@
+#include <cstring>
+
+#include "scan_codec.hpp"
+
+uint64_t to_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double from_bits(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Find the number of trailing zero bits that all the values have in common.
+uint8_t common_trailing_zeros(const double *values, size_t num_values) {
+    uint64_t common = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+        common |= to_bits(values[i]);
+    }
+    uint8_t shift = 0;
+    if (common == 0) {
+        return shift;
+    }
+    while (((common >> shift) & 1) == 0) {
+        ++shift;
+    }
+    return shift;
+}
+
+void write_varint(uint64_t value, std::vector<uint8_t> &output) {
+    while (value >= 0x80) {
+        output.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    output.push_back(value);
+}
+
+// Read a variable length integer starting at the given position. Returns false
+// if the data ends before the integer is complete or if it is longer than the
+// 10 bytes needed for 64 bits.
+bool read_varint(const uint8_t *data, size_t size, size_t &position,
+                 uint64_t &value) {
+    value = 0;
+    for (size_t i = 0; i < 10; ++i) {
+        if (position == size) {
+            return false;
+        }
+        uint8_t byte = data[position++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ScanCodec::encode_mz(const std::vector<double> &values,
+                          std::vector<uint8_t> &output) {
+    encode_mz(values.data(), values.size(), output);
+}
+
+void ScanCodec::encode_mz(const double *values, size_t num_values,
+                          std::vector<uint8_t> &output) {
+    uint8_t shift = common_trailing_zeros(values, num_values);
+    output.push_back(shift);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+        uint64_t bits = to_bits(values[i]) >> shift;
+        // The difference is zigzag encoded, so that unsorted values are still
+        // encoded correctly.
+        int64_t diff = static_cast<int64_t>(bits - previous);
+        write_varint((static_cast<uint64_t>(diff) << 1) ^
+                         static_cast<uint64_t>(diff >> 63),
+                     output);
+        previous = bits;
+    }
+}
+
+void ScanCodec::encode_intensity(const std::vector<double> &values,
+                                 std::vector<uint8_t> &output) {
+    encode_intensity(values.data(), values.size(), output);
+}
+
+void ScanCodec::encode_intensity(const double *values, size_t num_values,
+                                 std::vector<uint8_t> &output) {
+    uint8_t shift = common_trailing_zeros(values, num_values);
+    output.push_back(shift);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+        uint64_t bits = to_bits(values[i]) >> shift;
+        write_varint(bits ^ previous, output);
+        previous = bits;
+    }
+}
+
+int ScanCodec::decode_mz(const uint8_t *data, size_t size, size_t num_values,
+                         std::vector<double> &output) {
+    if (size == 0 || data[0] >= 64) {
+        return ERROR;
+    }
+    uint8_t shift = data[0];
+    size_t position = 1;
+    output.resize(num_values);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+        uint64_t zigzag = 0;
+        if (!read_varint(data, size, position, zigzag)) {
+            return ERROR;
+        }
+        uint64_t diff = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+        previous += diff;
+        output[i] = from_bits(previous << shift);
+    }
+    return OK;
+}
+
+int ScanCodec::decode_intensity(const uint8_t *data, size_t size,
+                                size_t num_values,
+                                std::vector<double> &output) {
+    if (size == 0 || data[0] >= 64) {
+        return ERROR;
+    }
+    uint8_t shift = data[0];
+    size_t position = 1;
+    output.resize(num_values);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+        uint64_t bits = 0;
+        if (!read_varint(data, size, position, bits)) {
+            return ERROR;
+        }
+        previous ^= bits;
+        output[i] = from_bits(previous << shift);
+    }
+    return OK;
+}
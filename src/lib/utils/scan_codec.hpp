@@ -0,0 +1,43 @@
+#ifndef UTILS_SCAN_CODEC_HPP
+#define UTILS_SCAN_CODEC_HPP
+
+#include <cstdint>
+#include <vector>
+
+// This namespace contains functions to losslessly compress the mz and
+// intensity arrays of a scan in memory. The values are encoded from their
+// IEEE 754 bit patterns, so that decoding gives back exactly the same doubles.
+// The trailing zero bits common to all values, for example the extra bits of
+// values read with 32 bit precision, are dropped first. Then, the mz are
+// stored as the difference to the previous value and the intensities as the
+// exclusive or with the previous value, since consecutive intensities usually
+// share the sign and exponent bits. The results are written as variable length
+// integers of 7 bits per byte.
+namespace ScanCodec {
+
+enum state { OK, ERROR };
+
+// Encode the given mz values, which are expected to be sorted, appending the
+// result to the output vector.
+void encode_mz(const std::vector<double> &values, std::vector<uint8_t> &output);
+// Encode the first num_values values of raw memory.
+void encode_mz(const double *values, size_t num_values,
+               std::vector<uint8_t> &output);
+
+// Encode the given intensity values, appending the result to the output
+// vector.
+void encode_intensity(const std::vector<double> &values,
+                      std::vector<uint8_t> &output);
+void encode_intensity(const double *values, size_t num_values,
+                      std::vector<uint8_t> &output);
+
+// Decode num_values mz/intensity values from the given data into the output
+// vector, which is resized accordingly. Returns ERROR if the data is corrupt.
+int decode_mz(const uint8_t *data, size_t size, size_t num_values,
+              std::vector<double> &output);
+int decode_intensity(const uint8_t *data, size_t size, size_t num_values,
+                     std::vector<double> &output);
+
+}  // namespace ScanCodec
+
+#endif /* UTILS_SCAN_CODEC_HPP */
@@ -8,6 +8,29 @@ namespace Search {
 
 size_t lower_bound(const std::vector<double> &haystack, double needle);
 
+// Same as above, for any array of the given size that can be indexed with
+// operator[], such as a pointer.
+template <typename T>
+size_t lower_bound(const T &haystack, size_t size, double needle) {
+    size_t index = 0;
+    size_t l = 0;
+    size_t r = size - 1;
+    while (l <= r) {
+        index = (l + r) / 2;
+        if (haystack[index] < needle) {
+            l = index + 1;
+        } else if (haystack[index] > needle) {
+            if (index == 0) {
+                break;
+            }
+            r = index - 1;
+        } else {
+            break;
+        }
+    }
+    return index;
+}
+
 // Generalize lower_bound search that uses a custom comparison fuction.
 template <class T>
 struct KeySort {
@@ -24,13 +47,13 @@ size_t lower_bound(const std::vector<KeySort<T>> &haystack, T needle) {
         if (haystack[index].sorting_key < needle) {
             l = index + 1;
         } else if (haystack[index].sorting_key > needle) {
+            if (index == 0) {
+                break;
+            }
             r = index - 1;
         } else {
             break;
         }
-        if (index == 0) {
-            break;
-        }
     }
     return index;
 }
@@ -488,6 +488,15 @@ def default_parameters(instrument, avg_fwhm_rt):
             'max_mz': 100000,
             'min_rt': 0,
             'max_rt': 100000,
+            # Only keep the metadata and precursor information of the MS2
+            # scans, which is all that is needed for linking, skipping the
+            # decoding of their spectra. The MS2 spectra are then not
+            # available for any other analysis, and scans are kept even if
+            # they have no points in the m/z range.
+            'ms2_headers_only': False,
+            # Centroid the scans acquired in profile mode while they are read,
+            # which reduces the number of points by an order of magnitude.
+            'centroid_profile_scans': False,
             #
             # Annotation linking.
             #
@@ -577,6 +586,14 @@ def _custom_log(msg, logger):
         logger.info(msg)
     print(msg)
 
+def _split_raw_path(raw_path):
+    # Gzip compressed raw files keep the extension of the uncompressed format,
+    # for example `sample.mzML.gz`.
+    base_name, file_extension = os.path.splitext(raw_path)
+    if file_extension.lower() == '.gz':
+        base_name, file_extension = os.path.splitext(base_name)
+    return base_name, file_extension
+
 def parse_raw_files(params, output_dir, logger=None, force_override=False):
     _custom_log('Starting raw data conversion', logger)
     time_start = time.time()
@@ -585,67 +602,28 @@ def parse_raw_files(params, output_dir, logger=None, force_override=False):
         raw_path = file['raw_path']
         stem = file['stem']
 
-        # Check if file has already been processed.
-        out_path = os.path.join(output_dir, 'raw', "{}.ms1".format(stem))
-        if os.path.exists(out_path) and not force_override:
-            continue
-
-        # File extension.
-        file_extension = os.path.splitext(raw_path)[1]
-
-        # Read raw files (MS1).
-        _custom_log('Reading MS1: {}'.format(raw_path), logger)
-        if file_extension.lower() == '.mzxml':
-            raw_data = pastaq.read_mzxml(
-                raw_path,
-                min_mz=params['min_mz'],
-                max_mz=params['max_mz'],
-                min_rt=params['min_rt'],
-                max_rt=params['max_rt'],
-                instrument_type=params['instrument_type'],
-                resolution_ms1=params['resolution_ms1'],
-                resolution_msn=params['resolution_msn'],
-                reference_mz=params['reference_mz'],
-                fwhm_rt=params['avg_fwhm_rt'],
-                polarity=params['polarity'],
-                ms_level=1,
-            )
-        elif file_extension.lower() == '.mzml':
-            raw_data = pastaq.read_mzml(
-                raw_path,
-                min_mz=params['min_mz'],
-                max_mz=params['max_mz'],
-                min_rt=params['min_rt'],
-                max_rt=params['max_rt'],
-                instrument_type=params['instrument_type'],
-                resolution_ms1=params['resolution_ms1'],
-                resolution_msn=params['resolution_msn'],
-                reference_mz=params['reference_mz'],
-                fwhm_rt=params['avg_fwhm_rt'],
-                polarity=params['polarity'],
-                ms_level=1,
-            )
-
-        # Write raw_data to disk (MS1).
-        _custom_log('Writing MS1: {}'.format(out_path), logger)
-        raw_data.dump(out_path)
-
-    for file in params['input_files']:
-        raw_path = file['raw_path']
-        stem = file['stem']
-
-        # Check if file has already been processed.
-        out_path = os.path.join(output_dir, 'raw', "{}.ms2".format(stem))
-        if os.path.exists(out_path) and not force_override:
+        # Check which MS levels have already been processed. The remaining
+        # ones are read together in a single pass over the file.
+        ms_levels = []
+        out_paths = []
+        for ms_level in [1, 2]:
+            out_path = os.path.join(
+                output_dir, 'raw', "{}.ms{}".format(stem, ms_level))
+            if os.path.exists(out_path) and not force_override:
+                continue
+            ms_levels.append(ms_level)
+            out_paths.append(out_path)
+        if len(ms_levels) == 0:
             continue
 
-        # File extension.
-        file_extension = os.path.splitext(raw_path)[1]
+        # File extension, ignoring the gzip extension of compressed files.
+        file_extension = _split_raw_path(raw_path)[1]
 
-        # Read raw files (MS2).
-        _custom_log('Reading MS2: {}'.format(raw_path), logger)
+        # Read raw files (MS1/MS2).
+        _custom_log('Reading: {}'.format(raw_path), logger)
+        outputs = [(ms_level, params['polarity']) for ms_level in ms_levels]
         if file_extension.lower() == '.mzxml':
-            raw_data = pastaq.read_mzxml(
+            raw_data = pastaq.read_mzxml_multi(
                 raw_path,
                 min_mz=params['min_mz'],
                 max_mz=params['max_mz'],
@@ -656,11 +634,12 @@ def parse_raw_files(params, output_dir, logger=None, force_override=False):
                 resolution_msn=params['resolution_msn'],
                 reference_mz=params['reference_mz'],
                 fwhm_rt=params['avg_fwhm_rt'],
-                polarity=params['polarity'],
-                ms_level=2,
+                outputs=outputs,
+                msn_headers_only=params['ms2_headers_only'],
+                centroid_profile=params['centroid_profile_scans'],
             )
         elif file_extension.lower() == '.mzml':
-            raw_data = pastaq.read_mzml(
+            raw_data = pastaq.read_mzml_multi(
                 raw_path,
                 min_mz=params['min_mz'],
                 max_mz=params['max_mz'],
@@ -671,13 +650,15 @@ def parse_raw_files(params, output_dir, logger=None, force_override=False):
                 resolution_msn=params['resolution_msn'],
                 reference_mz=params['reference_mz'],
                 fwhm_rt=params['avg_fwhm_rt'],
-                polarity=params['polarity'],
-                ms_level=2,
+                outputs=outputs,
+                msn_headers_only=params['ms2_headers_only'],
+                centroid_profile=params['centroid_profile_scans'],
             )
 
-        # Write raw_data to disk (MS2).
-        _custom_log('Writing MS2: {}'.format(out_path), logger)
-        raw_data.dump(out_path)
+        # Write raw_data to disk (MS1/MS2).
+        for ms_level, out_path, data in zip(ms_levels, out_paths, raw_data):
+            _custom_log('Writing MS{}: {}'.format(ms_level, out_path), logger)
+            data.dump(out_path)
 
     elapsed_time = datetime.timedelta(seconds=time.time()-time_start)
     _custom_log('Finished raw data parsing in {}'.format(elapsed_time), logger)
@@ -1718,8 +1699,10 @@ def dda_pipeline_summary(params, output_dir, logger):
             raw_data = pastaq.read_raw_data(in_path)
             summary_log.info('        MS2')
             summary_log.info('            number of scans: {}'.format(len(raw_data.scans)))
-            summary_log.info('            min_mz: {}'.format(raw_data.min_mz))
-            summary_log.info('            max_mz: {}'.format(raw_data.max_mz))
+            # Scans read without their points have no m/z range.
+            if np.isfinite(raw_data.min_mz):
+                summary_log.info('            min_mz: {}'.format(raw_data.min_mz))
+                summary_log.info('            max_mz: {}'.format(raw_data.max_mz))
             summary_log.info('            min_rt: {}'.format(raw_data.min_rt))
             summary_log.info('            max_rt: {}'.format(raw_data.max_rt))
 
@@ -2485,7 +2468,7 @@ def dda_pipeline(
         # Obtain the stem for this file if not manually specified.
         if 'stem' not in file:
             base_name = os.path.basename(file['raw_path'])
-            base_name = os.path.splitext(base_name)
+            base_name = _split_raw_path(base_name)
             file['stem'] = base_name[0]
 
         # Check that all files contain a group, if not, assign the default
@@ -24,6 +24,7 @@
 #include "raw_data/raw_data_serialize.hpp"
 #include "raw_data/xml_reader.hpp"
 #include "utils/compression.hpp"
+#include "utils/memory_map.hpp"
 #include "utils/search.hpp"
 #include "utils/serialization.hpp"
 #include "warp2d/warp2d.hpp"
@@ -32,61 +33,82 @@
 namespace py = pybind11;
 
 namespace PythonAPI {
-RawData::RawData read_mzxml(std::string &input_file, double min_mz,
-                            double max_mz, double min_rt, double max_rt,
-                            std::string instrument_type_str,
-                            double resolution_ms1, double resolution_msn,
-                            double reference_mz, double fwhm_rt,
-                            std::string polarity_str, size_t ms_level) {
-    pybind11::gil_scoped_release release;
-    // Setup infinite range if no point was specified.
-    min_rt = min_rt < 0 ? 0 : min_rt;
-    max_rt = max_rt < 0 ? std::numeric_limits<double>::infinity() : max_rt;
-    min_mz = min_mz < 0 ? 0 : min_mz;
-    max_mz = max_mz < 0 ? std::numeric_limits<double>::infinity() : max_mz;
-
-    // Parse the instrument type.
-    auto instrument_type = Instrument::UNKNOWN;
+// Parse the instrument type from its name.
+Instrument::Type parse_instrument_type(std::string instrument_type_str) {
     for (auto &ch : instrument_type_str) {
         ch = std::tolower(ch);
     }
     if (instrument_type_str == "orbitrap") {
-        instrument_type = Instrument::ORBITRAP;
+        return Instrument::ORBITRAP;
     } else if (instrument_type_str == "tof") {
-        instrument_type = Instrument::TOF;
-    } else if (instrument_type_str == "quad" || instrument_type_str == "quadrupole") {
-        instrument_type = Instrument::QUAD;
-    } else if (instrument_type_str == "fticr" || instrument_type_str == "ft-icr" ) {
-        instrument_type = Instrument::FTICR;
-    } else {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "the given instrument is not supported";
-        throw std::invalid_argument(error_stream.str());
+        return Instrument::TOF;
+    } else if (instrument_type_str == "quad" ||
+               instrument_type_str == "quadrupole") {
+        return Instrument::QUAD;
+    } else if (instrument_type_str == "fticr" ||
+               instrument_type_str == "ft-icr") {
+        return Instrument::FTICR;
     }
-    // Parse the polarity.
-    auto polarity = Polarity::BOTH;
+    pybind11::gil_scoped_acquire acquire;
+    std::ostringstream error_stream;
+    error_stream << "the given instrument is not supported";
+    throw std::invalid_argument(error_stream.str());
+}
+
+// Parse the polarity from its name. An empty string selects both polarities.
+Polarity::Type parse_polarity(std::string polarity_str) {
     for (auto &ch : polarity_str) {
         ch = std::tolower(ch);
     }
     if (polarity_str == "" || polarity_str == "both" || polarity_str == "+-" ||
         polarity_str == "-+") {
-        polarity = Polarity::BOTH;
+        return Polarity::BOTH;
     } else if (polarity_str == "+" || polarity_str == "pos" ||
                polarity_str == "positive") {
-        polarity = Polarity::POSITIVE;
+        return Polarity::POSITIVE;
     } else if (polarity_str == "-" || polarity_str == "neg" ||
                polarity_str == "negative") {
-        polarity = Polarity::NEGATIVE;
-    } else {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "the given polarity is not supported. choose "
-                        "between '+', '-', 'both' (default)";
-        throw std::invalid_argument(error_stream.str());
+        return Polarity::NEGATIVE;
+    }
+    pybind11::gil_scoped_acquire acquire;
+    std::ostringstream error_stream;
+    error_stream << "the given polarity is not supported. choose "
+                    "between '+', '-', 'both' (default)";
+    throw std::invalid_argument(error_stream.str());
+}
+
+// Parse the (ms_level, polarity) pairs that select the scans of each output.
+// If msn_headers_only is set, the outputs for MSn scans only keep the scan
+// metadata and precursor information. If centroid_profile is set, profile mode
+// scans are centroided while they are read.
+std::vector<XmlReader::ScanFilter> parse_scan_filters(
+    const std::vector<std::tuple<size_t, std::string>> &outputs,
+    bool msn_headers_only, bool centroid_profile) {
+    std::vector<XmlReader::ScanFilter> filters;
+    for (const auto &[ms_level, polarity_str] : outputs) {
+        filters.push_back({ms_level, parse_polarity(polarity_str),
+                           msn_headers_only && ms_level > 1,
+                           centroid_profile});
+    }
+    return filters;
+}
+
+// Check if the file has a .gz extension, in which case it is decompressed
+// while it is being read.
+bool is_gzip_file(const std::string &file_name) {
+    if (file_name.size() < 3) {
+        return false;
+    }
+    auto extension = file_name.substr(file_name.size() - 3);
+    for (auto &ch : extension) {
+        ch = std::tolower(ch);
     }
+    return extension == ".gz";
+}
 
-    // Sanity check the min/max rt/mz.
+// Sanity check the min/max rt/mz.
+void check_mz_rt_range(double min_mz, double max_mz, double min_rt,
+                       double max_rt) {
     if (min_rt >= max_rt) {
         pybind11::gil_scoped_acquire acquire;
         std::ostringstream error_stream;
@@ -101,20 +123,71 @@ RawData::RawData read_mzxml(std::string &input_file, double min_mz,
                      << ", max_mz: " << max_mz << ")";
         throw std::invalid_argument(error_stream.str());
     }
+}
 
-    // Open file stream.
-    std::ifstream stream;
-    stream.open(input_file);
-    if (!stream) {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "error: couldn't open input file" << input_file;
-        throw std::invalid_argument(error_stream.str());
-    }
+std::vector<RawData::RawData> read_mzxml_multi(
+    std::string &input_file, double min_mz, double max_mz, double min_rt,
+    double max_rt, std::string instrument_type_str, double resolution_ms1,
+    double resolution_msn, double reference_mz, double fwhm_rt,
+    std::vector<std::tuple<size_t, std::string>> outputs,
+    bool msn_headers_only, bool centroid_profile, size_t max_threads) {
+    pybind11::gil_scoped_release release;
+    // Setup infinite range if no point was specified.
+    min_rt = min_rt < 0 ? 0 : min_rt;
+    max_rt = max_rt < 0 ? std::numeric_limits<double>::infinity() : max_rt;
+    min_mz = min_mz < 0 ? 0 : min_mz;
+    max_mz = max_mz < 0 ? std::numeric_limits<double>::infinity() : max_mz;
 
-    auto raw_data = XmlReader::read_mzxml(
-        stream, min_mz, max_mz, min_rt, max_rt, instrument_type, resolution_ms1,
-        resolution_msn, reference_mz, polarity, ms_level);
+    auto instrument_type = parse_instrument_type(instrument_type_str);
+    auto filters =
+        parse_scan_filters(outputs, msn_headers_only, centroid_profile);
+    check_mz_rt_range(min_mz, max_mz, min_rt, max_rt);
+
+    // If the file is indexed, the scans within the retention time range are
+    // decoded independently of each other. Otherwise we read the entire file
+    // sequentially. Compressed files can't use the index and are decompressed
+    // ahead of the parser on a separate thread.
+    std::optional<std::vector<RawData::RawData>> raw_data;
+    if (is_gzip_file(input_file)) {
+        Compression::ReadAheadInflateStream stream(input_file);
+        if (!stream) {
+            pybind11::gil_scoped_acquire acquire;
+            std::ostringstream error_stream;
+            error_stream << "error: couldn't open input file" << input_file;
+            throw std::invalid_argument(error_stream.str());
+        }
+        raw_data = XmlReader::read_mzxml_parallel(
+            stream, min_mz, max_mz, min_rt, max_rt, instrument_type,
+            resolution_ms1, resolution_msn, reference_mz, filters, max_threads);
+        if (stream.status() != Compression::OK) {
+            raw_data = std::nullopt;
+        }
+    } else {
+        // Map the file into memory.
+        MemoryMap::MappedFile file;
+        if (file.open(input_file) != MemoryMap::OK) {
+            pybind11::gil_scoped_acquire acquire;
+            std::ostringstream error_stream;
+            error_stream << "error: couldn't open input file" << input_file;
+            throw std::invalid_argument(error_stream.str());
+        }
+        auto index = XmlReader::read_mzxml_index(file.view());
+        if (index) {
+            auto [first_scan, last_scan] = XmlReader::find_mzxml_scans(
+                file.view(), index.value(), min_rt, max_rt);
+            raw_data = XmlReader::read_mzxml_indexed(
+                file.view(), index.value(), first_scan, last_scan, min_mz,
+                max_mz, min_rt, max_rt, instrument_type, resolution_ms1,
+                resolution_msn, reference_mz, filters, max_threads);
+        }
+        if (!raw_data) {
+            MemoryMap::MemoryStream stream(file.view());
+            raw_data = XmlReader::read_mzxml_parallel(
+                stream, min_mz, max_mz, min_rt, max_rt, instrument_type,
+                resolution_ms1, resolution_msn, reference_mz, filters,
+                max_threads);
+        }
+    }
     if (!raw_data) {
         pybind11::gil_scoped_acquire acquire;
         std::ostringstream error_stream;
@@ -122,18 +195,36 @@ RawData::RawData read_mzxml(std::string &input_file, double min_mz,
                      << input_file;
         throw std::invalid_argument(error_stream.str());
     }
-    raw_data.value().fwhm_rt = fwhm_rt;
+    for (auto &output : raw_data.value()) {
+        output.fwhm_rt = fwhm_rt;
+    }
     pybind11::gil_scoped_acquire acquire;
 
     return raw_data.value();
 }
 
-RawData::RawData read_mzml(std::string &input_file, double min_mz,
-                           double max_mz, double min_rt, double max_rt,
-                           std::string instrument_type_str,
-                           double resolution_ms1, double resolution_msn,
-                           double reference_mz, double fwhm_rt,
-                           std::string polarity_str, size_t ms_level) {
+RawData::RawData read_mzxml(std::string &input_file, double min_mz,
+                            double max_mz, double min_rt, double max_rt,
+                            std::string instrument_type_str,
+                            double resolution_ms1, double resolution_msn,
+                            double reference_mz, double fwhm_rt,
+                            std::string polarity_str, size_t ms_level,
+                            bool msn_headers_only, bool centroid_profile,
+                            size_t max_threads) {
+    auto raw_data = read_mzxml_multi(
+        input_file, min_mz, max_mz, min_rt, max_rt, instrument_type_str,
+        resolution_ms1, resolution_msn, reference_mz, fwhm_rt,
+        {{ms_level, polarity_str}}, msn_headers_only, centroid_profile,
+        max_threads);
+    return std::move(raw_data[0]);
+}
+
+std::vector<RawData::RawData> read_mzml_multi(
+    std::string &input_file, double min_mz, double max_mz, double min_rt,
+    double max_rt, std::string instrument_type_str, double resolution_ms1,
+    double resolution_msn, double reference_mz, double fwhm_rt,
+    std::vector<std::tuple<size_t, std::string>> outputs,
+    bool msn_headers_only, bool centroid_profile, size_t max_threads) {
     pybind11::gil_scoped_release release;
     // Setup infinite range if no point was specified.
     min_rt = min_rt < 0 ? 0 : min_rt;
@@ -141,76 +232,58 @@ RawData::RawData read_mzml(std::string &input_file, double min_mz,
     min_mz = min_mz < 0 ? 0 : min_mz;
     max_mz = max_mz < 0 ? std::numeric_limits<double>::infinity() : max_mz;
 
-    // Parse the instrument type.
-    auto instrument_type = Instrument::UNKNOWN;
-    for (auto &ch : instrument_type_str) {
-        ch = std::tolower(ch);
-    }
-    if (instrument_type_str == "orbitrap") {
-        instrument_type = Instrument::ORBITRAP;
-    } else if (instrument_type_str == "tof") {
-        instrument_type = Instrument::TOF;
-    } else if (instrument_type_str == "quad") {
-        instrument_type = Instrument::QUAD;
-    } else if (instrument_type_str == "fticr") {
-        instrument_type = Instrument::FTICR;
-    } else {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "the given instrument is not supported";
-        throw std::invalid_argument(error_stream.str());
-    }
-    // Parse the polarity.
-    auto polarity = Polarity::BOTH;
-    for (auto &ch : polarity_str) {
-        ch = std::tolower(ch);
-    }
-    if (polarity_str == "" || polarity_str == "both" || polarity_str == "+-" ||
-        polarity_str == "-+") {
-        polarity = Polarity::BOTH;
-    } else if (polarity_str == "+" || polarity_str == "pos" ||
-               polarity_str == "positive") {
-        polarity = Polarity::POSITIVE;
-    } else if (polarity_str == "-" || polarity_str == "neg" ||
-               polarity_str == "negative") {
-        polarity = Polarity::NEGATIVE;
+    auto instrument_type = parse_instrument_type(instrument_type_str);
+    auto filters =
+        parse_scan_filters(outputs, msn_headers_only, centroid_profile);
+    check_mz_rt_range(min_mz, max_mz, min_rt, max_rt);
+
+    // If the file is indexed, we can jump directly to the spectra within the
+    // retention time range. Otherwise we read the entire file sequentially.
+    // Compressed files can't use the index and are decompressed ahead of the
+    // parser on a separate thread.
+    std::optional<std::vector<RawData::RawData>> raw_data;
+    if (is_gzip_file(input_file)) {
+        Compression::ReadAheadInflateStream stream(input_file);
+        if (!stream) {
+            pybind11::gil_scoped_acquire acquire;
+            std::ostringstream error_stream;
+            error_stream << "error: couldn't open input file" << input_file;
+            throw std::invalid_argument(error_stream.str());
+        }
+        raw_data = XmlReader::read_mzml_parallel(
+            stream, min_mz, max_mz, min_rt, max_rt, instrument_type,
+            resolution_ms1, resolution_msn, reference_mz, filters, max_threads);
+        if (stream.status() != Compression::OK) {
+            raw_data = std::nullopt;
+        }
     } else {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "the given polarity is not supported. choose "
-                        "between '+', '-', 'both' (default)";
-        throw std::invalid_argument(error_stream.str());
-    }
-
-    // Sanity check the min/max rt/mz.
-    if (min_rt >= max_rt) {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "error: min_rt >= max_rt (min_rt: " << min_rt
-                     << ", max_rt: " << max_rt << ")";
-        throw std::invalid_argument(error_stream.str());
-    }
-    if (min_mz >= max_mz) {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "error: min_mz >= max_mz (min_mz: " << min_mz
-                     << ", max_mz: " << max_mz << ")";
-        throw std::invalid_argument(error_stream.str());
-    }
-
-    // Open file stream.
-    std::ifstream stream;
-    stream.open(input_file);
-    if (!stream) {
-        pybind11::gil_scoped_acquire acquire;
-        std::ostringstream error_stream;
-        error_stream << "error: couldn't open input file" << input_file;
-        throw std::invalid_argument(error_stream.str());
+        // Map the file into memory.
+        MemoryMap::MappedFile file;
+        if (file.open(input_file) != MemoryMap::OK) {
+            pybind11::gil_scoped_acquire acquire;
+            std::ostringstream error_stream;
+            error_stream << "error: couldn't open input file" << input_file;
+            throw std::invalid_argument(error_stream.str());
+        }
+        auto index = XmlReader::read_mzml_index(file.view());
+        if (index) {
+            auto [first_spectrum, last_spectrum] =
+                XmlReader::find_mzml_spectra(file.view(), index.value(),
+                                             min_rt, max_rt);
+            raw_data = XmlReader::read_mzml_indexed(
+                file.view(), index.value(), first_spectrum, last_spectrum,
+                min_mz, max_mz, min_rt, max_rt, instrument_type,
+                resolution_ms1, resolution_msn, reference_mz, filters,
+                max_threads);
+        }
+        if (!raw_data) {
+            MemoryMap::MemoryStream stream(file.view());
+            raw_data = XmlReader::read_mzml_parallel(
+                stream, min_mz, max_mz, min_rt, max_rt, instrument_type,
+                resolution_ms1, resolution_msn, reference_mz, filters,
+                max_threads);
+        }
     }
-
-    auto raw_data = XmlReader::read_mzml(
-        stream, min_mz, max_mz, min_rt, max_rt, instrument_type, resolution_ms1,
-        resolution_msn, reference_mz, polarity, ms_level);
     if (!raw_data) {
         pybind11::gil_scoped_acquire acquire;
         std::ostringstream error_stream;
@@ -218,14 +291,34 @@ RawData::RawData read_mzml(std::string &input_file, double min_mz,
                      << input_file;
         throw std::invalid_argument(error_stream.str());
     }
-    raw_data.value().fwhm_rt = fwhm_rt;
+    for (auto &output : raw_data.value()) {
+        output.fwhm_rt = fwhm_rt;
+    }
 
     pybind11::gil_scoped_acquire acquire;
     return raw_data.value();
 }
 
-Xic::Xic xic(const RawData::RawData &raw_data, double min_mz, double max_mz,
-             double min_rt, double max_rt, std::string method_str) {
+RawData::RawData read_mzml(std::string &input_file, double min_mz,
+                           double max_mz, double min_rt, double max_rt,
+                           std::string instrument_type_str,
+                           double resolution_ms1, double resolution_msn,
+                           double reference_mz, double fwhm_rt,
+                           std::string polarity_str, size_t ms_level,
+                           bool msn_headers_only, bool centroid_profile,
+                           size_t max_threads) {
+    auto raw_data = read_mzml_multi(
+        input_file, min_mz, max_mz, min_rt, max_rt, instrument_type_str,
+        resolution_ms1, resolution_msn, reference_mz, fwhm_rt,
+        {{ms_level, polarity_str}}, msn_headers_only, centroid_profile,
+        max_threads);
+    return std::move(raw_data[0]);
+}
+
+template <typename T>
+Xic::Xic xic(const T &raw_data, double min_mz, double max_mz, double min_rt,
+             double max_rt, std::string method_str,
+             const RawData::IntensitySums *sums) {
     pybind11::gil_scoped_release release;
     // Parse the instrument type.
     auto method = Xic::UNKNOWN;
@@ -243,23 +336,161 @@ Xic::Xic xic(const RawData::RawData &raw_data, double min_mz, double max_mz,
         throw std::invalid_argument(error_stream.str());
     }
     pybind11::gil_scoped_acquire acquire;
+    if (sums != nullptr) {
+        return RawData::xic(raw_data, *sums, min_mz, max_mz, min_rt, max_rt,
+                            method);
+    }
     return RawData::xic(raw_data, min_mz, max_mz, min_rt, max_rt, method);
 }
 
-Grid::Grid resample(const RawData::RawData &raw_data, uint64_t num_samples_mz,
+template <typename T>
+Xic::XicBatch xic_batch(const T &raw_data, const std::vector<double> &min_mz,
+                        const std::vector<double> &max_mz,
+                        const std::vector<double> &min_rt,
+                        const std::vector<double> &max_rt,
+                        std::string method_str, size_t max_threads,
+                        const RawData::IntensitySums *sums) {
+    auto method = Xic::UNKNOWN;
+    for (auto &ch : method_str) {
+        ch = std::tolower(ch);
+    }
+    if (method_str == "max") {
+        method = Xic::MAX;
+    } else if (method_str == "sum") {
+        method = Xic::SUM;
+    } else {
+        std::ostringstream error_stream;
+        error_stream << "the given xic method is not supported";
+        throw std::invalid_argument(error_stream.str());
+    }
+    size_t num_targets = min_mz.size();
+    if (max_mz.size() != num_targets || min_rt.size() != num_targets ||
+        max_rt.size() != num_targets) {
+        std::ostringstream error_stream;
+        error_stream << "the target min/max mz/rt must have the same length";
+        throw std::invalid_argument(error_stream.str());
+    }
+    std::vector<Xic::Target> targets(num_targets);
+    for (size_t i = 0; i < num_targets; ++i) {
+        targets[i] = {min_mz[i], max_mz[i], min_rt[i], max_rt[i]};
+    }
+    pybind11::gil_scoped_release release;
+    if (sums != nullptr) {
+        return RawData::xic_batch(raw_data, *sums, targets, method,
+                                  max_threads);
+    }
+    return RawData::xic_batch(raw_data, targets, method, max_threads);
+}
+
+template <typename T>
+Grid::Grid resample(const T &raw_data, uint64_t num_samples_mz,
                     uint64_t num_samples_rt, double smoothing_coef_mz,
-                    double smoothing_coef_rt) {
+                    double smoothing_coef_rt, size_t max_threads,
+                    bool single_precision) {
     pybind11::gil_scoped_release release;
     auto params = Grid::ResampleParams{};
     params.num_samples_mz = num_samples_mz;
     params.num_samples_rt = num_samples_rt;
     params.smoothing_coef_mz = smoothing_coef_mz;
     params.smoothing_coef_rt = smoothing_coef_rt;
-    auto grid =  Grid::resample(raw_data, params);
+    params.single_precision = single_precision;
+    auto grid = Grid::resample_parallel(raw_data, params, max_threads);
     pybind11::gil_scoped_acquire acquire;
     return grid;
 }
 
+template <typename T>
+std::vector<Centroid::Peak> find_peaks_streaming(
+    const T &raw_data, uint64_t num_samples_mz, uint64_t num_samples_rt,
+    double smoothing_coef_mz, double smoothing_coef_rt, uint64_t band_rows,
+    size_t max_peaks, size_t max_threads) {
+    pybind11::gil_scoped_release release;
+    auto params = Grid::ResampleParams{};
+    params.num_samples_mz = num_samples_mz;
+    params.num_samples_rt = num_samples_rt;
+    params.smoothing_coef_mz = smoothing_coef_mz;
+    params.smoothing_coef_rt = smoothing_coef_rt;
+    auto peaks = Centroid::find_peaks_streaming(raw_data, params, band_rows,
+                                                max_peaks, max_threads);
+    pybind11::gil_scoped_acquire acquire;
+    return peaks;
+}
+
+template <typename T>
+Grid::SparseGrid resample_sparse(const T &raw_data, uint64_t num_samples_mz,
+                                 uint64_t num_samples_rt,
+                                 double smoothing_coef_mz,
+                                 double smoothing_coef_rt) {
+    pybind11::gil_scoped_release release;
+    auto params = Grid::ResampleParams{};
+    params.num_samples_mz = num_samples_mz;
+    params.num_samples_rt = num_samples_rt;
+    params.smoothing_coef_mz = smoothing_coef_mz;
+    params.smoothing_coef_rt = smoothing_coef_rt;
+    auto grid = Grid::resample_sparse(raw_data, params);
+    pybind11::gil_scoped_acquire acquire;
+    return grid;
+}
+
+// Register the functions that work on any of the raw data layouts for the
+// layout T. Each layout adds an overload to the same Python functions.
+template <typename T>
+void def_raw_data_functions(py::module &m) {
+    m.def("xic", &xic<T>, py::arg("raw_data"), py::arg("min_mz"),
+          py::arg("max_mz"), py::arg("min_rt"), py::arg("max_rt"),
+          py::arg("method") = "sum", py::arg("sums") = nullptr)
+        .def("xic_batch", &xic_batch<T>,
+             "Extract the xic of multiple targets in a single pass over the "
+             "scans. The traces are returned in columnar arrays, with the "
+             "trace of the target i going from offsets[i] to offsets[i + 1]. "
+             "If the IntensitySums of the raw data are given, the 'sum' "
+             "method reads the totals from them",
+             py::arg("raw_data"), py::arg("min_mz"), py::arg("max_mz"),
+             py::arg("min_rt"), py::arg("max_rt"), py::arg("method") = "sum",
+             py::arg("max_threads") = std::thread::hardware_concurrency(),
+             py::arg("sums") = nullptr)
+        .def("build_intensity_sums", &RawData::build_intensity_sums<T>,
+             "Build the cumulative intensity sums of each scan, used to "
+             "calculate the total intensity of a region without visiting "
+             "each point",
+             py::arg("raw_data"))
+        .def("total_intensity", &RawData::total_intensity<T>,
+             "Calculate the total intensity of the points within the square "
+             "region defined by min/max_mz/rt using the IntensitySums of the "
+             "raw data",
+             py::arg("raw_data"), py::arg("sums"), py::arg("min_mz"),
+             py::arg("max_mz"), py::arg("min_rt"), py::arg("max_rt"))
+        .def("resample_sparse", &resample_sparse<T>,
+             "Resample the raw data into a smoothed warped grid, only storing "
+             "the occupied tiles of the grid",
+             py::arg("raw_data"), py::arg("num_mz") = 10,
+             py::arg("num_rt") = 10, py::arg("smoothing_coef_mz") = 0.5,
+             py::arg("smoothing_coef_rt") = 0.5)
+        .def("resample", &resample<T>,
+             "Resample the raw data into a smoothed warped grid",
+             py::arg("raw_data"), py::arg("num_mz") = 10,
+             py::arg("num_rt") = 10, py::arg("smoothing_coef_mz") = 0.5,
+             py::arg("smoothing_coef_rt") = 0.5,
+             py::arg("max_threads") = std::thread::hardware_concurrency(),
+             py::arg("single_precision") = false)
+        .def("find_peaks", &Centroid::find_peaks_parallel<T, Grid::Grid>,
+             "Find all peaks in the given grid", py::arg("raw_data"),
+             py::arg("grid"), py::arg("max_peaks") = 0,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
+        .def("find_peaks", &Centroid::find_peaks_parallel<T, Grid::SparseGrid>,
+             "Find all peaks in the given sparse grid", py::arg("raw_data"),
+             py::arg("grid"), py::arg("max_peaks") = 0,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
+        .def("find_peaks_streaming", &find_peaks_streaming<T>,
+             "Find all peaks resampling the raw data in bands of band_rows "
+             "retention time rows, without allocating the full grid",
+             py::arg("raw_data"), py::arg("num_mz") = 10,
+             py::arg("num_rt") = 10, py::arg("smoothing_coef_mz") = 0.5,
+             py::arg("smoothing_coef_rt") = 0.5, py::arg("band_rows") = 256,
+             py::arg("max_peaks") = 0,
+             py::arg("max_threads") = std::thread::hardware_concurrency());
+}
+
 std::string to_string(const Instrument::Type &instrument_type) {
     switch (instrument_type) {
         case Instrument::QUAD:
@@ -453,6 +684,52 @@ Grid::Grid read_grid(std::string &input_file) {
     return grid;
 }
 
+void write_sparse_grid(const Grid::SparseGrid &grid, std::string &output_file) {
+    pybind11::gil_scoped_release release;
+    // Open file stream.
+    Compression::DeflateStream stream;
+    stream.open(output_file);
+    if (!stream) {
+        pybind11::gil_scoped_acquire acquire;
+        std::ostringstream error_stream;
+        error_stream << "error: couldn't open output file" << output_file;
+        throw std::invalid_argument(error_stream.str());
+    }
+
+    if (!Grid::Serialize::write_sparse_grid(stream, grid)) {
+        pybind11::gil_scoped_acquire acquire;
+        std::ostringstream error_stream;
+        error_stream << "error: couldn't write the grid into the output file"
+                     << output_file;
+        throw std::invalid_argument(error_stream.str());
+    }
+    pybind11::gil_scoped_acquire acquire;
+}
+
+Grid::SparseGrid read_sparse_grid(std::string &input_file) {
+    pybind11::gil_scoped_release release;
+    // Open file stream.
+    Compression::InflateStream stream;
+    stream.open(input_file);
+    if (!stream) {
+        pybind11::gil_scoped_acquire acquire;
+        std::ostringstream error_stream;
+        error_stream << "error: couldn't open input file" << input_file;
+        throw std::invalid_argument(error_stream.str());
+    }
+
+    Grid::SparseGrid grid;
+    if (!Grid::Serialize::read_sparse_grid(stream, &grid)) {
+        pybind11::gil_scoped_acquire acquire;
+        std::ostringstream error_stream;
+        error_stream << "error: couldn't read the grid from the input file"
+                     << input_file;
+        throw std::invalid_argument(error_stream.str());
+    }
+    pybind11::gil_scoped_acquire acquire;
+    return grid;
+}
+
 void write_time_map(const Warp2D::TimeMap &time_map, std::string &output_file) {
     pybind11::gil_scoped_release release;
     // Open file stream.
@@ -905,7 +1182,8 @@ IdentData::IdentData read_mzidentml(std::string &input_file, bool ignore_decoy,
                                     double min_mz,
                                     double max_mz,
                                     double min_rt,
-                                    double max_rt) {
+                                    double max_rt,
+                                    size_t max_threads) {
     pybind11::gil_scoped_release release;
     // Setup infinite range if no point was specified.
     min_rt = min_rt < 0 ? 0 : min_rt;
@@ -913,17 +1191,17 @@ IdentData::IdentData read_mzidentml(std::string &input_file, bool ignore_decoy,
     min_mz = min_mz < 0 ? 0 : min_mz;
     max_mz = max_mz < 0 ? std::numeric_limits<double>::infinity() : max_mz;
 
-    // Open file stream.
-    std::ifstream stream;
-    stream.open(input_file);
-    if (!stream) {
+    // Map the file into memory.
+    MemoryMap::MappedFile file;
+    if (file.open(input_file) != MemoryMap::OK) {
         pybind11::gil_scoped_acquire acquire;
         std::ostringstream error_stream;
         error_stream << "error: couldn't open input file" << input_file;
         throw std::invalid_argument(error_stream.str());
     }
-    auto ident_data = XmlReader::read_mzidentml(stream, ignore_decoy, require_threshold,
-                                     max_rank_only, min_mz, max_mz, min_rt, max_rt);
+    auto ident_data = XmlReader::read_mzidentml_parallel(
+        file.view(), ignore_decoy, require_threshold, max_rank_only, min_mz,
+        max_mz, min_rt, max_rt, max_threads);
     pybind11::gil_scoped_acquire acquire;
     return ident_data;
 }
@@ -1022,20 +1300,25 @@ PYBIND11_MODULE(pastaq, m) {
             return PythonAPI::to_string(polarity);
         });
 
-    py::class_<RawData::RawData>(m, "RawData")
+    py::class_<RawData::Metadata>(m, "RawDataMetadata")
+        .def_readonly("fwhm_rt", &RawData::Metadata::fwhm_rt)
+        .def_readonly("instrument_type", &RawData::Metadata::instrument_type)
+        .def_readonly("resolution_ms1", &RawData::Metadata::resolution_ms1)
+        .def_readonly("resolution_msn", &RawData::Metadata::resolution_msn)
+        .def_readonly("reference_mz", &RawData::Metadata::reference_mz)
+        .def_readonly("min_mz", &RawData::Metadata::min_mz)
+        .def_readonly("max_mz", &RawData::Metadata::max_mz)
+        .def_readonly("min_rt", &RawData::Metadata::min_rt)
+        .def_readonly("max_rt", &RawData::Metadata::max_rt)
+        .def("theoretical_fwhm", &RawData::theoretical_fwhm, py::arg("mz"));
+
+    py::class_<RawData::RawData, RawData::Metadata>(m, "RawData")
         .def_readonly("scans", &RawData::RawData::scans)
-        .def_readonly("fwhm_rt", &RawData::RawData::fwhm_rt)
-        .def_readonly("instrument_type", &RawData::RawData::instrument_type)
-        .def_readonly("resolution_ms1", &RawData::RawData::resolution_ms1)
-        .def_readonly("resolution_msn", &RawData::RawData::resolution_msn)
-        .def_readonly("reference_mz", &RawData::RawData::reference_mz)
-        .def_readonly("min_mz", &RawData::RawData::min_mz)
-        .def_readonly("max_mz", &RawData::RawData::max_mz)
-        .def_readonly("min_rt", &RawData::RawData::min_rt)
-        .def_readonly("max_rt", &RawData::RawData::max_rt)
-        .def("theoretical_fwhm", &RawData::theoretical_fwhm, py::arg("mz"))
         .def("dump", &PythonAPI::write_raw_data)
-        .def("raw_points", &RawData::raw_points,
+        .def("raw_points",
+             static_cast<RawData::RawPoints (*)(const RawData::RawData &,
+                                                double, double, double,
+                                                double)>(&RawData::raw_points),
              "Get the raw data points on the square region defined by "
              "min/max_mz/rt",
              py::arg("min_mz"), py::arg("max_mz"), py::arg("min_rt"),
@@ -1053,14 +1336,55 @@ PYBIND11_MODULE(pastaq, m) {
                    "\n> number of scans: " + std::to_string(rd.scans.size());
         });
 
+    py::class_<RawData::FlatRawData, RawData::Metadata>(m, "FlatRawData")
+        .def("raw_points",
+             static_cast<RawData::RawPoints (*)(const RawData::FlatRawData &,
+                                                double, double, double,
+                                                double)>(&RawData::raw_points),
+             "Get the raw data points on the square region defined by "
+             "min/max_mz/rt",
+             py::arg("min_mz"), py::arg("max_mz"), py::arg("min_rt"),
+             py::arg("max_rt"));
+
+    py::class_<RawData::CompactRawData, RawData::Metadata>(m, "CompactRawData")
+        .def_readonly("single_precision_mz",
+                      &RawData::CompactRawData::single_precision_mz)
+        .def("raw_points",
+             static_cast<RawData::RawPoints (*)(const RawData::CompactRawData &,
+                                                double, double, double,
+                                                double)>(&RawData::raw_points),
+             "Get the raw data points on the square region defined by "
+             "min/max_mz/rt",
+             py::arg("min_mz"), py::arg("max_mz"), py::arg("min_rt"),
+             py::arg("max_rt"));
+
+    py::class_<RawData::CompressedRawData, RawData::Metadata>(
+        m, "CompressedRawData")
+        .def("raw_points",
+             static_cast<RawData::RawPoints (*)(
+                 const RawData::CompressedRawData &, double, double, double,
+                 double)>(&RawData::raw_points),
+             "Get the raw data points on the square region defined by "
+             "min/max_mz/rt",
+             py::arg("min_mz"), py::arg("max_mz"), py::arg("min_rt"),
+             py::arg("max_rt"));
+
     py::class_<Grid::Grid>(m, "Grid")
         .def_readonly("n", &Grid::Grid::n)
         .def_readonly("m", &Grid::Grid::m)
-        .def_readonly("data", &Grid::Grid::data)
+        .def_property_readonly("data", [](const Grid::Grid &grid) {
+            if (!grid.single_precision) {
+                return grid.data;
+            }
+            return std::vector<double>(grid.float_data.begin(),
+                                       grid.float_data.end());
+        })
+        .def_readonly("single_precision", &Grid::Grid::single_precision)
         .def_readonly("bins_mz", &Grid::Grid::bins_mz)
         .def_readonly("bins_rt", &Grid::Grid::bins_rt)
         .def("dump", &PythonAPI::write_grid)
-        .def("subset", &Grid::subset)
+        .def("subset", py::overload_cast<const Grid::Grid &, double, double,
+                                         double, double>(&Grid::subset))
         .def("__repr__", [](const Grid::Grid &s) {
             return "Grid <n: " + std::to_string(s.n) +
                    ", m: " + std::to_string(s.m) +
@@ -1072,6 +1396,33 @@ PYBIND11_MODULE(pastaq, m) {
                    ", max_rt: " + std::to_string(s.max_rt) + ">";
         });
 
+    py::class_<Grid::SparseGrid>(m, "SparseGrid")
+        .def_readonly("n", &Grid::SparseGrid::n)
+        .def_readonly("m", &Grid::SparseGrid::m)
+        .def_readonly("bins_mz", &Grid::SparseGrid::bins_mz)
+        .def_readonly("bins_rt", &Grid::SparseGrid::bins_rt)
+        .def("dump", &PythonAPI::write_sparse_grid)
+        .def("subset",
+             py::overload_cast<const Grid::SparseGrid &, double, double,
+                               double, double>(&Grid::subset))
+        .def("to_dense", &Grid::to_dense)
+        .def("__repr__", [](const Grid::SparseGrid &s) {
+            size_t allocated_tiles = 0;
+            for (const auto &tile : s.tiles) {
+                allocated_tiles += !tile.empty();
+            }
+            return "SparseGrid <n: " + std::to_string(s.n) +
+                   ", m: " + std::to_string(s.m) +
+                   ", k: " + std::to_string(s.k) +
+                   ", t: " + std::to_string(s.t) +
+                   ", allocated_tiles: " + std::to_string(allocated_tiles) +
+                   "/" + std::to_string(s.tiles.size()) +
+                   ", min_mz: " + std::to_string(s.min_mz) +
+                   ", max_mz: " + std::to_string(s.max_mz) +
+                   ", min_rt: " + std::to_string(s.min_rt) +
+                   ", max_rt: " + std::to_string(s.max_rt) + ">";
+        });
+
     py::class_<RawData::RawPoints>(m, "RawPoints")
         .def_readonly("rt", &RawData::RawPoints::rt)
         .def_readonly("mz", &RawData::RawPoints::mz)
@@ -1088,6 +1439,26 @@ PYBIND11_MODULE(pastaq, m) {
                    ", max_rt: " + std::to_string(s.max_rt) + ">";
         });
 
+    py::class_<RawData::IntensitySums>(m, "IntensitySums")
+        .def_readonly("offsets", &RawData::IntensitySums::offsets)
+        .def_readonly("cumulative", &RawData::IntensitySums::cumulative)
+        .def("__repr__", [](const RawData::IntensitySums &s) {
+            return "IntensitySums <n_scans: " +
+                   std::to_string(s.offsets.size()) + ">";
+        });
+
+    py::class_<Xic::XicBatch>(m, "XicBatch")
+        .def_readonly("offsets", &Xic::XicBatch::offsets)
+        .def_readonly("retention_time", &Xic::XicBatch::retention_time)
+        .def_readonly("intensity", &Xic::XicBatch::intensity)
+        .def("__repr__", [](const Xic::XicBatch &s) {
+            return "XicBatch <method: " + PythonAPI::to_string(s.method) +
+                   ", n_targets: " +
+                   std::to_string(s.offsets.empty() ? 0
+                                                    : s.offsets.size() - 1) +
+                   ", n_points: " + std::to_string(s.intensity.size()) + ">";
+        });
+
     py::class_<Centroid::Peak>(m, "Peak")
         .def_readonly("id", &Centroid::Peak::id)
         .def_readonly("local_max_mz", &Centroid::Peak::local_max_mz)
@@ -1127,7 +1498,7 @@ PYBIND11_MODULE(pastaq, m) {
                std::string method) {
                 return PythonAPI::xic(raw_data, peak.roi_min_mz,
                                       peak.roi_max_mz, peak.roi_min_rt,
-                                      peak.roi_max_rt, method);
+                                      peak.roi_max_rt, method, nullptr);
             },
             "Get the raw data points on the square region defined by "
             "min/max_mz/rt",
@@ -1414,7 +1785,10 @@ PYBIND11_MODULE(pastaq, m) {
           py::arg("min_rt") = -1.0, py::arg("max_rt") = -1.0,
           py::arg("instrument_type") = "", py::arg("resolution_ms1"),
           py::arg("resolution_msn"), py::arg("reference_mz"),
-          py::arg("fwhm_rt"), py::arg("polarity") = "", py::arg("ms_level") = 1)
+          py::arg("fwhm_rt"), py::arg("polarity") = "", py::arg("ms_level") = 1,
+          py::arg("msn_headers_only") = false,
+          py::arg("centroid_profile") = false,
+          py::arg("max_threads") = std::thread::hardware_concurrency())
         .def("read_mzml", &PythonAPI::read_mzml,
              "Read raw data from the given mzXML file ", py::arg("file_name"),
              py::arg("min_mz") = -1.0, py::arg("max_mz") = -1.0,
@@ -1422,20 +1796,48 @@ PYBIND11_MODULE(pastaq, m) {
              py::arg("instrument_type") = "", py::arg("resolution_ms1"),
              py::arg("resolution_msn"), py::arg("reference_mz"),
              py::arg("fwhm_rt"), py::arg("polarity") = "",
-             py::arg("ms_level") = 1)
+             py::arg("ms_level") = 1, py::arg("msn_headers_only") = false,
+             py::arg("centroid_profile") = false,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
+        .def("read_mzxml_multi", &PythonAPI::read_mzxml_multi,
+             "Read raw data from the given mzXML file in a single pass, "
+             "returning one raw data object for each of the (ms_level, "
+             "polarity) outputs",
+             py::arg("file_name"), py::arg("min_mz") = -1.0,
+             py::arg("max_mz") = -1.0, py::arg("min_rt") = -1.0,
+             py::arg("max_rt") = -1.0, py::arg("instrument_type") = "",
+             py::arg("resolution_ms1"), py::arg("resolution_msn"),
+             py::arg("reference_mz"), py::arg("fwhm_rt"), py::arg("outputs"),
+             py::arg("msn_headers_only") = false,
+             py::arg("centroid_profile") = false,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
+        .def("read_mzml_multi", &PythonAPI::read_mzml_multi,
+             "Read raw data from the given mzML file in a single pass, "
+             "returning one raw data object for each of the (ms_level, "
+             "polarity) outputs",
+             py::arg("file_name"), py::arg("min_mz") = -1.0,
+             py::arg("max_mz") = -1.0, py::arg("min_rt") = -1.0,
+             py::arg("max_rt") = -1.0, py::arg("instrument_type") = "",
+             py::arg("resolution_ms1"), py::arg("resolution_msn"),
+             py::arg("reference_mz"), py::arg("fwhm_rt"), py::arg("outputs"),
+             py::arg("msn_headers_only") = false,
+             py::arg("centroid_profile") = false,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
         .def("theoretical_fwhm", &RawData::theoretical_fwhm,
              "Calculate the theoretical width of the peak at the given m/z for "
              "the given raw file",
              py::arg("raw_data"), py::arg("mz"))
-        .def("resample", &PythonAPI::resample,
-             "Resample the raw data into a smoothed warped grid",
-             py::arg("raw_data"), py::arg("num_mz") = 10,
-             py::arg("num_rt") = 10, py::arg("smoothing_coef_mz") = 0.5,
-             py::arg("smoothing_coef_rt") = 0.5)
-        .def("find_peaks", &Centroid::find_peaks_parallel,
-             "Find all peaks in the given grid", py::arg("raw_data"),
-             py::arg("grid"), py::arg("max_peaks") = 0,
-             py::arg("max_threads") = std::thread::hardware_concurrency())
+        .def("flatten", &RawData::flatten,
+             "Convert the raw data into the contiguous FlatRawData layout",
+             py::arg("raw_data"))
+        .def("compact", &RawData::compact,
+             "Convert the raw data into the CompactRawData layout, storing the "
+             "intensities and optionally the m/z in single precision",
+             py::arg("raw_data"), py::arg("single_precision_mz") = false)
+        .def("compress", &RawData::compress,
+             "Convert the raw data into the CompressedRawData layout, storing "
+             "the scans compressed and decompressing them on access",
+             py::arg("raw_data"))
         .def("calculate_time_map", &PythonAPI::calculate_time_map,
              "Calculate a warping time_map to maximize the similarity of "
              "ref_peaks and source_peaks",
@@ -1464,6 +1866,9 @@ PYBIND11_MODULE(pastaq, m) {
              py::arg("file_name"))
         .def("read_grid", &PythonAPI::read_grid,
              "Read the grid from the binary grid file", py::arg("file_name"))
+        .def("read_sparse_grid", &PythonAPI::read_sparse_grid,
+             "Read the sparse grid from the binary grid file",
+             py::arg("file_name"))
         .def("read_linked_psm", &PythonAPI::read_linked_psm,
              "Read the linked_psm from the binary linked_psm file",
              py::arg("file_name"))
@@ -1482,7 +1887,8 @@ PYBIND11_MODULE(pastaq, m) {
              py::arg("require_threshold") = true,
              py::arg("max_rank_only") = true,
              py::arg("min_mz") = -1.0, py::arg("max_mz") = -1.0,
-             py::arg("min_rt") = -1.0, py::arg("max_rt") = -1.0)
+             py::arg("min_rt") = -1.0, py::arg("max_rt") = -1.0,
+             py::arg("max_threads") = std::thread::hardware_concurrency())
         .def("read_ident_data", &PythonAPI::read_ident_data,
              "Read the ident_data from the binary ident_data file",
              py::arg("file_name"))
@@ -1535,12 +1941,14 @@ PYBIND11_MODULE(pastaq, m) {
              "Link spectrum identifications with peaks",
              py::arg("ident_data"), py::arg("peaks"), py::arg("raw_data"),
              py::arg("n_sig_mz") = 3, py::arg("n_sig_rt") = 3)
-        .def("xic", &PythonAPI::xic, py::arg("raw_data"), py::arg("min_mz"),
-             py::arg("max_mz"), py::arg("min_rt"), py::arg("max_rt"),
-             py::arg("method") = "sum")
         .def("perform_protein_inference", &ProteinInference::razor,
              py::arg("ident_data"))
         .def("detect_features", &FeatureDetection::detect_features,
              "Link peaks as features", py::arg("peaks"),
              py::arg("charge_states"));
+
+    PythonAPI::def_raw_data_functions<RawData::RawData>(m);
+    PythonAPI::def_raw_data_functions<RawData::FlatRawData>(m);
+    PythonAPI::def_raw_data_functions<RawData::CompactRawData>(m);
+    PythonAPI::def_raw_data_functions<RawData::CompressedRawData>(m);
 }
@@ -0,0 +1,85 @@
+#include <string>
+#include <vector>
+
+#include "doctest.h"
+#include "utils/base64.hpp"
+
+// Simple base64 encoder used to generate the test inputs.
+std::string encode_base64(const std::vector<uint8_t> &data) {
+    const char *alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t group = data[i] << 16;
+        if (i + 1 < data.size()) {
+            group |= data[i + 1] << 8;
+        }
+        if (i + 2 < data.size()) {
+            group |= data[i + 2];
+        }
+        encoded += alphabet[(group >> 18) & 0x3F];
+        encoded += alphabet[(group >> 12) & 0x3F];
+        encoded += i + 1 < data.size() ? alphabet[(group >> 6) & 0x3F] : '=';
+        encoded += i + 2 < data.size() ? alphabet[group & 0x3F] : '=';
+    }
+    return encoded;
+}
+
+TEST_CASE("Decoding base64 data") {
+    SUBCASE("Short strings") {
+        std::vector<std::pair<std::string, std::string>> table = {
+            {"TQ==", "M"},
+            {"TWE=", "Ma"},
+            {"TWFu", "Man"},
+            {"cGxlYXN1cmUu", "pleasure."},
+            {"bGVhc3VyZS4=", "leasure."},
+            {"ZWFzdXJlLg==", "easure."},
+        };
+        for (const auto &test : table) {
+            std::vector<uint8_t> output;
+            Base64::decode_base64(test.first, output);
+            CHECK(std::string(output.begin(), output.end()) == test.second);
+        }
+    }
+    SUBCASE("All input sizes and byte values") {
+        // Long enough inputs are decoded with vector instructions if the CPU
+        // supports them, the results must match the encoded data for any
+        // combination of vectorized blocks and remaining characters.
+        for (size_t size = 0; size < 300; ++size) {
+            std::vector<uint8_t> data(size);
+            for (size_t i = 0; i < size; ++i) {
+                data[i] = static_cast<uint8_t>(i * 37 + size);
+            }
+            auto encoded = encode_base64(data);
+            std::vector<uint8_t> output;
+            Base64::decode_base64(encoded.data(), encoded.size(), output);
+            CHECK(output == data);
+        }
+    }
+}
+
+TEST_CASE("Interpreting raw data as floating-point values") {
+    // 1.5 and -2.25 stored as little endian followed by the same values as big
+    // endian.
+    std::vector<uint8_t> floats = {0x00, 0x00, 0xc0, 0x3f, 0x00, 0x00,
+                                   0x10, 0xc0, 0x3f, 0xc0, 0x00, 0x00,
+                                   0xc0, 0x10, 0x00, 0x00};
+    std::vector<uint8_t> doubles = {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x3f, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x02, 0xc0, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0xc0, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    for (bool little_endian : {true, false}) {
+        size_t offset = little_endian ? 0 : 2;
+        std::vector<double> output(2);
+        Base64::interpret_floats(floats.data() + offset * 4, 2, little_endian,
+                                 output.data());
+        CHECK(output == std::vector<double>{1.5, -2.25});
+        CHECK(Base64::interpret_float(floats, offset * 4, little_endian) ==
+              1.5);
+        Base64::interpret_doubles(doubles.data() + offset * 8, 2,
+                                  little_endian, output.data());
+        CHECK(output == std::vector<double>{1.5, -2.25});
+        CHECK(Base64::interpret_double(doubles, offset * 8, little_endian) ==
+              1.5);
+    }
+}
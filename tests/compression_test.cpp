@@ -0,0 +1,117 @@
+#include <zlib.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "doctest.h"
+#include "utils/compression.hpp"
+
+// Compress the data with zlib, using either a gzip or a zlib header.
+std::string compress_data(const std::string &data, bool gzip) {
+    z_stream strm = {};
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip ? 15 + 16 : 15,
+                 8, Z_DEFAULT_STRATEGY);
+    std::string compressed(deflateBound(&strm, data.size()), '\0');
+    strm.next_in =
+        reinterpret_cast<unsigned char *>(const_cast<char *>(data.data()));
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<unsigned char *>(&compressed[0]);
+    strm.avail_out = compressed.size();
+    deflate(&strm, Z_FINISH);
+    compressed.resize(compressed.size() - strm.avail_out);
+    deflateEnd(&strm);
+    return compressed;
+}
+
+// Write the compressed data to a temporary file and read it back with a
+// ReadAheadInflateStream. Returns the decompressed data and the status of the
+// stream after reading all of it.
+std::pair<std::string, int> read_ahead(const std::string &compressed,
+                                       size_t buffer_size, size_t max_buffers) {
+    auto path = std::filesystem::temp_directory_path() /
+                "pastaq_compression_test.gz";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(compressed.data(), compressed.size());
+    }
+    std::string data;
+    int status = Compression::ERROR;
+    {
+        Compression::ReadAheadInflateStream stream(path.string(), buffer_size,
+                                                   max_buffers);
+        data.assign(std::istreambuf_iterator<char>(stream),
+                    std::istreambuf_iterator<char>());
+        status = stream.status();
+    }
+    std::filesystem::remove(path);
+    return {data, status};
+}
+
+TEST_CASE("Reading compressed files ahead of the reader") {
+    std::string data;
+    for (size_t i = 0; i < 2000; ++i) {
+        data += "<scan num=\"" + std::to_string(i) + "\"/>\n";
+    }
+    // The small buffers split the input and the output of the decompression
+    // in many pieces.
+    std::vector<std::pair<size_t, size_t>> buffers = {
+        {7, 1}, {64, 2}, {4096, 4}, {1 << 22, 4}};
+
+    SUBCASE("gzip and zlib headers") {
+        for (bool gzip : {true, false}) {
+            auto compressed = compress_data(data, gzip);
+            for (auto [buffer_size, max_buffers] : buffers) {
+                auto [decompressed, status] =
+                    read_ahead(compressed, buffer_size, max_buffers);
+                CHECK(status == Compression::OK);
+                CHECK(decompressed == data);
+            }
+        }
+    }
+
+    SUBCASE("Concatenated gzip members") {
+        auto half = data.size() / 2;
+        auto compressed = compress_data(data.substr(0, half), true) +
+                          compress_data(data.substr(half), true);
+        for (auto [buffer_size, max_buffers] : buffers) {
+            auto [decompressed, status] =
+                read_ahead(compressed, buffer_size, max_buffers);
+            CHECK(status == Compression::OK);
+            CHECK(decompressed == data);
+        }
+    }
+
+    SUBCASE("Zero padding after the compressed data") {
+        auto compressed = compress_data(data, true) + std::string(1000, '\0');
+        for (auto [buffer_size, max_buffers] : buffers) {
+            auto [decompressed, status] =
+                read_ahead(compressed, buffer_size, max_buffers);
+            CHECK(status == Compression::OK);
+            CHECK(decompressed == data);
+        }
+    }
+
+    SUBCASE("Truncated file") {
+        auto compressed = compress_data(data, true);
+        compressed.resize(compressed.size() / 2);
+        for (auto [buffer_size, max_buffers] : buffers) {
+            auto [decompressed, status] =
+                read_ahead(compressed, buffer_size, max_buffers);
+            CHECK(status == Compression::ERROR);
+            CHECK(decompressed.size() < data.size());
+            CHECK(data.compare(0, decompressed.size(), decompressed) == 0);
+        }
+    }
+
+    SUBCASE("Data that is not compressed") {
+        for (auto [buffer_size, max_buffers] : buffers) {
+            auto [decompressed, status] =
+                read_ahead(data, buffer_size, max_buffers);
+            CHECK(status == Compression::ERROR);
+            CHECK(decompressed.empty());
+        }
+    }
+}
@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
 #include "doctest.h"
 #include "test_utils.hpp"
 
+#include "centroid/centroid.hpp"
 #include "grid/grid.hpp"
+#include "grid/grid_serialize.hpp"
 
 TEST_CASE("Gaussian splatting") {
     SUBCASE("Splat on the center of the mesh") {
@@ -39,7 +45,332 @@ TEST_CASE("Test the warped grid interpolation") {
     }
 }
 
+TEST_CASE("Smoothing matches a direct Gaussian convolution") {
+    // Points on the corners and on the center of a small grid, so that the
+    // kernel is truncated on all edges.
+    RawData::RawData raw_data = {};
+    raw_data.instrument_type = Instrument::ORBITRAP;
+    raw_data.min_mz = 200.0;
+    raw_data.max_mz = 200.1;
+    raw_data.min_rt = 10.0;
+    raw_data.max_rt = 14.0;
+    raw_data.resolution_ms1 = 70000;
+    raw_data.resolution_msn = 30000;
+    raw_data.reference_mz = 200;
+    raw_data.fwhm_rt = 2;
+    for (size_t j = 0; j < 5; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        for (double mz : {200.0001, 200.05, 200.0999}) {
+            scan.mz.push_back(mz);
+            scan.intensity.push_back(100.0 + 10.0 * j + mz - 200.0);
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    Grid::ResampleParams params = {5, 5, 1, 1};
+    auto grid = Grid::resample(raw_data, params);
+    const auto &bins_mz = grid.bins_mz;
+    const auto &bins_rt = grid.bins_rt;
+    size_t n = grid.n;
+    size_t m = grid.m;
+
+    // Kernel sigmas and half widths, as defined in Grid::resample.
+    double sigma_rt = RawData::fwhm_to_sigma(raw_data.fwhm_rt) *
+                      params.smoothing_coef_rt / std::sqrt(2);
+    std::vector<double> sigma_mz(n);
+    for (size_t i = 0; i < n; ++i) {
+        sigma_mz[i] = RawData::fwhm_to_sigma(
+                          RawData::theoretical_fwhm(raw_data, bins_mz[i])) *
+                      params.smoothing_coef_mz / std::sqrt(2);
+    }
+    size_t rt_hw = 3 * sigma_rt / (grid.fwhm_rt / params.num_samples_rt);
+    size_t mz_hw = 3 * RawData::fwhm_to_sigma(grid.fwhm_mz) /
+                   (grid.fwhm_mz / params.num_samples_mz);
+    CHECK(rt_hw > 0);
+    CHECK(mz_hw > 0);
+    CHECK(m > 2 * rt_hw);
+    CHECK(n > 2 * mz_hw);
+
+    // Splat the points, visiting each bin of the grid independently.
+    std::vector<double> splatted(n * m);
+    for (size_t j = 0; j < m; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+            double sum = 0;
+            double sum_weights = 0;
+            for (const auto &scan : raw_data.scans) {
+                size_t index_rt = Grid::y_index(grid, scan.retention_time);
+                if (std::max(index_rt, j) - std::min(index_rt, j) > rt_hw) {
+                    continue;
+                }
+                for (size_t k = 0; k < scan.num_points; ++k) {
+                    size_t index_mz = Grid::x_index(grid, scan.mz[k]);
+                    if (std::max(index_mz, i) - std::min(index_mz, i) > mz_hw) {
+                        continue;
+                    }
+                    double a = (bins_mz[i] - scan.mz[k]) / sigma_mz[index_mz];
+                    double b = (bins_rt[j] - scan.retention_time) / sigma_rt;
+                    double weight = std::exp(-0.5 * (a * a + b * b));
+                    sum += weight * scan.intensity[k];
+                    sum_weights += weight;
+                }
+            }
+            splatted[i + j * n] = sum_weights == 0 ? 0 : sum / sum_weights;
+        }
+    }
+
+    // Convolve each bin with the Gaussian kernel in rt and then in mz, only
+    // taking into account the neighbours that are inside the grid and
+    // normalizing by the sum of their weights.
+    std::vector<double> smoothed_rt(n * m);
+    for (size_t j = 0; j < m; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+            double sum = 0;
+            double sum_weights = 0;
+            for (size_t k = j > rt_hw ? j - rt_hw : 0;
+                 k <= j + rt_hw && k < m; ++k) {
+                double a = (bins_rt[j] - bins_rt[k]) / sigma_rt;
+                double weight = std::exp(-0.5 * a * a);
+                sum += weight * splatted[i + k * n];
+                sum_weights += weight;
+            }
+            smoothed_rt[i + j * n] = sum / sum_weights;
+        }
+    }
+    std::vector<double> expected(n * m);
+    for (size_t j = 0; j < m; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+            double sum = 0;
+            double sum_weights = 0;
+            for (size_t l = i > mz_hw ? i - mz_hw : 0;
+                 l <= i + mz_hw && l < n; ++l) {
+                double a = (bins_mz[i] - bins_mz[l]) / sigma_mz[i];
+                double weight = std::exp(-0.5 * a * a);
+                sum += weight * smoothed_rt[l + j * n];
+                sum_weights += weight;
+            }
+            expected[i + j * n] = sum / sum_weights;
+        }
+    }
+
+    CHECK(grid.data.size() == expected.size());
+    if (grid.data.size() != expected.size()) {
+        return;
+    }
+    for (size_t j = 0; j < m; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+            CHECK(grid.data[i + j * n] ==
+                  doctest::Approx(expected[i + j * n]).epsilon(1e-12));
+        }
+    }
+    // The values on the corners come from the truncated kernels.
+    CHECK(expected[0] > 0);
+    CHECK(expected[n - 1] > 0);
+    CHECK(expected[(m - 1) * n] > 0);
+    CHECK(expected[m * n - 1] > 0);
+}
+
+// Generate the raw data of a few compounds of the given mz/rt on a wide mz/rt
+// range, so that most of the grid is empty.
+RawData::RawData compounds_raw_data(
+    const std::vector<std::pair<double, double>> &compounds) {
+    RawData::RawData raw_data = {};
+    raw_data.instrument_type = Instrument::ORBITRAP;
+    raw_data.min_mz = 200.0;
+    raw_data.max_mz = 205.0;
+    raw_data.min_rt = 10.0;
+    raw_data.max_rt = 60.0;
+    raw_data.resolution_ms1 = 70000;
+    raw_data.resolution_msn = 30000;
+    raw_data.reference_mz = 200;
+    raw_data.fwhm_rt = 2;
+    for (size_t j = 0; j < 51; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        for (const auto &[mz, rt] : compounds) {
+            if (std::abs(scan.retention_time - rt) > 3) {
+                continue;
+            }
+            for (int i = -2; i <= 2; ++i) {
+                scan.mz.push_back(mz + i * 0.001);
+                double rt_distance = std::abs(scan.retention_time - rt);
+                scan.intensity.push_back(1000.0 / (1 + std::abs(i)) /
+                                         (1 + rt_distance));
+            }
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    return raw_data;
+}
+
 TEST_CASE("Parallel and serial execution offer the same results") {
-    // TODO:...
-    CHECK(true);
+    auto raw_data = compounds_raw_data(
+        {{200.5, 11.0}, {201.0, 20.0}, {203.0, 35.0}, {204.0, 59.0}});
+    auto flat_data = RawData::flatten(raw_data);
+    for (bool single_precision : {false, true}) {
+        Grid::ResampleParams params = {5, 5, 1, 1, single_precision};
+        auto grid = Grid::resample(raw_data, params);
+        CHECK(grid.m > 100);
+        // The rows are split in one band, in bands that don't divide the
+        // number of rows evenly, and in more bands than rows, which is
+        // limited to one row per band.
+        for (size_t max_threads : {size_t(1), size_t(3), grid.m + 10}) {
+            for (const auto &parallel_grid :
+                 {Grid::resample_parallel(raw_data, params, max_threads),
+                  Grid::resample_parallel(flat_data, params, max_threads)}) {
+                CHECK(parallel_grid.n == grid.n);
+                CHECK(parallel_grid.m == grid.m);
+                CHECK(parallel_grid.bins_mz == grid.bins_mz);
+                CHECK(parallel_grid.bins_rt == grid.bins_rt);
+                CHECK(parallel_grid.single_precision == single_precision);
+                CHECK(parallel_grid.data == grid.data);
+                CHECK(parallel_grid.float_data == grid.float_data);
+            }
+        }
+    }
+}
+
+TEST_CASE("Sparse grids give the same results as dense grids") {
+    auto raw_data = compounds_raw_data({{201.0, 20.0}, {204.0, 50.0}});
+
+    Grid::ResampleParams params = {5, 5, 1, 1};
+    auto grid = Grid::resample(raw_data, params);
+    auto sparse_grid = Grid::resample_sparse(raw_data, params);
+    CHECK(sparse_grid.n == grid.n);
+    CHECK(sparse_grid.m == grid.m);
+    CHECK(sparse_grid.bins_mz == grid.bins_mz);
+    CHECK(sparse_grid.bins_rt == grid.bins_rt);
+    size_t allocated_tiles = 0;
+    for (const auto &tile : sparse_grid.tiles) {
+        allocated_tiles += !tile.empty();
+    }
+    CHECK(allocated_tiles > 0);
+    CHECK(allocated_tiles * 10 < sparse_grid.tiles.size());
+    CHECK(Grid::to_dense(sparse_grid).data == grid.data);
+    CHECK(Grid::to_dense(Grid::to_sparse(grid)).data == grid.data);
+
+    auto local_max = Centroid::find_local_maxima(grid);
+    auto sparse_local_max = Centroid::find_local_maxima(sparse_grid);
+    CHECK(local_max.size() >= 2);
+    CHECK(local_max.size() == sparse_local_max.size());
+    for (size_t i = 0; i < sparse_local_max.size(); ++i) {
+        CHECK(local_max[i].mz == sparse_local_max[i].mz);
+        CHECK(local_max[i].rt == sparse_local_max[i].rt);
+        CHECK(local_max[i].value == sparse_local_max[i].value);
+    }
+
+    auto grid_subset = Grid::subset(grid, 200.9, 201.1, 15.0, 25.0);
+    auto sparse_subset = Grid::subset(sparse_grid, 200.9, 201.1, 15.0, 25.0);
+    CHECK(grid_subset.n == sparse_subset.n);
+    CHECK(grid_subset.m == sparse_subset.m);
+    CHECK(grid_subset.min_rt == doctest::Approx(15.0).epsilon(0.05));
+    CHECK(grid_subset.data == sparse_subset.data);
+
+    std::stringstream stream;
+    CHECK(Grid::Serialize::write_sparse_grid(stream, sparse_grid));
+    Grid::SparseGrid read_grid;
+    CHECK(Grid::Serialize::read_sparse_grid(stream, &read_grid));
+    CHECK(read_grid.num_tiles_mz == sparse_grid.num_tiles_mz);
+    CHECK(read_grid.tiles == sparse_grid.tiles);
+    CHECK(read_grid.bins_mz == sparse_grid.bins_mz);
+    CHECK(read_grid.instrument_type == sparse_grid.instrument_type);
+}
+
+TEST_CASE("Single precision grids find the same peaks as double grids") {
+    auto raw_data = compounds_raw_data(
+        {{201.0, 20.0}, {201.02, 22.0}, {203.0, 35.0}, {204.0, 50.0}});
+    Grid::ResampleParams params = {5, 5, 1, 1};
+    auto grid = Grid::resample(raw_data, params);
+    params.single_precision = true;
+    auto float_grid = Grid::resample(raw_data, params);
+    CHECK(!grid.single_precision);
+    CHECK(float_grid.single_precision);
+    CHECK(float_grid.data.empty());
+    CHECK(float_grid.float_data.size() == grid.data.size());
+    // The values are only rounded when stored between the resampling steps.
+    double max_error = 0;
+    for (size_t i = 0; i < grid.data.size(); ++i) {
+        if (grid.data[i] != 0) {
+            double error = std::abs(float_grid.float_data[i] - grid.data[i]);
+            max_error = std::max(max_error, error / grid.data[i]);
+        }
+    }
+    CHECK(max_error < 1e-6);
+    auto float_grid_parallel = Grid::resample_parallel(raw_data, params, 4);
+    CHECK(float_grid_parallel.float_data == float_grid.float_data);
+
+    auto peaks = Centroid::find_peaks_serial(raw_data, grid, 100);
+    auto float_peaks = Centroid::find_peaks_serial(raw_data, float_grid, 100);
+    CHECK(peaks.size() == 4);
+    CHECK(peaks.size() == float_peaks.size());
+    for (size_t i = 0; i < float_peaks.size(); ++i) {
+        CHECK(peaks[i].local_max_mz == float_peaks[i].local_max_mz);
+        CHECK(peaks[i].local_max_rt == float_peaks[i].local_max_rt);
+        CHECK(peaks[i].local_max_height ==
+              doctest::Approx(float_peaks[i].local_max_height));
+        CHECK(peaks[i].fitted_mz == float_peaks[i].fitted_mz);
+        CHECK(peaks[i].fitted_height == float_peaks[i].fitted_height);
+    }
+
+    // Single precision grids are serialized as double precision.
+    std::stringstream stream;
+    CHECK(Grid::Serialize::write_grid(stream, float_grid));
+    Grid::Grid read_grid;
+    CHECK(Grid::Serialize::read_grid(stream, &read_grid));
+    CHECK(!read_grid.single_precision);
+    CHECK(Centroid::find_local_maxima(read_grid).size() ==
+          Centroid::find_local_maxima(float_grid).size());
+}
+
+TEST_CASE("Resampling in bands of rows gives the same results") {
+    auto raw_data = compounds_raw_data(
+        {{201.0, 20.0}, {201.02, 22.0}, {203.0, 35.0}, {204.0, 50.0}});
+    Grid::ResampleParams params = {5, 5, 1, 1};
+    auto grid = Grid::resample(raw_data, params);
+    auto kernel = Grid::resample_kernel(raw_data, params);
+    CHECK(kernel.grid.n == grid.n);
+    CHECK(kernel.grid.m == grid.m);
+    CHECK(kernel.grid.data.empty());
+
+    // Bands at the borders, in the middle and past the end of the grid.
+    for (const auto &[row_begin, row_end] :
+         {std::pair<uint64_t, uint64_t>{0, 3}, {20, 57}, {grid.m - 5, grid.m},
+          {grid.m - 2, grid.m + 10}}) {
+        auto band = Grid::resample_rows(raw_data, kernel, row_begin, row_end);
+        uint64_t band_end = std::min(row_end, grid.m);
+        CHECK(band.m == band_end - row_begin);
+        CHECK(band.bins_rt.front() == grid.bins_rt[row_begin]);
+        CHECK(std::equal(band.data.begin(), band.data.end(),
+                         grid.data.begin() + row_begin * grid.n));
+    }
+
+    auto local_max = Centroid::find_local_maxima(grid);
+    for (uint64_t band_rows : {1, 7, 1000}) {
+        auto band_local_max =
+            Centroid::find_local_maxima(raw_data, params, band_rows, 4);
+        CHECK(band_local_max.size() == local_max.size());
+        for (size_t i = 0; i < band_local_max.size(); ++i) {
+            CHECK(band_local_max[i].mz == local_max[i].mz);
+            CHECK(band_local_max[i].rt == local_max[i].rt);
+            CHECK(band_local_max[i].value == local_max[i].value);
+        }
+    }
+
+    auto peaks = Centroid::find_peaks_parallel(raw_data, grid, 100, 4);
+    auto band_peaks =
+        Centroid::find_peaks_streaming(raw_data, params, 16, 100, 4);
+    CHECK(peaks.size() == 4);
+    CHECK(band_peaks.size() == peaks.size());
+    for (size_t i = 0; i < band_peaks.size(); ++i) {
+        CHECK(band_peaks[i].fitted_mz == peaks[i].fitted_mz);
+        CHECK(band_peaks[i].fitted_rt == peaks[i].fitted_rt);
+        CHECK(band_peaks[i].fitted_height == peaks[i].fitted_height);
+    }
 }
@@ -0,0 +1,55 @@
+#include <vector>
+
+#include "doctest.h"
+#include "utils/numpress.hpp"
+
+TEST_CASE("Decoding MS-Numpress data") {
+    SUBCASE("Linear prediction") {
+        // Fixed point of 10000, the first two values as integers and the
+        // differences to the extrapolated values as half bytes, with one half
+        // byte of padding at the end.
+        std::vector<uint8_t> data = {
+            0x40, 0xc3, 0x88, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40,
+            0x42, 0x0f, 0x00, 0xc8, 0x55, 0x0f, 0x00, 0x54, 0xc9,
+            0x8c, 0x2b, 0xf8, 0x25, 0xbd, 0x37, 0x10};
+        std::vector<double> expected = {100.0,  100.5,  101.25,
+                                        102.0,  99.875, 250.0625};
+        std::vector<double> output;
+        CHECK(Numpress::decode_linear(data, output) == Numpress::OK);
+        CHECK(output.size() == expected.size());
+        for (size_t i = 0; i < output.size() && i < expected.size(); ++i) {
+            CHECK(output[i] == doctest::Approx(expected[i]));
+        }
+    }
+    SUBCASE("Positive integers") {
+        std::vector<uint8_t> data = {0x87, 0x17, 0xf5, 0xc2, 0x13,
+                                     0x07, 0x11, 0x1f, 0xf0};
+        std::vector<double> expected = {0, 1, 15, 300, 70000, 4294967295.0};
+        std::vector<double> output;
+        CHECK(Numpress::decode_pic(data, output) == Numpress::OK);
+        CHECK(output == expected);
+    }
+    SUBCASE("Short logged floats") {
+        // Fixed point of 5000. The values are rounded when encoded, so they
+        // are only approximately recovered.
+        std::vector<uint8_t> data = {0x40, 0xb3, 0x88, 0x00, 0x00, 0x00,
+                                     0x00, 0x00, 0x00, 0x00, 0xd5, 0x2e,
+                                     0xf2, 0x86, 0xfa, 0xe4};
+        std::vector<double> expected = {0.0, 10.0, 1000.5, 123456.0};
+        std::vector<double> output;
+        CHECK(Numpress::decode_slof(data, output) == Numpress::OK);
+        CHECK(output.size() == expected.size());
+        for (size_t i = 0; i < output.size() && i < expected.size(); ++i) {
+            CHECK(output[i] == doctest::Approx(expected[i]).epsilon(0.001));
+        }
+    }
+    SUBCASE("Corrupt data") {
+        std::vector<double> output;
+        // Not enough bytes for the fixed point.
+        CHECK(Numpress::decode_linear({0x40, 0xc3}, output) ==
+              Numpress::ERROR);
+        CHECK(Numpress::decode_slof({0x40, 0xc3}, output) == Numpress::ERROR);
+        // The integer is truncated after its first half byte.
+        CHECK(Numpress::decode_pic({0x01}, output) == Numpress::ERROR);
+    }
+}
@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "doctest.h"
+
+#include "grid/grid.hpp"
+#include "raw_data/raw_data.hpp"
+
+TEST_CASE("Other raw data layouts give the same results as the scan layout") {
+    RawData::RawData raw_data = {};
+    raw_data.instrument_type = Instrument::ORBITRAP;
+    raw_data.min_mz = 200.0;
+    raw_data.max_mz = 202.0;
+    raw_data.min_rt = 10.0;
+    raw_data.max_rt = 14.0;
+    raw_data.resolution_ms1 = 70000;
+    raw_data.resolution_msn = 30000;
+    raw_data.reference_mz = 200;
+    raw_data.fwhm_rt = 2;
+    for (size_t j = 0; j < 5; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        // The middle scan is empty.
+        if (j != 2) {
+            for (size_t i = 0; i < 3; ++i) {
+                scan.mz.push_back(200.0 + i * 0.5 + j * 0.001);
+                scan.intensity.push_back(100.0 * (i + 1) + j);
+            }
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    auto flat_data = RawData::flatten(raw_data);
+    CHECK(RawData::num_scans(flat_data) == 5);
+    CHECK(flat_data.offsets == std::vector<uint64_t>{0, 3, 6, 6, 9, 12});
+    CHECK(flat_data.precursors.empty());
+    CHECK(flat_data.instrument_type == raw_data.instrument_type);
+    CHECK(flat_data.max_mz == raw_data.max_mz);
+    CHECK(flat_data.fwhm_rt == raw_data.fwhm_rt);
+    CHECK(RawData::theoretical_fwhm(flat_data, 201.0) ==
+          RawData::theoretical_fwhm(raw_data, 201.0));
+
+    auto xic_a = RawData::xic(raw_data, 200.4, 201.1, 10.5, 14.0, Xic::SUM);
+    auto xic_b = RawData::xic(flat_data, 200.4, 201.1, 10.5, 14.0, Xic::SUM);
+    CHECK(xic_a.retention_time.size() == 3);
+    CHECK(xic_a.retention_time == xic_b.retention_time);
+    CHECK(xic_a.intensity == xic_b.intensity);
+
+    auto points_a = RawData::raw_points(raw_data, 200.4, 201.1, 10.5, 14.0);
+    auto points_b = RawData::raw_points(flat_data, 200.4, 201.1, 10.5, 14.0);
+    CHECK(points_a.num_scans == 3);
+    CHECK(points_a.num_scans == points_b.num_scans);
+    CHECK(points_a.rt == points_b.rt);
+    CHECK(points_a.mz == points_b.mz);
+    CHECK(points_a.intensity == points_b.intensity);
+
+    Grid::ResampleParams params = {5, 5, 1, 1};
+    auto grid_a = Grid::resample(raw_data, params);
+    auto grid_b = Grid::resample(flat_data, params);
+    CHECK(grid_a.n == grid_b.n);
+    CHECK(grid_a.m == grid_b.m);
+    CHECK(grid_a.data == grid_b.data);
+    auto grid_parallel = Grid::resample_parallel(raw_data, params, 4);
+    CHECK(grid_a.data == grid_parallel.data);
+
+    // The single precision layout only matches approximately.
+    for (bool single_precision_mz : {false, true}) {
+        auto compact_data = RawData::compact(raw_data, single_precision_mz);
+        CHECK(RawData::num_scans(compact_data) == 5);
+        CHECK(compact_data.offsets == flat_data.offsets);
+        CHECK(compact_data.mz.size() == (single_precision_mz ? 0 : 12));
+        CHECK(compact_data.mz_offsets.size() == (single_precision_mz ? 12 : 0));
+
+        auto xic_c =
+            RawData::xic(compact_data, 200.4, 201.1, 10.5, 14.0, Xic::SUM);
+        CHECK(xic_a.retention_time == xic_c.retention_time);
+        for (size_t i = 0; i < xic_c.intensity.size(); ++i) {
+            CHECK(xic_a.intensity[i] == doctest::Approx(xic_c.intensity[i]));
+        }
+
+        auto points_c =
+            RawData::raw_points(compact_data, 200.4, 201.1, 10.5, 14.0);
+        CHECK(points_a.num_points == points_c.num_points);
+        CHECK(points_a.rt == points_c.rt);
+        for (size_t i = 0; i < points_c.num_points; ++i) {
+            CHECK(points_a.mz[i] == doctest::Approx(points_c.mz[i]));
+            CHECK(points_a.intensity[i] ==
+                  doctest::Approx(points_c.intensity[i]));
+        }
+
+        auto grid_c = Grid::resample(compact_data, params);
+        CHECK(grid_a.data.size() == grid_c.data.size());
+        double max_diff = 0;
+        for (size_t i = 0; i < grid_c.data.size(); ++i) {
+            max_diff =
+                std::max(max_diff, std::abs(grid_a.data[i] - grid_c.data[i]));
+        }
+        CHECK(max_diff < 1e-3);
+    }
+
+    // The compressed layout is lossless.
+    auto compressed_data = RawData::compress(raw_data);
+    CHECK(RawData::num_scans(compressed_data) == 5);
+    CHECK(compressed_data.num_points == std::vector<uint64_t>{3, 3, 0, 3, 3});
+    auto xic_d =
+        RawData::xic(compressed_data, 200.4, 201.1, 10.5, 14.0, Xic::SUM);
+    CHECK(xic_a.retention_time == xic_d.retention_time);
+    CHECK(xic_a.intensity == xic_d.intensity);
+    auto points_d =
+        RawData::raw_points(compressed_data, 200.4, 201.1, 10.5, 14.0);
+    CHECK(points_a.num_scans == points_d.num_scans);
+    CHECK(points_a.rt == points_d.rt);
+    CHECK(points_a.mz == points_d.mz);
+    CHECK(points_a.intensity == points_d.intensity);
+    auto grid_d = Grid::resample(compressed_data, params);
+    CHECK(grid_a.data == grid_d.data);
+}
+
+TEST_CASE("Indexed raw points queries") {
+    RawData::RawData raw_data = {};
+    raw_data.instrument_type = Instrument::ORBITRAP;
+    for (size_t j = 0; j < 20; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        // Every third scan only has points on the upper half of the range.
+        for (size_t i = 0; i < 100; ++i) {
+            double mz = 100.0 + i * 0.37 + j * 0.01;
+            if (j % 3 != 0 || i >= 50) {
+                scan.mz.push_back(mz);
+                scan.intensity.push_back(i + j);
+            }
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    auto index = RawData::build_roi_index(raw_data);
+    CHECK(index.num_tiles == 5);
+    CHECK(index.min_mz == doctest::Approx(100.01));
+    CHECK(index.tile_offsets.size() == 20 * 6);
+    auto compressed_data = RawData::compress(raw_data);
+    auto compressed_index = RawData::build_roi_index(compressed_data);
+    CHECK(compressed_index.tile_offsets == index.tile_offsets);
+
+    std::vector<std::vector<double>> queries = {
+        {105.0, 110.0, 12.0, 20.0},  {99.0, 100.5, 0.0, 100.0},
+        {110.0, 113.0, 15.5, 15.6},  {120.0, 150.0, 25.0, 40.0},
+        {0.0, 1000.0, 0.0, 1000.0},  {130.0, 135.0, 10.0, 29.0},
+        {135.0, 130.0, 10.0, 29.0},  {200.0, 300.0, 10.0, 29.0},
+    };
+    for (const auto &query : queries) {
+        auto expected = RawData::raw_points(raw_data, query[0], query[1],
+                                            query[2], query[3]);
+        auto points = RawData::raw_points(raw_data, index, query[0],
+                                          query[1], query[2], query[3]);
+        CHECK(points.num_points == expected.num_points);
+        CHECK(points.num_scans == expected.num_scans);
+        CHECK(points.rt == expected.rt);
+        CHECK(points.mz == expected.mz);
+        CHECK(points.intensity == expected.intensity);
+        points = RawData::raw_points(compressed_data, compressed_index,
+                                     query[0], query[1], query[2], query[3]);
+        CHECK(points.mz == expected.mz);
+        CHECK(points.intensity == expected.intensity);
+    }
+}
+
+TEST_CASE("Batched XIC extraction") {
+    RawData::RawData raw_data = {};
+    for (size_t j = 0; j < 30; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        // Some of the scans are empty.
+        if (j % 7 != 3) {
+            for (size_t i = 0; i < 50; ++i) {
+                scan.mz.push_back(100.0 + i * 0.5 + j * 0.01);
+                scan.intensity.push_back(1.0 + (i * j) % 11);
+            }
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    std::vector<Xic::Target> targets = {
+        {105.0, 106.0, 12.0, 30.0}, {100.0, 125.0, 0.0, 100.0},
+        {105.5, 105.6, 15.0, 15.0}, {110.0, 112.0, 25.5, 38.0},
+        {90.0, 95.0, 10.0, 20.0},   {105.0, 106.0, 50.0, 60.0},
+        {106.0, 105.0, 10.0, 20.0}, {104.0, 108.0, 20.0, 10.0},
+    };
+    for (auto method : {Xic::SUM, Xic::MAX}) {
+        for (size_t max_threads : {1, 4}) {
+            auto batch =
+                RawData::xic_batch(raw_data, targets, method, max_threads);
+            CHECK(batch.method == method);
+            CHECK(batch.offsets.size() == targets.size() + 1);
+            for (size_t k = 0; k < targets.size(); ++k) {
+                const auto &target = targets[k];
+                auto xic = RawData::xic(raw_data, target.min_mz, target.max_mz,
+                                        target.min_rt, target.max_rt, method);
+                std::vector<double> retention_time(
+                    batch.retention_time.begin() + batch.offsets[k],
+                    batch.retention_time.begin() + batch.offsets[k + 1]);
+                std::vector<double> intensity(
+                    batch.intensity.begin() + batch.offsets[k],
+                    batch.intensity.begin() + batch.offsets[k + 1]);
+                CHECK(retention_time == xic.retention_time);
+                CHECK(intensity == xic.intensity);
+            }
+        }
+    }
+    auto batch = RawData::xic_batch(raw_data, targets, Xic::UNKNOWN, 1);
+    CHECK(batch.method == Xic::UNKNOWN);
+    CHECK(batch.intensity.empty());
+}
+
+TEST_CASE("Intensity sums of rectangular regions") {
+    RawData::RawData raw_data = {};
+    for (size_t j = 0; j < 10; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 10.0 + j;
+        if (j != 4) {
+            for (size_t i = 0; i < 40; ++i) {
+                scan.mz.push_back(100.0 + i * 0.25 + j * 0.01);
+                scan.intensity.push_back(1.0 + (i * j) % 7);
+            }
+        }
+        scan.num_points = scan.mz.size();
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    auto sums = RawData::build_intensity_sums(raw_data);
+    CHECK(sums.offsets.size() == 10);
+    CHECK(sums.cumulative.size() == 9 * 41 + 1);
+
+    std::vector<Xic::Target> targets = {
+        {101.0, 103.0, 11.0, 15.0}, {100.0, 110.0, 0.0, 100.0},
+        {102.51, 102.51, 12.0, 12.0}, {95.0, 99.0, 10.0, 20.0},
+        {103.0, 101.0, 10.0, 20.0}, {101.0, 103.0, 30.0, 40.0},
+    };
+    for (const auto &target : targets) {
+        auto points = RawData::raw_points(raw_data, target.min_mz,
+                                          target.max_mz, target.min_rt,
+                                          target.max_rt);
+        double expected = 0;
+        for (const auto &intensity : points.intensity) {
+            expected += intensity;
+        }
+        CHECK(RawData::total_intensity(raw_data, sums, target.min_mz,
+                                       target.max_mz, target.min_rt,
+                                       target.max_rt) ==
+              doctest::Approx(expected));
+
+        auto xic_a = RawData::xic(raw_data, target.min_mz, target.max_mz,
+                                  target.min_rt, target.max_rt, Xic::SUM);
+        auto xic_b = RawData::xic(raw_data, sums, target.min_mz,
+                                  target.max_mz, target.min_rt, target.max_rt,
+                                  Xic::SUM);
+        CHECK(xic_a.retention_time == xic_b.retention_time);
+        for (size_t i = 0; i < xic_b.intensity.size(); ++i) {
+            CHECK(xic_a.intensity[i] == doctest::Approx(xic_b.intensity[i]));
+        }
+    }
+    auto batch_a = RawData::xic_batch(raw_data, targets, Xic::SUM, 1);
+    auto batch_b = RawData::xic_batch(raw_data, sums, targets, Xic::SUM, 1);
+    CHECK(batch_a.offsets == batch_b.offsets);
+    CHECK(batch_a.retention_time == batch_b.retention_time);
+    for (size_t i = 0; i < batch_b.intensity.size(); ++i) {
+        CHECK(batch_a.intensity[i] == doctest::Approx(batch_b.intensity[i]));
+    }
+    // The maximum doesn't use the sums.
+    batch_a = RawData::xic_batch(raw_data, targets, Xic::MAX, 1);
+    batch_b = RawData::xic_batch(raw_data, sums, targets, Xic::MAX, 1);
+    CHECK(batch_a.intensity == batch_b.intensity);
+}
+
+TEST_CASE("Decompressing scans of compressed raw data") {
+    // The arrays of the scans are longer than their number of points, which
+    // are the only ones that are compressed.
+    auto make_raw_data = [](double mz_offset) {
+        RawData::RawData raw_data = {};
+        for (size_t j = 0; j < 3; ++j) {
+            RawData::Scan scan = {};
+            scan.scan_number = j + 1;
+            scan.ms_level = 1;
+            scan.retention_time = 10.0 + j;
+            for (size_t i = 0; i < 4; ++i) {
+                scan.mz.push_back(mz_offset + i + j * 0.1);
+                scan.intensity.push_back(100.0 + i);
+            }
+            scan.num_points = 3;
+            raw_data.scans.push_back(scan);
+            raw_data.retention_times.push_back(scan.retention_time);
+        }
+        return raw_data;
+    };
+    auto raw_data_a = make_raw_data(100.0);
+    auto raw_data_b = make_raw_data(500.0);
+    auto compressed_a = RawData::compress(raw_data_a);
+    auto compressed_b = RawData::compress(raw_data_b);
+    CHECK(compressed_a.id != 0);
+    CHECK(compressed_b.id != 0);
+    CHECK(compressed_a.id != compressed_b.id);
+    CHECK(compressed_a.num_points == std::vector<uint64_t>{3, 3, 3});
+
+    // Check that the decompressed points of each scan are the first
+    // num_points points of the original scan.
+    auto check_points = [](const RawData::CompressedRawData &compressed_data,
+                           const RawData::RawData &raw_data) {
+        for (size_t j = 0; j < raw_data.scans.size(); ++j) {
+            const auto &scan = raw_data.scans[j];
+            auto points = RawData::scan_points(compressed_data, j);
+            CHECK(points.num_points == scan.num_points);
+            for (size_t i = 0; i < points.num_points; ++i) {
+                CHECK(points.mz[i] == scan.mz[i]);
+                CHECK(points.intensity[i] == scan.intensity[i]);
+            }
+        }
+    };
+    check_points(compressed_a, raw_data_a);
+    check_points(compressed_b, raw_data_b);
+
+    // Data with the id 0 is never taken from the cache, even if another data
+    // with the same id was decompressed before.
+    compressed_a.id = 0;
+    compressed_b.id = 0;
+    for (size_t k = 0; k < 2; ++k) {
+        check_points(compressed_a, raw_data_a);
+        check_points(compressed_b, raw_data_b);
+    }
+
+    // The points of scans with the id 0 remain valid after decompressing
+    // other scans, like those of any other data.
+    auto points_a = RawData::scan_points(compressed_a, 0);
+    auto points_b = RawData::scan_points(compressed_b, 2);
+    CHECK(points_a.num_points == 3);
+    CHECK(points_b.num_points == 3);
+    for (size_t i = 0; i < 3; ++i) {
+        CHECK(points_a.mz[i] == raw_data_a.scans[0].mz[i]);
+        CHECK(points_a.intensity[i] == raw_data_a.scans[0].intensity[i]);
+        CHECK(points_b.mz[i] == raw_data_b.scans[2].mz[i]);
+        CHECK(points_b.intensity[i] == raw_data_b.scans[2].intensity[i]);
+    }
+}
+
+TEST_CASE("Queries starting between the first two scans") {
+    // The search for the first scan in the retention time range must not stop
+    // at the first scan, which would include the second one even if it is
+    // below min_rt.
+    RawData::RawData raw_data = {};
+    for (size_t j = 0; j < 2; ++j) {
+        RawData::Scan scan = {};
+        scan.scan_number = j + 1;
+        scan.ms_level = 1;
+        scan.retention_time = 1.0 + j;
+        scan.mz = {200.0, 201.0};
+        scan.intensity = {100.0, 200.0};
+        scan.num_points = 2;
+        raw_data.scans.push_back(scan);
+        raw_data.retention_times.push_back(scan.retention_time);
+    }
+    auto xic = RawData::xic(raw_data, 0.0, 1000.0, 2.5, 10.0, Xic::SUM);
+    CHECK(xic.retention_time.empty());
+    CHECK(xic.intensity.empty());
+    auto points = RawData::raw_points(raw_data, 0.0, 1000.0, 2.5, 10.0);
+    CHECK(points.num_points == 0);
+    CHECK(std::find(points.rt.begin(), points.rt.end(), 2.0) ==
+          points.rt.end());
+
+    // The second scan is still found when the range starts at it.
+    xic = RawData::xic(raw_data, 0.0, 1000.0, 1.5, 10.0, Xic::SUM);
+    CHECK(xic.retention_time == std::vector<double>{2.0});
+    CHECK(xic.intensity == std::vector<double>{300.0});
+}
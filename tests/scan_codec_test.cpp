@@ -0,0 +1,92 @@
+#include <cstring>
+#include <vector>
+
+#include "doctest.h"
+#include "utils/scan_codec.hpp"
+
+// Compare the bit patterns, since the decoded values must be exactly the same.
+bool same_bits(const std::vector<double> &a, const std::vector<double> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        uint64_t a_bits = 0;
+        uint64_t b_bits = 0;
+        std::memcpy(&a_bits, &a[i], sizeof(double));
+        std::memcpy(&b_bits, &b[i], sizeof(double));
+        if (a_bits != b_bits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Compressing scans in memory") {
+    SUBCASE("Single and double precision values") {
+        std::vector<double> mz = {
+            400.0, 400.001, 400.0025, 400.5, 401.0009765625, 1999.999};
+        std::vector<double> intensity = {0.0, 1.5, 0.0, 123456.789, 1e-3, 7.0};
+        std::vector<std::vector<double>> mz_cases = {mz, {}};
+        std::vector<std::vector<double>> intensity_cases = {intensity, {}};
+        // Values read with 32 bit precision.
+        std::vector<double> mz_float;
+        std::vector<double> intensity_float;
+        for (size_t i = 0; i < mz.size(); ++i) {
+            mz_float.push_back(static_cast<float>(mz[i]));
+            intensity_float.push_back(static_cast<float>(intensity[i]));
+        }
+        mz_cases.push_back(mz_float);
+        intensity_cases.push_back(intensity_float);
+        for (size_t k = 0; k < mz_cases.size(); ++k) {
+            std::vector<uint8_t> data;
+            ScanCodec::encode_mz(mz_cases[k], data);
+            size_t mz_size = data.size();
+            ScanCodec::encode_intensity(intensity_cases[k], data);
+            std::vector<double> output;
+            CHECK(ScanCodec::decode_mz(data.data(), mz_size,
+                                       mz_cases[k].size(),
+                                       output) == ScanCodec::OK);
+            CHECK(same_bits(output, mz_cases[k]));
+            CHECK(ScanCodec::decode_intensity(
+                      data.data() + mz_size, data.size() - mz_size,
+                      intensity_cases[k].size(), output) == ScanCodec::OK);
+            CHECK(same_bits(output, intensity_cases[k]));
+        }
+    }
+    SUBCASE("Unsorted and negative values") {
+        std::vector<double> values = {5.0, -3.25, 1e300, 0.0, -0.0, 2.0};
+        std::vector<uint8_t> data;
+        ScanCodec::encode_mz(values, data);
+        std::vector<double> output;
+        CHECK(ScanCodec::decode_mz(data.data(), data.size(), values.size(),
+                                   output) == ScanCodec::OK);
+        CHECK(same_bits(output, values));
+    }
+    SUBCASE("Single precision mz take few bytes") {
+        // Profile spectra sampled every ~0.005 m/z.
+        std::vector<double> mz;
+        for (size_t i = 0; i < 1000; ++i) {
+            mz.push_back(static_cast<float>(400.0 + i * 0.005));
+        }
+        std::vector<uint8_t> data;
+        ScanCodec::encode_mz(mz, data);
+        CHECK(data.size() < 3 * mz.size());
+    }
+    SUBCASE("Corrupt data") {
+        std::vector<double> values = {1.0, 2.0, 3.0};
+        std::vector<uint8_t> data;
+        ScanCodec::encode_intensity(values, data);
+        std::vector<double> output;
+        // Truncated data.
+        CHECK(ScanCodec::decode_intensity(data.data(), data.size() - 1,
+                                          values.size(),
+                                          output) == ScanCodec::ERROR);
+        // Invalid shift.
+        data[0] = 64;
+        CHECK(ScanCodec::decode_intensity(data.data(), data.size(),
+                                          values.size(),
+                                          output) == ScanCodec::ERROR);
+        CHECK(ScanCodec::decode_mz(data.data(), 0, 0, output) ==
+              ScanCodec::ERROR);
+    }
+}
@@ -1,7 +1,193 @@
+#include <zlib.h>
+#include <cstring>
+#include <filesystem>
+#include <limits>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include "doctest.h"
 #include "raw_data/xml_reader.hpp"
+#include "utils/compression.hpp"
+#include "utils/memory_map.hpp"
+
+// Encode the values as little endian 64 bit floats in base64, as they are
+// stored in the binary data arrays of mzML files, optionally compressing them
+// with zlib first.
+std::string encode_mzml_array(const std::vector<double> &values,
+                              bool compressed) {
+    std::vector<uint8_t> bytes(values.size() * 8);
+    for (size_t i = 0; i < values.size(); ++i) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &values[i], 8);
+        for (size_t k = 0; k < 8; ++k) {
+            bytes[i * 8 + k] = (bits >> (8 * k)) & 0xff;
+        }
+    }
+    if (compressed) {
+        uLongf compressed_size = compressBound(bytes.size());
+        std::vector<uint8_t> compressed_bytes(compressed_size);
+        compress(compressed_bytes.data(), &compressed_size, bytes.data(),
+                 bytes.size());
+        compressed_bytes.resize(compressed_size);
+        bytes = compressed_bytes;
+    }
+    const char *table =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t n = bytes[i] << 16;
+        if (i + 1 < bytes.size()) {
+            n |= bytes[i + 1] << 8;
+        }
+        if (i + 2 < bytes.size()) {
+            n |= bytes[i + 2];
+        }
+        encoded += table[(n >> 18) & 63];
+        encoded += table[(n >> 12) & 63];
+        encoded += i + 1 < bytes.size() ? table[(n >> 6) & 63] : '=';
+        encoded += i + 2 < bytes.size() ? table[n & 63] : '=';
+    }
+    return encoded;
+}
+
+// Description of the spectra of the synthetic mzML files used in the tests.
+// The points of each spectrum are generated from its position in the file.
+struct MzmlSpectrum {
+    size_t ms_level;
+    Polarity::Type polarity;
+    double retention_time;
+    // Scan number of the precursor of MSn spectra.
+    size_t precursor_scan;
+    // The binary data of corrupt spectra can't be decompressed.
+    bool corrupt;
+};
+
+// Spectra of a DDA run with the given number of cycles, each consisting of one
+// MS1 spectrum followed by two MS2 spectra. The polarity alternates between
+// cycles and the retention time increases by one second on every spectrum.
+std::vector<MzmlSpectrum> dda_spectra(size_t num_cycles) {
+    std::vector<MzmlSpectrum> spectra;
+    for (size_t i = 0; i < num_cycles; ++i) {
+        auto polarity = i % 2 == 0 ? Polarity::POSITIVE : Polarity::NEGATIVE;
+        size_t ms1_scan = spectra.size() + 1;
+        spectra.push_back({1, polarity, spectra.size() + 1.0, 0, false});
+        spectra.push_back({2, polarity, spectra.size() + 1.0, ms1_scan, false});
+        spectra.push_back({2, polarity, spectra.size() + 1.0, ms1_scan, false});
+    }
+    return spectra;
+}
+
+// Build an indexed mzML file with the given spectra. The index contains the
+// byte offsets of all spectrum tags.
+std::string indexed_mzml(const std::vector<MzmlSpectrum> &spectra,
+                         bool compressed) {
+    std::string data = "<indexedmzML>\n<mzML>\n<run id=\"test\">\n";
+    data += "<spectrumList count=\"" + std::to_string(spectra.size()) +
+            "\">\n";
+    std::vector<size_t> offsets;
+    for (size_t i = 0; i < spectra.size(); ++i) {
+        const auto &spectrum = spectra[i];
+        auto id = "controllerType=0 controllerNumber=1 scan=" +
+                  std::to_string(i + 1);
+        offsets.push_back(data.size());
+        data += "<spectrum index=\"" + std::to_string(i) + "\" id=\"" + id +
+                "\" defaultArrayLength=\"4\">\n";
+        data += "<cvParam accession=\"MS:1000511\" name=\"ms level\" "
+                "value=\"" +
+                std::to_string(spectrum.ms_level) + "\"/>\n";
+        if (spectrum.polarity == Polarity::POSITIVE) {
+            data += "<cvParam accession=\"MS:1000130\"/>\n";
+        } else {
+            data += "<cvParam accession=\"MS:1000129\"/>\n";
+        }
+        data += "<scanList count=\"1\"><scan>\n";
+        data += "<cvParam accession=\"MS:1000016\" value=\"" +
+                std::to_string(spectrum.retention_time) +
+                "\" unitAccession=\"UO:0000010\"/>\n";
+        data += "</scan></scanList>\n";
+        if (spectrum.precursor_scan != 0) {
+            data += "<precursorList count=\"1\">\n";
+            data += "<precursor spectrumRef=\"controllerType=0 "
+                    "controllerNumber=1 scan=" +
+                    std::to_string(spectrum.precursor_scan) + "\">\n";
+            data += "<isolationWindow><cvParam accession=\"MS:1000827\" "
+                    "value=\"" +
+                    std::to_string(500.0 + i) +
+                    "\"/></isolationWindow>\n";
+            data += "<selectedIonList count=\"1\"><selectedIon>"
+                    "<cvParam accession=\"MS:1000041\" value=\"2\"/>"
+                    "</selectedIon></selectedIonList>\n";
+            data += "</precursor>\n</precursorList>\n";
+        }
+        // One of the points has zero intensity and is filtered out.
+        std::vector<double> mz = {100.0 + 10.0 * i, 100.5 + 10.0 * i,
+                                  101.0 + 10.0 * i, 101.5 + 10.0 * i};
+        std::vector<double> intensity = {1000.0 * (i + 1), 0.0, 500.0,
+                                         250.0 + i};
+        data += "<binaryDataArrayList count=\"2\">\n";
+        for (int type = 0; type < 2; ++type) {
+            data += "<binaryDataArray>\n";
+            data += "<cvParam accession=\"MS:1000523\"/>\n";
+            if (compressed || spectrum.corrupt) {
+                data += "<cvParam accession=\"MS:1000574\"/>\n";
+            }
+            data += type == 0 ? "<cvParam accession=\"MS:1000514\"/>\n"
+                              : "<cvParam accession=\"MS:1000515\"/>\n";
+            auto binary = spectrum.corrupt
+                              ? std::string("AAAAAAAAAAAA")
+                              : encode_mzml_array(type == 0 ? mz : intensity,
+                                                  compressed);
+            data += "<binary>" + binary + "</binary>\n";
+            data += "</binaryDataArray>\n";
+        }
+        data += "</binaryDataArrayList>\n</spectrum>\n";
+    }
+    data += "</spectrumList>\n</run>\n</mzML>\n";
+    size_t index_list_offset = data.size();
+    data += "<indexList count=\"1\">\n<index name=\"spectrum\">\n";
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        data += "<offset idRef=\"controllerType=0 controllerNumber=1 scan=" +
+                std::to_string(i + 1) + "\">" + std::to_string(offsets[i]) +
+                "</offset>\n";
+    }
+    data += "</index>\n</indexList>\n<indexListOffset>" +
+            std::to_string(index_list_offset) +
+            "</indexListOffset>\n</indexedmzML>\n";
+    return data;
+}
+
+// Read all the spectra of the given MS level and polarity from the mzML data
+// with the sequential reader.
+std::optional<RawData::RawData> read_mzml_sequential(
+    const std::string &data, double min_rt, double max_rt,
+    Polarity::Type polarity, size_t ms_level) {
+    std::stringstream stream(data);
+    return XmlReader::read_mzml(stream, 0, 1000, min_rt, max_rt,
+                                Instrument::ORBITRAP, 70000, 30000, 200,
+                                polarity, ms_level);
+}
+
+// Check that both RawData contain the same scans in the same order.
+void check_same_scans(const RawData::RawData &a, const RawData::RawData &b) {
+    CHECK(a.scans.size() == b.scans.size());
+    CHECK(a.retention_times == b.retention_times);
+    for (size_t i = 0; i < a.scans.size() && i < b.scans.size(); ++i) {
+        CHECK(a.scans[i].scan_number == b.scans[i].scan_number);
+        CHECK(a.scans[i].ms_level == b.scans[i].ms_level);
+        CHECK(a.scans[i].polarity == b.scans[i].polarity);
+        CHECK(a.scans[i].retention_time == b.scans[i].retention_time);
+        CHECK(a.scans[i].num_points == b.scans[i].num_points);
+        CHECK(a.scans[i].mz == b.scans[i].mz);
+        CHECK(a.scans[i].intensity == b.scans[i].intensity);
+        CHECK(a.scans[i].precursor_information.scan_number ==
+              b.scans[i].precursor_information.scan_number);
+        CHECK(a.scans[i].precursor_information.mz ==
+              b.scans[i].precursor_information.mz);
+        CHECK(a.scans[i].precursor_information.charge ==
+              b.scans[i].precursor_information.charge);
+    }
+}
 
 TEST_CASE("Reading a well formed tag") {
     SUBCASE("No spaces on the attributes") {
@@ -155,3 +341,937 @@ TEST_CASE("Reading mzidentml") {
     // TODO:...
     CHECK(true);
 }
+
+TEST_CASE("Tokenizing tags and data") {
+    SUBCASE("Attributes") {
+        std::vector<std::string> table = {
+            "<testTag attr1=\"one two\" attr2=\"2.0001\">DATA</testTag>",
+            "<testTag attr1=\"one two\"\tattr2='2.0001'   >DATA</testTag>",
+            "<testTag\n attr1 = \"one two\"\n attr2=\"2.0001\"\n>DATA</testTag>",
+        };
+        for (auto& test : table) {
+            auto tokenizer = XmlReader::Tokenizer(test);
+            auto tag = tokenizer.read_tag();
+            CHECK(tag != std::nullopt);
+            if (tag) {
+                CHECK(tag->name == "testTag");
+                CHECK(!tag->closed);
+                CHECK(tag->num_attributes == 2);
+                CHECK(tag->has_attribute("attr1"));
+                CHECK(!tag->has_attribute("attr3"));
+                CHECK(tag->attribute("attr1") == "one two");
+                CHECK(tag->attribute("attr2") == "2.0001");
+                CHECK(tag->attribute("attr3") == "");
+            }
+            auto data = tokenizer.read_data();
+            CHECK(data == std::optional<std::string_view>("DATA"));
+            tag = tokenizer.read_tag();
+            CHECK(tag != std::nullopt);
+            if (tag) {
+                CHECK(tag->name == "testTag");
+                CHECK(tag->closed);
+            }
+            CHECK(tokenizer.read_tag() == std::nullopt);
+        }
+    }
+    SUBCASE("Self-closing tags and whitespace") {
+        auto tokenizer = XmlReader::Tokenizer(
+            "<a>\n  <b c=\"1\"/>\n  <d/>\n  <e>   </e>\n</a>");
+        auto tag = tokenizer.read_tag();
+        CHECK(tag->name == "a");
+        CHECK(!tag->closed);
+        tag = tokenizer.read_tag();
+        CHECK(tag->name == "b");
+        CHECK(tag->closed);
+        CHECK(tag->attribute("c") == "1");
+        tag = tokenizer.read_tag();
+        CHECK(tag->name == "d");
+        CHECK(tag->closed);
+        CHECK(tag->num_attributes == 0);
+        tag = tokenizer.read_tag();
+        CHECK(tag->name == "e");
+        CHECK(tokenizer.read_data() == std::nullopt);
+        tag = tokenizer.read_tag();
+        CHECK(tag->name == "e");
+        CHECK(tag->closed);
+        tag = tokenizer.read_tag();
+        CHECK(tag->name == "a");
+        CHECK(tag->closed);
+    }
+    SUBCASE("More attributes than stored inline") {
+        std::string test = "<scan";
+        for (size_t i = 0; i < 30; ++i) {
+            test += " vendor" + std::to_string(i) + "=\"" +
+                    std::to_string(i) + "\"";
+        }
+        test += " msLevel=\"2\"/>";
+        auto tokenizer = XmlReader::Tokenizer(test);
+        auto tag = tokenizer.read_tag();
+        CHECK(tag != std::nullopt);
+        if (tag) {
+            CHECK(tag->name == "scan");
+            CHECK(tag->closed);
+            CHECK(tag->num_attributes == XmlReader::TagView::max_attributes);
+            CHECK(tag->overflow_attributes.size() ==
+                  31 - XmlReader::TagView::max_attributes);
+            CHECK(tag->attribute("vendor0") == "0");
+            CHECK(tag->attribute("vendor29") == "29");
+            CHECK(tag->has_attribute("msLevel"));
+            CHECK(tag->attribute("msLevel") == "2");
+        }
+    }
+    SUBCASE("Malformed tags") {
+        auto tokenizer = XmlReader::Tokenizer("<a b=\"1></a>");
+        CHECK(tokenizer.read_tag() == std::nullopt);
+    }
+}
+
+TEST_CASE("Reading MS-Numpress compressed mzML") {
+    // The m/z are stored with linear prediction followed by zlib compression,
+    // while the intensities are stored as short logged floats on the first
+    // spectrum and as positive integers on the second.
+    const char* mz_ml_data = R"mz_ml(
+        <mzML>
+        <run id="numpress">
+        <spectrumList count="2">
+        <spectrum index="0" id="scan=1" defaultArrayLength="4">
+            <cvParam accession="MS:1000511" name="ms level" value="1"/>
+            <scanList count="1"><scan>
+                <cvParam accession="MS:1000016" value="10.5"
+                         unitAccession="UO:0000010"/>
+            </scan></scanList>
+            <binaryDataArrayList count="2">
+            <binaryDataArray encodedLength="32">
+                <cvParam accession="MS:1000523" name="64-bit float"/>
+                <cvParam accession="MS:1002746"/>
+                <cvParam accession="MS:1000514" name="m/z array"/>
+                <binary>eJxz+JHFAAZRSUwBsslMzf1OAgAwqASX</binary>
+            </binaryDataArray>
+            <binaryDataArray encodedLength="24">
+                <cvParam accession="MS:1000523" name="64-bit float"/>
+                <cvParam accession="MS:1002314"/>
+                <cvParam accession="MS:1000515" name="intensity array"/>
+                <binary>QLOIAAAAAADwhgAAAkBS9g==</binary>
+            </binaryDataArray>
+            </binaryDataArrayList>
+        </spectrum>
+        <spectrum index="1" id="scan=2" defaultArrayLength="4">
+            <cvParam accession="MS:1000511" name="ms level" value="1"/>
+            <scanList count="1"><scan>
+                <cvParam accession="MS:1000016" value="11.5"
+                         unitAccession="UO:0000010"/>
+            </scan></scanList>
+            <binaryDataArrayList count="2">
+            <binaryDataArray encodedLength="32">
+                <cvParam accession="MS:1000523" name="64-bit float"/>
+                <cvParam accession="MS:1002746"/>
+                <cvParam accession="MS:1000514" name="m/z array"/>
+                <binary>eJxz+JHFAAZRSUwBsslMzf1OAgAwqASX</binary>
+            </binaryDataArray>
+            <binaryDataArray encodedLength="12">
+                <cvParam accession="MS:1000523" name="64-bit float"/>
+                <cvParam accession="MS:1002313"/>
+                <cvParam accession="MS:1000515" name="intensity array"/>
+                <binary>WOOGoTDjlA==</binary>
+            </binaryDataArray>
+            </binaryDataArrayList>
+        </spectrum>
+        </spectrumList>
+        </run>
+        </mzML>
+    )mz_ml";
+    auto stream = std::stringstream(mz_ml_data);
+    auto raw_data = XmlReader::read_mzml(
+        stream, 0, std::numeric_limits<double>::infinity(), 0,
+        std::numeric_limits<double>::infinity(), Instrument::ORBITRAP, 70000,
+        30000, 200, Polarity::BOTH, 1);
+    CHECK(raw_data != std::nullopt);
+    if (raw_data) {
+        CHECK(raw_data->scans.size() == 2);
+        // Points with zero intensity are filtered out.
+        std::vector<double> expected_mz = {400.0, 401.0, 402.25};
+        std::vector<double> expected_intensity = {1000.0, 25.5, 300000.0};
+        for (const auto& scan : raw_data->scans) {
+            CHECK(scan.num_points == 3);
+            for (size_t i = 0; i < scan.num_points && i < 3; ++i) {
+                CHECK(scan.mz[i] == doctest::Approx(expected_mz[i]));
+                CHECK(scan.intensity[i] ==
+                      doctest::Approx(expected_intensity[i]).epsilon(0.02));
+            }
+        }
+    }
+}
+
+TEST_CASE("Reading indexed mzXML with nested scans") {
+    // Each MS1 scan contains its MS2 scans, and the MS3 scan is nested on the
+    // first MS2 scan.
+    std::string scan_template =
+        R"(<scan num="%" msLevel="#" peaksCount="3" polarity="+" )"
+        R"(retentionTime="PT@S">)"
+        R"(<precursorMz precursorCharge="2">500.0</precursorMz>)"
+        R"(<peaks precision="32" byteOrder="network" contentType="m/z-int">)"
+        R"(QsgAAEEgAABDSAAAQaAAAEOWAABB8AAA</peaks>)";
+    auto scan_tag = [&scan_template](int num, int ms_level, double rt) {
+        auto tag = scan_template;
+        tag.replace(tag.find('%'), 1, std::to_string(num));
+        tag.replace(tag.find('#'), 1, std::to_string(ms_level));
+        tag.replace(tag.find('@'), 1, std::to_string(rt));
+        return tag + "\n";
+    };
+    std::string data = "<mzXML>\n<msRun>\n";
+    std::vector<size_t> offsets;
+    int num = 1;
+    for (int i = 0; i < 3; ++i) {
+        offsets.push_back(data.size());
+        data += scan_tag(num, 1, num);
+        ++num;
+        offsets.push_back(data.size());
+        data += scan_tag(num, 2, num);
+        ++num;
+        offsets.push_back(data.size());
+        data += scan_tag(num, 3, num) + "</scan>\n</scan>\n";
+        ++num;
+        offsets.push_back(data.size());
+        data += scan_tag(num, 2, num) + "</scan>\n</scan>\n";
+        ++num;
+    }
+    data += "</msRun>\n";
+    size_t index_offset = data.size();
+    data += "<index name=\"scan\">\n";
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        data += "<offset id=\"" + std::to_string(i + 1) + "\">" +
+                std::to_string(offsets[i]) + "</offset>\n";
+    }
+    data += "</index>\n<indexOffset>" + std::to_string(index_offset) +
+            "</indexOffset>\n</mzXML>\n";
+
+    auto index = XmlReader::read_mzxml_index(data);
+    CHECK(index != std::nullopt);
+    if (!index) {
+        return;
+    }
+    CHECK(index->offsets.size() == 12);
+    for (size_t ms_level = 1; ms_level <= 3; ++ms_level) {
+        for (auto [min_rt, max_rt] : {std::pair{0.0, 100.0},
+                                      std::pair{2.5, 7.5},
+                                      std::pair{6.0, 6.0}}) {
+            auto [first, last] =
+                XmlReader::find_mzxml_scans(data, *index, min_rt, max_rt);
+            auto indexed = XmlReader::read_mzxml_indexed(
+                data, *index, first, last, 0, 1000, min_rt, max_rt,
+                Instrument::ORBITRAP, 70000, 30000, 200, Polarity::BOTH,
+                ms_level, 2);
+            std::stringstream stream(data);
+            auto sequential = XmlReader::read_mzxml(
+                stream, 0, 1000, min_rt, max_rt, Instrument::ORBITRAP, 70000,
+                30000, 200, Polarity::BOTH, ms_level);
+            CHECK(indexed != std::nullopt);
+            CHECK(sequential != std::nullopt);
+            if (!indexed || !sequential) {
+                continue;
+            }
+            CHECK(indexed->scans.size() == sequential->scans.size());
+            for (size_t i = 0; i < indexed->scans.size() &&
+                               i < sequential->scans.size();
+                 ++i) {
+                const auto &a = indexed->scans[i];
+                const auto &b = sequential->scans[i];
+                CHECK(a.scan_number == b.scan_number);
+                CHECK(a.retention_time == b.retention_time);
+                CHECK(a.mz == b.mz);
+                CHECK(a.intensity == b.intensity);
+                CHECK(a.precursor_information.scan_number ==
+                      b.precursor_information.scan_number);
+            }
+        }
+    }
+    // The MS3 scans take the MS2 scan that contains them as precursor.
+    auto ms3 = XmlReader::read_mzxml_indexed(
+        data, *index, 0, index->offsets.size(), 0, 1000, 0, 100,
+        Instrument::ORBITRAP, 70000, 30000, 200, Polarity::BOTH, 3, 1);
+    CHECK(ms3 != std::nullopt);
+    if (ms3) {
+        CHECK(ms3->scans.size() == 3);
+        for (const auto &scan : ms3->scans) {
+            CHECK(scan.precursor_information.scan_number ==
+                  scan.scan_number - 1);
+        }
+    }
+    // The MS2 scans can be read without their points in the same pass as the
+    // MS1 scans.
+    std::vector<XmlReader::ScanFilter> filters = {
+        {1, Polarity::BOTH}, {2, Polarity::BOTH, true}};
+    std::stringstream stream(data);
+    auto sequential = XmlReader::read_mzxml_parallel(
+        stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000, 200,
+        filters, 2);
+    auto indexed = XmlReader::read_mzxml_indexed(
+        data, *index, 0, index->offsets.size(), 0, 1000, 0, 100,
+        Instrument::ORBITRAP, 70000, 30000, 200, filters, 2);
+    CHECK(sequential != std::nullopt);
+    CHECK(indexed != std::nullopt);
+    for (const auto &raw_data : {sequential, indexed}) {
+        if (!raw_data) {
+            continue;
+        }
+        CHECK(raw_data->at(0).scans.size() == 3);
+        for (const auto &scan : raw_data->at(0).scans) {
+            CHECK(scan.num_points == 3);
+        }
+        CHECK(raw_data->at(1).scans.size() == 6);
+        for (const auto &scan : raw_data->at(1).scans) {
+            CHECK(scan.num_points == 0);
+            CHECK(scan.mz.empty());
+            CHECK(scan.precursor_information.mz == 500.0);
+            CHECK(scan.precursor_information.scan_number ==
+                  (scan.scan_number - 1) / 4 * 4 + 1);
+        }
+    }
+}
+
+TEST_CASE("Centroiding profile scans while reading") {
+    // Two Gaussian peaks centered at 400.003 and 400.502, sampled every 0.01
+    // m/z with 64 bit precision, separated by a gap in the sampling.
+    std::string peaks =
+        "QHj/hR64UexAEUV32dmXRUB4/64UeuFIQFHAV7c2uq1AeP/XCj1wpEB62Orwcc2B"
+        "QHkAAAAAAABAjd/618FqCUB5ACj1wo9dQIh1ouTxqGlAeQBR64UeuUBtd9/b79VT"
+        "QHkAeuFHrhVAOh8Ut1arJ0B5AKPXCj1xP/EJSFJFCzNAeQeFHrhR7EAH53KLuV+u"
+        "QHkHrhR64UhARjr7x8wNoEB5B9cKPXCkQG5sCT2LovdAeQgAAAAAAEB+oZbiB9Ji"
+        "QHkIKPXCj11AdrExOlke6UB5CFHrhR65QFi8wiSUE8RAeQh64UeuFUAj11H8M24x";
+    std::string data =
+        R"(<mzXML><msRun>)"
+        R"(<scan num="1" msLevel="1" peaksCount="15" retentionTime="PT1S" )"
+        R"(centroided="0"><peaks precision="64" byteOrder="network" )"
+        R"(contentType="m/z-int">)" +
+        peaks +
+        R"(</peaks></scan>)"
+        R"(<scan num="2" msLevel="1" peaksCount="15" retentionTime="PT2S" )"
+        R"(centroided="1"><peaks precision="64" byteOrder="network" )"
+        R"(contentType="m/z-int">)" +
+        peaks + R"(</peaks></scan></msRun></mzXML>)";
+    for (bool centroid : {false, true}) {
+        std::vector<XmlReader::ScanFilter> filters = {
+            {1, Polarity::BOTH, false, centroid}};
+        std::stringstream stream(data);
+        auto raw_data = XmlReader::read_mzxml_parallel(
+            stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000, 200,
+            filters, 1);
+        CHECK(raw_data != std::nullopt);
+        if (!raw_data) {
+            continue;
+        }
+        const auto &scans = raw_data->at(0).scans;
+        CHECK(scans.size() == 2);
+        if (scans.size() != 2) {
+            continue;
+        }
+        // Scans that are already centroided are not modified.
+        CHECK(scans[1].num_points == 15);
+        if (!centroid) {
+            CHECK(scans[0].num_points == 15);
+            continue;
+        }
+        CHECK(scans[0].num_points == 2);
+        CHECK(scans[0].mz.size() == 2);
+        CHECK(scans[0].intensity.size() == 2);
+        if (scans[0].mz.size() != 2 || scans[0].intensity.size() != 2) {
+            continue;
+        }
+        CHECK(scans[0].mz[0] == doctest::Approx(400.003).epsilon(1e-8));
+        CHECK(scans[0].mz[1] == doctest::Approx(400.502).epsilon(1e-8));
+        CHECK(scans[0].intensity[0] == doctest::Approx(2506.5148));
+        CHECK(scans[0].intensity[1] == doctest::Approx(1252.8687));
+        CHECK(scans[0].total_intensity ==
+              doctest::Approx(scans[1].total_intensity));
+    }
+}
+
+TEST_CASE("Reading indexed mzML") {
+    auto spectra = dda_spectra(6);
+    auto data = indexed_mzml(spectra, false);
+    auto index = XmlReader::read_mzml_index(data);
+    CHECK(index != std::nullopt);
+    if (!index) {
+        return;
+    }
+    CHECK(index->offsets.size() == spectra.size());
+    CHECK(index->ids.size() == spectra.size());
+    for (size_t i = 0; i < index->offsets.size(); ++i) {
+        CHECK(data.compare(index->offsets[i], 9, "<spectrum") == 0);
+        CHECK(index->ids[i] == "controllerType=0 controllerNumber=1 scan=" +
+                                   std::to_string(i + 1));
+    }
+
+    SUBCASE("Reading the whole file") {
+        for (size_t ms_level : {1, 2}) {
+            auto indexed = XmlReader::read_mzml_indexed(
+                data, *index, 0, index->offsets.size(), 0, 1000, 0, 100,
+                Instrument::ORBITRAP, 70000, 30000, 200, Polarity::BOTH,
+                ms_level, 2);
+            auto sequential =
+                read_mzml_sequential(data, 0, 100, Polarity::BOTH, ms_level);
+            CHECK(indexed != std::nullopt);
+            CHECK(sequential != std::nullopt);
+            if (indexed && sequential) {
+                CHECK(indexed->scans.size() == (ms_level == 1 ? 6 : 12));
+                check_same_scans(*indexed, *sequential);
+            }
+        }
+    }
+
+    SUBCASE("Reading a retention time range") {
+        // The spectra have retention times 1, 2, ..., 18.
+        auto [first, last] =
+            XmlReader::find_mzml_spectra(data, *index, 4.5, 10.0);
+        CHECK(first == 4);
+        CHECK(last == 10);
+        for (size_t ms_level : {1, 2}) {
+            auto indexed = XmlReader::read_mzml_indexed(
+                data, *index, first, last, 0, 1000, 4.5, 10.0,
+                Instrument::ORBITRAP, 70000, 30000, 200, Polarity::BOTH,
+                ms_level, 3);
+            auto sequential =
+                read_mzml_sequential(data, 4.5, 10.0, Polarity::BOTH, ms_level);
+            CHECK(indexed != std::nullopt);
+            CHECK(sequential != std::nullopt);
+            if (indexed && sequential) {
+                CHECK(indexed->scans.size() == (ms_level == 1 ? 2 : 4));
+                check_same_scans(*indexed, *sequential);
+            }
+        }
+        // Ranges outside of the file are empty.
+        auto [before_first, before_last] =
+            XmlReader::find_mzml_spectra(data, *index, -10.0, 0.5);
+        CHECK(before_first == 0);
+        CHECK(before_last == 0);
+        auto [after_first, after_last] =
+            XmlReader::find_mzml_spectra(data, *index, 18.5, 100.0);
+        CHECK(after_first == spectra.size());
+        CHECK(after_last == spectra.size());
+    }
+
+    SUBCASE("Missing index list offset") {
+        auto truncated = data.substr(0, data.find("<indexListOffset>"));
+        CHECK(XmlReader::read_mzml_index(truncated) == std::nullopt);
+    }
+
+    SUBCASE("Offsets not pointing to a spectrum") {
+        auto wrong_index = *index;
+        wrong_index.offsets[3] += 1;
+        auto indexed = XmlReader::read_mzml_indexed(
+            data, wrong_index, 0, wrong_index.offsets.size(), 0, 1000, 0, 100,
+            Instrument::ORBITRAP, 70000, 30000, 200, Polarity::BOTH, 1, 2);
+        CHECK(indexed == std::nullopt);
+    }
+}
+
+TEST_CASE("Reading mzML and mzXML in parallel") {
+    auto spectra = dda_spectra(20);
+    SUBCASE("mzML") {
+        for (bool compressed : {false, true}) {
+            auto data = indexed_mzml(spectra, compressed);
+            for (size_t ms_level : {1, 2}) {
+                auto sequential = read_mzml_sequential(
+                    data, 0, 100, Polarity::BOTH, ms_level);
+                CHECK(sequential != std::nullopt);
+                if (!sequential) {
+                    continue;
+                }
+                CHECK(sequential->scans.size() == (ms_level == 1 ? 20 : 40));
+                for (size_t max_threads : {1, 4}) {
+                    // Elements read from a std::stringstream are copied
+                    // before being parsed, while the ones from a
+                    // MemoryStream point directly to its memory.
+                    std::stringstream stream(data);
+                    MemoryMap::MemoryStream memory_stream(data);
+                    for (std::istream *input :
+                         {static_cast<std::istream *>(&stream),
+                          static_cast<std::istream *>(&memory_stream)}) {
+                        auto parallel = XmlReader::read_mzml_parallel(
+                            *input, 0, 1000, 0, 100, Instrument::ORBITRAP,
+                            70000, 30000, 200, Polarity::BOTH, ms_level,
+                            max_threads);
+                        CHECK(parallel != std::nullopt);
+                        if (parallel) {
+                            check_same_scans(*parallel, *sequential);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    SUBCASE("mzML with a corrupt spectrum") {
+        // Reading stops at the spectrum that can't be decoded, keeping the
+        // ones before it.
+        auto corrupt_spectra = spectra;
+        corrupt_spectra[30].corrupt = true;
+        auto data = indexed_mzml(corrupt_spectra, true);
+        auto sequential = read_mzml_sequential(data, 0, 100, Polarity::BOTH, 1);
+        CHECK(sequential != std::nullopt);
+        if (!sequential) {
+            return;
+        }
+        CHECK(sequential->scans.size() == 10);
+        for (size_t max_threads : {1, 4}) {
+            std::stringstream stream(data);
+            auto parallel = XmlReader::read_mzml_parallel(
+                stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000,
+                200, Polarity::BOTH, 1, max_threads);
+            CHECK(parallel != std::nullopt);
+            if (parallel) {
+                check_same_scans(*parallel, *sequential);
+            }
+        }
+    }
+
+    SUBCASE("mzXML") {
+        std::string data = "<mzXML>\n<msRun>\n";
+        for (size_t i = 0; i < spectra.size(); ++i) {
+            const auto &spectrum = spectra[i];
+            data += "<scan num=\"" + std::to_string(i + 1) + "\" msLevel=\"" +
+                    std::to_string(spectrum.ms_level) +
+                    "\" peaksCount=\"3\" polarity=\"" +
+                    (spectrum.polarity == Polarity::POSITIVE ? "+" : "-") +
+                    "\" retentionTime=\"PT" +
+                    std::to_string(spectrum.retention_time) + "S\">";
+            if (spectrum.precursor_scan != 0) {
+                data += "<precursorMz precursorScanNum=\"" +
+                        std::to_string(spectrum.precursor_scan) +
+                        "\" precursorCharge=\"2\">500.0</precursorMz>";
+            }
+            data +=
+                "<peaks precision=\"32\" byteOrder=\"network\" "
+                "contentType=\"m/z-int\">"
+                "QsgAAEEgAABDSAAAQaAAAEOWAABB8AAA</peaks></scan>\n";
+        }
+        data += "</msRun>\n</mzXML>\n";
+        for (size_t ms_level : {1, 2}) {
+            std::stringstream sequential_stream(data);
+            auto sequential = XmlReader::read_mzxml(
+                sequential_stream, 0, 1000, 0, 100, Instrument::ORBITRAP,
+                70000, 30000, 200, Polarity::BOTH, ms_level);
+            CHECK(sequential != std::nullopt);
+            if (!sequential) {
+                continue;
+            }
+            CHECK(sequential->scans.size() == (ms_level == 1 ? 20 : 40));
+            for (size_t max_threads : {1, 4}) {
+                std::stringstream stream(data);
+                MemoryMap::MemoryStream memory_stream(data);
+                for (std::istream *input :
+                     {static_cast<std::istream *>(&stream),
+                      static_cast<std::istream *>(&memory_stream)}) {
+                    auto parallel = XmlReader::read_mzxml_parallel(
+                        *input, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000,
+                        30000, 200, Polarity::BOTH, ms_level, max_threads);
+                    CHECK(parallel != std::nullopt);
+                    if (parallel) {
+                        check_same_scans(*parallel, *sequential);
+                    }
+                }
+            }
+        }
+    }
+
+    SUBCASE("Elements split between chunks") {
+        // With small chunks the tags and the elements are split between the
+        // buffers of the reader, which must return the same elements as when
+        // reading the whole file from memory.
+        auto data = indexed_mzml(spectra, false);
+        MemoryMap::MemoryStream memory_stream(data);
+        XmlReader::ElementReader memory_reader(memory_stream, "spectrum");
+        std::vector<std::string> expected;
+        while (auto element = memory_reader.next()) {
+            expected.emplace_back(element.value());
+        }
+        CHECK(expected.size() == spectra.size());
+        for (size_t chunk_size : {1, 7, 64, 1000}) {
+            std::stringstream stream(data);
+            XmlReader::ElementReader reader(stream, "spectrum", chunk_size);
+            std::vector<std::string> elements;
+            while (auto element = reader.next()) {
+                elements.emplace_back(element.value());
+            }
+            CHECK(elements == expected);
+        }
+    }
+}
+
+TEST_CASE("Skipping mzML spectra while reading") {
+    auto spectra = dda_spectra(6);
+    // Read the data with the sequential and parallel readers, checking that
+    // all of them give the same results.
+    auto read_all = [](const std::string &data, double max_rt,
+                       Polarity::Type polarity, size_t ms_level) {
+        auto sequential =
+            read_mzml_sequential(data, 0, max_rt, polarity, ms_level);
+        CHECK(sequential != std::nullopt);
+        if (!sequential) {
+            return RawData::RawData{};
+        }
+        for (size_t max_threads : {1, 4}) {
+            std::stringstream stream(data);
+            auto parallel = XmlReader::read_mzml_parallel(
+                stream, 0, 1000, 0, max_rt, Instrument::ORBITRAP, 70000, 30000,
+                200, polarity, ms_level, max_threads);
+            CHECK(parallel != std::nullopt);
+            if (parallel) {
+                check_same_scans(*parallel, *sequential);
+            }
+        }
+        return sequential.value();
+    };
+
+    SUBCASE("MS2 spectra interleaved with MS1 spectra") {
+        auto data = indexed_mzml(spectra, false);
+        auto ms1 = read_all(data, 100, Polarity::BOTH, 1);
+        CHECK(ms1.scans.size() == 6);
+        for (size_t i = 0; i < ms1.scans.size(); ++i) {
+            CHECK(ms1.scans[i].ms_level == 1);
+            CHECK(ms1.scans[i].scan_number == 3 * i + 1);
+            CHECK(ms1.scans[i].num_points == 3);
+        }
+        auto ms2 = read_all(data, 100, Polarity::BOTH, 2);
+        CHECK(ms2.scans.size() == 12);
+        for (size_t i = 0; i < ms2.scans.size(); ++i) {
+            CHECK(ms2.scans[i].ms_level == 2);
+            CHECK(ms2.scans[i].scan_number == 3 * (i / 2) + 2 + i % 2);
+            CHECK(ms2.scans[i].precursor_information.scan_number ==
+                  3 * (i / 2) + 1);
+            CHECK(ms2.scans[i].num_points == 3);
+        }
+    }
+
+    SUBCASE("Maximum retention time in the middle of the file") {
+        // Reading stops at the first spectrum past max_rt, so the last
+        // spectrum is not read even if its retention time is in range.
+        auto unsorted_spectra = spectra;
+        unsorted_spectra.push_back({1, Polarity::POSITIVE, 2.5, 0, false});
+        auto data = indexed_mzml(unsorted_spectra, false);
+        for (size_t ms_level : {1, 2}) {
+            auto raw_data = read_all(data, 9.5, Polarity::BOTH, ms_level);
+            CHECK(raw_data.scans.size() == (ms_level == 1 ? 3 : 6));
+            for (const auto &scan : raw_data.scans) {
+                CHECK(scan.retention_time <= 9.5);
+            }
+        }
+    }
+
+    SUBCASE("Spectra rejected by their polarity") {
+        // The binary data of a spectrum with the wrong polarity is not
+        // decoded, so its corrupt data is not an error.
+        auto corrupt_spectra = spectra;
+        corrupt_spectra[3].corrupt = true;
+        auto data = indexed_mzml(corrupt_spectra, true);
+        auto positive = read_all(data, 100, Polarity::POSITIVE, 1);
+        CHECK(positive.scans.size() == 3);
+        for (const auto &scan : positive.scans) {
+            CHECK(scan.polarity == Polarity::POSITIVE);
+        }
+        // When the spectrum is selected, reading stops at its corrupt data.
+        auto negative = read_all(data, 100, Polarity::NEGATIVE, 1);
+        CHECK(negative.scans.empty());
+        auto both = read_all(data, 100, Polarity::BOTH, 1);
+        CHECK(both.scans.size() == 1);
+    }
+}
+
+TEST_CASE("Reading several mzML scan filters in one pass") {
+    auto data = indexed_mzml(dda_spectra(8), true);
+    auto index = XmlReader::read_mzml_index(data);
+    CHECK(index != std::nullopt);
+    if (!index) {
+        return;
+    }
+    std::vector<XmlReader::ScanFilter> filters = {{1, Polarity::POSITIVE},
+                                                  {1, Polarity::NEGATIVE},
+                                                  {2, Polarity::BOTH}};
+    std::vector<RawData::RawData> expected;
+    for (const auto &filter : filters) {
+        auto raw_data = read_mzml_sequential(data, 0, 100, filter.polarity,
+                                             filter.ms_level);
+        CHECK(raw_data != std::nullopt);
+        if (!raw_data) {
+            return;
+        }
+        expected.push_back(raw_data.value());
+    }
+    CHECK(expected[0].scans.size() == 4);
+    CHECK(expected[1].scans.size() == 4);
+    CHECK(expected[2].scans.size() == 16);
+    for (size_t max_threads : {1, 4}) {
+        std::stringstream stream(data);
+        auto parallel = XmlReader::read_mzml_parallel(
+            stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000, 200,
+            filters, max_threads);
+        auto indexed = XmlReader::read_mzml_indexed(
+            data, *index, 0, index->offsets.size(), 0, 1000, 0, 100,
+            Instrument::ORBITRAP, 70000, 30000, 200, filters, max_threads);
+        for (const auto &raw_data : {parallel, indexed}) {
+            CHECK(raw_data != std::nullopt);
+            if (!raw_data) {
+                continue;
+            }
+            CHECK(raw_data->size() == filters.size());
+            for (size_t i = 0; i < raw_data->size() && i < filters.size();
+                 ++i) {
+                check_same_scans(raw_data->at(i), expected[i]);
+                CHECK(raw_data->at(i).min_mz == expected[i].min_mz);
+                CHECK(raw_data->at(i).max_mz == expected[i].max_mz);
+                CHECK(raw_data->at(i).min_rt == expected[i].min_rt);
+                CHECK(raw_data->at(i).max_rt == expected[i].max_rt);
+            }
+        }
+    }
+}
+
+TEST_CASE("Reading gzip compressed mzML") {
+    auto data = indexed_mzml(dda_spectra(20), false);
+    auto path = std::filesystem::temp_directory_path() /
+                "pastaq_xml_reader_test.mzML.gz";
+    gzFile file = gzopen(path.string().c_str(), "wb");
+    CHECK(file != nullptr);
+    if (!file) {
+        return;
+    }
+    gzwrite(file, data.data(), data.size());
+    gzclose(file);
+    for (size_t ms_level : {1, 2}) {
+        auto sequential =
+            read_mzml_sequential(data, 0, 100, Polarity::BOTH, ms_level);
+        CHECK(sequential != std::nullopt);
+        for (size_t max_threads : {1, 4}) {
+            // Small buffers make the spectra span several of them.
+            Compression::ReadAheadInflateStream stream(path.string(), 256, 2);
+            auto parallel = XmlReader::read_mzml_parallel(
+                stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000,
+                200, Polarity::BOTH, ms_level, max_threads);
+            CHECK(stream.status() == Compression::OK);
+            CHECK(parallel != std::nullopt);
+            if (sequential && parallel) {
+                CHECK(parallel->scans.size() == (ms_level == 1 ? 20 : 40));
+                check_same_scans(*parallel, *sequential);
+            }
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Reading mzIdentML in parallel") {
+    // Every fourth peptide evidence is a decoy, and the results have between
+    // one and three identifications with different ranks, some of which don't
+    // pass the threshold. The retention time is given either as scan start
+    // time in minutes or as retention time in seconds.
+    std::string data = "<MzIdentML>\n<SequenceCollection>\n";
+    for (size_t i = 0; i < 4; ++i) {
+        auto id = std::to_string(i);
+        data += "<DBSequence id=\"DBSeq" + id + "\" accession=\"P" + id +
+                "\" searchDatabase_ref=\"SDB\">\n<cvParam "
+                "accession=\"MS:1001088\" value=\"Protein " +
+                id + "\"/>\n</DBSequence>\n";
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        auto id = std::to_string(i);
+        data += "<Peptide id=\"Pep" + id + "\">\n<PeptideSequence>PEPTIDE" +
+                std::string(i, 'K') + "</PeptideSequence>\n";
+        if (i % 3 == 0) {
+            data += "<Modification location=\"" + id +
+                    "\" residues=\"M\" monoisotopicMassDelta=\"15.994915\">"
+                    "<cvParam accession=\"UNIMOD:35\" name=\"Oxidation\"/>"
+                    "</Modification>\n";
+        }
+        data += "</Peptide>\n";
+        data += "<PeptideEvidence id=\"PE" + id + "\" dBSequence_ref=\"DBSeq" +
+                std::to_string(i % 4) + "\" peptide_ref=\"Pep" + id +
+                "\" isDecoy=\"" + (i % 4 == 3 ? "true" : "false") + "\"/>\n";
+    }
+    data += "</SequenceCollection>\n<AnalysisData>\n"
+            "<SpectrumIdentificationList id=\"SIL\">\n";
+    for (size_t i = 0; i < 10; ++i) {
+        data += "<SpectrumIdentificationResult id=\"SIR" + std::to_string(i) +
+                "\" spectrumID=\"index=" + std::to_string(i) + "\">\n";
+        for (size_t k = 0; k < 1 + i % 3; ++k) {
+            auto id = std::to_string(i) + "_" + std::to_string(k);
+            data += "<SpectrumIdentificationItem id=\"SII" + id +
+                    "\" chargeState=\"" + std::to_string(2 + k) +
+                    "\" experimentalMassToCharge=\"" +
+                    std::to_string(400.0 + 10.0 * i) +
+                    "\" calculatedMassToCharge=\"" +
+                    std::to_string(400.0 + 10.0 * i + 0.01 * k) +
+                    "\" peptide_ref=\"Pep" + std::to_string((i + k) % 8) +
+                    "\" rank=\"" + std::to_string(k + 1) +
+                    "\" passThreshold=\"" +
+                    ((i + k) % 4 != 0 ? "true" : "false") + "\">\n";
+            data += "<PeptideEvidenceRef peptideEvidence_ref=\"PE" +
+                    std::to_string((i + k) % 8) +
+                    "\"/>\n</SpectrumIdentificationItem>\n";
+        }
+        if (i % 2 == 0) {
+            data += "<cvParam accession=\"MS:1000016\" value=\"" +
+                    std::to_string(i * 0.5) +
+                    "\" unitAccession=\"UO:0000031\"/>\n";
+        } else {
+            data += "<cvParam accession=\"MS:1000894\" value=\"" +
+                    std::to_string(i * 30.0) +
+                    "\" unitAccession=\"UO:0000010\"/>\n";
+        }
+        data += "</SpectrumIdentificationResult>\n";
+    }
+    data += "</SpectrumIdentificationList>\n</AnalysisData>\n</MzIdentML>\n";
+
+    double inf = std::numeric_limits<double>::infinity();
+    struct Options {
+        bool ignore_decoy;
+        bool require_threshold;
+        bool max_rank_only;
+        double min_mz;
+        double max_mz;
+        double min_rt;
+        double max_rt;
+    };
+    std::vector<Options> all_options = {
+        {false, false, false, 0, inf, 0, inf},
+        {true, true, false, 0, inf, 0, inf},
+        {false, false, true, 0, inf, 0, inf},
+        {false, true, true, 420, 470, 60, 240}};
+    for (const auto &options : all_options) {
+        std::stringstream stream(data);
+        auto sequential = XmlReader::read_mzidentml(
+            stream, options.ignore_decoy, options.require_threshold,
+            options.max_rank_only, options.min_mz, options.max_mz,
+            options.min_rt, options.max_rt);
+        CHECK(sequential.db_sequences.size() == 4);
+        CHECK(sequential.peptides.size() == 8);
+        CHECK(sequential.peptide_evidence.size() ==
+              (options.ignore_decoy ? 6 : 8));
+        CHECK(!sequential.spectrum_matches.empty());
+        // More threads than results leave some of the chunks empty.
+        for (size_t max_threads : {1, 2, 16}) {
+            auto parallel = XmlReader::read_mzidentml_parallel(
+                data, options.ignore_decoy, options.require_threshold,
+                options.max_rank_only, options.min_mz, options.max_mz,
+                options.min_rt, options.max_rt, max_threads);
+            CHECK(parallel.db_sequences.size() ==
+                  sequential.db_sequences.size());
+            for (size_t i = 0; i < parallel.db_sequences.size() &&
+                               i < sequential.db_sequences.size();
+                 ++i) {
+                const auto &a = parallel.db_sequences[i];
+                const auto &b = sequential.db_sequences[i];
+                CHECK(a.id == b.id);
+                CHECK(a.accession == b.accession);
+                CHECK(a.db_reference == b.db_reference);
+                CHECK(a.description == b.description);
+            }
+            CHECK(parallel.peptides.size() == sequential.peptides.size());
+            for (size_t i = 0; i < parallel.peptides.size() &&
+                               i < sequential.peptides.size();
+                 ++i) {
+                const auto &a = parallel.peptides[i];
+                const auto &b = sequential.peptides[i];
+                CHECK(a.id == b.id);
+                CHECK(a.sequence == b.sequence);
+                CHECK(a.modifications.size() == b.modifications.size());
+                for (size_t k = 0; k < a.modifications.size() &&
+                                   k < b.modifications.size();
+                     ++k) {
+                    CHECK(a.modifications[k].monoisotopic_mass_delta ==
+                          b.modifications[k].monoisotopic_mass_delta);
+                    CHECK(a.modifications[k].location ==
+                          b.modifications[k].location);
+                    CHECK(a.modifications[k].id == b.modifications[k].id);
+                }
+            }
+            CHECK(parallel.peptide_evidence.size() ==
+                  sequential.peptide_evidence.size());
+            for (size_t i = 0; i < parallel.peptide_evidence.size() &&
+                               i < sequential.peptide_evidence.size();
+                 ++i) {
+                const auto &a = parallel.peptide_evidence[i];
+                const auto &b = sequential.peptide_evidence[i];
+                CHECK(a.id == b.id);
+                CHECK(a.db_sequence_id == b.db_sequence_id);
+                CHECK(a.peptide_id == b.peptide_id);
+                CHECK(a.decoy == b.decoy);
+            }
+            CHECK(parallel.spectrum_matches.size() ==
+                  sequential.spectrum_matches.size());
+            for (size_t i = 0; i < parallel.spectrum_matches.size() &&
+                               i < sequential.spectrum_matches.size();
+                 ++i) {
+                const auto &a = parallel.spectrum_matches[i];
+                const auto &b = sequential.spectrum_matches[i];
+                CHECK(a.id == b.id);
+                CHECK(a.pass_threshold == b.pass_threshold);
+                CHECK(a.match_id == b.match_id);
+                CHECK(a.charge_state == b.charge_state);
+                CHECK(a.theoretical_mz == b.theoretical_mz);
+                CHECK(a.experimental_mz == b.experimental_mz);
+                CHECK(a.retention_time == b.retention_time);
+                CHECK(a.rank == b.rank);
+            }
+        }
+    }
+}
+
+TEST_CASE("Reading only the headers of mzML spectra") {
+    auto spectra = dda_spectra(6);
+    auto full_ms2 = read_mzml_sequential(indexed_mzml(spectra, true), 0, 100,
+                                         Polarity::BOTH, 2);
+    CHECK(full_ms2 != std::nullopt);
+    if (!full_ms2) {
+        return;
+    }
+    CHECK(full_ms2->scans.size() == 12);
+    // The binary data of the MS2 spectra is never decoded, so their corrupt
+    // data is not an error.
+    for (auto &spectrum : spectra) {
+        spectrum.corrupt = spectrum.ms_level == 2;
+    }
+    auto data = indexed_mzml(spectra, true);
+    auto index = XmlReader::read_mzml_index(data);
+    CHECK(index != std::nullopt);
+    if (!index) {
+        return;
+    }
+    std::vector<XmlReader::ScanFilter> filters = {
+        {1, Polarity::BOTH}, {2, Polarity::BOTH, true}};
+    std::stringstream stream(data);
+    auto parallel = XmlReader::read_mzml_parallel(
+        stream, 0, 1000, 0, 100, Instrument::ORBITRAP, 70000, 30000, 200,
+        filters, 2);
+    auto indexed = XmlReader::read_mzml_indexed(
+        data, *index, 0, index->offsets.size(), 0, 1000, 0, 100,
+        Instrument::ORBITRAP, 70000, 30000, 200, filters, 2);
+    for (const auto &raw_data : {parallel, indexed}) {
+        CHECK(raw_data != std::nullopt);
+        if (!raw_data) {
+            continue;
+        }
+        CHECK(raw_data->at(0).scans.size() == 6);
+        const auto &headers = raw_data->at(1);
+        CHECK(headers.scans.size() == full_ms2->scans.size());
+        CHECK(headers.retention_times == full_ms2->retention_times);
+        // Without points there are no m/z bounds.
+        CHECK(headers.min_mz == std::numeric_limits<double>::infinity());
+        CHECK(headers.max_mz == -std::numeric_limits<double>::infinity());
+        for (size_t i = 0;
+             i < headers.scans.size() && i < full_ms2->scans.size(); ++i) {
+            const auto &a = headers.scans[i];
+            const auto &b = full_ms2->scans[i];
+            CHECK(a.num_points == 0);
+            CHECK(a.mz.empty());
+            CHECK(a.intensity.empty());
+            CHECK(a.scan_number == b.scan_number);
+            CHECK(a.ms_level == 2);
+            CHECK(a.polarity == b.polarity);
+            CHECK(a.retention_time == b.retention_time);
+            CHECK(a.precursor_information.scan_number ==
+                  b.precursor_information.scan_number);
+            CHECK(a.precursor_information.mz == b.precursor_information.mz);
+            CHECK(a.precursor_information.charge ==
+                  b.precursor_information.charge);
+        }
+    }
+}